@@ -9,7 +9,14 @@
 *
 *************************************************/
 #include <assert.h>
+#include <errno.h>
+#include <string.h>
+#include <sstream>
+#include <algorithm>
+#include <snappy.h>
+#include <zlib.h>
 #include "log/log.h"
+#include "config_option.h"
 #include "block_store.h"
 
 CephBlockStore::CephBlockStore(const std::string& cluster,
@@ -88,3 +95,281 @@ int CephBlockStore::read(const std::string& object, char* buf, size_t len, off_t
     /*return read size if success*/
     return rados_read(m_io_ctx, object.c_str(), buf, len, off);
 }
+
+int CephBlockStore::read_batch(std::vector<block_read_t>& reads, const int window) {
+    std::vector<rados_completion_t> comps(reads.size(), nullptr);
+    size_t inflight_window = (window > 0) ? window : 1;
+    size_t oldest = 0;
+    int err = 0;
+    auto reap = [&](size_t i) {
+        if (comps[i] != nullptr) {
+            rados_aio_wait_for_complete(comps[i]);
+            reads[i].ret = rados_aio_get_return_value(comps[i]);
+            rados_aio_release(comps[i]);
+            comps[i] = nullptr;
+        }
+        if (reads[i].ret < 0 && err == 0) {
+            err = reads[i].ret;
+        }
+    };
+
+    for (size_t i = 0; i < reads.size(); i++) {
+        /*window full, wait the oldest one*/
+        if (i - oldest >= inflight_window) {
+            reap(oldest++);
+        }
+        block_read_t& r = reads[i];
+        int ret = rados_aio_create_completion(nullptr, nullptr, nullptr, &comps[i]);
+        if (ret < 0) {
+            comps[i] = nullptr;
+            r.ret = ret;
+            continue;
+        }
+        ret = rados_aio_read(m_io_ctx, r.object.c_str(), comps[i], r.buf, r.len, r.off);
+        if (ret < 0) {
+            rados_aio_release(comps[i]);
+            comps[i] = nullptr;
+            r.ret = ret;
+        }
+    }
+    while (oldest < reads.size()) {
+        reap(oldest++);
+    }
+    return err;
+}
+
+CompressBlockStore::CompressBlockStore(BlockStore* base,
+                                       const block_codec_t codec)
+    : m_base(base), m_codec(codec) {
+}
+
+CompressBlockStore::~CompressBlockStore() {
+    if (m_base) {
+        delete m_base;
+    }
+}
+
+int CompressBlockStore::create(const std::string& object) {
+    return m_base->create(object);
+}
+
+int CompressBlockStore::remove(const std::string& object) {
+    return m_base->remove(object);
+}
+
+void CompressBlockStore::encode(const char* buf, const size_t len,
+                                std::string& raw) {
+    block_hdr_t hdr;
+    hdr.magic = BLOCK_HDR_MAGIC;
+    hdr.codec = BLOCK_CODEC_NONE;
+    hdr.orig_len = len;
+    hdr.data_len = len;
+
+    size_t data_len = 0;
+    if (m_codec == BLOCK_CODEC_SNAPPY) {
+        raw.resize(sizeof(hdr) + snappy::MaxCompressedLength(len));
+        snappy::RawCompress(buf, len, &raw[sizeof(hdr)], &data_len);
+    } else if (m_codec == BLOCK_CODEC_ZLIB) {
+        uLongf dest_len = compressBound(len);
+        raw.resize(sizeof(hdr) + dest_len);
+        if (compress2((Bytef*)&raw[sizeof(hdr)], &dest_len, (const Bytef*)buf,
+                      len, Z_DEFAULT_COMPRESSION) == Z_OK) {
+            data_len = dest_len;
+        }
+    } else {
+        /*raw as before unless data look like header*/
+        uint32_t magic = 0;
+        if (len >= sizeof(magic)) {
+            memcpy(&magic, buf, sizeof(magic));
+        }
+        if (magic != BLOCK_HDR_MAGIC) {
+            raw.assign(buf, len);
+            return;
+        }
+    }
+
+    /*save less than 1/8, not worth decompress on read*/
+    if (data_len == 0 || data_len >= len - len / 8) {
+        raw.resize(sizeof(hdr) + len);
+        memcpy(&raw[sizeof(hdr)], buf, len);
+    } else {
+        hdr.codec = m_codec;
+        hdr.data_len = data_len;
+        raw.resize(sizeof(hdr) + data_len);
+    }
+    memcpy(&raw[0], &hdr, sizeof(hdr));
+}
+
+int CompressBlockStore::decode(const char* raw, const size_t raw_len,
+                               std::string& data) {
+    block_hdr_t hdr;
+    if (raw_len < sizeof(hdr)) {
+        data.assign(raw, raw_len);
+        return data.size();
+    }
+    memcpy(&hdr, raw, sizeof(hdr));
+    if (hdr.magic != BLOCK_HDR_MAGIC) {
+        data.assign(raw, raw_len);
+        return data.size();
+    }
+    if (hdr.data_len > raw_len - sizeof(hdr) || hdr.orig_len > BLOCK_OBJECT_MAX) {
+        LOG_ERROR << "block header invalid data_len:" << hdr.data_len
+                  << " orig_len:" << hdr.orig_len << " raw_len:" << raw_len;
+        return -1;
+    }
+    const char* src = raw + sizeof(hdr);
+    if (hdr.codec == BLOCK_CODEC_NONE) {
+        data.assign(src, hdr.data_len);
+        return data.size();
+    }
+    data.resize(hdr.orig_len);
+    if (hdr.codec == BLOCK_CODEC_SNAPPY) {
+        size_t orig_len = 0;
+        if (!snappy::GetUncompressedLength(src, hdr.data_len, &orig_len) ||
+            orig_len != hdr.orig_len ||
+            !snappy::RawUncompress(src, hdr.data_len, &data[0])) {
+            LOG_ERROR << "block snappy uncompress failed";
+            return -1;
+        }
+    } else if (hdr.codec == BLOCK_CODEC_ZLIB) {
+        uLongf dest_len = hdr.orig_len;
+        if (uncompress((Bytef*)&data[0], &dest_len, (const Bytef*)src,
+                       hdr.data_len) != Z_OK || dest_len != hdr.orig_len) {
+            LOG_ERROR << "block zlib uncompress failed";
+            return -1;
+        }
+    } else {
+        LOG_ERROR << "block codec:" << hdr.codec << " unknown";
+        return -1;
+    }
+    return data.size();
+}
+
+int CompressBlockStore::write(const std::string& object, char* buf,
+                              size_t len, off_t off) {
+    std::string data;
+    if (off != 0 && m_codec == BLOCK_CODEC_NONE) {
+        /*raw object patched in place, object with header or write that may
+         *form magic at its start still go read-modify-write*/
+        block_hdr_t hdr;
+        int ret = m_base->read(object, (char*)&hdr, sizeof(hdr), 0);
+        if (ret < 0 && ret != -ENOENT) {
+            LOG_ERROR << "block object:" << object << " read failed:" << ret;
+            return ret;
+        }
+        bool headed = (ret >= (int)sizeof(hdr.magic) &&
+                       hdr.magic == BLOCK_HDR_MAGIC);
+        if (!headed && (size_t)off >= sizeof(hdr.magic)) {
+            return m_base->write(object, buf, len, off);
+        }
+    }
+    if (off != 0) {
+        std::string raw(sizeof(block_hdr_t) + BLOCK_OBJECT_MAX, '\0');
+        int ret = m_base->read(object, &raw[0], raw.size(), 0);
+        /*only a missing object is empty, never overwrite what can not read*/
+        if (ret < 0 && ret != -ENOENT) {
+            LOG_ERROR << "block object:" << object << " read failed:" << ret;
+            return ret;
+        }
+        if (ret > 0 && decode(raw.data(), ret, data) < 0) {
+            return -1;
+        }
+        if (data.size() < off + len) {
+            data.resize(off + len);
+        }
+        data.replace(off, len, buf, len);
+        buf = &data[0];
+        len = data.size();
+    }
+    std::string raw;
+    encode(buf, len, raw);
+    return m_base->write(object, &raw[0], raw.size(), 0);
+}
+
+int CompressBlockStore::read(const std::string& object, char* buf,
+                             size_t len, off_t off) {
+    std::string raw(sizeof(block_hdr_t) + BLOCK_OBJECT_MAX, '\0');
+    int ret = m_base->read(object, &raw[0], raw.size(), 0);
+    if (ret < 0) {
+        return ret;
+    }
+    std::string data;
+    if (decode(raw.data(), ret, data) < 0) {
+        return -1;
+    }
+    if ((size_t)off >= data.size()) {
+        return 0;
+    }
+    size_t n = std::min(len, data.size() - off);
+    memcpy(buf, data.data() + off, n);
+    return n;
+}
+
+int CompressBlockStore::read_batch(std::vector<block_read_t>& reads,
+                                   const int window) {
+    size_t raw_size = sizeof(block_hdr_t) + BLOCK_OBJECT_MAX;
+    std::vector<std::string> raws(reads.size(), std::string(raw_size, '\0'));
+    std::vector<block_read_t> raw_reads(reads.size());
+    for (size_t i = 0; i < reads.size(); i++) {
+        raw_reads[i].object = reads[i].object;
+        raw_reads[i].buf = &raws[i][0];
+        raw_reads[i].len = raw_size;
+        raw_reads[i].off = 0;
+        raw_reads[i].ret = 0;
+    }
+    m_base->read_batch(raw_reads, window);
+
+    int err = 0;
+    std::string data;
+    for (size_t i = 0; i < reads.size(); i++) {
+        block_read_t& r = reads[i];
+        r.ret = raw_reads[i].ret;
+        if (r.ret >= 0) {
+            if (decode(raw_reads[i].buf, r.ret, data) < 0) {
+                r.ret = -1;
+            } else if ((size_t)r.off >= data.size()) {
+                r.ret = 0;
+            } else {
+                r.ret = std::min(r.len, data.size() - r.off);
+                memcpy(r.buf, data.data() + r.off, r.ret);
+            }
+        }
+        if (r.ret < 0 && err == 0) {
+            err = r.ret;
+        }
+    }
+    return err;
+}
+
+static block_codec_t block_codec_from_name(const std::string& name) {
+    if (name == "snappy") {
+        return BLOCK_CODEC_SNAPPY;
+    }
+    if (name == "zlib") {
+        return BLOCK_CODEC_ZLIB;
+    }
+    if (!name.empty() && name != "none") {
+        LOG_WARN << "block codec:" << name << " unknown, use none";
+    }
+    return BLOCK_CODEC_NONE;
+}
+
+block_codec_t block_codec_of(const std::string& vol_name) {
+    /*format: vol1:codec1,vol2:codec2*/
+    std::stringstream volumes(g_option.block_store_compress_volumes);
+    std::string entry;
+    while (getline(volumes, entry, ',')) {
+        size_t pos = entry.find(':');
+        if (pos != std::string::npos && entry.substr(0, pos) == vol_name) {
+            return block_codec_from_name(entry.substr(pos + 1));
+        }
+    }
+    return block_codec_from_name(g_option.block_store_compress);
+}
+
+BlockStore* create_block_store(const std::string& vol_name) {
+    BlockStore* base = new CephBlockStore(g_option.ceph_cluster_name,
+                                          g_option.ceph_user_name,
+                                          g_option.ceph_pool_name);
+    return new CompressBlockStore(base, block_codec_of(vol_name));
+}
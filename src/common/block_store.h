@@ -11,9 +11,46 @@
 #ifndef SRC_COMMON_BLOCK_STORE_H_
 #define SRC_COMMON_BLOCK_STORE_H_
 #include <unistd.h>
+#include <stdint.h>
 #include <string>
+#include <vector>
 #include <rados/librados.h>
 
+/*default max object reads in flight of a batch read*/
+#define BLOCK_READ_WINDOW (16)
+
+/*object compress codec*/
+enum block_codec {
+    BLOCK_CODEC_NONE   = 0,
+    BLOCK_CODEC_SNAPPY = 1, /*fast*/
+    BLOCK_CODEC_ZLIB   = 2, /*high ratio*/
+};
+typedef enum block_codec block_codec_t;
+
+/*in object header of compress store object*/
+#define BLOCK_HDR_MAGIC (0x5a424753U)
+struct block_hdr {
+    uint32_t magic;
+    uint32_t codec;
+    uint32_t orig_len;
+    uint32_t data_len;
+};
+typedef struct block_hdr block_hdr_t;
+
+/*max logical size of backup or cow object*/
+#define BLOCK_OBJECT_MAX (1*1024*1024UL)
+
+/*one object read of batch read*/
+struct block_read {
+    std::string object;
+    char*  buf;
+    size_t len;
+    off_t  off;
+    /*read size or negative error after batch read*/
+    int    ret;
+};
+typedef struct block_read block_read_t;
+
 /*store cow data*/
 class BlockStore {
  public:
@@ -25,6 +62,19 @@ class BlockStore {
     virtual int remove(const std::string& object) = 0;
     virtual int write(const std::string& object, char* buf, size_t len, off_t off) = 0;
     virtual int read(const std::string& object, char* buf, size_t len, off_t off) = 0;
+    /*read batch of objects, at most window reads in flight, return 0 if all
+     *reads success, otherwise the first error*/
+    virtual int read_batch(std::vector<block_read_t>& reads,
+                           const int window = BLOCK_READ_WINDOW) {
+        int err = 0;
+        for (auto& r : reads) {
+            r.ret = read(r.object, r.buf, r.len, r.off);
+            if (r.ret < 0 && err == 0) {
+                err = r.ret;
+            }
+        }
+        return err;
+    }
 };
 
 class CephBlockStore : public BlockStore {
@@ -40,6 +90,9 @@ class CephBlockStore : public BlockStore {
     int remove(const std::string& object) override;
     int write(const std::string& object, char* buf, size_t len, off_t off) override;
     int read(const std::string& object, char* buf, size_t len, off_t off) override;
+    /*rados aio read with bounded window*/
+    int read_batch(std::vector<block_read_t>& reads,
+                   const int window = BLOCK_READ_WINDOW) override;
 
  private:
     std::string m_cluster_name;
@@ -49,4 +102,41 @@ class CephBlockStore : public BlockStore {
     rados_ioctx_t m_io_ctx;
 };
 
+/*compress object on whole object write, object hold block_hdr_t and
+ *compressed data; block not compress well stored with codec none;
+ *object without header(written before compress enabled) read as raw,
+ *so codec of volume can change any time; with codec none raw object
+ *written in place*/
+class CompressBlockStore : public BlockStore {
+ public:
+    /*own the base store*/
+    CompressBlockStore(BlockStore* base, const block_codec_t codec);
+    virtual ~CompressBlockStore();
+
+    int create(const std::string& object) override;
+    int remove(const std::string& object) override;
+    /*partial write read-modify-write the whole object, except raw object
+     *under codec none*/
+    int write(const std::string& object, char* buf, size_t len, off_t off) override;
+    int read(const std::string& object, char* buf, size_t len, off_t off) override;
+    /*whole objects read by base batch read, then decoded*/
+    int read_batch(std::vector<block_read_t>& reads,
+                   const int window = BLOCK_READ_WINDOW) override;
+
+ private:
+    /*object raw content to logical data, return logical size or -1*/
+    int decode(const char* raw, const size_t raw_len, std::string& data);
+    /*logical data to object content*/
+    void encode(const char* buf, const size_t len, std::string& raw);
+
+ private:
+    BlockStore* m_base;
+    block_codec_t m_codec;
+};
+
+/*codec of volume: block_store.compress_volumes entry, else block_store.compress*/
+block_codec_t block_codec_of(const std::string& vol_name);
+/*ceph object store, compress by codec of volume if any*/
+BlockStore* create_block_store(const std::string& vol_name);
+
 #endif  // SRC_COMMON_BLOCK_STORE_H_
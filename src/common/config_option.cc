@@ -22,6 +22,7 @@ ConfigureOptions::ConfigureOptions() {
     iscsi_target_config_dir = config_parser.get_default("iscsi.target_config_dir", default_iscsi_target_config_dir);
     agent_dev_conf = config_parser.get_default("agent.dev_conf", std::string("/etc/storage-gateway/agent_dev.conf"));
     volumes_conf = config_parser.get_default("volumes.volumes_conf", std::string("/etc/storage-gateway/volumes.conf"));
+    clone_meta_dir = config_parser.get_default("volumes.clone_meta_dir", std::string("/etc/storage-gateway/clone"));
 
     ctrl_server_ip = config_parser.get_default("ctrl_server.ip", std::string("127.0.0.1"));
     ctrl_server_port = config_parser.get_default("ctrl_server.port", 1111);
@@ -62,6 +63,22 @@ ConfigureOptions::ConfigureOptions() {
     replicate_local_ip = config_parser.get_default("replicate.local_ip", std::string("127.0.0.1"));
     replicate_remote_ip  = config_parser.get_default("replicate.remote_ip", std::string("127.0.0.1"));
     replicate_port = config_parser.get_default("replicate.port", 50061);
+    replicate_compress = config_parser.get_default("replicate.compress", std::string("none"));
+    replicate_compress_volumes = config_parser.get_default("replicate.compress_volumes", std::string(""));
+    replicate_collapse = config_parser.get_default("replicate.collapse", 0);
+    replicate_collapse_volumes = config_parser.get_default("replicate.collapse_volumes", std::string(""));
+    replicate_reseed = config_parser.get_default("replicate.reseed", 0);
+    replicate_bandwidth = config_parser.get_default("replicate.bandwidth", 0);
+    replicate_volume_bandwidth = config_parser.get_default("replicate.volume_bandwidth", 0);
+    replicate_qos_volumes = config_parser.get_default("replicate.qos_volumes", std::string(""));
+
+    index_store_type = config_parser.get_default("index_store.type", std::string("rocksdb"));
+    index_store_block_cache_mb = config_parser.get_default("index_store.block_cache_mb", 64);
+    index_store_bloom_bits = config_parser.get_default("index_store.bloom_bits", 10);
+
+    backup_dedup = config_parser.get_default("backup.dedup", 0);
+    block_store_compress = config_parser.get_default("block_store.compress", std::string("none"));
+    block_store_compress_volumes = config_parser.get_default("block_store.compress_volumes", std::string(""));
 }
 
 ConfigureOptions::~ConfigureOptions() {
@@ -63,10 +63,38 @@ class ConfigureOptions {
     std::string replicate_local_ip;
     std::string replicate_remote_ip;
     int    replicate_port;
+    /*replicate data wire codec: none, snappy or zlib*/
+    std::string replicate_compress;
+    /*per volume codec override, format: vol1:codec1,vol2:codec2*/
+    std::string replicate_compress_volumes;
+    /*ship only latest write of each extent inside replication window*/
+    int    replicate_collapse;
+    /*volumes collapse enabled for, format: vol1,vol2*/
+    std::string replicate_collapse_volumes;
+    /*base sync only send blocks differ from peer block hashes*/
+    int    replicate_reseed;
+    /*replicate link bandwidth of all volumes in MB/s, 0 means no limit*/
+    int    replicate_bandwidth;
+    /*bandwidth of each volume in MB/s, 0 means no limit*/
+    int    replicate_volume_bandwidth;
+    /*per volume override, format: vol1:mb:weight,vol2:mb:weight*/
+    std::string replicate_qos_volumes;
     /*agent*/
     std::string agent_dev_conf;
     /*volumes*/
     std::string volumes_conf;
+    /*state of instant clone volumes still filling*/
+    std::string clone_meta_dir;
+    /*meta index store*/
+    std::string index_store_type;
+    int index_store_block_cache_mb;
+    int index_store_bloom_bits;
+    /*backup*/
+    int backup_dedup;
+    /*object compress codec: none, snappy or zlib*/
+    std::string block_store_compress;
+    /*per volume codec: vol1:codec1,vol2:codec2*/
+    std::string block_store_compress_volumes;
 };
 
 #define g_option (ConfigureOptions::instance())
@@ -39,6 +39,8 @@ typedef uint64_t block_t;
 
 /*index db store path (disk layout)*/
 #define DB_DIR  "/var/tmp/"
+/*max threads recover volume meta at start*/
+#define META_RECOVER_THREADS (8)
 
 /**********************snapshot**********************/
 /*block operation way*/
@@ -49,11 +51,16 @@ enum cow_op
 };
 typedef enum cow_op cow_op_t;
 
-/*mininum cow block size*/
+/*default and maximum cow block size*/
 #define COW_BLOCK_SIZE (1*1024*1024UL)
+/*mininum cow block size, volume choose power of two between min and max
+ *when the first snapshot created*/
+#define COW_BLOCK_SIZE_MIN (4*1024UL)
 
 /************************backup**********************/
 /*backup block size*/
 #define BACKUP_BLOCK_SIZE (1*1024*1024UL)
+/*block map value of all zero backup block, no object stored for it*/
+#define BACKUP_ZERO_OBJECT "backup_zero_object"
 
 #endif
@@ -660,7 +660,7 @@ void hbitmap_free(HBitmap *hb)
 
 HBitmap *hbitmap_alloc(uint64_t size, int granularity)
 {
-    HBitmap *hb = (HBitmap*)malloc(sizeof(HBitmap));
+    HBitmap *hb = (HBitmap*)calloc(1, sizeof(HBitmap));
     unsigned i;
 
     assert(granularity >= 0 && granularity < 64);
@@ -672,7 +672,7 @@ HBitmap *hbitmap_alloc(uint64_t size, int granularity)
     for (i = HBITMAP_LEVELS; i-- > 0; ) {
         size = MAX((size + BITS_PER_LONG - 1) >> BITS_PER_LEVEL, 1);
         hb->sizes[i] = size;
-        hb->levels[i] = (unsigned long*)malloc(size * sizeof(unsigned long));
+        hb->levels[i] = (unsigned long*)calloc(size, sizeof(unsigned long));
     }
 
     /* We necessarily have free bits in level 0 due to the definition
@@ -18,6 +18,10 @@
 //#include "bitops.h"
 //#include "host-utils.h"
 
+#if defined (__cplusplus)
+extern "C" {
+#endif
+
 typedef struct HBitmap HBitmap;
 typedef struct HBitmapIter HBitmapIter;
 
@@ -314,4 +318,8 @@ int64_t hbitmap_iter_next(HBitmapIter *hbi);
  */
 size_t hbitmap_iter_next_word(HBitmapIter *hbi, unsigned long *p_cur);
 
+#if defined (__cplusplus)
+}
+#endif
+
 #endif
@@ -4,52 +4,239 @@
 #include <sys/stat.h>
 #include <assert.h>
 #include <iostream>
+#include <algorithm>
 #include "rocksdb/slice.h"
 #include "rocksdb/slice_transform.h"
+#include "rocksdb/cache.h"
+#include "rocksdb/filter_policy.h"
+#include "rocksdb/table.h"
+#include "rocksdb/transaction_log.h"
+#include "rocksdb/write_batch.h"
 #include "../log/log.h"
+#include "config_option.h"
 #include "index_store.h"
 
-IndexStore* IndexStore::create(const string& type, const string& db_path)
+/*max ops of one batch when move keys to column family*/
+#define MIGRATE_BATCH_OPS (10000)
+/*write ahead log kept for meta checkpoint replay*/
+#define WAL_KEEP_SECONDS (6 * 3600)
+
+/*feed ops after given sequence of write batch to replay handler*/
+class ReplayBatchHandler : public rocksdb::WriteBatch::Handler
+{
+public:
+    ReplayBatchHandler(const uint64_t batch_seq, const uint64_t after,
+                       const IndexStore::replay_handler_t& handler)
+        :m_seq(batch_seq), m_after(after), m_handler(handler){
+    }
+    rocksdb::Status PutCF(uint32_t cf_id, const rocksdb::Slice& key,
+                          const rocksdb::Slice& value) override
+    {
+        if(m_seq++ > m_after){
+            m_handler(false, key.ToString(), value.ToString());
+        }
+        return rocksdb::Status::OK();
+    }
+    rocksdb::Status DeleteCF(uint32_t cf_id, const rocksdb::Slice& key) override
+    {
+        if(m_seq++ > m_after){
+            m_handler(true, key.ToString(), "");
+        }
+        return rocksdb::Status::OK();
+    }
+
+private:
+    uint64_t m_seq;
+    uint64_t m_after;
+    const IndexStore::replay_handler_t& m_handler;
+};
+
+IndexStore* IndexStore::create(const string& type, const string& db_path,
+                               const vector<string>& cf_prefixes,
+                               const char key_sep)
 {
     if(type == "rocksdb"){
-        return new RocksDbIndexStore(db_path); 
+        return new RocksDbIndexStore(db_path, cf_prefixes, key_sep);
+    }
+    if(type == "memory"){
+        return new MemIndexStore();
     }
     return nullptr;
 }
 
+const char* SeparatorPrefixTransform::Name() const
+{
+    return m_name.c_str();
+}
+
+size_t SeparatorPrefixTransform::prefix_len(const rocksdb::Slice& key) const
+{
+    int count = 0;
+    for(size_t i = 0; i < key.size(); i++){
+        if(key.data()[i] == m_sep && ++count == m_n){
+            return i + 1;
+        }
+    }
+    return 0;
+}
+
+rocksdb::Slice SeparatorPrefixTransform::Transform(const rocksdb::Slice& key) const
+{
+    return rocksdb::Slice(key.data(), prefix_len(key));
+}
+
+bool SeparatorPrefixTransform::InDomain(const rocksdb::Slice& key) const
+{
+    return prefix_len(key) != 0;
+}
+
+bool SeparatorPrefixTransform::InRange(const rocksdb::Slice& dst) const
+{
+    return prefix_len(dst) == dst.size();
+}
+
+/*smallest string greater than all keys start with prefix, empty if none*/
+static string prefix_successor(const string& prefix)
+{
+    string succ = prefix;
+    while(!succ.empty()){
+        unsigned char c = succ.back();
+        if(c != 0xff){
+            succ.back() = (char)(c + 1);
+            return succ;
+        }
+        succ.pop_back();
+    }
+    return succ;
+}
+
+rocksdb::ColumnFamilyOptions RocksDbIndexStore::cf_options(const int prefix_segments)
+{
+    rocksdb::ColumnFamilyOptions cf_opt;
+    cf_opt.OptimizeLevelStyleCompaction();
+    cf_opt.prefix_extractor.reset(new SeparatorPrefixTransform(m_key_sep,
+                                                               prefix_segments));
+    /*whole key bloom for db_get, prefix bloom for seek*/
+    rocksdb::BlockBasedTableOptions table_opt;
+    if(g_option.index_store_bloom_bits > 0){
+        table_opt.filter_policy.reset(rocksdb::NewBloomFilterPolicy(
+                                      g_option.index_store_bloom_bits, false));
+    }
+    table_opt.whole_key_filtering = true;
+    if(m_block_cache){
+        table_opt.block_cache = m_block_cache;
+    }
+    table_opt.cache_index_and_filter_blocks = true;
+    cf_opt.table_factory.reset(rocksdb::NewBlockBasedTableFactory(table_opt));
+    return cf_opt;
+}
+
 int RocksDbIndexStore::db_open()
 {
     m_db_option.IncreaseParallelism();
     m_db_option.OptimizeLevelStyleCompaction();
     m_db_option.create_if_missing = true;
-    m_db_option.prefix_extractor.reset(NewFixedPrefixTransform(3));
-    
+    m_db_option.create_missing_column_families = true;
+    m_db_option.allow_concurrent_memtable_write = true;
+    m_db_option.WAL_ttl_seconds = WAL_KEEP_SECONDS;
+    if(g_option.index_store_block_cache_mb > 0){
+        m_block_cache = rocksdb::NewLRUCache(
+                    (size_t)g_option.index_store_block_cache_mb << 20);
+    }
+
     string file_lock = m_db_path + "/" + "LOCK";
     if(access(file_lock.c_str(), F_OK) == 0){
-        /*file lock exist, will open db failed , so remove it*/ 
+        /*file lock exist, will open db failed , so remove it*/
         int ret = unlink(file_lock.c_str());
         assert(ret == 0);
     }
 
-    Status s = DB::Open(m_db_option, m_db_path, &m_db);
+    /*column family not exist yet should take its keys from default one*/
+    vector<string> exist_cfs;
+    rocksdb::DB::ListColumnFamilies(m_db_option, m_db_path, &exist_cfs);
+    bool fresh_db = exist_cfs.empty();
+
+    vector<rocksdb::ColumnFamilyDescriptor> cf_descs;
+    cf_descs.push_back(rocksdb::ColumnFamilyDescriptor(
+                       rocksdb::kDefaultColumnFamilyName, cf_options(1)));
+    for(auto& prefix : m_cf_prefixes){
+        /*keys of one prefix share the first segment, bloom on the second*/
+        cf_descs.push_back(rocksdb::ColumnFamilyDescriptor(prefix, cf_options(2)));
+    }
+
+    Status s = DB::Open(m_db_option, m_db_path, cf_descs, &m_cf_handles, &m_db);
     if(!s.ok()){
-        LOG_ERROR << "open db:" << m_db_path << " failed:" << s.ToString(); 
+        LOG_ERROR << "open db:" << m_db_path << " failed:" << s.ToString();
         return -1;
     }
+
+    for(size_t i = 0; !fresh_db && i < m_cf_prefixes.size(); i++){
+        if(find(exist_cfs.begin(), exist_cfs.end(), m_cf_prefixes[i])
+                != exist_cfs.end()){
+            continue;
+        }
+        if(migrate_to_cf(i + 1)){
+            LOG_ERROR << "open db:" << m_db_path << " migrate column family:"
+                      << m_cf_prefixes[i] << " failed";
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int RocksDbIndexStore::migrate_to_cf(const size_t cf_idx)
+{
+    const string& prefix = m_cf_prefixes[cf_idx - 1];
+    rocksdb::ReadOptions rop;
+    rop.total_order_seek = true;
+    unique_ptr<rocksdb::Iterator> it(m_db->NewIterator(rop, m_cf_handles[0]));
+    rocksdb::WriteBatch batch;
+    size_t count = 0;
+    for(it->Seek(prefix); it->Valid() && it->key().starts_with(prefix);
+            it->Next()){
+        batch.Put(m_cf_handles[cf_idx], it->key(), it->value());
+        batch.Delete(m_cf_handles[0], it->key());
+        if(++count % MIGRATE_BATCH_OPS == 0){
+            if(!m_db->Write(rocksdb::WriteOptions(), &batch).ok()){
+                return -1;
+            }
+            batch.Clear();
+        }
+    }
+    if(!it->status().ok() || !m_db->Write(rocksdb::WriteOptions(), &batch).ok()){
+        return -1;
+    }
+    LOG_INFO << "db:" << m_db_path << " move " << count
+             << " keys to column family:" << prefix;
     return 0;
 }
 
+rocksdb::ColumnFamilyHandle* RocksDbIndexStore::cf_handle(const string& key)
+{
+    for(size_t i = 0; i < m_cf_prefixes.size(); i++){
+        if(!key.compare(0, m_cf_prefixes[i].size(), m_cf_prefixes[i])){
+            return m_cf_handles[i + 1];
+        }
+    }
+    return m_cf_handles[0];
+}
+
 int RocksDbIndexStore::db_close()
 {
+    for(auto handle : m_cf_handles){
+        delete handle;
+    }
+    m_cf_handles.clear();
     if(m_db){
         delete m_db;
+        m_db = nullptr;
     }
     return 0;
 }
 
 int RocksDbIndexStore::db_put(string key, string value)
 {
-    Status s = m_db->Put(WriteOptions(), key, value);
+    Status s = m_db->Put(WriteOptions(), cf_handle(key), key, value);
     assert(s.ok());
 
     return 0;
@@ -58,34 +245,58 @@ int RocksDbIndexStore::db_put(string key, string value)
 string RocksDbIndexStore::db_get(string key)
 {
     string value;
-    Status s = m_db->Get(ReadOptions(), key, &value);
-    assert(s.ok());
+    Status s = m_db->Get(ReadOptions(), cf_handle(key), key, &value);
+    assert(s.ok() || s.IsNotFound());
 
     return value;
 }
 
 int RocksDbIndexStore::db_del(string key)
 {
-    Status s = m_db->Delete(WriteOptions(), key);
+    Status s = m_db->Delete(WriteOptions(), cf_handle(key), key);
     assert(s.ok());
 
     return 0;
 }
 
+void RocksDbIndexStore::IteratorImpl::reset_iter(const string& prefix,
+                                                 const bool total_order)
+{
+    if(m_db_iter){
+        delete m_db_iter;
+    }
+    m_past_prefix = false;
+    /*prefix cover the extracted prefix, bloom filter can skip files,
+     *otherwise scan in total order*/
+    rocksdb::ColumnFamilyHandle* cf = m_store->cf_handle(prefix);
+    int segments = (cf == m_store->m_cf_handles[0]) ? 1 : 2;
+    SeparatorPrefixTransform transform(m_store->m_key_sep, segments);
+    rocksdb::ReadOptions rop;
+    if(!total_order && !prefix.empty() && transform.InDomain(prefix)){
+        rop.prefix_same_as_start = true;
+    } else {
+        rop.total_order_seek = true;
+    }
+    m_db_iter = m_store->m_db->NewIterator(rop, cf);
+}
+
 int RocksDbIndexStore::IteratorImpl::seek_to_first()
 {
+    reset_iter("");
     m_db_iter->SeekToFirst();
     return m_db_iter->status().ok() ? 0 : -1;
 }
 
 int RocksDbIndexStore::IteratorImpl::seek_to_last()
 {
-    m_db_iter->SeekToFirst();
+    reset_iter("");
+    m_db_iter->SeekToLast();
     return m_db_iter->status().ok() ? 0 : -1;
 }
 
 int RocksDbIndexStore::IteratorImpl::seek_to_first(const string& prefix)
 {
+    reset_iter(prefix);
     rocksdb::Slice slice_prefix(prefix);
     m_db_iter->Seek(slice_prefix);
     return m_db_iter->status().ok() ? 0 : -1;
@@ -93,20 +304,35 @@ int RocksDbIndexStore::IteratorImpl::seek_to_first(const string& prefix)
 
 int RocksDbIndexStore::IteratorImpl::seek_to_last(const string& prefix)
 {
-    return 0;
+    /*step back from the first key beyond prefix range*/
+    reset_iter(prefix, true);
+    string succ = prefix_successor(prefix);
+    if(succ.empty()){
+        m_db_iter->SeekToLast();
+    } else {
+        m_db_iter->Seek(succ);
+        if(m_db_iter->Valid()){
+            m_db_iter->Prev();
+        } else if(m_db_iter->status().ok()){
+            m_db_iter->SeekToLast();
+        }
+    }
+    /*no key of prefix, iterator stay invalid until next seek*/
+    m_past_prefix = m_db_iter->Valid() && !m_db_iter->key().starts_with(prefix);
+    return m_db_iter->status().ok() ? 0 : -1;
 }
 
 bool RocksDbIndexStore::IteratorImpl::valid()
 {
-    return m_db_iter->Valid();
+    return m_db_iter && !m_past_prefix && m_db_iter->Valid();
 }
 
 int RocksDbIndexStore::IteratorImpl::next()
 {
     if(valid()){
-        m_db_iter->Next(); 
+        m_db_iter->Next();
     }
-    return m_db_iter->status().ok() ? 0 : -1;
+    return (!m_db_iter || m_db_iter->status().ok()) ? 0 : -1;
 }
 
 string RocksDbIndexStore::IteratorImpl::key()
@@ -123,18 +349,18 @@ IndexStore::SimpleIteratorPtr RocksDbIndexStore::db_iterator()
 {
     assert(m_db != nullptr);
 
-    return make_shared<IteratorImpl>(m_db->NewIterator(rocksdb::ReadOptions()));
+    return make_shared<IteratorImpl>(this);
 }
 
-void RocksDbIndexStore::RocksTransactionImpl::put(const string& key, 
-                                                  const string& val)  
+void RocksDbIndexStore::RocksTransactionImpl::put(const string& key,
+                                                  const string& val)
 {
-   batch_.Put(rocksdb::Slice(key), rocksdb::Slice(val)); 
+    ops_.push_back({false, key, val});
 }
 
-void RocksDbIndexStore::RocksTransactionImpl::del(const string& key) 
+void RocksDbIndexStore::RocksTransactionImpl::del(const string& key)
 {
-    batch_.Delete(key);
+    ops_.push_back({true, key, ""});
 }
 
 IndexStore::Transaction RocksDbIndexStore::fetch_transaction()
@@ -145,7 +371,222 @@ IndexStore::Transaction RocksDbIndexStore::fetch_transaction()
 int RocksDbIndexStore::submit_transaction(Transaction t)
 {
     RocksTransactionImpl* trc = reinterpret_cast<RocksTransactionImpl*>(t.get());
+    commit_req req = {trc, false, 0};
+
+    unique_lock<mutex> lock(m_commit_mutex);
+    m_commit_queue.push_back(&req);
+    m_commit_cond.wait(lock, [&]{ return req.done || !m_committing; });
+    if(req.done){
+        return req.ret;
+    }
+
+    /*become leader, commit all queued transactions in one write*/
+    m_committing = true;
+    deque<commit_req*> group;
+    group.swap(m_commit_queue);
+    lock.unlock();
+
+    rocksdb::WriteBatch batch;
+    for(auto r : group){
+        for(auto& op : r->trc->ops_){
+            if(op.del){
+                batch.Delete(cf_handle(op.key), op.key);
+            } else {
+                batch.Put(cf_handle(op.key), op.key, op.val);
+            }
+        }
+    }
     rocksdb::WriteOptions wop;
-    rocksdb::Status s = m_db->Write(wop, &(trc->batch_));
-    return s.ok()? 0 : -1;
+    rocksdb::Status s = m_db->Write(wop, &batch);
+
+    lock.lock();
+    for(auto r : group){
+        r->ret = s.ok() ? 0 : -1;
+        r->done = true;
+    }
+    m_committing = false;
+    m_commit_cond.notify_all();
+    return req.ret;
+}
+
+uint64_t RocksDbIndexStore::db_sequence()
+{
+    return m_db->GetLatestSequenceNumber();
+}
+
+int RocksDbIndexStore::db_replay(const uint64_t seq,
+                                 const replay_handler_t& handler)
+{
+    if(seq >= m_db->GetLatestSequenceNumber()){
+        return 0;
+    }
+    unique_ptr<rocksdb::TransactionLogIterator> it;
+    rocksdb::Status s = m_db->GetUpdatesSince(seq + 1, &it);
+    if(!s.ok()){
+        LOG_WARN << "db:" << m_db_path << " replay since:" << seq
+                 << " failed:" << s.ToString();
+        return -1;
+    }
+    bool first = true;
+    for(; it->Valid(); it->Next()){
+        rocksdb::BatchResult batch = it->GetBatch();
+        /*log before seq has been purged*/
+        if(first && batch.sequence > seq + 1){
+            LOG_WARN << "db:" << m_db_path << " replay since:" << seq
+                     << " log start from:" << batch.sequence;
+            return -1;
+        }
+        first = false;
+        ReplayBatchHandler batch_handler(batch.sequence, seq, handler);
+        if(!batch.writeBatchPtr->Iterate(&batch_handler).ok()){
+            return -1;
+        }
+    }
+    return it->status().ok() ? 0 : -1;
+}
+
+int MemIndexStore::db_open()
+{
+    return 0;
+}
+
+int MemIndexStore::db_close()
+{
+    lock_guard<mutex> lock(m_mutex);
+    m_kv.clear();
+    return 0;
+}
+
+int MemIndexStore::db_put(string key, string value)
+{
+    lock_guard<mutex> lock(m_mutex);
+    m_kv[key] = value;
+    return 0;
+}
+
+string MemIndexStore::db_get(string key)
+{
+    lock_guard<mutex> lock(m_mutex);
+    auto it = m_kv.find(key);
+    return it != m_kv.end() ? it->second : "";
+}
+
+int MemIndexStore::db_del(string key)
+{
+    lock_guard<mutex> lock(m_mutex);
+    m_kv.erase(key);
+    return 0;
+}
+
+void MemIndexStore::IteratorImpl::load(map<string, string>::iterator it)
+{
+    m_valid = (it != m_store->m_kv.end());
+    if(m_valid){
+        m_key = it->first;
+        m_value = it->second;
+    }
+}
+
+int MemIndexStore::IteratorImpl::seek_to_first()
+{
+    lock_guard<mutex> lock(m_store->m_mutex);
+    load(m_store->m_kv.begin());
+    return 0;
+}
+
+int MemIndexStore::IteratorImpl::seek_to_last()
+{
+    lock_guard<mutex> lock(m_store->m_mutex);
+    if(m_store->m_kv.empty()){
+        m_valid = false;
+        return 0;
+    }
+    load(--m_store->m_kv.end());
+    return 0;
+}
+
+int MemIndexStore::IteratorImpl::seek_to_first(const string& prefix)
+{
+    lock_guard<mutex> lock(m_store->m_mutex);
+    load(m_store->m_kv.lower_bound(prefix));
+    return 0;
+}
+
+int MemIndexStore::IteratorImpl::seek_to_last(const string& prefix)
+{
+    lock_guard<mutex> lock(m_store->m_mutex);
+    string succ = prefix_successor(prefix);
+    auto it = succ.empty() ? m_store->m_kv.end()
+                           : m_store->m_kv.lower_bound(succ);
+    if(it == m_store->m_kv.begin()){
+        m_valid = false;
+        return 0;
+    }
+    --it;
+    if(it->first.compare(0, prefix.size(), prefix)){
+        m_valid = false;
+        return 0;
+    }
+    load(it);
+    return 0;
+}
+
+bool MemIndexStore::IteratorImpl::valid()
+{
+    return m_valid;
+}
+
+int MemIndexStore::IteratorImpl::next()
+{
+    if(!m_valid){
+        return 0;
+    }
+    lock_guard<mutex> lock(m_store->m_mutex);
+    load(m_store->m_kv.upper_bound(m_key));
+    return 0;
+}
+
+string MemIndexStore::IteratorImpl::key()
+{
+    return m_key;
+}
+
+string MemIndexStore::IteratorImpl::value()
+{
+    return m_value;
+}
+
+IndexStore::SimpleIteratorPtr MemIndexStore::db_iterator()
+{
+    return make_shared<IteratorImpl>(this);
+}
+
+void MemIndexStore::MemTransactionImpl::put(const string& key,
+                                            const string& val)
+{
+    ops_.push_back({false, key, val});
+}
+
+void MemIndexStore::MemTransactionImpl::del(const string& key)
+{
+    ops_.push_back({true, key, ""});
+}
+
+IndexStore::Transaction MemIndexStore::fetch_transaction()
+{
+    return make_shared<MemTransactionImpl>();
+}
+
+int MemIndexStore::submit_transaction(Transaction t)
+{
+    MemTransactionImpl* trc = reinterpret_cast<MemTransactionImpl*>(t.get());
+    lock_guard<mutex> lock(m_mutex);
+    for(auto& op : trc->ops_){
+        if(op.del){
+            m_kv.erase(op.key);
+        } else {
+            m_kv[op.key] = op.val;
+        }
+    }
+    return 0;
 }
@@ -2,8 +2,16 @@
 #define _INDEX_STORE_H
 #include <string>
 #include <memory>
+#include <vector>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
 #include "rocksdb/db.h"
 #include "rocksdb/options.h"
+#include "rocksdb/slice_transform.h"
+#include "rocksdb/cache.h"
 
 using namespace std;
 using namespace rocksdb;
@@ -15,17 +23,23 @@ public:
     IndexStore(){}
     virtual ~IndexStore(){}
 
-    static IndexStore* create(const string& type, const string& db_path);
+    /*type: "rocksdb" or "memory"(no disk, for test and benchmark)
+     *cf_prefixes: key prefixes each kept in own column family
+     *key_sep: separator of key fields, prefix bloom filter split on it*/
+    static IndexStore* create(const string& type, const string& db_path,
+                              const vector<string>& cf_prefixes = {},
+                              const char key_sep = '@');
 
     virtual int db_open()  = 0;
     virtual int db_close() = 0;
 
     virtual int    db_put(string key, string value) = 0;
+    /*return empty if key not exist*/
     virtual string db_get(string key) = 0;
     virtual int    db_del(string key) = 0;
-   
+
     /*iterator*/
-    class SimpleIterator 
+    class SimpleIterator
     {
     public:
         SimpleIterator(){}
@@ -34,19 +48,21 @@ public:
         virtual int seek_to_first() = 0;
         virtual int seek_to_last()  = 0;
         virtual int seek_to_first(const string& prefix) = 0;
+        /*last key start with prefix, invalid if none*/
         virtual int seek_to_last(const string& prefix) = 0;
         virtual bool valid()   = 0;
         virtual int  next()    = 0;
         virtual string key()   = 0;
         virtual string value() = 0;
     };
-    typedef shared_ptr<SimpleIterator> SimpleIteratorPtr;    
+    typedef shared_ptr<SimpleIterator> SimpleIteratorPtr;
     virtual SimpleIteratorPtr db_iterator()= 0;
 
     /*transaction*/
     class TransactionImpl
     {
     public:
+        virtual ~TransactionImpl(){}
         virtual void put(const string& key, const string& val) = 0;
         virtual void del(const string& key) = 0;
     };
@@ -54,35 +70,70 @@ public:
 
     virtual  Transaction fetch_transaction() = 0;
     virtual  int submit_transaction(Transaction t) = 0;
+
+    /*sequence of the latest write, 0 if store not support*/
+    virtual uint64_t db_sequence() { return 0; }
+    /*replay writes after seq in order, -1 if not all of them available*/
+    typedef function<void(bool del, const string& key,
+                          const string& val)> replay_handler_t;
+    virtual int db_replay(const uint64_t seq, const replay_handler_t& handler) {
+        return -1;
+    }
+};
+
+/*key prefix up to and include the n-th separator, keys of one backup or one
+ *block share the prefix, so prefix bloom filter skip files on seek*/
+class SeparatorPrefixTransform : public rocksdb::SliceTransform
+{
+public:
+    SeparatorPrefixTransform(const char sep, const int n):m_sep(sep), m_n(n){
+        m_name = string("sg.SeparatorPrefix.") + sep + to_string(n);
+    }
+    const char* Name() const override;
+    rocksdb::Slice Transform(const rocksdb::Slice& key) const override;
+    bool InDomain(const rocksdb::Slice& key) const override;
+    bool InRange(const rocksdb::Slice& dst) const override;
+
+private:
+    /*length of prefix, 0 if key has not enough separator*/
+    size_t prefix_len(const rocksdb::Slice& key) const;
+    char   m_sep;
+    int    m_n;
+    string m_name;
 };
 
 class RocksDbIndexStore : public IndexStore
 {
 public:
-    explicit RocksDbIndexStore(const string& db_path):m_db_path(db_path){
+    RocksDbIndexStore(const string& db_path, const vector<string>& cf_prefixes,
+                      const char key_sep)
+        :m_db_path(db_path), m_cf_prefixes(cf_prefixes), m_key_sep(key_sep){
         m_db = nullptr;
+        m_committing = false;
     }
 
     ~RocksDbIndexStore(){
         db_close();
     }
-    
+
     int db_open() override;
     int db_close() override;
 
     int    db_put(string key, string value) override;
     string db_get(string key) override;
     int    db_del(string key) override;
-    
+
     class IteratorImpl : public IndexStore::SimpleIterator
     {
     public:
-        explicit IteratorImpl(rocksdb::Iterator* db_iter):m_db_iter(db_iter){
+        explicit IteratorImpl(RocksDbIndexStore* store):m_store(store){
+            m_db_iter = nullptr;
+            m_past_prefix = false;
         }
 
         ~IteratorImpl(){
             if(m_db_iter){
-                delete m_db_iter;    
+                delete m_db_iter;
             }
         }
         virtual int seek_to_first() override;
@@ -95,9 +146,14 @@ public:
         virtual string value() override;
 
     private:
+        /*iterator on column family the prefix belong to*/
+        void reset_iter(const string& prefix, const bool total_order = false);
+        RocksDbIndexStore* m_store;
         rocksdb::Iterator* m_db_iter;
+        /*seek_to_last found no key of prefix*/
+        bool m_past_prefix;
     };
-     
+
     virtual SimpleIteratorPtr db_iterator() override;
 
     class RocksTransactionImpl : public IndexStore::TransactionImpl
@@ -105,16 +161,112 @@ public:
     public:
         virtual void put(const string& key, const string& val) override;
         virtual void del(const string& key) override;
-        rocksdb::WriteBatch batch_;
+        /*ops resolved to column family when submit*/
+        struct op {
+            bool   del;
+            string key;
+            string val;
+        };
+        vector<op> ops_;
     };
 
     virtual  Transaction fetch_transaction() override;
+    /*concurrent submits are grouped, one leader write them in one batch*/
     virtual  int submit_transaction(Transaction t) override;
 
+    uint64_t db_sequence() override;
+    /*replay from write ahead log kept for WAL_KEEP_SECONDS*/
+    int db_replay(const uint64_t seq, const replay_handler_t& handler) override;
+
 private:
+    /*tuned options for one column family*/
+    rocksdb::ColumnFamilyOptions cf_options(const int prefix_segments);
+    /*move keys of new column family out of default column family*/
+    int migrate_to_cf(const size_t cf_idx);
+    /*column family the key or prefix belong to*/
+    rocksdb::ColumnFamilyHandle* cf_handle(const string& key);
+
+    struct commit_req {
+        RocksTransactionImpl* trc;
+        bool done;
+        int  ret;
+    };
+
     string  m_db_path;
+    vector<string> m_cf_prefixes;
+    char    m_key_sep;
     rocksdb::Options m_db_option;
     rocksdb::DB* m_db;
+    /*block cache shared by all column families*/
+    shared_ptr<rocksdb::Cache> m_block_cache;
+    /*default column family first, then one per prefix*/
+    vector<rocksdb::ColumnFamilyHandle*> m_cf_handles;
+    /*group commit*/
+    mutex m_commit_mutex;
+    condition_variable m_commit_cond;
+    deque<commit_req*> m_commit_queue;
+    bool m_committing;
+};
+
+/*ordered map in memory, same semantic as rocksdb store without persist*/
+class MemIndexStore : public IndexStore
+{
+public:
+    MemIndexStore(){}
+    ~MemIndexStore(){}
+
+    int db_open() override;
+    int db_close() override;
+
+    int    db_put(string key, string value) override;
+    string db_get(string key) override;
+    int    db_del(string key) override;
+
+    class IteratorImpl : public IndexStore::SimpleIterator
+    {
+    public:
+        explicit IteratorImpl(MemIndexStore* store):m_store(store){
+            m_valid = false;
+        }
+        virtual int seek_to_first() override;
+        virtual int seek_to_last()  override;
+        virtual int seek_to_first(const string& prefix) override;
+        virtual int seek_to_last(const string& prefix)  override;
+        virtual bool valid()   override;
+        virtual int  next()    override;
+        virtual string key()   override;
+        virtual string value() override;
+
+    private:
+        /*hold key and value copy, store may change while iterating*/
+        void load(map<string, string>::iterator it);
+        MemIndexStore* m_store;
+        bool   m_valid;
+        string m_key;
+        string m_value;
+    };
+
+    virtual SimpleIteratorPtr db_iterator() override;
+
+    class MemTransactionImpl : public IndexStore::TransactionImpl
+    {
+    public:
+        virtual void put(const string& key, const string& val) override;
+        virtual void del(const string& key) override;
+        struct op {
+            bool   del;
+            string key;
+            string val;
+        };
+        vector<op> ops_;
+    };
+
+    virtual  Transaction fetch_transaction() override;
+    virtual  int submit_transaction(Transaction t) override;
+
+private:
+    mutex m_mutex;
+    map<string, string> m_kv;
 };
 
 #endif
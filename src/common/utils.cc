@@ -1,4 +1,9 @@
+#include <stdint.h>
+#include <string.h>
 #include <fstream>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 #include "utils.h"
 
 bool is_support_sse4_2() {
@@ -14,6 +19,35 @@ void memory_barrier() {
     __asm__ __volatile__("" : : : "memory");
 }
 
+bool buf_is_zero(const char* buf, const size_t len) {
+    size_t pos = 0;
+#ifdef __SSE2__
+    const __m128i zero = _mm_setzero_si128();
+    for (; pos + 64 <= len; pos += 64) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(buf + pos));
+        v = _mm_or_si128(v, _mm_loadu_si128((const __m128i*)(buf + pos + 16)));
+        v = _mm_or_si128(v, _mm_loadu_si128((const __m128i*)(buf + pos + 32)));
+        v = _mm_or_si128(v, _mm_loadu_si128((const __m128i*)(buf + pos + 48)));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(v, zero)) != 0xFFFF) {
+            return false;
+        }
+    }
+#endif
+    for (; pos + sizeof(uint64_t) <= len; pos += sizeof(uint64_t)) {
+        uint64_t word;
+        memcpy(&word, buf + pos, sizeof(word));
+        if (word) {
+            return false;
+        }
+    }
+    for (; pos < len; pos++) {
+        if (buf[pos]) {
+            return false;
+        }
+    }
+    return true;
+}
+
 const std::string SUFFIX = ".snapshot";
 
 std::string backup_to_snap_name(std::string backup_name) {
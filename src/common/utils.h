@@ -8,6 +8,9 @@ bool is_support_sse4_2();
 
 void memory_barrier();
 
+/*whether buffer all zero, sse2 compare 64 bytes per round*/
+bool buf_is_zero(const char* buf, const size_t len);
+
 std::string backup_to_snap_name(std::string backup_name);
 std::string snap_to_backup_name(std::string snap_name);
 
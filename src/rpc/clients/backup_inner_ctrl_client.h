@@ -1,6 +1,7 @@
 #ifndef BACKUP_INNER_CTRL_CLIENT_H_
 #define BACKUP_INNER_CTRL__CLIENT_H_
 #include <unistd.h>
+#include <string.h>
 #include <fcntl.h>
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -9,6 +10,8 @@
 #include <memory>
 #include <set>
 #include <vector>
+#include <thread>
+#include <atomic>
 #include <grpc++/grpc++.h>
 #include "../backup.pb.h"
 #include "../backup_inner_control.pb.h"
@@ -16,6 +19,7 @@
 #include "common/define.h"
 #include "common/block_store.h"
 #include "common/env_posix.h"
+#include "common/blocking_queue.h"
 
 using namespace std;
 
@@ -41,6 +45,9 @@ using huawei::proto::inner::DeleteBackupInAck;
 using huawei::proto::inner::RestoreBackupInReq;
 using huawei::proto::inner::RestoreBackupInAck;
 
+/*restore workers read object and write device concurrently*/
+#define BACKUP_RESTORE_WORKERS (8)
+
 /*backup control rpc client*/
 class BackupInnerCtrlClient {
  public:
@@ -111,7 +118,6 @@ class BackupInnerCtrlClient {
         req.set_vol_name(vol_name);
         req.set_backup_name(backup_name);
         req.set_backup_type(backup_type);
-        RestoreBackupInAck ack;
         ClientContext context;
         unique_ptr<ClientReader<RestoreBackupInAck>> reader(m_stub->Restore(&context, req));
         
@@ -119,37 +125,103 @@ class BackupInnerCtrlClient {
         Env::instance()->create_access_file(new_block_device, true, &blk_file);
         if (blk_file.get() == nullptr) {
             LOG_ERROR << "restore open file failed";
+            context.TryCancel();
+            reader->Finish();
             return StatusCode::sInternalError;
         }
-        char* buf = new char[BACKUP_BLOCK_SIZE];
-        assert(buf != nullptr);
-        while (reader->Read(&ack) && !ack.blk_over()) {
-            uint64_t blk_no = ack.blk_no();
-            string blk_obj = ack.blk_obj();
-            char* blk_data = (char*)ack.blk_data().c_str();
-
-            LOG_INFO << "restore blk_no:" << blk_no << " blk_oj:" << blk_obj
-                     << " blk_data_len:" << ack.blk_data().length();
-            if (!blk_obj.empty()) {
-                /*(local)read from block store*/
-                int read_ret = block_store->read(blk_obj, buf, BACKUP_BLOCK_SIZE, 0);
-                assert(read_ret == BACKUP_BLOCK_SIZE);
-                blk_data = buf;
-            }
-            if (blk_data) {
-                /*write to new block device*/
-                ssize_t write_ret = blk_file->write(blk_data, BACKUP_BLOCK_SIZE,
-                                                    blk_no * BACKUP_BLOCK_SIZE);
-                assert(write_ret == BACKUP_BLOCK_SIZE);
+
+        /*server send latest version of each block once, blocks independent,
+         *workers read object and write device in parallel with stream*/
+        BlockingQueue<restore_ack_ptr> block_que(2 * BACKUP_RESTORE_WORKERS);
+        std::atomic<int> ret(StatusCode::sOk);
+        vector<std::thread> workers;
+        for (int i = 0; i < BACKUP_RESTORE_WORKERS; i++) {
+            workers.push_back(std::thread([&]() {
+                char* buf = nullptr;
+                if (posix_memalign((void**)&buf, 4096, BACKUP_BLOCK_SIZE)) {
+                    ret = StatusCode::sInternalError;
+                }
+                restore_ack_ptr ack;
+                while (block_que.pop(ack) && ack != nullptr) {
+                    if (ret != StatusCode::sOk) {
+                        continue;
+                    }
+                    StatusCode st = restore_block(*ack, buf, blk_file.get(),
+                                                  block_store);
+                    if (st != StatusCode::sOk) {
+                        ret = st;
+                    }
+                }
+                free(buf);
+            }));
+        }
+
+        restore_ack_ptr ack(new RestoreBackupInAck);
+        while (ret == StatusCode::sOk && reader->Read(ack.get())) {
+            if (ack->blk_over()) {
+                if (ack->status() != StatusCode::sOk) {
+                    ret = ack->status();
+                }
+                break;
             }
+            block_que.push(ack);
+            ack.reset(new RestoreBackupInAck);
+        }
+        for (int i = 0; i < BACKUP_RESTORE_WORKERS; i++) {
+            block_que.push(nullptr);
+        }
+        for (auto& worker : workers) {
+            worker.join();
+        }
+        if (ret != StatusCode::sOk) {
+            context.TryCancel();
         }
         Status status = reader->Finish();
-        if (buf) {
-            delete [] buf;
+        if (ret != StatusCode::sOk) {
+            LOG_ERROR << "restore backup:" << backup_name << " failed:" << ret;
+            return (StatusCode)ret.load();
         }
         return status.ok() ? StatusCode::sOk : StatusCode::sInternalError;
     }
 
+ private:
+    typedef shared_ptr<RestoreBackupInAck> restore_ack_ptr;
+
+    /*buf: block size, page aligned for direct write*/
+    StatusCode restore_block(const RestoreBackupInAck& ack, char* buf,
+                             AccessFile* blk_file, BlockStore* block_store) {
+        uint64_t blk_no = ack.blk_no();
+        const string& blk_obj = ack.blk_obj();
+        LOG_INFO << "restore blk_no:" << blk_no << " blk_oj:" << blk_obj
+                 << " blk_data_len:" << ack.blk_data().length();
+        if (blk_obj == BACKUP_ZERO_OBJECT) {
+            /*zero block has no object*/
+            memset(buf, 0, BACKUP_BLOCK_SIZE);
+        } else if (!blk_obj.empty()) {
+            /*(local)read from block store*/
+            int read_ret = block_store->read(blk_obj, buf, BACKUP_BLOCK_SIZE, 0);
+            if (read_ret != BACKUP_BLOCK_SIZE) {
+                LOG_ERROR << "restore read blk_obj:" << blk_obj
+                          << " ret:" << read_ret;
+                return StatusCode::sInternalError;
+            }
+        } else if (ack.blk_data().length() == BACKUP_BLOCK_SIZE) {
+            /*(remote)data carried in ack*/
+            memcpy(buf, ack.blk_data().data(), BACKUP_BLOCK_SIZE);
+        } else {
+            return StatusCode::sOk;
+        }
+        /*write to new block device*/
+        ssize_t write_ret = blk_file->write(buf, BACKUP_BLOCK_SIZE,
+                                            blk_no * BACKUP_BLOCK_SIZE);
+        if (write_ret != BACKUP_BLOCK_SIZE) {
+            LOG_ERROR << "restore write blk_no:" << blk_no
+                      << " ret:" << write_ret;
+            return StatusCode::sInternalError;
+        }
+        return StatusCode::sOk;
+    }
+
  private:
     unique_ptr<BackupInnerControl::Stub> m_stub;
 };
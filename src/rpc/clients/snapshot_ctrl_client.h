@@ -8,6 +8,8 @@
 #include "../snapshot.pb.h"
 #include "../snapshot_control.grpc.pb.h"
 #include "../volume.pb.h"
+#include "common/define.h"
+#include "common/hbitmap.h"
 
 using namespace std;
 
@@ -17,6 +19,7 @@ using grpc::Status;
 using huawei::proto::VolumeStatus;
 using huawei::proto::SnapStatus;
 using huawei::proto::DiffBlocks;
+using huawei::proto::DiffBitmap;
 using huawei::proto::StatusCode;
 
 using huawei::proto::control::SnapshotControl;
@@ -32,14 +35,108 @@ using huawei::proto::control::RollbackSnapshotReq;
 using huawei::proto::control::RollbackSnapshotAck;
 using huawei::proto::control::DiffSnapshotReq;
 using huawei::proto::control::DiffSnapshotAck;
+using huawei::proto::control::DiffSnapshotStreamAck;
 using huawei::proto::control::ReadSnapshotReq;
 using huawei::proto::control::ReadSnapshotAck;
+using huawei::proto::control::ReadSnapshotBatchReq;
+using huawei::proto::control::ReadSnapshotBatchAck;
+using huawei::proto::control::ReadSnapshotBlock;
 using huawei::proto::control::CreateVolumeFromSnapReq;
 using huawei::proto::control::CreateVolumeFromSnapAck;
 using huawei::proto::control::QueryVolumeFromSnapReq;
 using huawei::proto::control::QueryVolumeFromSnapAck;
 
 
+/*pull diff blocks from diff stream, only one diff chunk hold in memory*/
+class DiffReader
+{
+public:
+    DiffReader(SnapshotControl::Stub* stub, const string& vol_name,
+               const string& first_snap_name, const string& last_snap_name,
+               const bool merged = false)
+        :m_bitmap(nullptr), m_start_blk(0), m_blk_size(COW_BLOCK_SIZE),
+         m_finished(false), m_status(StatusCode::sOk){
+        DiffSnapshotReq req;
+        req.set_vol_name(vol_name);
+        req.set_first_snap_name(first_snap_name);
+        req.set_last_snap_name(last_snap_name);
+        req.set_merged(merged);
+        m_reader = stub->DiffSnapshotStream(&m_context, req);
+    }
+
+    ~DiffReader(){
+        if(m_bitmap){
+            hbitmap_free(m_bitmap);
+        }
+        if(!m_finished){
+            m_context.TryCancel();
+            m_reader->Finish();
+        }
+    }
+
+    /*next diff block, false when diff over or failed, check status()*/
+    bool next(string& snap_name, uint64_t& blk_no){
+        while(true){
+            if(m_bitmap){
+                int64_t bit = hbitmap_iter_next(&m_iter);
+                if(bit >= 0){
+                    snap_name = m_snap_name;
+                    blk_no = m_start_blk + bit;
+                    return true;
+                }
+                hbitmap_free(m_bitmap);
+                m_bitmap = nullptr;
+            }
+            if(m_finished){
+                return false;
+            }
+            DiffSnapshotStreamAck ack;
+            if(!m_reader->Read(&ack)){
+                grpc::Status status = m_reader->Finish();
+                m_finished = true;
+                if(!status.ok()){
+                    m_status = StatusCode::sInternalError;
+                }
+                return false;
+            }
+            const DiffBitmap& chunk = ack.diff_bitmap();
+            if(chunk.blk_size()){
+                m_blk_size = chunk.blk_size();
+            }
+            if(chunk.blk_count() == 0){
+                continue;
+            }
+            m_snap_name = chunk.snap_name();
+            m_start_blk = chunk.start_blk();
+            m_bitmap = hbitmap_alloc(chunk.blk_count(), 0);
+            hbitmap_deserialize_part(m_bitmap, (uint8_t*)chunk.bitmap().data(),
+                                     0, chunk.blk_count(), true);
+            hbitmap_iter_init(&m_iter, m_bitmap, 0);
+        }
+    }
+
+    StatusCode status()const{
+        return m_status;
+    }
+
+    /*cow block size, valid after first next()*/
+    uint64_t blk_size()const{
+        return m_blk_size;
+    }
+
+private:
+    ClientContext m_context;
+    unique_ptr<grpc::ClientReader<DiffSnapshotStreamAck>> m_reader;
+    /*current diff chunk*/
+    HBitmap*     m_bitmap;
+    HBitmapIter  m_iter;
+    string       m_snap_name;
+    uint64_t     m_start_blk;
+    uint64_t     m_blk_size;
+    bool         m_finished;
+    StatusCode   m_status;
+};
+
 /*snapshot and other control rpc client*/
 class SnapshotCtrlClient 
 {
@@ -51,10 +148,13 @@ public:
     ~SnapshotCtrlClient(){
     }
 
-    StatusCode CreateSnapshot(const string& vol_name, const string& snap_name){
+    /*cow_block_size only take effect on the first snapshot of volume*/
+    StatusCode CreateSnapshot(const string& vol_name, const string& snap_name,
+                              const uint64_t cow_block_size = 0){
         CreateSnapshotReq req;
         req.set_vol_name(vol_name);
         req.set_snap_name(snap_name);
+        req.set_cow_block_size(cow_block_size);
         CreateSnapshotAck ack;
         ClientContext context;
         grpc::Status status = m_ctrl_stub->CreateSnapshot(&context, req, &ack);
@@ -109,29 +209,45 @@ public:
                             const string& first_snap_name, 
                             const string& last_snap_name,
                             vector<DiffBlocks>& diff){
-        DiffSnapshotReq req;
-        req.set_vol_name(vol_name);
-        req.set_first_snap_name(first_snap_name);
-        req.set_last_snap_name(last_snap_name);
-        DiffSnapshotAck ack;
-        ClientContext context;
-        grpc::Status status = m_ctrl_stub->DiffSnapshot(&context, req, &ack);
-        
-        /*todo: there may be too many diff blocks, should batch and split*/
-        int count = ack.diff_blocks_size();
-        for(int i = 0; i < count; i++){
-            diff.push_back(ack.diff_blocks(i)); 
+        /*transfer by diff stream, avoid one huge diff message*/
+        DiffReader reader(m_ctrl_stub.get(), vol_name, first_snap_name,
+                          last_snap_name);
+        string   snap_name;
+        uint64_t blk_no;
+        while(reader.next(snap_name, blk_no)){
+            if(diff.empty() || diff.back().snap_name() != snap_name){
+                DiffBlocks diff_blocks;
+                diff_blocks.set_vol_name(vol_name);
+                diff_blocks.set_snap_name(snap_name);
+                diff_blocks.set_blk_size(reader.blk_size());
+                diff.push_back(diff_blocks);
+            }
+            diff.back().add_diff_block_no(blk_no);
         }
-        return ack.header().status();
+        return reader.status();
+    }
+
+    /*incremental diff, caller pull diff block one by one
+     *merged: each changed block once in ascending order*/
+    shared_ptr<DiffReader> DiffSnapshotStream(const string& vol_name,
+                                              const string& first_snap_name,
+                                              const string& last_snap_name,
+                                              const bool merged = false){
+        return make_shared<DiffReader>(m_ctrl_stub.get(), vol_name,
+                                       first_snap_name, last_snap_name,
+                                       merged);
     }
 
+    /*zero: optional, set true when the range all zero*/
     StatusCode ReadSnapshot(const string& vol_name, const string& snap_name,
-                            const char* buf, const size_t len, const off_t off){
+                            const char* buf, const size_t len, const off_t off,
+                            bool* zero = nullptr){
         ReadSnapshotReq req;
         req.set_vol_name(vol_name);
         req.set_snap_name(snap_name);
         req.set_off(off);
         req.set_len(len);
+        req.set_sparse(true);
         ReadSnapshotAck ack;
         ClientContext context;
         /*todo: current read snapshot request should send to 
@@ -140,17 +256,70 @@ public:
         if(!status.ok()){
             return ack.header().status();
         }
-        memcpy((char*)buf, ack.data().data(), len);
+        if (zero) {
+            *zero = ack.zero();
+        }
+        if (ack.zero()) {
+            memset((char*)buf, 0, len);
+        } else {
+            memcpy((char*)buf, ack.data().data(), len);
+        }
         return ack.header().status();
     }
 
+    /*read ranges [offs[i], offs[i]+len) into bufs[i], zeros[i] set when
+     *the range all zero; nearby ranges share one layout query*/
+    StatusCode ReadSnapshotBatch(const string& vol_name, const string& snap_name,
+                                 const vector<off_t>& offs, const size_t len,
+                                 const vector<char*>& bufs, vector<bool>& zeros){
+        ReadSnapshotBatchReq req;
+        req.set_vol_name(vol_name);
+        req.set_snap_name(snap_name);
+        for(auto off : offs){
+            req.add_offs(off);
+        }
+        req.set_len(len);
+        req.set_sparse(true);
+        ReadSnapshotBatchAck ack;
+        ClientContext context;
+        grpc::Status status = m_ctrl_stub->ReadSnapshotBatch(&context, req, &ack);
+        if(!status.ok()){
+            return ack.header().status() != StatusCode::sOk ?
+                   ack.header().status() : StatusCode::sInternalError;
+        }
+        if(ack.header().status() != StatusCode::sOk){
+            return ack.header().status();
+        }
+        if(ack.blocks_size() != (int)offs.size()){
+            return StatusCode::sInternalError;
+        }
+        zeros.assign(offs.size(), false);
+        for(int i = 0; i < ack.blocks_size(); i++){
+            const ReadSnapshotBlock& block = ack.blocks(i);
+            zeros[i] = block.zero();
+            if(block.zero()){
+                memset(bufs[i], 0, len);
+            } else if(block.data().size() == len){
+                memcpy(bufs[i], block.data().data(), len);
+            } else {
+                return StatusCode::sInternalError;
+            }
+        }
+        return StatusCode::sOk;
+    }
+
+    /*lazy_clone: new volume usable at once, data populate in background*/
     StatusCode CreateVolumeFromSnap(const string& vol_name, const string& snap_name,
-                                    const string& new_vol, const string& new_blk){
+                                    const string& new_vol, const string& new_blk,
+                                    bool lazy_clone = false,
+                                    uint32_t fill_threads = 0){
         CreateVolumeFromSnapReq req;
         req.set_vol_name(vol_name);
         req.set_snap_name(snap_name);
         req.set_new_vol_name(new_vol);
         req.set_new_blk_device(new_blk);
+        req.set_lazy_clone(lazy_clone);
+        req.set_fill_threads(fill_threads);
         CreateVolumeFromSnapAck ack;
         ClientContext context;
 
@@ -171,6 +340,20 @@ public:
         return ack.header().status();
     }
 
+    /*lazy clone volume report populated size while filling*/
+    StatusCode QueryVolumeFromSnap(const string& new_vol, VolumeStatus& new_vol_status,
+                                   uint64_t& filled_size, uint64_t& total_size){
+        QueryVolumeFromSnapReq req;
+        req.set_new_vol_name(new_vol);
+        QueryVolumeFromSnapAck ack;
+        ClientContext context;
+        grpc::Status status = m_ctrl_stub->QueryVolumeFromSnap(&context, req, &ack);
+        new_vol_status = ack.vol_status();
+        filled_size = ack.filled_size();
+        total_size = ack.total_size();
+        return ack.header().status();
+    }
+
 private:
     unique_ptr<SnapshotControl::Stub> m_ctrl_stub;
 };
@@ -30,9 +30,7 @@ BackupProxy::BackupProxy(VolumeAttr& vol_attr,
     m_backup_inner_rpc_client.reset(new BackupInnerCtrlClient(grpc::CreateChannel(
                                     meta_rpc_addr,
                                     grpc::InsecureChannelCredentials())));
-    m_block_store.reset(new CephBlockStore(g_option.ceph_cluster_name,
-                                           g_option.ceph_user_name,
-                                           g_option.ceph_pool_name));
+    m_block_store.reset(create_block_store(m_vol_attr.vol_name()));
 }
 
 BackupProxy::~BackupProxy() {
@@ -21,6 +21,7 @@
 #include "common.h"
 #include "common/config_option.h"
 #include "rpc/message.pb.h"
+#include "../snapshot/clone_volume.h"
 
 using google::protobuf::Message;
 using huawei::proto::WriteMessage;
@@ -323,6 +324,14 @@ int Bcache::_cache_miss_read(off_t off, size_t len, char* buf,
             pbuf_len = MIN(k.m_len, off+len-k.m_off);
         }
         pbuf = buf+(pbuf_off - off);
+        /*instant clone volume populate from parent snapshot first, device
+         *data of block not populated is not volume data*/
+        if (CloneVolumeMgr::instance().prepare_read(m_blkdev, pbuf_off,
+                                                    pbuf_len)) {
+            LOG_ERROR << "miss read populate off:" << pbuf_off
+                      << " len:" << pbuf_len << " failed";
+            return -1;
+        }
         m_blkfile->read(pbuf, pbuf_len, pbuf_off);
     }
     LOG_INFO << "miss read ok";
@@ -381,14 +390,14 @@ int Bcache::read(off_t off, size_t len, char* buf) {
 
         /*read from device*/
         if (!order_miss_keys.empty()) {
-            _cache_miss_read(off, len, buf, order_miss_keys);
+            return _cache_miss_read(off, len, buf, order_miss_keys);
         }
 
     } else {
         LOG_DEBUG << "read region no hit ";
         vector<Bkey> order_miss_keys;
         order_miss_keys.push_back(Bkey(off, len, IoVersion(0, 0)));
-        _cache_miss_read(off, len, buf, order_miss_keys);
+        return _cache_miss_read(off, len, buf, order_miss_keys);
     }
     return 0;
 }
@@ -10,6 +10,7 @@
 *************************************************/
 #include <fstream>
 #include "common/env_posix.h"
+#include "common/config_option.h"
 #include "log/log.h"
 #include "control_snapshot.h"
 using huawei::proto::StatusCode;
@@ -35,6 +36,30 @@ SnapshotControlImpl::~SnapshotControlImpl() {
     m_volumes.clear();
 }
 
+void SnapshotControlImpl::recover_clones() {
+    CloneVolumeMgr::instance().load(g_option.clone_meta_dir);
+}
+
+void SnapshotControlImpl::start_clones() {
+    vector<shared_ptr<CloneVolume>> clones;
+    CloneVolumeMgr::instance().list(clones);
+    for (auto clone : clones) {
+        shared_ptr<SnapshotProxy> parent_proxy = get_vol_snap_proxy(
+                                                     clone->parent_volume());
+        if (parent_proxy == nullptr) {
+            LOG_ERROR << "lazy clone new_vol:" << clone->new_volume()
+                      << " parent vol:" << clone->parent_volume()
+                      << " not exist";
+            continue;
+        }
+        clone->attach_parent(parent_proxy);
+        if (!clone->start(0)) {
+            LOG_ERROR << "lazy clone new_vol:" << clone->new_volume()
+                      << " restart failed";
+        }
+    }
+}
+
 shared_ptr<SnapshotProxy> SnapshotControlImpl::get_vol_snap_proxy(
                                                const string& vol_name) {
     auto it = m_volumes.find(vol_name);
@@ -108,6 +133,13 @@ Status SnapshotControlImpl::DeleteSnapshot(ServerContext* context,
     string vname = req->vol_name();
     LOG_INFO << "RPC DeleteSnapshot" << " vname:" << vname;
 
+    /*parent snapshot of lazy clone read until all blocks populated*/
+    if (CloneVolumeMgr::instance().is_parent(vname, req->snap_name())) {
+        LOG_ERROR << "RPC DeleteSnapshot vname:" << vname << " sname:"
+                  << req->snap_name() << " in use by clone";
+        ack->mutable_header()->set_status(StatusCode::sSnapInUse);
+        return Status::CANCELLED;
+    }
     shared_ptr<SnapshotProxy> vol_snap_proxy = get_vol_snap_proxy(vname);
     assert(vol_snap_proxy != nullptr);
     /*dispatch to volume*/
@@ -160,6 +192,25 @@ Status SnapshotControlImpl::DiffSnapshot(ServerContext* context,
     return Status::OK;
 }
 
+Status SnapshotControlImpl::DiffSnapshotStream(ServerContext* context,
+        const DiffSnapshotReq* req,
+        ServerWriter<DiffSnapshotStreamAck>* writer) {
+    string vname = req->vol_name();
+    LOG_INFO << "RPC DiffSnapshotStream" << " vname:" << vname;
+    shared_ptr<SnapshotProxy> vol_snap_proxy = get_vol_snap_proxy(vname);
+    assert(vol_snap_proxy != nullptr);
+    /*dispatch to volume*/
+    StatusCode ret = vol_snap_proxy->diff_snapshot_stream(req, writer);
+    if (ret != StatusCode::sOk) {
+        LOG_ERROR << "RPC DiffSnapshotStream vname:" << vname
+                  << " failed" << " err:" << ret;
+        return Status::CANCELLED;
+    }
+
+    LOG_INFO << "RPC DiffSnapshotStream vname:" << vname << " ok";
+    return Status::OK;
+}
+
 Status SnapshotControlImpl::ReadSnapshot(ServerContext* context,
                                          const ReadSnapshotReq* req,
                                          ReadSnapshotAck* ack) {
@@ -180,6 +231,26 @@ Status SnapshotControlImpl::ReadSnapshot(ServerContext* context,
     return Status::OK;
 }
 
+Status SnapshotControlImpl::ReadSnapshotBatch(ServerContext* context,
+                                              const ReadSnapshotBatchReq* req,
+                                              ReadSnapshotBatchAck* ack) {
+    string vname = req->vol_name();
+    LOG_INFO << "RPC ReadSnapshotBatch" << " vname:" << vname;
+    shared_ptr<SnapshotProxy> vol_snap_proxy = get_vol_snap_proxy(vname);
+    assert(vol_snap_proxy != nullptr);
+    /*dispatch to volume*/
+    StatusCode ret = vol_snap_proxy->read_snapshot_batch(req, ack);
+    if (ret != StatusCode::sOk) {
+        LOG_ERROR << "RPC ReadSnapshotBatch vname:" << vname
+                  << " failed" << " err:" << ret;
+        ack->mutable_header()->set_status(ret);
+        return Status::CANCELLED;
+    }
+    LOG_INFO << "RPC ReadSnapshotBatch vname:" << vname
+             << " blocks:" << ack->blocks_size() << " ok";
+    return Status::OK;
+}
+
 bool SnapshotControlImpl::is_bdev_available(const string& blk_device) {
     int ret = access(blk_device.c_str(), F_OK);
     if (ret) {
@@ -225,6 +296,14 @@ Status SnapshotControlImpl::CreateVolumeFromSnap(ServerContext* context,
         return Status::CANCELLED;
     }
 
+    if (req->lazy_clone()) {
+        StatusCode ret = lazy_clone(req);
+        ack->mutable_header()->set_status(ret);
+        LOG_INFO << "RPC CreateVolumeFromSnap vname:" << vname << " lazy"
+                 << (ret == StatusCode::sOk ? " ok" : " failed");
+        return ret == StatusCode::sOk ? Status::OK : Status::CANCELLED;
+    }
+
     if (m_pending_queue->full()) {
         LOG_ERROR << "RPC CreateVolumeFromSnap vname:" << vname << "queue full failed";
         ack->mutable_header()->set_status(StatusCode::sSnapCreateVolumeBusy);
@@ -243,6 +322,21 @@ Status SnapshotControlImpl::QueryVolumeFromSnap(ServerContext* context,
             const QueryVolumeFromSnapReq* req, QueryVolumeFromSnapAck* ack) {
     string new_volume = req->new_vol_name();
     LOG_INFO << "RPC QueryVolumeFromSnap vname:" << new_volume;
+    shared_ptr<CloneVolume> clone = CloneVolumeMgr::instance().get(new_volume);
+    if (clone != nullptr) {
+        /*lazy clone volume available while filling*/
+        uint64_t filled_size = 0;
+        uint64_t total_size = 0;
+        clone->progress(filled_size, total_size);
+        ack->set_vol_status(VolumeStatus::VOL_AVAILABLE);
+        ack->mutable_header()->set_status(clone->is_failed() ?
+                StatusCode::sInternalError : StatusCode::sOk);
+        ack->set_filled_size(filled_size);
+        ack->set_total_size(total_size);
+        LOG_INFO << "volume:" << new_volume << " filling " << filled_size
+                 << "/" << total_size;
+        return Status::OK;
+    }
     for (int i = 0; i < m_pending_queue->size(); i++) {
         struct BgJob* job = (*m_pending_queue)[i];
         if (job->new_volume.compare(new_volume) == 0) {
@@ -265,6 +359,29 @@ Status SnapshotControlImpl::QueryVolumeFromSnap(ServerContext* context,
     return Status::OK;
 }
 
+StatusCode SnapshotControlImpl::lazy_clone(
+        const CreateVolumeFromSnapReq* req) {
+    shared_ptr<SnapshotProxy> vol_snap_proxy = get_vol_snap_proxy(
+                                                   req->vol_name());
+    if (vol_snap_proxy == nullptr) {
+        return StatusCode::sVolumeNotExist;
+    }
+    shared_ptr<CloneVolume> clone = make_shared<CloneVolume>(
+            req->new_vol_name(), req->new_blk_device(), vol_snap_proxy,
+            req->vol_name(), req->snap_name());
+    if (!clone->init()) {
+        return StatusCode::sInternalError;
+    }
+    if (!CloneVolumeMgr::instance().add(clone)) {
+        return StatusCode::sVolumeAlreadyExist;
+    }
+    if (!clone->start(req->fill_threads())) {
+        CloneVolumeMgr::instance().remove(req->new_vol_name());
+        return StatusCode::sInternalError;
+    }
+    return StatusCode::sOk;
+}
+
 void SnapshotControlImpl::bg_work() {
     while (m_run) {
         struct BgJob* job = m_pending_queue->pop();
@@ -277,7 +394,9 @@ void SnapshotControlImpl::bg_work() {
         Env::instance()->create_access_file(job->new_blk_device, true, &block_file);
         size_t bdev_size = Env::instance()->file_size(job->new_blk_device);
         off_t  bdev_off = 0;
-        size_t bdev_slice = COW_BLOCK_SIZE;
+        size_t bdev_slice = SNAP_READ_SLICE;
+        /*zero slice no data carried back, write from zero buffer*/
+        char* zero_buf = nullptr;
 
         shared_ptr<SnapshotProxy> vol_snap_proxy = get_vol_snap_proxy(job->vol_name);
         assert(vol_snap_proxy != nullptr);
@@ -285,19 +404,31 @@ void SnapshotControlImpl::bg_work() {
         ReadSnapshotAck ack;
         req.set_vol_name(job->vol_name);
         req.set_snap_name(job->snap_name);
+        req.set_sparse(true);
         LOG_INFO << "bg restore vol:" << job->new_volume << " size:" << bdev_size;
         while (bdev_off < bdev_size) {
-            bdev_slice = ((bdev_size-bdev_off) > COW_BLOCK_SIZE) ? \
-                          COW_BLOCK_SIZE : (bdev_size-bdev_off);
+            bdev_slice = ((bdev_size-bdev_off) > SNAP_READ_SLICE) ? \
+                          SNAP_READ_SLICE : (bdev_size-bdev_off);
             req.set_off(bdev_off);
             req.set_len(bdev_slice);
+            ack.Clear();
             StatusCode ret = vol_snap_proxy->read_snapshot(&req, &ack);
             assert(ret == StatusCode::sOk);
-            ssize_t write_ret = block_file->write(const_cast<char*>(ack.data().c_str()),
-                                                  ack.data().length(), bdev_off);
-            assert(write_ret == ack.data().length());
+            char* data = const_cast<char*>(ack.data().c_str());
+            if (ack.zero()) {
+                if (zero_buf == nullptr) {
+                    zero_buf = (char*)calloc(1, SNAP_READ_SLICE);
+                    assert(zero_buf != nullptr);
+                }
+                data = zero_buf;
+            }
+            ssize_t write_ret = block_file->write(data, bdev_slice, bdev_off);
+            assert(write_ret == bdev_slice);
             bdev_off += bdev_slice;
         }
+        if (zero_buf) {
+            free(zero_buf);
+        }
         LOG_INFO << "bg restore vol:" << job->new_volume << " size:" << bdev_size << " ok";
 
         job->status = BG_DONE;
@@ -311,6 +442,22 @@ void SnapshotControlImpl::bg_work() {
 
 void SnapshotControlImpl::bg_reclaim() {
     while (m_run) {
+        /*lazy clone fully populated, io path need not redirect any more*/
+        vector<shared_ptr<CloneVolume>> done_clones;
+        CloneVolumeMgr::instance().list_done(done_clones);
+        for (auto clone : done_clones) {
+            struct BgJob* job = new BgJob(clone->new_volume(),
+                                          clone->blk_device(), "", "");
+            job->status = BG_DONE;
+            gettimeofday(&(job->complete_ts), NULL);
+            gettimeofday(&(job->expire_ts), NULL);
+            job->expire_ts.tv_sec += (60*60*12);
+            m_complete_queue->push_back(job);
+            clone->drop_meta();
+            CloneVolumeMgr::instance().remove(clone->new_volume());
+            LOG_INFO << "lazy clone new_vol:" << clone->new_volume() << " done";
+        }
+
         if (m_complete_queue->empty()) {
             sleep(10);
             continue;
@@ -23,12 +23,15 @@
 #include "rpc/snapshot_control.pb.h"
 #include "rpc/snapshot_control.grpc.pb.h"
 #include "../snapshot/snapshot_proxy.h"
+#include "../snapshot/clone_volume.h"
+#include "../snapshot/snapshot_reader.h"
 #include "../volume.h"
 
 using grpc::Server;
 using grpc::ServerBuilder;
 using grpc::ServerContext;
 using grpc::Status;
+using grpc::ServerWriter;
 
 using huawei::proto::control::SnapshotControl;
 using huawei::proto::control::CreateSnapshotReq;
@@ -41,8 +44,11 @@ using huawei::proto::control::DeleteSnapshotReq;
 using huawei::proto::control::DeleteSnapshotAck;
 using huawei::proto::control::DiffSnapshotReq;
 using huawei::proto::control::DiffSnapshotAck;
+using huawei::proto::control::DiffSnapshotStreamAck;
 using huawei::proto::control::ReadSnapshotReq;
 using huawei::proto::control::ReadSnapshotAck;
+using huawei::proto::control::ReadSnapshotBatchReq;
+using huawei::proto::control::ReadSnapshotBatchAck;
 using huawei::proto::control::CreateVolumeFromSnapReq;
 using huawei::proto::control::CreateVolumeFromSnapAck;
 using huawei::proto::control::QueryVolumeFromSnapReq;
@@ -56,6 +62,12 @@ class SnapshotControlImpl final: public SnapshotControl::Service {
     explicit SnapshotControlImpl(map<string, shared_ptr<Volume>>& volumes);
     virtual ~SnapshotControlImpl();
 
+    /*instant clones saved before restart, io path of their volumes must
+     *see them before replay start*/
+    void recover_clones();
+    /*attach parent of recovered clones and go on filling*/
+    void start_clones();
+
     Status CreateSnapshot(ServerContext* context, const CreateSnapshotReq* req,
                           CreateSnapshotAck* ack) override;
     Status ListSnapshot(ServerContext* context, const ListSnapshotReq* req,
@@ -68,8 +80,14 @@ class SnapshotControlImpl final: public SnapshotControl::Service {
             const RollbackSnapshotReq* req, RollbackSnapshotAck* ack) override;
     Status DiffSnapshot(ServerContext* context, const DiffSnapshotReq* req,
                         DiffSnapshotAck* ack) override;
+    Status DiffSnapshotStream(ServerContext* context,
+                              const DiffSnapshotReq* req,
+                              ServerWriter<DiffSnapshotStreamAck>* writer) override;
     Status ReadSnapshot(ServerContext* context, const ReadSnapshotReq* req,
                         ReadSnapshotAck* ack) override;
+    Status ReadSnapshotBatch(ServerContext* context,
+                             const ReadSnapshotBatchReq* req,
+                             ReadSnapshotBatchAck* ack) override;
     Status CreateVolumeFromSnap(ServerContext* context,
                                 const CreateVolumeFromSnapReq* req,
                                 CreateVolumeFromSnapAck* ack) override;
@@ -83,6 +101,8 @@ class SnapshotControlImpl final: public SnapshotControl::Service {
     /*create volume from snapshot*/
     bool is_bdev_available(const string& blk_device);
     bool is_snapshot_available(const string& vol, const string& snap);
+    /*instant clone, new volume usable before data populated*/
+    StatusCode lazy_clone(const CreateVolumeFromSnapReq* req);
     void bg_work();
     void bg_reclaim();
 
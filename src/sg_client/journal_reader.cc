@@ -59,7 +59,12 @@ void JournalReader::work() {
                   << " off:" << ioreq.offset << " len:" << ioreq.len;
         /*read*/
         int ret = m_cacheproxy->read(ioreq.offset, ioreq.len, buf);
-        iorsp->error = 0;
+        if (ret != 0) {
+            LOG_ERROR << "read" << " seq:" << ioreq.seq
+                      << " off:" << ioreq.offset << " len:" << ioreq.len
+                      << " failed";
+        }
+        iorsp->error = (ret == 0) ? 0 : 1;
         iorsp->len = ioreq.len;
         /*send reply*/
         if (!m_reply_queue.push(iorsp)) {
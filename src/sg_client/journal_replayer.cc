@@ -21,9 +21,13 @@
 #include "common/utils.h"
 #include "rpc/message.pb.h"
 #include "perf_counter.h"
+#include "snapshot/clone_volume.h"
 #include "journal_replayer.h"
 
 using google::protobuf::Message;
+
+/*entry failed to replay is retried after it, marker held meanwhile*/
+#define REPLAY_RETRY_INTERVAL_US (1000000)
 using huawei::proto::WriteMessage;
 using huawei::proto::SnapshotMessage;
 using huawei::proto::DiskPos;
@@ -128,6 +132,11 @@ bool JournalReplayer::replay_each_journal(const std::string& journal,
             break;
         }
         retval = process_journal_entry(journal_entry);
+        if (!retval) {
+            /*entries after it wait, journal replayed again from marker*/
+            LOG_ERROR << "replay journal:" << journal << " failed";
+            break;
+        }
     }
     return retval;
 }
@@ -167,10 +176,13 @@ void JournalReplayer::replica_replay() {
         off_t end_pos   = it.end_offset();
         LOG_INFO << "replica replay journal:" << journal;
         ret = replay_each_journal(journal, start_pos, end_pos);
-        /*replay ok, update in memory consumer marker*/
-        if (ret) {
-            update_consumer_marker(it.journal(), end_pos);
+        /*failed, later journals wait and it is retried from marker*/
+        if (!ret) {
+            usleep(REPLAY_RETRY_INTERVAL_US);
+            break;
         }
+        /*replay ok, update in memory consumer marker*/
+        update_consumer_marker(it.journal(), end_pos);
     }
 }
 
@@ -183,7 +195,13 @@ bool JournalReplayer::normal_replay() {
     if (entry->get_cache_type() == CEntry::IN_MEM) {
         // replay from memory
         LOG_INFO << "replay from memory";
+        /*entry already popped, retry it until replayed*/
         bool succeed = process_memory(entry->get_journal_entry());
+        while (!succeed && running_) {
+            LOG_ERROR << "replay from memory failed, retry";
+            usleep(REPLAY_RETRY_INTERVAL_US);
+            succeed = process_memory(entry->get_journal_entry());
+        }
         if (succeed) {
             std::string journal_key = entry->get_journal_file().substr(g_option.journal_mount_point.length());
             update_consumer_marker(journal_key, entry->get_journal_off());
@@ -193,6 +211,11 @@ bool JournalReplayer::normal_replay() {
         // replay from journal file
         LOG_INFO << "replay from journal file";
         bool succeed = process_file(entry);
+        while (!succeed && running_) {
+            LOG_ERROR << "replay from journal file failed, retry";
+            usleep(REPLAY_RETRY_INTERVAL_US);
+            succeed = process_file(entry);
+        }
         if (succeed) {
             update_consumer_marker(entry->get_journal_file(),
                                    entry->get_journal_off());
@@ -223,6 +246,14 @@ bool JournalReplayer::handle_io_cmd(shared_ptr<JournalEntry> entry) {
         DiskPos* pos = write->mutable_pos(i);
         off_t  off = pos->offset();
         size_t len = pos->length();
+        /*instant clone volume populate partial written block first*/
+        int clone_ret = CloneVolumeMgr::instance().prepare_write(
+                            vol_attr_.blk_device(), off, len);
+        if (clone_ret != 0) {
+            LOG_ERROR << "replay populate clone off:" << off << " len:"
+                      << len << " failed";
+            return false;
+        }
         if (!snapshot_proxy_ptr_->check_exist_snapshot()) {
             ssize_t ret = blk_file_->write(data, len, off);
             assert(ret == len);
@@ -236,8 +267,9 @@ bool JournalReplayer::handle_io_cmd(shared_ptr<JournalEntry> entry) {
     return true;
 }
 
-void JournalReplayer::handle_snapshot_cmd(int type, SnapReqHead shead,
+bool JournalReplayer::handle_snapshot_cmd(int type, SnapReqHead shead,
                                           std::string snap_name) {
+    StatusCode ret = StatusCode::sOk;
     switch (type) {
         case SNAPSHOT_CREATE:
             LOG_INFO << "journal_replayer create snapshot:" << snap_name;
@@ -249,11 +281,19 @@ void JournalReplayer::handle_snapshot_cmd(int type, SnapReqHead shead,
             break;
         case SNAPSHOT_ROLLBACK:
             LOG_INFO << "journal_replayer rollback snapshot:" << snap_name;
-            snapshot_proxy_ptr_->rollback_transaction(shead, snap_name);
+            ret = snapshot_proxy_ptr_->rollback_transaction(shead, snap_name);
+            if (ret != StatusCode::sOk) {
+                /*device holds partly restored data, hold marker and redo,
+                 *executor resume from its checkpoint*/
+                LOG_ERROR << "journal_replayer rollback snapshot:" << snap_name
+                          << " failed:" << ret;
+                return false;
+            }
             break;
         default:
             break;
     }
+    return true;
 }
 
 void JournalReplayer::handle_backup_cmd(int type, SnapReqHead shead,
@@ -302,7 +342,9 @@ bool JournalReplayer::handle_ctrl_cmd(shared_ptr<JournalEntry> entry) {
         SnapScene scene  = (SnapScene)snap_message->snap_scene();
         switch (scene) {
             case SnapScene::FOR_NORMAL:
-                handle_snapshot_cmd(type, shead, snap_name);
+                if (!handle_snapshot_cmd(type, shead, snap_name)) {
+                    return false;
+                }
                 break;
             case SnapScene::FOR_BACKUP:
                 handle_backup_cmd(type, shead, snap_name);
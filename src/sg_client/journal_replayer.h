@@ -56,7 +56,7 @@ class JournalReplayer {
                              const off_t& end_pos);
     bool handle_io_cmd(shared_ptr<JournalEntry> entry);
     bool handle_ctrl_cmd(shared_ptr<JournalEntry> entry);
-    void handle_snapshot_cmd(int type, SnapReqHead shead, std::string snap_name);
+    bool handle_snapshot_cmd(int type, SnapReqHead shead, std::string snap_name);
     void handle_backup_cmd(int type, SnapReqHead shead, std::string snap_name);
     void handle_replication_cmd(int type, SnapReqHead shead, std::string snap_name);
     void handle_replication_failover_cmd(int type, SnapReqHead shead, std::string snap_name);
@@ -0,0 +1,501 @@
+/**********************************************
+*  Copyright (c) 2016 Huawei Technologies Co., Ltd. All rights reserved.
+*  
+*  File name:    clone_volume.cc
+*  Author: 
+*  Date:         2017/06/20
+*  Version:      1.0
+*  Description:  instant clone volume from snapshot
+*  
+*************************************************/
+#include <assert.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include "log/log.h"
+#include "common/config_option.h"
+#include "snapshot_proxy.h"
+#include "clone_volume.h"
+
+static bool write_all(int fd, const char* buf, size_t len) {
+    while (len > 0) {
+        ssize_t ret = ::write(fd, buf, len);
+        if (ret <= 0) {
+            return false;
+        }
+        buf += ret;
+        len -= ret;
+    }
+    return true;
+}
+
+CloneVolume::CloneVolume(const string& new_volume, const string& blk_device,
+                         shared_ptr<SnapshotProxy> parent_proxy,
+                         const string& parent_volume, const string& snap_name)
+    : m_new_volume(new_volume), m_blk_device(blk_device),
+      m_parent_proxy(parent_proxy), m_parent_volume(parent_volume),
+      m_snap_name(snap_name) {
+    m_dev_size = 0;
+    m_blk_count = 0;
+    m_populated = nullptr;
+    m_saved = nullptr;
+    m_fill_cursor = 0;
+    m_dropped = false;
+    m_unsaved = 0;
+    m_fill_count = 0;
+    m_run = false;
+    m_failed = false;
+}
+
+CloneVolume::~CloneVolume() {
+    stop();
+    if (m_populated) {
+        hbitmap_free(m_populated);
+    }
+    if (m_saved) {
+        hbitmap_free(m_saved);
+    }
+}
+
+shared_ptr<CloneVolume> CloneVolume::load(const string& meta_file) {
+    ifstream in(meta_file, ios::binary);
+    if (!in.is_open()) {
+        LOG_ERROR << "clone meta:" << meta_file << " open failed";
+        return nullptr;
+    }
+    string line;
+    getline(in, line);
+    istringstream head(line);
+    string new_volume;
+    string blk_device;
+    string parent_volume;
+    string snap_name;
+    int fill_count = 0;
+    uint64_t blk_count = 0;
+    if (!(head >> new_volume >> blk_device >> parent_volume >> snap_name
+               >> fill_count >> blk_count)) {
+        LOG_ERROR << "clone meta:" << meta_file << " invalid head";
+        return nullptr;
+    }
+    shared_ptr<CloneVolume> clone = make_shared<CloneVolume>(new_volume,
+            blk_device, nullptr, parent_volume, snap_name);
+    if (!clone->init() || clone->m_blk_count != blk_count) {
+        LOG_ERROR << "clone meta:" << meta_file << " device mismatch";
+        return nullptr;
+    }
+    clone->m_fill_count = fill_count;
+    if (blk_count > 0) {
+        uint64_t size = hbitmap_serialization_size(clone->m_saved, 0,
+                                                   blk_count);
+        vector<uint8_t> buf(size);
+        if (!in.read(reinterpret_cast<char*>(buf.data()), size)) {
+            LOG_ERROR << "clone meta:" << meta_file << " short bitmap";
+            return nullptr;
+        }
+        /*deserialize not keep bit count, set populated bit by bit*/
+        hbitmap_deserialize_part(clone->m_saved, buf.data(), 0, blk_count,
+                                 true);
+        HBitmapIter hbi;
+        hbitmap_iter_init(&hbi, clone->m_saved, 0);
+        int64_t blk_no;
+        while ((blk_no = hbitmap_iter_next(&hbi)) >= 0) {
+            hbitmap_set(clone->m_populated, blk_no, 1);
+        }
+    }
+    LOG_INFO << "clone vname:" << new_volume << " recovered, populated:"
+             << hbitmap_count(clone->m_populated) << "/" << blk_count;
+    return clone;
+}
+
+bool CloneVolume::init() {
+    Env::instance()->create_access_file(m_blk_device, true, &m_blk_file);
+    if (m_blk_file == nullptr) {
+        LOG_ERROR << "clone vname:" << m_new_volume << " open device failed";
+        return false;
+    }
+    m_dev_size = Env::instance()->file_size(m_blk_device);
+    m_blk_count = (m_dev_size + CLONE_BLOCK_SIZE - 1) / CLONE_BLOCK_SIZE;
+    m_populated = hbitmap_alloc(m_blk_count, 0);
+    m_saved = hbitmap_alloc(m_blk_count, 0);
+    LOG_INFO << "clone vname:" << m_new_volume << " from vname:"
+             << m_parent_volume << " snap:" << m_snap_name
+             << " size:" << m_dev_size << " blocks:" << m_blk_count;
+    return true;
+}
+
+bool CloneVolume::start(int fill_threads) {
+    if (fill_threads <= 0) {
+        fill_threads = m_fill_count > 0 ? m_fill_count : CLONE_FILL_THREADS;
+    }
+    m_fill_count = fill_threads;
+    /*clone known after restart before any block populated*/
+    if (!save()) {
+        return false;
+    }
+    m_run = true;
+    for (int i = 0; i < fill_threads; i++) {
+        m_fill_threads.push_back(new thread(&CloneVolume::fill_work, this));
+    }
+    return true;
+}
+
+void CloneVolume::stop() {
+    m_run = false;
+    for (auto t : m_fill_threads) {
+        t->join();
+        delete t;
+    }
+    m_fill_threads.clear();
+}
+
+void CloneVolume::attach_parent(shared_ptr<SnapshotProxy> parent_proxy) {
+    lock_guard<mutex> lock(m_mutex);
+    m_parent_proxy = parent_proxy;
+    m_cond.notify_all();
+}
+
+shared_ptr<SnapshotProxy> CloneVolume::parent() {
+    unique_lock<mutex> lock(m_mutex);
+    m_cond.wait_for(lock, chrono::seconds(CLONE_PARENT_WAIT_SECONDS),
+                    [this] { return m_parent_proxy != nullptr; });
+    return m_parent_proxy;
+}
+
+string CloneVolume::meta_file() const {
+    return g_option.clone_meta_dir + "/" + m_new_volume;
+}
+
+bool CloneVolume::save() {
+    lock_guard<mutex> save_lock(m_save_mutex);
+    if (m_dropped) {
+        return true;
+    }
+    uint64_t size = hbitmap_serialization_size(m_populated, 0, m_blk_count);
+    vector<uint8_t> buf(size);
+    {
+        lock_guard<mutex> lock(m_mutex);
+        hbitmap_serialize_part(m_populated, buf.data(), 0, m_blk_count);
+    }
+    ostringstream head;
+    head << m_new_volume << " " << m_blk_device << " " << m_parent_volume
+         << " " << m_snap_name << " " << m_fill_count << " " << m_blk_count
+         << "\n";
+    string dir = g_option.clone_meta_dir;
+    if (!Env::instance()->file_exists(dir) &&
+        !Env::instance()->create_dir(dir)) {
+        return false;
+    }
+    /*replace old state as a whole, a crash leave either of them*/
+    string path = meta_file();
+    string tmp = path + ".tmp";
+    int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) {
+        LOG_ERROR << "clone vname:" << m_new_volume << " open meta failed:"
+                  << errno;
+        return false;
+    }
+    bool ok = write_all(fd, head.str().data(), head.str().size()) &&
+              write_all(fd, reinterpret_cast<char*>(buf.data()), size) &&
+              ::fsync(fd) == 0;
+    ::close(fd);
+    if (!ok || ::rename(tmp.c_str(), path.c_str()) != 0) {
+        LOG_ERROR << "clone vname:" << m_new_volume << " save meta failed:"
+                  << errno;
+        return false;
+    }
+    if (m_blk_count > 0) {
+        HBitmap* saved = hbitmap_alloc(m_blk_count, 0);
+        hbitmap_deserialize_part(saved, buf.data(), 0, m_blk_count, true);
+        lock_guard<mutex> lock(m_mutex);
+        hbitmap_merge(m_saved, saved);
+        hbitmap_free(saved);
+    }
+    return true;
+}
+
+void CloneVolume::drop_meta() {
+    lock_guard<mutex> save_lock(m_save_mutex);
+    m_dropped = true;
+    Env::instance()->delete_file(meta_file());
+}
+
+bool CloneVolume::is_saved(const block_t first_blk, const block_t last_blk) {
+    lock_guard<mutex> lock(m_mutex);
+    for (block_t blk = first_blk; blk <= last_blk && blk < m_blk_count;
+         blk++) {
+        if (!hbitmap_get(m_saved, blk)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool CloneVolume::wait_inflight(unique_lock<mutex>& lock,
+                                const block_t blk_no) {
+    while (true) {
+        if (hbitmap_get(m_populated, blk_no)) {
+            return true;
+        }
+        if (m_inflight.find(blk_no) == m_inflight.end()) {
+            return false;
+        }
+        m_cond.wait(lock);
+    }
+}
+
+int CloneVolume::fill_block(const block_t blk_no) {
+    unique_lock<mutex> lock(m_mutex);
+    if (wait_inflight(lock, blk_no)) {
+        return 0;
+    }
+    m_inflight.insert(blk_no);
+    lock.unlock();
+
+    off_t  blk_off = blk_no * CLONE_BLOCK_SIZE;
+    size_t blk_len = std::min(CLONE_BLOCK_SIZE, m_dev_size - blk_off);
+    ReadSnapshotReq req;
+    ReadSnapshotAck ack;
+    req.set_vol_name(m_parent_volume);
+    req.set_snap_name(m_snap_name);
+    req.set_off(blk_off);
+    req.set_len(blk_len);
+    int ret = 0;
+    shared_ptr<SnapshotProxy> parent_proxy = parent();
+    StatusCode st = parent_proxy == nullptr ? StatusCode::sVolumeNotExist :
+                    parent_proxy->read_snapshot(&req, &ack);
+    if (st != StatusCode::sOk || ack.data().length() != blk_len) {
+        LOG_ERROR << "clone vname:" << m_new_volume << " read snapshot blk:"
+                  << blk_no << " failed";
+        ret = -1;
+    } else {
+        ssize_t write_ret = m_blk_file->write(
+                const_cast<char*>(ack.data().c_str()), blk_len, blk_off);
+        if (write_ret != blk_len) {
+            LOG_ERROR << "clone vname:" << m_new_volume << " write blk:"
+                      << blk_no << " failed";
+            ret = -1;
+        }
+    }
+
+    lock.lock();
+    m_inflight.erase(blk_no);
+    if (ret == 0) {
+        hbitmap_set(m_populated, blk_no, 1);
+    }
+    m_cond.notify_all();
+    return ret;
+}
+
+void CloneVolume::claim_block(const block_t blk_no) {
+    unique_lock<mutex> lock(m_mutex);
+    if (wait_inflight(lock, blk_no)) {
+        return;
+    }
+    hbitmap_set(m_populated, blk_no, 1);
+}
+
+int CloneVolume::prepare_read(const off_t off, const size_t len) {
+    if (len == 0) {
+        return 0;
+    }
+    block_t first_blk = off / CLONE_BLOCK_SIZE;
+    block_t last_blk  = (off + len - 1) / CLONE_BLOCK_SIZE;
+    for (block_t blk = first_blk; blk <= last_blk && blk < m_blk_count; blk++) {
+        if (fill_block(blk)) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int CloneVolume::prepare_write(const off_t off, const size_t len) {
+    if (len == 0) {
+        return 0;
+    }
+    block_t first_blk = off / CLONE_BLOCK_SIZE;
+    block_t last_blk  = (off + len - 1) / CLONE_BLOCK_SIZE;
+    for (block_t blk = first_blk; blk <= last_blk && blk < m_blk_count; blk++) {
+        off_t blk_start = blk * CLONE_BLOCK_SIZE;
+        off_t blk_end = std::min(blk_start + CLONE_BLOCK_SIZE, m_dev_size);
+        if (off <= blk_start && off + len >= blk_end) {
+            claim_block(blk);
+            continue;
+        }
+        if (fill_block(blk)) {
+            return -1;
+        }
+    }
+    /*block saved populated before guest data land on it, or a restart
+     *fill it from parent again over guest data*/
+    if (!is_saved(first_blk, last_blk) && !save()) {
+        return -1;
+    }
+    return 0;
+}
+
+void CloneVolume::fill_work() {
+    while (m_run && !m_failed) {
+        block_t blk_no;
+        {
+            lock_guard<mutex> lock(m_mutex);
+            /*skip blocks guest already read or written*/
+            while (m_fill_cursor < m_blk_count &&
+                   hbitmap_get(m_populated, m_fill_cursor)) {
+                m_fill_cursor++;
+            }
+            if (m_fill_cursor >= m_blk_count) {
+                break;
+            }
+            blk_no = m_fill_cursor++;
+        }
+        if (fill_block(blk_no)) {
+            m_failed = true;
+        } else if (++m_unsaved % CLONE_SAVE_BLOCKS == 0) {
+            save();
+        }
+    }
+    /*progress kept for restart*/
+    save();
+    LOG_INFO << "clone vname:" << m_new_volume << " filler exit"
+             << (m_failed ? " failed" : "");
+}
+
+bool CloneVolume::is_done() {
+    lock_guard<mutex> lock(m_mutex);
+    return hbitmap_count(m_populated) == m_blk_count;
+}
+
+bool CloneVolume::is_failed() const {
+    return m_failed;
+}
+
+void CloneVolume::progress(uint64_t& filled_size, uint64_t& total_size) {
+    lock_guard<mutex> lock(m_mutex);
+    total_size = m_dev_size;
+    filled_size = std::min((uint64_t)m_dev_size,
+                           hbitmap_count(m_populated) * CLONE_BLOCK_SIZE);
+}
+
+const string& CloneVolume::new_volume() const {
+    return m_new_volume;
+}
+
+const string& CloneVolume::blk_device() const {
+    return m_blk_device;
+}
+
+const string& CloneVolume::parent_volume() const {
+    return m_parent_volume;
+}
+
+const string& CloneVolume::snap_name() const {
+    return m_snap_name;
+}
+
+bool CloneVolumeMgr::add(shared_ptr<CloneVolume> clone) {
+    lock_guard<mutex> lock(m_mutex);
+    auto ret = m_clones.insert({clone->new_volume(), clone});
+    if (ret.second) {
+        m_count++;
+    }
+    return ret.second;
+}
+
+void CloneVolumeMgr::remove(const string& new_volume) {
+    lock_guard<mutex> lock(m_mutex);
+    if (m_clones.erase(new_volume)) {
+        m_count--;
+    }
+}
+
+shared_ptr<CloneVolume> CloneVolumeMgr::get(const string& new_volume) {
+    lock_guard<mutex> lock(m_mutex);
+    auto it = m_clones.find(new_volume);
+    if (it == m_clones.end()) {
+        return nullptr;
+    }
+    return it->second;
+}
+
+void CloneVolumeMgr::list(vector<shared_ptr<CloneVolume>>& clones) {
+    lock_guard<mutex> lock(m_mutex);
+    for (auto& it : m_clones) {
+        clones.push_back(it.second);
+    }
+}
+
+void CloneVolumeMgr::load(const string& dir) {
+    vector<string> files;
+    if (!Env::instance()->file_exists(dir) ||
+        !Env::instance()->get_dirent(dir, &files)) {
+        return;
+    }
+    for (auto& file : files) {
+        string path = dir + "/" + file;
+        /*left by a crash in save, the old state is still there*/
+        if (file.size() > 4 && file.compare(file.size() - 4, 4, ".tmp") == 0) {
+            Env::instance()->delete_file(path);
+            continue;
+        }
+        shared_ptr<CloneVolume> clone = CloneVolume::load(path);
+        if (clone != nullptr) {
+            add(clone);
+        }
+    }
+}
+
+bool CloneVolumeMgr::is_parent(const string& vol_name,
+                               const string& snap_name) {
+    lock_guard<mutex> lock(m_mutex);
+    for (auto& it : m_clones) {
+        if (it.second->parent_volume() == vol_name &&
+            it.second->snap_name() == snap_name) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void CloneVolumeMgr::list_done(vector<shared_ptr<CloneVolume>>& done) {
+    lock_guard<mutex> lock(m_mutex);
+    for (auto& it : m_clones) {
+        if (it.second->is_done()) {
+            done.push_back(it.second);
+        }
+    }
+}
+
+shared_ptr<CloneVolume> CloneVolumeMgr::get_by_device(
+        const string& blk_device) {
+    if (m_count == 0) {
+        return nullptr;
+    }
+    lock_guard<mutex> lock(m_mutex);
+    for (auto& it : m_clones) {
+        if (it.second->blk_device() == blk_device) {
+            return it.second;
+        }
+    }
+    return nullptr;
+}
+
+int CloneVolumeMgr::prepare_read(const string& blk_device, const off_t off,
+                                 const size_t len) {
+    shared_ptr<CloneVolume> clone = get_by_device(blk_device);
+    if (clone == nullptr) {
+        return 0;
+    }
+    return clone->prepare_read(off, len);
+}
+
+int CloneVolumeMgr::prepare_write(const string& blk_device, const off_t off,
+                                  const size_t len) {
+    shared_ptr<CloneVolume> clone = get_by_device(blk_device);
+    if (clone == nullptr) {
+        return 0;
+    }
+    return clone->prepare_write(off, len);
+}
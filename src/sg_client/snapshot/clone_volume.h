@@ -0,0 +1,161 @@
+/**********************************************
+*  Copyright (c) 2016 Huawei Technologies Co., Ltd. All rights reserved.
+*  
+*  File name:    clone_volume.h
+*  Author: 
+*  Date:         2017/06/20
+*  Version:      1.0
+*  Description:  instant clone volume from snapshot
+*  
+*************************************************/
+#ifndef SRC_SG_CLIENT_SNAPSHOT_CLONE_VOLUME_H_
+#define SRC_SG_CLIENT_SNAPSHOT_CLONE_VOLUME_H_
+#include <string>
+#include <vector>
+#include <set>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <condition_variable>
+#include "common/define.h"
+#include "common/env_posix.h"
+#include "common/hbitmap.h"
+
+class SnapshotProxy;
+
+/*block unit populate clone volume*/
+#define CLONE_BLOCK_SIZE COW_BLOCK_SIZE
+/*default background filler thread number*/
+#define CLONE_FILL_THREADS (4)
+/*blocks filled by filler between two saves of populate state*/
+#define CLONE_SAVE_BLOCKS (1024)
+/*io of recovered clone wait its parent volume attached*/
+#define CLONE_PARENT_WAIT_SECONDS (60)
+
+/*new volume usable at once, block not populated yet copy from parent
+ *snapshot on first access, background filler populate the rest; populate
+ *state saved in clone meta dir, survive restart*/
+class CloneVolume {
+ public:
+    CloneVolume(const std::string& new_volume, const std::string& blk_device,
+                std::shared_ptr<SnapshotProxy> parent_proxy,
+                const std::string& parent_volume, const std::string& snap_name);
+    CloneVolume(const CloneVolume& other) = delete;
+    CloneVolume& operator=(const CloneVolume& other) = delete;
+    ~CloneVolume();
+
+    /*recover clone saved before restart, parent attached later*/
+    static std::shared_ptr<CloneVolume> load(const std::string& meta_file);
+
+    bool init();
+    /*save state and start filler, false if state can not be saved*/
+    bool start(int fill_threads);
+    void stop();
+    void attach_parent(std::shared_ptr<SnapshotProxy> parent_proxy);
+    /*persist populate bitmap, blocks populated before it stay populated
+     *after restart*/
+    bool save();
+    /*all blocks populated, state no longer needed*/
+    void drop_meta();
+
+    /*before device read, populate blocks overlap with [off, off+len)*/
+    int prepare_read(const off_t off, const size_t len);
+    /*before guest write land on device, populate partial covered blocks,
+     *full covered blocks no need copy from snapshot*/
+    int prepare_write(const off_t off, const size_t len);
+
+    bool is_done();
+    bool is_failed() const;
+    void progress(uint64_t& filled_size, uint64_t& total_size);
+    const std::string& new_volume() const;
+    const std::string& blk_device() const;
+    const std::string& parent_volume() const;
+    const std::string& snap_name() const;
+
+ private:
+    std::string meta_file() const;
+    /*parent snapshot proxy, wait a while if not attached yet*/
+    std::shared_ptr<SnapshotProxy> parent();
+    /*whether blocks in range populated in saved state*/
+    bool is_saved(const block_t first_blk, const block_t last_blk);
+    /*copy block from parent snapshot to device*/
+    int fill_block(const block_t blk_no);
+    /*guest write cover whole block, mark populated without copy*/
+    void claim_block(const block_t blk_no);
+    /*wait block populating by others, return true if already populated*/
+    bool wait_inflight(std::unique_lock<std::mutex>& lock,
+                       const block_t blk_no);
+    void fill_work();
+
+ private:
+    std::string m_new_volume;
+    std::string m_blk_device;
+    std::shared_ptr<SnapshotProxy> m_parent_proxy;
+    std::string m_parent_volume;
+    std::string m_snap_name;
+    std::unique_ptr<AccessFile> m_blk_file;
+    size_t   m_dev_size;
+    uint64_t m_blk_count;
+
+    /*protect populate bitmap, inflight blocks and fill cursor*/
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+    HBitmap* m_populated;
+    /*populated blocks already saved, never ahead of m_populated*/
+    HBitmap* m_saved;
+    std::set<block_t> m_inflight;
+    block_t m_fill_cursor;
+
+    /*one save at a time*/
+    std::mutex m_save_mutex;
+    bool m_dropped;
+    std::atomic<uint64_t> m_unsaved;
+    int m_fill_count;
+
+    std::atomic_bool m_run;
+    std::atomic_bool m_failed;
+    std::vector<std::thread*> m_fill_threads;
+};
+
+/*all clone volume in filling, io path lookup by block device*/
+class CloneVolumeMgr {
+ public:
+    static CloneVolumeMgr& instance() {
+        static CloneVolumeMgr mgr;
+        return mgr;
+    }
+    CloneVolumeMgr(const CloneVolumeMgr& other) = delete;
+    CloneVolumeMgr& operator=(const CloneVolumeMgr& other) = delete;
+
+    bool add(std::shared_ptr<CloneVolume> clone);
+    void remove(const std::string& new_volume);
+    std::shared_ptr<CloneVolume> get(const std::string& new_volume);
+    void list(std::vector<std::shared_ptr<CloneVolume>>& clones);
+    /*clone volume which already populated all blocks*/
+    void list_done(std::vector<std::shared_ptr<CloneVolume>>& done);
+    /*register clones saved in dir, before their volumes start replay*/
+    void load(const std::string& dir);
+    /*snapshot still read by a filling clone, must not be deleted*/
+    bool is_parent(const std::string& vol_name, const std::string& snap_name);
+
+    /*io path hook, do nothing if device not a filling clone volume*/
+    int prepare_read(const std::string& blk_device, const off_t off,
+                     const size_t len);
+    int prepare_write(const std::string& blk_device, const off_t off,
+                      const size_t len);
+
+ private:
+    CloneVolumeMgr() : m_count(0) {}
+    ~CloneVolumeMgr() {}
+    std::shared_ptr<CloneVolume> get_by_device(const std::string& blk_device);
+
+ private:
+    std::mutex m_mutex;
+    /*avoid lock on io path when no clone volume*/
+    std::atomic<int> m_count;
+    std::map<std::string, std::shared_ptr<CloneVolume>> m_clones;
+};
+
+#endif  // SRC_SG_CLIENT_SNAPSHOT_CLONE_VOLUME_H_
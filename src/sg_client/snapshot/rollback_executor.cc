@@ -0,0 +1,175 @@
+/**********************************************
+*  Copyright (c) 2016 Huawei Technologies Co., Ltd. All rights reserved.
+*
+*  File name:    rollback_executor.cc
+*  Author:
+*  Date:         2017/06/28
+*  Version:      1.0
+*  Description:  restore rollback blocks concurrently and resumable
+*
+*************************************************/
+#include <stdlib.h>
+#include <stdio.h>
+#include <fstream>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+#include "log/log.h"
+#include "snapshot_proxy.h"
+#include "rollback_executor.h"
+
+RollbackExecutor::RollbackExecutor(SnapshotProxy* proxy, AccessFile* block_file,
+                                   BlockStore* block_store,
+                                   const size_t cow_block_size,
+                                   const std::string& ckpt_file) {
+    m_proxy = proxy;
+    m_block_file = block_file;
+    m_block_store = block_store;
+    m_cow_block_size = cow_block_size;
+    m_ckpt_file = ckpt_file;
+    m_protect_pool.reset(new sg_threads::ThreadPool(ROLLBACK_PROTECT_THREADS));
+}
+
+RollbackExecutor::~RollbackExecutor() {
+}
+
+StatusCode RollbackExecutor::run(const std::vector<RollBlock>& roll_blocks) {
+    size_t total = roll_blocks.size();
+    size_t done = load_checkpoint();
+    if (done > total) {
+        done = 0;
+    }
+    LOG_INFO << "rollback executor blocks:" << total << " resume from:" << done;
+
+    while (done < total) {
+        size_t end = std::min(done + ROLLBACK_WINDOW, total);
+        StatusCode ret = restore_window(roll_blocks, done, end);
+        if (ret != StatusCode::sOk) {
+            LOG_ERROR << "rollback executor window start:" << done
+                      << " end:" << end << " failed";
+            return ret;
+        }
+        done = end;
+        save_checkpoint(done);
+    }
+    clear_checkpoint();
+    LOG_INFO << "rollback executor blocks:" << total << " ok";
+    return StatusCode::sOk;
+}
+
+StatusCode RollbackExecutor::protect_block(const RollBlock& roll_block) {
+    off_t  block_off = roll_block.blk_no() * m_cow_block_size;
+    size_t block_size = m_cow_block_size;
+    char* block_buf = nullptr;
+    if (posix_memalign((void**)&block_buf, 4096, block_size)) {
+        return StatusCode::sInternalError;
+    }
+    ssize_t read_ret = m_block_file->read(block_buf, block_size, block_off);
+    if (read_ret != (ssize_t)block_size) {
+        free(block_buf);
+        LOG_ERROR << "rollback protect read device blk_no:"
+                  << roll_block.blk_no() << " ret:" << read_ret;
+        return StatusCode::sInternalError;
+    }
+    StatusCode ret = m_proxy->do_cow(block_off, block_size, block_buf, true);
+    free(block_buf);
+    return ret;
+}
+
+StatusCode RollbackExecutor::restore_window(
+        const std::vector<RollBlock>& roll_blocks,
+        const size_t start, const size_t end) {
+    size_t count = end - start;
+    /*protect current data, blocks independent with each other*/
+    std::vector<StatusCode> rets(count, StatusCode::sOk);
+    std::mutex mtx;
+    std::condition_variable cond;
+    size_t pending = count;
+    for (size_t i = 0; i < count; i++) {
+        auto protect = [this, &roll_blocks, &rets, &mtx, &cond, &pending,
+                        start, i]() {
+            rets[i] = protect_block(roll_blocks[start + i]);
+            std::lock_guard<std::mutex> lck(mtx);
+            if (--pending == 0) {
+                cond.notify_all();
+            }
+        };
+        if (!m_protect_pool->submit(protect)) {
+            protect();
+        }
+    }
+    {
+        std::unique_lock<std::mutex> lck(mtx);
+        cond.wait(lck, [&pending]() { return pending == 0; });
+    }
+    for (auto ret : rets) {
+        if (ret != StatusCode::sOk) {
+            return ret;
+        }
+    }
+
+    /*read rollback objects in parallel*/
+    char* roll_buf = nullptr;
+    if (posix_memalign((void**)&roll_buf, 4096, count * m_cow_block_size)) {
+        return StatusCode::sInternalError;
+    }
+    std::vector<block_read_t> reads(count);
+    for (size_t i = 0; i < count; i++) {
+        reads[i].object = roll_blocks[start + i].blk_object();
+        reads[i].buf = roll_buf + i * m_cow_block_size;
+        reads[i].len = m_cow_block_size;
+        reads[i].off = 0;
+        reads[i].ret = 0;
+    }
+    m_block_store->read_batch(reads, ROLLBACK_WINDOW);
+
+    /*write back to block device, block aligned*/
+    StatusCode ret = StatusCode::sOk;
+    for (size_t i = 0; i < count; i++) {
+        if (reads[i].ret != (int)m_cow_block_size) {
+            LOG_ERROR << "rollback read object:" << reads[i].object
+                      << " ret:" << reads[i].ret;
+            ret = StatusCode::sInternalError;
+            break;
+        }
+        off_t block_off = roll_blocks[start + i].blk_no() * m_cow_block_size;
+        ssize_t write_ret = m_block_file->write(reads[i].buf, m_cow_block_size,
+                                                block_off);
+        if (write_ret != (ssize_t)m_cow_block_size) {
+            LOG_ERROR << "rollback write device blk_no:"
+                      << roll_blocks[start + i].blk_no() << " ret:" << write_ret;
+            ret = StatusCode::sInternalError;
+            break;
+        }
+    }
+    free(roll_buf);
+    return ret;
+}
+
+size_t RollbackExecutor::load_checkpoint() {
+    std::ifstream in(m_ckpt_file);
+    size_t done = 0;
+    if (!in.is_open() || !(in >> done)) {
+        return 0;
+    }
+    return done;
+}
+
+void RollbackExecutor::save_checkpoint(const size_t done) {
+    /*write temp then rename, checkpoint never torn*/
+    std::string tmp = m_ckpt_file + ".tmp";
+    std::ofstream out(tmp, std::ios::trunc);
+    if (!out.is_open()) {
+        LOG_WARN << "rollback checkpoint:" << m_ckpt_file << " open failed";
+        return;
+    }
+    out << done << std::endl;
+    out.close();
+    if (::rename(tmp.c_str(), m_ckpt_file.c_str())) {
+        LOG_WARN << "rollback checkpoint:" << m_ckpt_file << " save failed";
+    }
+}
+
+void RollbackExecutor::clear_checkpoint() {
+    ::remove(m_ckpt_file.c_str());
+}
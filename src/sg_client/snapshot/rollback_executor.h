@@ -0,0 +1,68 @@
+/**********************************************
+*  Copyright (c) 2016 Huawei Technologies Co., Ltd. All rights reserved.
+*
+*  File name:    rollback_executor.h
+*  Author:
+*  Date:         2017/06/28
+*  Version:      1.0
+*  Description:  restore rollback blocks concurrently and resumable
+*
+*************************************************/
+#ifndef SRC_SG_CLIENT_SNAPSHOT_ROLLBACK_EXECUTOR_H_
+#define SRC_SG_CLIENT_SNAPSHOT_ROLLBACK_EXECUTOR_H_
+#include <string>
+#include <vector>
+#include <memory>
+#include "rpc/common.pb.h"
+#include "rpc/snapshot_inner_control.pb.h"
+#include "common/define.h"
+#include "common/block_store.h"
+#include "common/env_posix.h"
+#include "common/thread_pool.h"
+
+using huawei::proto::StatusCode;
+using huawei::proto::inner::RollBlock;
+
+class SnapshotProxy;
+
+/*max rollback blocks restore at the same time*/
+#define ROLLBACK_WINDOW (16)
+/*threads protect blocks of window, bound concurrent cow to dr server*/
+#define ROLLBACK_PROTECT_THREADS (4)
+
+/*rollback block list fetched up front, restore window by window:
+ *protect current data of blocks into latest snapshot concurrently, read
+ *rollback objects by aio, then write blocks to device; after each window
+ *progress checkpoint persist, interrupted rollback resume from it*/
+class RollbackExecutor {
+ public:
+    RollbackExecutor(SnapshotProxy* proxy, AccessFile* block_file,
+                     BlockStore* block_store, const size_t cow_block_size,
+                     const std::string& ckpt_file);
+    RollbackExecutor(const RollbackExecutor& other) = delete;
+    RollbackExecutor& operator=(const RollbackExecutor& other) = delete;
+    ~RollbackExecutor();
+
+    StatusCode run(const std::vector<RollBlock>& roll_blocks);
+
+ private:
+    /*cow current block data before overwritten by rollback data*/
+    StatusCode protect_block(const RollBlock& roll_block);
+    StatusCode restore_window(const std::vector<RollBlock>& roll_blocks,
+                              const size_t start, const size_t end);
+
+    /*number of blocks has been restored*/
+    size_t load_checkpoint();
+    void   save_checkpoint(const size_t done);
+    void   clear_checkpoint();
+
+ private:
+    SnapshotProxy* m_proxy;
+    AccessFile* m_block_file;
+    BlockStore* m_block_store;
+    size_t m_cow_block_size;
+    std::string m_ckpt_file;
+    std::unique_ptr<sg_threads::ThreadPool> m_protect_pool;
+};
+
+#endif  // SRC_SG_CLIENT_SNAPSHOT_ROLLBACK_EXECUTOR_H_
@@ -30,6 +30,9 @@ using huawei::proto::control::DiffSnapshotReq;
 using huawei::proto::control::DiffSnapshotAck;
 using huawei::proto::control::ReadSnapshotReq;
 using huawei::proto::control::ReadSnapshotAck;
+using huawei::proto::control::ReadSnapshotBatchReq;
+using huawei::proto::control::ReadSnapshotBatchAck;
+using huawei::proto::control::ReadSnapshotBlock;
 
 
 class ISnapshot {
@@ -8,6 +8,7 @@
 *  Description:  snapshot interface
 * *************************************************/
 #include <stdlib.h>
+#include <stdio.h>
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -24,6 +25,8 @@
 #include "common/config_option.h"
 #include "rpc/message.pb.h"
 #include "snapshot_proxy.h"
+#include "snapshot_reader.h"
+#include "rollback_executor.h"
 
 using huawei::proto::SnapshotMessage;
 using huawei::proto::SnapScene;
@@ -49,6 +52,7 @@ using huawei::proto::inner::RollbackReq;
 using huawei::proto::inner::RollbackAck;
 using huawei::proto::inner::DiffReq;
 using huawei::proto::inner::DiffAck;
+using huawei::proto::inner::DiffStreamAck;
 using huawei::proto::inner::ReadReq;
 using huawei::proto::inner::ReadAck;
 using huawei::proto::inner::SyncReq;
@@ -84,12 +88,11 @@ bool SnapshotProxy::init() {
                                         &m_block_file);
 
     /*snapshot block store*/
-    m_block_store = new CephBlockStore(g_option.ceph_cluster_name,
-                                       g_option.ceph_user_name,
-                                       g_option.ceph_pool_name);
+    m_block_store = create_block_store(m_vol_attr.vol_name());
     m_sync_table.clear();
     m_active_snapshot.clear();
     m_exist_snapshot = false;
+    m_cow_block_size = COW_BLOCK_SIZE;
     /*sync with dr server*/
     sync_state();
     return true;
@@ -121,6 +124,9 @@ StatusCode SnapshotProxy::sync_state() {
     if (!m_active_snapshot.empty()) {
         m_exist_snapshot = true;
     }
+    if (iack.cow_block_size()) {
+        m_cow_block_size = iack.cow_block_size();
+    }
     LOG_INFO << "synchronize current snapshot state, active snaphsot:" << m_active_snapshot;
     return StatusCode::sOk;
 }
@@ -199,7 +205,7 @@ StatusCode SnapshotProxy::create_snapshot(const CreateSnapshotReq* req,
     }
 
     /*rpc with dr_server */
-    ret_code = do_create(req->header(), sname);
+    ret_code = do_create(req->header(), sname, req->cow_block_size());
     LOG_INFO << "create_snapshot vname:" << vname << " sname:" << sname
              << (!ret_code ? " ok" : " failed, rpc error");
     /*sync end*/
@@ -348,6 +354,10 @@ StatusCode SnapshotProxy::rollback_transaction(const SnapReqHead& shead,
         return ret;
     }
 
+    /*checkpoint under journal mount point so rollback replay from journal
+     *resume where it stopped*/
+    string ckpt_file = g_option.journal_mount_point + "/" +
+                       m_vol_attr.vol_name() + "." + snap_name + ".rollback";
     ClientContext context;
     RollbackReq ireq;
     RollbackAck iack;
@@ -356,35 +366,30 @@ StatusCode SnapshotProxy::rollback_transaction(const SnapReqHead& shead,
     ireq.set_snap_name(snap_name);
     Status st = m_rpc_stub->Rollback(&context, ireq, &iack);
     if (!st.ok()) {
+        LOG_ERROR << "rollback transaction sname:" << snap_name << " failed";
+        return StatusCode::sInternalError;
+    }
+    if (iack.header().status() == StatusCode::sSnapNotExist) {
+        /*rollback snapshot deleted at end of rollback, replay redo after
+         *rollback finished but before marker advanced*/
+        LOG_WARN << "rollback transaction sname:" << snap_name << " done";
+        ::remove(ckpt_file.c_str());
+        return StatusCode::sOk;
+    }
+    if (iack.header().status() != StatusCode::sOk) {
         LOG_ERROR << "rollback transaction sname:" << snap_name << " failed";
         return iack.header().status();
     }
 
-    int roll_blk_num = iack.roll_blocks_size();
-    for (int i = 0; i < roll_blk_num; i++) {
-        RollBlock roll_block = iack.roll_blocks(i);
-        LOG_INFO << "do rollback blk_no:" << roll_block.blk_no()
-                 << " blk_object:" << roll_block.blk_object();
-
-        /*read latest data from block device*/
-        off_t  block_off  = roll_block.blk_no() * COW_BLOCK_SIZE;
-        size_t block_size = COW_BLOCK_SIZE;
-        char* block_buf  = (char*)malloc(block_size);
-        ssize_t read_ret = m_block_file->read(block_buf, block_size, block_off);
-        assert(read_ret == COW_BLOCK_SIZE);
-        /*do cow*/
-        ret = do_cow(block_off, block_size, block_buf, true);
-        assert(ret == StatusCode::sOk);
-        free(block_buf);
-
-        /*rollback*/
-        string roll_block_object = roll_block.blk_object();
-        char* roll_buf = (char*)malloc(block_size);
-        read_ret = m_block_store->read(roll_block_object, roll_buf, block_size, 0);
-        assert(read_ret == block_size);
-        ssize_t write_ret = m_block_file->write(roll_buf, block_size, block_off);
-        assert(write_ret == COW_BLOCK_SIZE);
-        free(roll_buf);
+    /*restore blocks concurrently*/
+    vector<RollBlock> roll_blocks(iack.roll_blocks().begin(),
+                                  iack.roll_blocks().end());
+    RollbackExecutor executor(this, m_block_file.get(), m_block_store,
+                              m_cow_block_size, ckpt_file);
+    ret = executor.run(roll_blocks);
+    if (ret != StatusCode::sOk) {
+        LOG_ERROR << "rollback transaction sname:" << snap_name << " failed";
+        return ret;
     }
 
     /*dr server to delete rollback snapshot*/
@@ -432,19 +437,24 @@ bool SnapshotProxy::check_exist_snapshot()const {
 }
 
 StatusCode SnapshotProxy::do_create(const SnapReqHead& shead,
-                                    const string& sname) {
+                                    const string& sname,
+                                    const size_t cow_block_size) {
     LOG_INFO << "do_create" << " snap_name:" << sname;
     ClientContext context;
     CreateReq ireq;
     ireq.mutable_header()->CopyFrom(shead);
     ireq.set_vol_name(m_vol_attr.vol_name());
     ireq.set_snap_name(sname);
+    ireq.set_cow_block_size(cow_block_size);
     CreateAck iack;
     Status st = m_rpc_stub->Create(&context, ireq, &iack);
     if (!st.ok()) {
         LOG_ERROR << "do_create" << " snap_name:" << sname << " failed";
         return iack.header().status();
     }
+    if (iack.cow_block_size()) {
+        m_cow_block_size = iack.cow_block_size();
+    }
     LOG_INFO << "do_create" << " snap_name:" << sname << " ok";
     return StatusCode::sOk;
 }
@@ -493,11 +503,15 @@ StatusCode SnapshotProxy::do_update(const SnapReqHead& shead,
     } else {
         m_exist_snapshot = true;
     }
+    if (iack.cow_block_size()) {
+        m_cow_block_size = iack.cow_block_size();
+    }
 
     if (!st.ok()) {
         LOG_INFO << "do_update snap_name:" << sname
                  << " event:" << sevent << " failed";
-        return iack.header().status();
+        return iack.header().status() != StatusCode::sOk ?
+               iack.header().status() : StatusCode::sInternalError;
     }
     LOG_INFO << "do_update snap_name:" << sname << " event:" << sevent << " ok";
     return StatusCode::sOk;
@@ -511,12 +525,12 @@ void SnapshotProxy::split_cow_block(const off_t& off, const size_t& size,
     block_t cur_blk_no;
     size_t  split_size;
     while (start < end && len > 0) {
-       if (start % COW_BLOCK_SIZE  == 0) {
-            cur_blk_no  = start / COW_BLOCK_SIZE;
-            split_size  = min(len,  COW_BLOCK_SIZE);
+       if (start % m_cow_block_size  == 0) {
+            cur_blk_no  = start / m_cow_block_size;
+            split_size  = min(len,  m_cow_block_size);
         } else {
-            cur_blk_no  = start / COW_BLOCK_SIZE;
-            split_size  = min(len, ((cur_blk_no+1)*COW_BLOCK_SIZE) - start);
+            cur_blk_no  = start / m_cow_block_size;
+            split_size  = min(len, ((cur_blk_no+1)*m_cow_block_size) - start);
         }
         cow_block_t cow_block;
         cow_block.off    = start;
@@ -575,8 +589,8 @@ StatusCode SnapshotProxy::do_cow(const off_t& off, const size_t& size,
         /*io cow */
         assert(cow_ack.op() == COW_YES);
         /*read from block device*/
-        off_t block_off = cow_block.blk_no * COW_BLOCK_SIZE;
-        size_t block_size = COW_BLOCK_SIZE;
+        off_t block_off = cow_block.blk_no * m_cow_block_size;
+        size_t block_size = m_cow_block_size;
         char* block_buf = (char*)malloc(block_size);
         ssize_t read_ret = m_block_file->read(block_buf, block_size, block_off);
         assert(read_ret == block_size);
@@ -652,6 +666,50 @@ StatusCode SnapshotProxy::diff_snapshot(const DiffSnapshotReq* req,
     return StatusCode::sOk;
 }
 
+StatusCode SnapshotProxy::diff_snapshot_stream(const DiffSnapshotReq* req,
+        ServerWriter<DiffSnapshotStreamAck>* writer) {
+    string vname = req->vol_name();
+    string first_snap_name = req->first_snap_name();
+    string last_snap_name = req->last_snap_name();
+
+    LOG_INFO << "diff_snapshot_stream vname:" << vname
+             << " first_snap:" << first_snap_name
+             << " last_snap:"  << last_snap_name;
+
+    ClientContext context;
+    DiffReq ireq;
+    ireq.mutable_header()->CopyFrom(req->header());
+    ireq.set_vol_name(vname);
+    ireq.set_first_snap_name(first_snap_name);
+    ireq.set_last_snap_name(last_snap_name);
+    ireq.set_merged(req->merged());
+    unique_ptr<grpc::ClientReader<DiffStreamAck>> reader(
+            m_rpc_stub->DiffStream(&context, ireq));
+    DiffStreamAck iack;
+    while (reader->Read(&iack)) {
+        DiffSnapshotStreamAck ack;
+        ack.mutable_header()->CopyFrom(iack.header());
+        ack.mutable_diff_bitmap()->Swap(iack.mutable_diff_bitmap());
+        if (!writer->Write(ack)) {
+            LOG_ERROR << "diff_snapshot_stream vname:" << vname
+                      << " relay chunk failed";
+            context.TryCancel();
+            break;
+        }
+    }
+    Status st = reader->Finish();
+    if (!st.ok()) {
+        LOG_ERROR << "diff_snapshot_stream vname:" << vname << " failed";
+        return StatusCode::sInternalError;
+    }
+
+    LOG_INFO << "diff_snapshot_stream vname:" << vname
+             << " first_snap:" << first_snap_name
+             << " last_snap:"  << last_snap_name
+             << " ok";
+    return StatusCode::sOk;
+}
+
 StatusCode SnapshotProxy::read_snapshot(const ReadSnapshotReq* req,
                                         ReadSnapshotAck* ack) {
     string vname = req->vol_name();
@@ -662,141 +720,86 @@ StatusCode SnapshotProxy::read_snapshot(const ReadSnapshotReq* req,
     LOG_INFO << "read_snapshot vname:" << vname << " sname:" << sname
              << " off:" << off << " len:" << len;
 
-    ClientContext ctx0;
-    ReadReq ireq;
-    ReadAck iack;
-    ireq.mutable_header()->CopyFrom(req->header());
-    ireq.set_vol_name(vname);
-    ireq.set_snap_name(sname);
-    ireq.set_off(off);
-    ireq.set_len(len);
-    Status st = m_rpc_stub->Read(&ctx0, ireq, &iack);
-    if (!st.ok()) {
-        return iack.header().status();
-    }
-
     char* read_buf = (char*)malloc(len);
     assert(read_buf != nullptr);
-
-    /*--------first read----------------------*/
-    interval_set<uint64_t> read_region;
-    read_region.clear();
-    read_region.insert(off, len);
-    /*region read from orginal block device*/
-    interval_set<uint64_t> read_device_region;
-    read_device_region.clear();
-    read_device_region.insert(off, len);
-    /*region read from cow object*/
-    interval_set<uint64_t> read_cowobj_region;
-    read_cowobj_region.clear();
-    /*cow block set in first read*/
-    set<uint64_t> cow_block_set0;
-
-    int read_blk_num = iack.read_blocks_size();
-    for (int i = 0; i < read_blk_num; i++) {
-        uint64_t block_no = iack.read_blocks(i).blk_no();
-        string block_object = iack.read_blocks(i).blk_object();
-        /*accumulate record which cow block */
-        cow_block_set0.insert(block_no);
-        
-        /*accumulate record which read from cow object*/
-        read_cowobj_region.insert(block_no * COW_BLOCK_SIZE, COW_BLOCK_SIZE);
-
-        interval_set<uint64_t> block_region;
-        block_region.insert(block_no * COW_BLOCK_SIZE, COW_BLOCK_SIZE);
-        block_region.intersection_of(read_region);
-        /*block region read from cow object*/
-        if (!block_region.empty()) {
-            for (interval_set<uint64_t>::iterator it = block_region.begin();
-                    it != block_region.end(); it++) {
-                char*  rbuf = read_buf + it.get_start() - off;
-                size_t rlen = it.get_len();
-                off_t  roff = it.get_start() - (block_no * COW_BLOCK_SIZE);
-                size_t read_ret = m_block_store->read(block_object, rbuf, rlen, roff);
-                assert(read_ret == rlen);
-
-                LOG_INFO << "read_snapshot first read cow object"
-                << " blk_no:" << block_no << " blk_ob:" << block_object
-                << " start:" << it.get_start() << " len:"  << it.get_len()
-                << " roff:" << roff << " rlen:" << rlen << " read_ret:" << read_ret;
- 
-           }
-        }
+    SnapshotReader reader(m_rpc_stub.get(), m_block_store, m_block_file.get(),
+                          m_cow_block_size);
+    StatusCode ret = reader.read(req->header(), vname, sname, off, len, read_buf);
+    if (ret != StatusCode::sOk) {
+        free(read_buf);
+        LOG_ERROR << "read_snapshot vname:" << vname << " sname:" << sname
+                  << " off:" << off << " len:" << len << " failed:" << ret;
+        return ret;
     }
-   
-    /*compute which read from block device*/
-    if (!read_cowobj_region.empty()) {
-        read_device_region.subtract(read_cowobj_region);
-    }
-
-    if (!read_device_region.empty()) {
-        for (interval_set<uint64_t>::iterator it = read_device_region.begin();
-             it != read_device_region.end(); it++) {
-            off_t  r_off = it.get_start();
-            size_t r_len = it.get_len();
-            char*  r_buf = read_buf + r_off - off;
-            LOG_INFO << "read_snapshot first read block device"
-                     << " cur_off:" << r_off
-                     << " cur_len:" << r_len
-                     << " align_off:" << ALIGN_UP(r_off, 512)
-                     << " align_len:" << ALIGN_UP(r_len, 512);
-            ssize_t read_ret = m_block_file->read(r_buf, 
-                               ALIGN_UP(r_len, 512), ALIGN_UP(r_off, 512));
-            assert(read_ret == r_len);
-        }
+
+    ack->mutable_header()->set_status(StatusCode::sOk);
+    /*zero range no need carry data back*/
+    if (req->sparse() && buf_is_zero(read_buf, len)) {
+        ack->set_zero(true);
+    } else {
+        ack->set_data(read_buf, len);
     }
+    free(read_buf);
 
-    /*----------second read---------------*/
-    ClientContext ctx1;
-    ReadReq ireq1;
-    ReadAck iack1;
-    ireq1.mutable_header()->CopyFrom(req->header());
-    ireq1.set_vol_name(vname);
-    ireq1.set_snap_name(sname);
-    ireq1.set_off(off);
-    ireq1.set_len(len);
-    st = m_rpc_stub->Read(&ctx1, ireq1, &iack1);
-    int read_block_num1 = iack1.read_blocks_size();
-    for (int i = 0; i < read_block_num1; i++) {
-        uint64_t block_no = iack1.read_blocks(i).blk_no();
-        string   block_object = iack1.read_blocks(i).blk_object();
-        /*cow block has read during first second*/
-        if (cow_block_set0.find(block_no) != cow_block_set0.end()) {
-            continue;
-        }
+    LOG_INFO << "read_snapshot vname:" << vname << " sname:" << sname
+             << " off:" << off << " len:" << len
+             << " zero:" << ack->zero()
+             << " data_len:"  << ack->data().length() << " ok";
+    return StatusCode::sOk;
+}
 
-        /*when second read, some region in first read from block deivce should
-         *read from new snapshot cow object*/
-        interval_set<uint64_t> block_region;
-        block_region.insert(block_no * COW_BLOCK_SIZE, COW_BLOCK_SIZE);
-        block_region.intersection_of(read_device_region);
-
-        /*block region read from cow object*/
-        if (!block_region.empty()) {
-            for (interval_set<uint64_t>::iterator it = block_region.begin();
-                    it != block_region.end(); it++) {
-                char*  rbuf = read_buf + it.get_start() - off;
-                size_t rlen = it.get_len();
-                off_t  roff = it.get_start() - (block_no * COW_BLOCK_SIZE);
-                LOG_INFO << "read_snapshot second read cow object"
-                    << " blk_no:" << block_no
-                    << " blk_ob:" << block_object
-                    << " cow_off:"  << it.get_start()
-                    << " cow_len:"  << it.get_len();
-                m_block_store->read(block_object, rbuf, rlen, roff);
-            }
+StatusCode SnapshotProxy::read_snapshot_batch(const ReadSnapshotBatchReq* req,
+                                              ReadSnapshotBatchAck* ack) {
+    string vname = req->vol_name();
+    string sname = req->snap_name();
+    size_t len   = req->len();
+    int    count = req->offs_size();
+
+    LOG_INFO << "read_snapshot_batch vname:" << vname << " sname:" << sname
+             << " count:" << count << " len:" << len;
+
+    SnapshotReader reader(m_rpc_stub.get(), m_block_store, m_block_file.get(),
+                          m_cow_block_size);
+    std::vector<string> datas(count);
+    int start = 0;
+    while (start < count) {
+        /*group ascending nearby ranges, layout ack of the span stay small*/
+        off_t first = req->offs(start);
+        std::vector<off_t> offs;
+        std::vector<char*> bufs;
+        int end = start;
+        do {
+            datas[end].resize(len);
+            offs.push_back(req->offs(end));
+            bufs.push_back(&datas[end][0]);
+            end++;
+        } while (end < count && (off_t)req->offs(end) > offs.back() &&
+                 req->offs(end) + len - first <= SNAP_READ_BATCH_SPAN);
+
+        StatusCode ret = reader.read_batch(req->header(), vname, sname,
+                                           offs, len, bufs);
+        if (ret != StatusCode::sOk) {
+            LOG_ERROR << "read_snapshot_batch vname:" << vname
+                      << " sname:" << sname << " off:" << first
+                      << " failed:" << ret;
+            return ret;
         }
+        start = end;
     }
 
     ack->mutable_header()->set_status(StatusCode::sOk);
-    ack->set_data(read_buf, len);
-    if (read_buf) {
-        free(read_buf);
+    for (int i = 0; i < count; i++) {
+        ReadSnapshotBlock* block = ack->add_blocks();
+        block->set_off(req->offs(i));
+        /*zero range no need carry data back*/
+        if (req->sparse() && buf_is_zero(datas[i].data(), len)) {
+            block->set_zero(true);
+        } else {
+            block->mutable_data()->swap(datas[i]);
+        }
     }
-    
-    LOG_INFO << "read_snapshot vname:" << vname << " sname:" << sname
-             << " off:" << off << " len:" << len
-             << " data size:" << ack->data().size()
-             << " data_len:"  << ack->data().length() << " ok";
+
+    LOG_INFO << "read_snapshot_batch vname:" << vname << " sname:" << sname
+             << " count:" << count << " ok";
     return StatusCode::sOk;
 }
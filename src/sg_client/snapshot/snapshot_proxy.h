@@ -43,6 +43,7 @@
 using grpc::Channel;
 using grpc::ClientContext;
 using grpc::Status;
+using grpc::ServerWriter;
 using huawei::proto::VolumeInfo;
 using huawei::proto::StatusCode;
 using huawei::proto::SnapType;
@@ -52,6 +53,7 @@ using huawei::proto::JournalMarker;
 using huawei::proto::DiffBlocks;
 using huawei::proto::inner::SnapshotInnerControl;
 using huawei::proto::inner::UpdateEvent;
+using huawei::proto::control::DiffSnapshotStreamAck;
 
 /*work on storage gateway client, each volume own a SnapshotProxy*/
 class SnapshotProxy : public ISnapshot, public ITransaction,
@@ -84,6 +86,12 @@ class SnapshotProxy : public ISnapshot, public ITransaction,
                              DiffSnapshotAck* ack) override;
     StatusCode read_snapshot(const ReadSnapshotReq* req,
                              ReadSnapshotAck* ack) override;
+    /*nearby ranges grouped, each group one layout query*/
+    StatusCode read_snapshot_batch(const ReadSnapshotBatchReq* req,
+                                   ReadSnapshotBatchAck* ack);
+    /*relay diff chunks from dr server without materialize all diff*/
+    StatusCode diff_snapshot_stream(const DiffSnapshotReq* req,
+                                ServerWriter<DiffSnapshotStreamAck>* writer);
 
     /*call by journal replayer*/
     StatusCode create_transaction(const SnapReqHead& shead,
@@ -96,7 +104,8 @@ class SnapshotProxy : public ISnapshot, public ITransaction,
     bool check_exist_snapshot()const;
 
     /*rpc with dr server*/
-    StatusCode do_create(const SnapReqHead& shead, const std::string& sname);
+    StatusCode do_create(const SnapReqHead& shead, const std::string& sname,
+                         const size_t cow_block_size = 0);
     StatusCode do_delete(const SnapReqHead& shead, const std::string& sname);
     StatusCode do_cow(const off_t& off, const size_t& size, char* buf,
                       bool rollback);
@@ -155,6 +164,8 @@ class SnapshotProxy : public ISnapshot, public ITransaction,
     std::string  m_active_snapshot;
     /*check now exist snapshot or not*/
     atomic_bool m_exist_snapshot{false};
+    /*cow granularity of volume, dr server decide it*/
+    size_t m_cow_block_size;
     /*snapshot block store*/
     BlockStore* m_block_store;
     /*rpc interact with dr server, snapshot meta data access*/
@@ -0,0 +1,196 @@
+/**********************************************
+*  Copyright (c) 2016 Huawei Technologies Co., Ltd. All rights reserved.
+*
+*  File name:    snapshot_reader.cc
+*  Author:
+*  Date:         2017/06/26
+*  Version:      1.0
+*  Description:  materialize snapshot data of a range
+*
+*************************************************/
+#include <string.h>
+#include <grpc++/grpc++.h>
+#include <algorithm>
+#include "log/log.h"
+#include "snapshot_reader.h"
+
+using grpc::ClientContext;
+using grpc::Status;
+using huawei::proto::inner::ReadReq;
+
+#ifndef ALIGN_UP
+#define ALIGN_UP(v, align) (((v)+(align)-1) & ~((align)-1))
+#endif
+
+SnapshotReader::SnapshotReader(SnapshotInnerControl::Stub* stub,
+                               BlockStore* block_store, AccessFile* block_file,
+                               const size_t cow_block_size) {
+    m_rpc_stub = stub;
+    m_block_store = block_store;
+    m_block_file = block_file;
+    m_cow_block_size = cow_block_size;
+}
+
+SnapshotReader::~SnapshotReader() {
+}
+
+StatusCode SnapshotReader::query_layout(const SnapReqHead& shead,
+                                        const std::string& vname,
+                                        const std::string& sname,
+                                        const off_t off, const size_t len,
+                                        ReadAck* iack) {
+    ClientContext ctx;
+    ReadReq ireq;
+    ireq.mutable_header()->CopyFrom(shead);
+    ireq.set_vol_name(vname);
+    ireq.set_snap_name(sname);
+    ireq.set_off(off);
+    ireq.set_len(len);
+    Status st = m_rpc_stub->Read(&ctx, ireq, iack);
+    if (!st.ok()) {
+        LOG_ERROR << "snapshot reader query layout vname:" << vname
+                  << " sname:" << sname << " failed";
+        return iack->header().status() != StatusCode::sOk ?
+               iack->header().status() : StatusCode::sInternalError;
+    }
+    return StatusCode::sOk;
+}
+
+StatusCode SnapshotReader::read_cow_blocks(const ReadAck& iack,
+                                           const interval_set<uint64_t>& region,
+                                           const off_t off, char* buf,
+                                           std::set<uint64_t>& done,
+                                           interval_set<uint64_t>& cow_region) {
+    std::vector<block_read_t> reads;
+    for (int i = 0; i < iack.read_blocks_size(); i++) {
+        uint64_t blk_no = iack.read_blocks(i).blk_no();
+        if (!done.insert(blk_no).second) {
+            continue;
+        }
+        uint64_t blk_off = blk_no * m_cow_block_size;
+        interval_set<uint64_t> blk_region;
+        blk_region.insert(blk_off, m_cow_block_size);
+        blk_region.intersection_of(region);
+        for (auto it = blk_region.begin(); it != blk_region.end(); it++) {
+            block_read_t r;
+            r.object = iack.read_blocks(i).blk_object();
+            r.buf = buf + it.get_start() - off;
+            r.len = it.get_len();
+            r.off = it.get_start() - blk_off;
+            r.ret = 0;
+            reads.push_back(r);
+            cow_region.insert(it.get_start(), it.get_len());
+        }
+    }
+    if (reads.empty()) {
+        return StatusCode::sOk;
+    }
+
+    m_block_store->read_batch(reads);
+    for (auto& r : reads) {
+        if (r.ret < 0 || (size_t)r.ret != r.len) {
+            LOG_ERROR << "snapshot reader read cow object:" << r.object
+                      << " off:" << r.off << " len:" << r.len
+                      << " ret:" << r.ret;
+            return StatusCode::sInternalError;
+        }
+    }
+    return StatusCode::sOk;
+}
+
+StatusCode SnapshotReader::read_device(const interval_set<uint64_t>& region,
+                                       const off_t off, char* buf) {
+    for (auto it = region.begin(); it != region.end(); it++) {
+        off_t  r_off = it.get_start();
+        size_t r_len = it.get_len();
+        char*  r_buf = buf + r_off - off;
+        ssize_t ret = m_block_file->read(r_buf, ALIGN_UP(r_len, 512),
+                                         ALIGN_UP(r_off, 512));
+        if (ret != (ssize_t)r_len) {
+            LOG_ERROR << "snapshot reader read device off:" << r_off
+                      << " len:" << r_len << " ret:" << ret;
+            return StatusCode::sInternalError;
+        }
+    }
+    return StatusCode::sOk;
+}
+
+StatusCode SnapshotReader::read(const SnapReqHead& shead,
+                                const std::string& vname,
+                                const std::string& sname,
+                                const off_t off, const size_t len, char* buf) {
+    std::vector<off_t> offs(1, off);
+    std::vector<char*> bufs(1, buf);
+    return read_batch(shead, vname, sname, offs, len, bufs);
+}
+
+StatusCode SnapshotReader::read_batch(const SnapReqHead& shead,
+                                      const std::string& vname,
+                                      const std::string& sname,
+                                      const std::vector<off_t>& offs,
+                                      const size_t len,
+                                      const std::vector<char*>& bufs) {
+    if (offs.empty()) {
+        return StatusCode::sOk;
+    }
+    off_t span_start = *std::min_element(offs.begin(), offs.end());
+    off_t span_end = *std::max_element(offs.begin(), offs.end()) + len;
+    size_t span_len = span_end - span_start;
+
+    /*first read: cow blocks from object, the rest from block device*/
+    ReadAck iack;
+    StatusCode ret = query_layout(shead, vname, sname, span_start, span_len,
+                                  &iack);
+    if (ret != StatusCode::sOk) {
+        return ret;
+    }
+    /*cow block may cover several ranges, done set kept per range*/
+    std::vector<std::set<uint64_t>> done_blocks(offs.size());
+    std::vector<interval_set<uint64_t>> device_regions(offs.size());
+    bool device_read = false;
+    for (size_t i = 0; i < offs.size(); i++) {
+        interval_set<uint64_t> read_region;
+        read_region.insert(offs[i], len);
+        interval_set<uint64_t> cow_region;
+        ret = read_cow_blocks(iack, read_region, offs[i], bufs[i],
+                              done_blocks[i], cow_region);
+        if (ret != StatusCode::sOk) {
+            return ret;
+        }
+        device_regions[i].insert(offs[i], len);
+        if (!cow_region.empty()) {
+            device_regions[i].subtract(cow_region);
+        }
+        if (device_regions[i].empty()) {
+            continue;
+        }
+        ret = read_device(device_regions[i], offs[i], bufs[i]);
+        if (ret != StatusCode::sOk) {
+            return ret;
+        }
+        device_read = true;
+    }
+    if (!device_read) {
+        return StatusCode::sOk;
+    }
+
+    /*second read: block device region cowed during first read should
+     *read from new cow object*/
+    ReadAck iack1;
+    ret = query_layout(shead, vname, sname, span_start, span_len, &iack1);
+    if (ret != StatusCode::sOk) {
+        return ret;
+    }
+    for (size_t i = 0; i < offs.size(); i++) {
+        if (device_regions[i].empty()) {
+            continue;
+        }
+        interval_set<uint64_t> cow_region1;
+        ret = read_cow_blocks(iack1, device_regions[i], offs[i], bufs[i],
+                              done_blocks[i], cow_region1);
+        if (ret != StatusCode::sOk) {
+            return ret;
+        }
+    }
+    return StatusCode::sOk;
+}
@@ -0,0 +1,78 @@
+/**********************************************
+*  Copyright (c) 2016 Huawei Technologies Co., Ltd. All rights reserved.
+*
+*  File name:    snapshot_reader.h
+*  Author:
+*  Date:         2017/06/26
+*  Version:      1.0
+*  Description:  materialize snapshot data of a range
+*
+*************************************************/
+#ifndef SRC_SG_CLIENT_SNAPSHOT_SNAPSHOT_READER_H_
+#define SRC_SG_CLIENT_SNAPSHOT_SNAPSHOT_READER_H_
+#include <string>
+#include <vector>
+#include <set>
+#include "rpc/common.pb.h"
+#include "rpc/snapshot_inner_control.pb.h"
+#include "rpc/snapshot_inner_control.grpc.pb.h"
+#include "common/define.h"
+#include "common/block_store.h"
+#include "common/env_posix.h"
+#include "common/interval_set.h"
+
+using huawei::proto::StatusCode;
+using huawei::proto::SnapReqHead;
+using huawei::proto::inner::SnapshotInnerControl;
+using huawei::proto::inner::ReadAck;
+
+/*range size per read when copy whole snapshot*/
+#define SNAP_READ_SLICE (16 * COW_BLOCK_SIZE)
+/*max span of ranges share one layout query in batch read*/
+#define SNAP_READ_BATCH_SPAN (64 * COW_BLOCK_SIZE)
+
+/*read snapshot data of a range: one layout query for whole range, cow
+ *objects read in parallel by aio window, the rest read from block device,
+ *layout query again to catch cow happened during the read*/
+class SnapshotReader {
+ public:
+    SnapshotReader(SnapshotInnerControl::Stub* stub, BlockStore* block_store,
+                   AccessFile* block_file, const size_t cow_block_size);
+    SnapshotReader(const SnapshotReader& other) = delete;
+    SnapshotReader& operator=(const SnapshotReader& other) = delete;
+    ~SnapshotReader();
+
+    /*read [off, off+len) of snapshot into buf*/
+    StatusCode read(const SnapReqHead& shead, const std::string& vname,
+                    const std::string& sname, const off_t off,
+                    const size_t len, char* buf);
+    /*read ranges [offs[i], offs[i]+len) into bufs[i], one layout query for
+     *the span of all ranges, caller keep the span small*/
+    StatusCode read_batch(const SnapReqHead& shead, const std::string& vname,
+                          const std::string& sname,
+                          const std::vector<off_t>& offs, const size_t len,
+                          const std::vector<char*>& bufs);
+
+ private:
+    /*query block to cow object layout of the range*/
+    StatusCode query_layout(const SnapReqHead& shead, const std::string& vname,
+                            const std::string& sname, const off_t off,
+                            const size_t len, ReadAck* iack);
+    /*read cow blocks in layout restricted to region, skip blocks in done*/
+    StatusCode read_cow_blocks(const ReadAck& iack,
+                               const interval_set<uint64_t>& region,
+                               const off_t off, char* buf,
+                               std::set<uint64_t>& done,
+                               interval_set<uint64_t>& cow_region);
+    /*read region from block device*/
+    StatusCode read_device(const interval_set<uint64_t>& region,
+                           const off_t off, char* buf);
+
+ private:
+    SnapshotInnerControl::Stub* m_rpc_stub;
+    BlockStore* m_block_store;
+    AccessFile* m_block_file;
+    size_t m_cow_block_size;
+};
+
+#endif  // SRC_SG_CLIENT_SNAPSHOT_SNAPSHOT_READER_H_
@@ -127,7 +127,9 @@ bool VolumeManager::init()
     vol_ctrl = new VolumeControlImpl(host_, port_,vol_inner_client_, *this);
     ctrl_rpc_server->register_service(vol_ctrl);
 
+    snapshot_ctrl->recover_clones();
     init_volumes();
+    snapshot_ctrl->start_clones();
 
     if(!ctrl_rpc_server->run()){
         LOG_FATAL << "start ctrl rpc server failed!";
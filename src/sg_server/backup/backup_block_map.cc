@@ -0,0 +1,244 @@
+/**********************************************
+* Copyright (c) 2016 Huawei Technologies Co., Ltd. All rights reserved.
+* 
+* File name:    backup_block_map.cc
+* Author: 
+* Date:         2017/07/10
+* Version:      1.0
+* Description:  compact in memory block map of one backup
+* 
+***********************************************/
+#include <string.h>
+#include <algorithm>
+#include "common/define.h"
+#include "backup_util.h"
+#include "backup_block_map.h"
+
+const backupid_t BackupBlockMap::BLOCK_MAP_ZERO_OWNER;
+
+BackupBlockMap::BackupBlockMap(const std::string& vol_name)
+    : m_vol_name(vol_name), m_size(0) {
+}
+
+BackupBlockMap::~BackupBlockMap() {
+}
+
+backup_object_t BackupBlockMap::object_of(const block_t& blk,
+                                          const backupid_t& owner) const {
+    if (owner == BLOCK_MAP_ZERO_OWNER) {
+        return BACKUP_ZERO_OBJECT;
+    }
+    return spawn_backup_object_name(m_vol_name, owner, blk);
+}
+
+bool BackupBlockMap::cut(const block_t& blk) {
+    auto it = m_runs.upper_bound(blk);
+    if (it == m_runs.begin()) {
+        return false;
+    }
+    --it;
+    block_t start = it->first;
+    run_t run = it->second;
+    if (blk >= start + run.len) {
+        return false;
+    }
+    m_runs.erase(it);
+    if (blk > start) {
+        m_runs[start] = {blk - start, run.owner};
+    }
+    if (blk + 1 < start + run.len) {
+        m_runs[blk + 1] = {start + run.len - blk - 1, run.owner};
+    }
+    return true;
+}
+
+void BackupBlockMap::put_run(const block_t& blk, const backupid_t& owner) {
+    auto next = m_runs.lower_bound(blk);
+    bool join_next = (next != m_runs.end() && next->first == blk + 1 &&
+                      next->second.owner == owner);
+    if (next != m_runs.begin()) {
+        auto prev = std::prev(next);
+        if (prev->second.owner == owner &&
+            prev->first + prev->second.len == blk) {
+            prev->second.len++;
+            if (join_next) {
+                prev->second.len += next->second.len;
+                m_runs.erase(next);
+            }
+            return;
+        }
+    }
+    if (join_next) {
+        run_t run = next->second;
+        run.len++;
+        m_runs.erase(next);
+        m_runs[blk] = run;
+        return;
+    }
+    m_runs[blk] = {1, owner};
+}
+
+void BackupBlockMap::set(const block_t& blk, const backup_object_t& obj) {
+    bool existed = cut(blk);
+    existed = (m_named.erase(blk) > 0) || existed;
+    if (!existed) {
+        m_size++;
+    }
+
+    if (obj == BACKUP_ZERO_OBJECT) {
+        put_run(blk, BLOCK_MAP_ZERO_OWNER);
+        return;
+    }
+    std::string vol_name;
+    backupid_t owner;
+    block_t obj_blk;
+    if (split_backup_object_name(obj, vol_name, owner, obj_blk) &&
+        obj_blk == blk && vol_name == m_vol_name &&
+        owner != BLOCK_MAP_ZERO_OWNER) {
+        put_run(blk, owner);
+        return;
+    }
+    m_named[blk] = obj;
+}
+
+bool BackupBlockMap::insert(const block_t& blk, const backup_object_t& obj) {
+    if (exist(blk)) {
+        return false;
+    }
+    set(blk, obj);
+    return true;
+}
+
+bool BackupBlockMap::get(const block_t& blk, backup_object_t& obj) const {
+    auto named_it = m_named.find(blk);
+    if (named_it != m_named.end()) {
+        obj = named_it->second;
+        return true;
+    }
+    auto it = m_runs.upper_bound(blk);
+    if (it == m_runs.begin()) {
+        return false;
+    }
+    --it;
+    if (blk >= it->first + it->second.len) {
+        return false;
+    }
+    obj = object_of(blk, it->second.owner);
+    return true;
+}
+
+bool BackupBlockMap::exist(const block_t& blk) const {
+    backup_object_t obj;
+    return get(blk, obj);
+}
+
+size_t BackupBlockMap::size() const {
+    return m_size;
+}
+
+size_t BackupBlockMap::extents() const {
+    return m_runs.size() + m_named.size();
+}
+
+void BackupBlockMap::for_each(const visitor_t& visitor,
+                              const block_t& start) const {
+    auto named_it = m_named.lower_bound(start);
+    auto it = m_runs.upper_bound(start);
+    if (it != m_runs.begin()) {
+        auto prev = std::prev(it);
+        if (start < prev->first + prev->second.len) {
+            it = prev;
+        }
+    }
+    /*named blocks lie between or before runs, merge two ordered sequence*/
+    for (; it != m_runs.end(); ++it) {
+        block_t end = it->first + it->second.len;
+        for (block_t blk = std::max(it->first, start); blk < end; blk++) {
+            while (named_it != m_named.end() && named_it->first < blk) {
+                if (!visitor(named_it->first, named_it->second)) {
+                    return;
+                }
+                ++named_it;
+            }
+            if (!visitor(blk, object_of(blk, it->second.owner))) {
+                return;
+            }
+        }
+    }
+    for (; named_it != m_named.end(); ++named_it) {
+        if (!visitor(named_it->first, named_it->second)) {
+            return;
+        }
+    }
+}
+
+static void encode_u64(std::string& buf, const uint64_t val) {
+    buf.append(reinterpret_cast<const char*>(&val), sizeof(val));
+}
+
+static bool decode_u64(const std::string& buf, size_t& pos, uint64_t& val) {
+    if (pos + sizeof(val) > buf.size()) {
+        return false;
+    }
+    memcpy(&val, buf.data() + pos, sizeof(val));
+    pos += sizeof(val);
+    return true;
+}
+
+std::string BackupBlockMap::encode() const {
+    /*run count, runs(start, len, owner), named count, named(blk, len, obj)*/
+    std::string buf;
+    buf.reserve((m_runs.size() * 3 + 2) * sizeof(uint64_t));
+    encode_u64(buf, m_runs.size());
+    for (auto& run : m_runs) {
+        encode_u64(buf, run.first);
+        encode_u64(buf, run.second.len);
+        encode_u64(buf, run.second.owner);
+    }
+    encode_u64(buf, m_named.size());
+    for (auto& named : m_named) {
+        encode_u64(buf, named.first);
+        encode_u64(buf, named.second.size());
+        buf.append(named.second);
+    }
+    return buf;
+}
+
+bool BackupBlockMap::decode(const std::string& buf) {
+    std::map<block_t, run_t> runs;
+    std::map<block_t, backup_object_t> named;
+    size_t size = 0;
+    size_t pos = 0;
+    uint64_t count = 0;
+    if (!decode_u64(buf, pos, count)) {
+        return false;
+    }
+    for (uint64_t i = 0; i < count; i++) {
+        uint64_t start, len, owner;
+        if (!decode_u64(buf, pos, start) || !decode_u64(buf, pos, len) ||
+            !decode_u64(buf, pos, owner)) {
+            return false;
+        }
+        runs.insert(runs.end(), {start, {len, owner}});
+        size += len;
+    }
+    if (!decode_u64(buf, pos, count)) {
+        return false;
+    }
+    for (uint64_t i = 0; i < count; i++) {
+        uint64_t blk, len;
+        if (!decode_u64(buf, pos, blk) || !decode_u64(buf, pos, len) ||
+            pos + len > buf.size()) {
+            return false;
+        }
+        named.insert(named.end(), {blk, buf.substr(pos, len)});
+        pos += len;
+    }
+    if (pos != buf.size()) {
+        return false;
+    }
+    m_runs.swap(runs);
+    m_named.swap(named);
+    m_size = size + m_named.size();
+    return true;
+}
@@ -0,0 +1,72 @@
+/**********************************************
+* Copyright (c) 2016 Huawei Technologies Co., Ltd. All rights reserved.
+* 
+* File name:    backup_block_map.h
+* Author: 
+* Date:         2017/07/10
+* Version:      1.0
+* Description:  compact in memory block map of one backup
+* 
+***********************************************/
+#ifndef SRC_SG_SERVER_BACKUP_BACKUP_BLOCK_MAP_H_
+#define SRC_SG_SERVER_BACKUP_BACKUP_BLOCK_MAP_H_
+#include <stdint.h>
+#include <string>
+#include <map>
+#include <functional>
+#include "backup_def.h"
+
+/*object of a block almost always spawned from (volume, backup id, block no)
+ *or the zero object, so no object name kept for such block: consecutive
+ *blocks whose object spawned from the same backup id (or all zero) form one
+ *run; only objects not derivable (dedup shared object of other block) kept
+ *by name. full backup is a few runs, incr backup one run per changed range*/
+class BackupBlockMap {
+ public:
+    explicit BackupBlockMap(const std::string& vol_name);
+    ~BackupBlockMap();
+
+    /*map block to object, replace old object of the block*/
+    void set(const block_t& blk, const backup_object_t& obj);
+    /*false and nothing changed if block already mapped*/
+    bool insert(const block_t& blk, const backup_object_t& obj);
+    /*false if block not mapped*/
+    bool get(const block_t& blk, backup_object_t& obj) const;
+    bool exist(const block_t& blk) const;
+
+    /*mapped blocks*/
+    size_t size() const;
+    /*runs and named blocks, what memory cost in proportion to*/
+    size_t extents() const;
+
+    /*blocks from start in ascending order, stop when visitor return false*/
+    typedef std::function<bool(const block_t&, const backup_object_t&)> visitor_t;
+    void for_each(const visitor_t& visitor, const block_t& start = 0) const;
+
+    /*persist form, decode fail if buffer corrupt*/
+    std::string encode() const;
+    bool decode(const std::string& buf);
+
+ private:
+    /*owner: backup id object spawned from, or BLOCK_MAP_ZERO_OWNER*/
+    struct run_t {
+        block_t    len;
+        backupid_t owner;
+    };
+    static const backupid_t BLOCK_MAP_ZERO_OWNER = UINT64_MAX;
+
+    backup_object_t object_of(const block_t& blk, const backupid_t& owner) const;
+    /*unmap block, split the run it belong to*/
+    bool cut(const block_t& blk);
+    /*map unmapped block, coalesce with neighbour runs of same owner*/
+    void put_run(const block_t& blk, const backupid_t& owner);
+
+    std::string m_vol_name;
+    /*run start block to run*/
+    std::map<block_t, run_t> m_runs;
+    /*block whose object name not derivable*/
+    std::map<block_t, backup_object_t> m_named;
+    size_t m_size;
+};
+
+#endif  // SRC_SG_SERVER_BACKUP_BACKUP_BLOCK_MAP_H_
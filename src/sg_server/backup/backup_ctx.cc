@@ -26,9 +26,7 @@ BackupCtx::BackupCtx(const string& vol_name, const size_t& vol_size) {
     m_backups.clear();
     m_backup_block_map.clear();
 
-    m_block_store = new CephBlockStore(g_option.ceph_cluster_name,
-                                       g_option.ceph_user_name,
-                                       g_option.ceph_pool_name);
+    m_block_store = create_block_store(vol_name);
     /*todo: read from configure file*/
     string db_path = DB_DIR + vol_name + "/backup";
     if (access(db_path.c_str(), F_OK)) {
@@ -37,8 +35,15 @@ BackupCtx::BackupCtx(const string& vol_name, const size_t& vol_size) {
         int ret = system(cmd);
         assert(ret != -1);
     }
-    m_index_store = IndexStore::create("rocksdb", db_path);
+    /*attr and backup block map each in own column family*/
+    m_index_store = IndexStore::create(g_option.index_store_type, db_path,
+                                       {BACKUP_MAP_PREFIX, BACKUP_BLOCK_PREFIX},
+                                       BACKUP_FS[0]);
     m_index_store->db_open();
+    /*refs of dedup objects always kept, flag only turn off reuse*/
+    m_dedup = new BackupDedup(m_index_store, m_block_store,
+                              g_option.backup_dedup);
+    m_reclaimer = new BackupReclaimer(m_index_store, m_block_store);
 
     m_snap_client = new SnapshotCtrlClient(grpc::CreateChannel
             ("127.0.0.1:1111", grpc::InsecureChannelCredentials()));
@@ -48,6 +53,12 @@ BackupCtx::~BackupCtx() {
     if (m_snap_client) {
         delete m_snap_client;
     }
+    if (m_reclaimer) {
+        delete m_reclaimer;
+    }
+    if (m_dedup) {
+        delete m_dedup;
+    }
     if (m_index_store) {
         delete m_index_store;
     }
@@ -78,10 +89,19 @@ map<string, backup_attr_t>& BackupCtx::cur_backups_map() {
     return m_backups;
 }
 
-map<backupid_t, map<block_t, backup_object_t>>& BackupCtx::cur_blocks_map() {
+map<backupid_t, BackupBlockMap>& BackupCtx::cur_blocks_map() {
     return m_backup_block_map;
 }
 
+BackupBlockMap& BackupCtx::add_block_map(const backupid_t& backup_id) {
+    auto it = m_backup_block_map.find(backup_id);
+    if (it == m_backup_block_map.end()) {
+        it = m_backup_block_map.insert({backup_id,
+                                        BackupBlockMap(m_vol_name)}).first;
+    }
+    return it->second;
+}
+
 IndexStore* BackupCtx::index_store() const {
     return m_index_store;
 }
@@ -90,6 +110,14 @@ BlockStore* BackupCtx::block_store()const {
     return m_block_store;
 }
 
+BackupDedup* BackupCtx::dedup()const {
+    return m_dedup;
+}
+
+BackupReclaimer* BackupCtx::reclaimer()const {
+    return m_reclaimer;
+}
+
 SnapshotCtrlClient* BackupCtx::snap_client()const {
     return m_snap_client;
 }
@@ -302,6 +330,30 @@ string BackupCtx::get_backup_base(const string& cur_backup) {
     return "";
 }
 
+void BackupCtx::flatten_backup_chain(const string& cur_backup,
+                                     BackupBlockMap& blocks) {
+    lock_guard<std::recursive_mutex> lock(m_mutex);
+    string backup = get_backup_base(cur_backup);
+    if (backup.empty()) {
+        backup = cur_backup;
+    }
+    while (!backup.empty()) {
+        auto block_map_it = m_backup_block_map.find(get_backup_id(backup));
+        if (block_map_it != m_backup_block_map.end()) {
+            block_map_it->second.for_each([&blocks](const block_t& blk,
+                                          const backup_object_t& obj) {
+                blocks.set(blk, obj);
+                return true;
+            });
+        }
+        if (backup.compare(cur_backup) == 0) {
+            /*arrive the end backup*/
+            break;
+        }
+        backup = get_next_backup(backup);
+    }
+}
+
 backupid_t BackupCtx::spawn_backup_id() {
     lock_guard<std::recursive_mutex> lock(m_mutex);
     /*todo: how to maintain and recycle backup id*/
@@ -319,12 +371,9 @@ void BackupCtx::trace() {
     }
 
     LOG_INFO << "\t backup block map";
-    for (auto it : m_backup_block_map) {
-        LOG_INFO << "\t\t backup_id:" << it.first;
-        map<block_t, backup_object_t>& blk_map = it.second;
-        for (auto blk_it : blk_map) {
-            LOG_INFO << "\t\t\t blk_no:" << blk_it.first
-                     << " backup_obj:"   << blk_it.second;
-        }
+    for (auto& it : m_backup_block_map) {
+        LOG_INFO << "\t\t backup_id:" << it.first
+                 << " blocks:"  << it.second.size()
+                 << " extents:" << it.second.extents();
     }
 }
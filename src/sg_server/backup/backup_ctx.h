@@ -14,6 +14,9 @@
 #include <mutex>
 #include <map>
 #include "backup_def.h"
+#include "backup_block_map.h"
+#include "backup_dedup.h"
+#include "backup_reclaimer.h"
 #include "common/block_store.h"
 #include "common/index_store.h"
 #include "rpc/clients/snapshot_ctrl_client.h"
@@ -33,10 +36,15 @@ class BackupCtx {
     backupid_t latest_backup_id()const;
 
     map<string, backup_attr_t>& cur_backups_map();
-    map<backupid_t, map<block_t, backup_object_t>>& cur_blocks_map();
+    map<backupid_t, BackupBlockMap>& cur_blocks_map();
+    /*empty block map of backup if not exist yet*/
+    BackupBlockMap& add_block_map(const backupid_t& backup_id);
 
     IndexStore* index_store()const;
     BlockStore* block_store()const;
+    /*always exist, reuse only if enabled*/
+    BackupDedup* dedup()const;
+    BackupReclaimer* reclaimer()const;
 
     SnapshotCtrlClient* snap_client()const;
 
@@ -65,6 +73,11 @@ class BackupCtx {
     string get_prev_backup(const string& cur_backup);
     string get_next_backup(const string& cur_backup);
 
+    /*latest version block map of backup: from base backup to it, block of
+     *later backup override the same block of earlier one*/
+    void flatten_backup_chain(const string& cur_backup,
+                              BackupBlockMap& blocks);
+
     backupid_t spawn_backup_id();
 
     /*debug*/
@@ -84,12 +97,16 @@ class BackupCtx {
     /*backup and attr map*/
     map<string, backup_attr_t> m_backups;
     /*backup id and backup block map*/
-    map<backupid_t, map<block_t, backup_object_t>> m_backup_block_map;
+    map<backupid_t, BackupBlockMap> m_backup_block_map;
 
     /*index store for backup meta*/
     IndexStore* m_index_store;
     /*block store for backup data*/
     BlockStore* m_block_store;
+    /*dedup backup object in block store*/
+    BackupDedup* m_dedup;
+    /*remove unreferenced backup object in background*/
+    BackupReclaimer* m_reclaimer;
 
     /*snapshot client for reading incremental data and metadata */
     SnapshotCtrlClient* m_snap_client;
@@ -0,0 +1,170 @@
+/**********************************************
+* Copyright (c) 2016 Huawei Technologies Co., Ltd. All rights reserved.
+* 
+* File name:    backup_dedup.cc
+* Author: 
+* Date:         2017/07/04
+* Version:      1.0
+* Description:  content addressed backup object store
+* 
+***********************************************/
+#include <cstdlib>
+#include <openssl/sha.h>
+#include "log/log.h"
+#include "common/xxhash.h"
+#include "backup_util.h"
+#include "backup_dedup.h"
+
+BackupDedup::BackupDedup(IndexStore* index_store, BlockStore* block_store,
+                         const bool enabled) {
+    m_enabled = enabled;
+    m_index_store = index_store;
+    m_block_store = block_store;
+}
+
+BackupDedup::~BackupDedup() {
+    m_xxh_filter.clear();
+}
+
+bool BackupDedup::enabled()const {
+    return m_enabled;
+}
+
+int BackupDedup::recover() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    IndexStore::SimpleIteratorPtr it = m_index_store->db_iterator();
+    std::string prefix = BACKUP_FP_PREFIX;
+    prefix.append(BACKUP_FS);
+    for (it->seek_to_first(prefix);
+         it->valid() && !it->key().compare(0, prefix.size(), prefix);
+         it->next()) {
+        uint64_t xxh;
+        backup_object_t obj;
+        split_backup_fp_key(it->key(), xxh, obj);
+        m_xxh_filter.insert(xxh);
+    }
+    LOG_INFO << "backup dedup recover fingerprints:" << m_xxh_filter.size();
+    return 0;
+}
+
+std::string BackupDedup::sha256_hex(const char* buf, const size_t len) {
+    unsigned char digest[SHA256_DIGEST_LENGTH];
+    SHA256((const unsigned char*)buf, len, digest);
+    static const char hex[] = "0123456789abcdef";
+    std::string sha;
+    for (int i = 0; i < SHA256_DIGEST_LENGTH; i++) {
+        sha.push_back(hex[digest[i] >> 4]);
+        sha.push_back(hex[digest[i] & 0xf]);
+    }
+    return sha;
+}
+
+backup_object_t BackupDedup::lookup(const uint64_t xxh, const char* buf,
+                                    const size_t len) {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_xxh_filter.find(xxh) == m_xxh_filter.end()) {
+            return "";
+        }
+    }
+    std::string sha;
+    std::string prefix = spawn_backup_fp_key(xxh, "");
+    IndexStore::SimpleIteratorPtr it = m_index_store->db_iterator();
+    for (it->seek_to_first(prefix);
+         it->valid() && !it->key().compare(0, prefix.size(), prefix);
+         it->next()) {
+        uint64_t cand_xxh;
+        backup_object_t cand_obj;
+        split_backup_fp_key(it->key(), cand_xxh, cand_obj);
+        /*value: len#sha256, sha256 empty until first compared*/
+        std::string cand_len;
+        std::string cand_sha;
+        split_key(it->value(), cand_len, cand_sha);
+        if (strtoull(cand_len.c_str(), nullptr, 10) != len) {
+            continue;
+        }
+        if (sha.empty()) {
+            sha = sha256_hex(buf, len);
+        }
+        if (cand_sha.empty()) {
+            char* cand_buf = new char[len];
+            int read_ret = m_block_store->read(cand_obj, cand_buf, len, 0);
+            if (read_ret == (int)len) {
+                cand_sha = sha256_hex(cand_buf, len);
+                m_index_store->db_put(it->key(), cand_len + BACKUP_FS + cand_sha);
+            }
+            delete [] cand_buf;
+        }
+        if (cand_sha == sha) {
+            return cand_obj;
+        }
+    }
+    return "";
+}
+
+int BackupDedup::store(const backup_object_t& new_obj, char* buf,
+                       const size_t len, backup_object_t& obj) {
+    uint64_t xxh = XXH64(buf, len, 0);
+    backup_object_t exist_obj = lookup(xxh, buf, len);
+    if (exist_obj == new_obj) {
+        /*stored but block map not committed, its ref is still the one*/
+        obj = new_obj;
+        return 0;
+    }
+    if (!exist_obj.empty()) {
+        /*ref persist before block map refer it, crash only leak object*/
+        std::lock_guard<std::mutex> lock(m_mutex);
+        std::string ref_key = spawn_backup_ref_key(exist_obj);
+        std::string ref_val = m_index_store->db_get(ref_key);
+        /*last ref dropped after lookup, object going away*/
+        if (!ref_val.empty()) {
+            std::string ref_cnt;
+            std::string ref_xxh;
+            split_key(ref_val, ref_cnt, ref_xxh);
+            uint64_t cnt = strtoull(ref_cnt.c_str(), nullptr, 10) + 1;
+            m_index_store->db_put(ref_key, std::to_string(cnt) + BACKUP_FS + ref_xxh);
+            obj = exist_obj;
+            return 0;
+        }
+    }
+
+    int ret = m_block_store->write(new_obj, buf, len, 0);
+    if (ret != 0) {
+        LOG_ERROR << "backup dedup write object:" << new_obj << " failed";
+        return ret;
+    }
+    std::lock_guard<std::mutex> lock(m_mutex);
+    IndexStore::Transaction transaction = m_index_store->fetch_transaction();
+    transaction->put(spawn_backup_fp_key(xxh, new_obj),
+                     std::to_string(len) + BACKUP_FS);
+    transaction->put(spawn_backup_ref_key(new_obj),
+                     std::string("1") + BACKUP_FS + std::to_string(xxh));
+    m_index_store->submit_transaction(transaction);
+    m_xxh_filter.insert(xxh);
+    obj = new_obj;
+    return 0;
+}
+
+bool BackupDedup::unref(const backup_object_t& obj) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::string ref_key = spawn_backup_ref_key(obj);
+    std::string ref_val = m_index_store->db_get(ref_key);
+    if (ref_val.empty()) {
+        return true;
+    }
+    std::string ref_cnt;
+    std::string ref_xxh;
+    split_key(ref_val, ref_cnt, ref_xxh);
+    uint64_t cnt = strtoull(ref_cnt.c_str(), nullptr, 10);
+    if (cnt > 1) {
+        m_index_store->db_put(ref_key, std::to_string(cnt - 1) + BACKUP_FS + ref_xxh);
+        return false;
+    }
+    /*xxh64 left in filter, only cost a miss lookup*/
+    uint64_t xxh = strtoull(ref_xxh.c_str(), nullptr, 10);
+    IndexStore::Transaction transaction = m_index_store->fetch_transaction();
+    transaction->del(spawn_backup_fp_key(xxh, obj));
+    transaction->del(ref_key);
+    m_index_store->submit_transaction(transaction);
+    return true;
+}
@@ -0,0 +1,66 @@
+/**********************************************
+* Copyright (c) 2016 Huawei Technologies Co., Ltd. All rights reserved.
+* 
+* File name:    backup_dedup.h
+* Author: 
+* Date:         2017/07/04
+* Version:      1.0
+* Description:  content addressed backup object store
+* 
+***********************************************/
+#ifndef SRC_SG_SERVER_BACKUP_BACKUP_DEDUP_H_
+#define SRC_SG_SERVER_BACKUP_BACKUP_DEDUP_H_
+#include <string>
+#include <mutex>
+#include <unordered_set>
+#include "backup_def.h"
+#include "common/block_store.h"
+#include "common/index_store.h"
+
+/*same data of a volume stored in one backup object:
+ *1. xxh64 of block filter in memory, only filter hit block pay sha256
+ *2. fingerprint index(xxh64, object) -> (len, sha256) in index store,
+ *   sha256 of existing object computed lazily on first filter hit
+ *3. object refcount by block map entries, object removed on last unref;
+ *disabled store only turn off reuse, refs taken before still kept*/
+class BackupDedup {
+ public:
+    BackupDedup(IndexStore* index_store, BlockStore* block_store,
+                const bool enabled = true);
+    BackupDedup(const BackupDedup& other) = delete;
+    BackupDedup& operator=(const BackupDedup& other) = delete;
+    ~BackupDedup();
+
+    /*whether new blocks look up and store by content*/
+    bool enabled()const;
+
+    /*load xxh64 filter from fingerprint index*/
+    int recover();
+
+    /*reuse object hold the same data with ref taken, otherwise write data
+     *to new_obj; obj output the object block map should refer; store to
+     *new_obj again(resend or resume) take no more ref*/
+    int store(const backup_object_t& new_obj, char* buf, const size_t len,
+              backup_object_t& obj);
+
+    /*drop one ref, true if no ref left and caller should remove object,
+     *object not in dedup store always removable*/
+    bool unref(const backup_object_t& obj);
+
+ private:
+    /*existing object of same data, empty if none*/
+    backup_object_t lookup(const uint64_t xxh, const char* buf,
+                           const size_t len);
+    std::string sha256_hex(const char* buf, const size_t len);
+
+ private:
+    /*guard filter and ref count, not held over object io*/
+    std::mutex m_mutex;
+    bool m_enabled;
+    IndexStore* m_index_store;
+    BlockStore* m_block_store;
+    /*xxh64 of all dedup objects, false positive allowed*/
+    std::unordered_set<uint64_t> m_xxh_filter;
+};
+
+#endif  // SRC_SG_SERVER_BACKUP_BACKUP_DEDUP_H_
@@ -43,9 +43,39 @@ typedef struct backup_attr backup_attr_t;
 
 #define BACKUP_INIT_UUID (2222)
 
+/*backup pipeline stage threads and queue depth*/
+#define BACKUP_READ_THREADS   (4)
+#define BACKUP_WRITE_THREADS  (4)
+#define BACKUP_PIPELINE_DEPTH (8)
+/*data bytes per batch snapshot read, keep rpc message under 4MB limit*/
+#define BACKUP_READ_BATCH_BYTES (3 * 1024 * 1024UL)
+/*committed blocks per index store transaction*/
+#define BACKUP_COMMIT_BATCH   (64)
+
 /*backup indexstore key prefix*/
 #define BACKUP_ID_PREFIX      "backup_latestid"
 #define BACKUP_MAP_PREFIX     "backup_map_prefix"
 #define BACKUP_BLOCK_PREFIX   "backup_block_prefix"
+/*dedup fingerprint index and object refcount*/
+#define BACKUP_FP_PREFIX      "backup_fp_prefix"
+#define BACKUP_REF_PREFIX     "backup_ref_prefix"
+/*creating backup committed position, for resume*/
+#define BACKUP_PROGRESS_PREFIX "backup_progress_prefix"
+/*block map of finished backup in compact encoding, loaded on recover*/
+#define BACKUP_COMPACT_PREFIX "backup_compact_prefix"
+/*object no longer referred, wait background removal*/
+#define BACKUP_GC_PREFIX      "backup_gc_prefix"
+
+/*objects removed per reclaim round*/
+#define BACKUP_RECLAIM_BATCH  (64)
+
+/*remote upload: blocks between two sync, unacked blocks in flight*/
+#define BACKUP_UPLOAD_SYNC_BLOCKS (16)
+#define BACKUP_UPLOAD_WINDOW      (64)
+/*remote download: objects read ahead while sending*/
+#define BACKUP_DOWNLOAD_PREFETCH  (16)
+/*remote transfer reconnect and resume times before give up*/
+#define BACKUP_REMOTE_RETRY       (5)
+#define BACKUP_REMOTE_RETRY_WAIT  (2)
 
 #endif  // SRC_SG_SERVER_BACKUP_BACKUP_DEF_H_
@@ -10,7 +10,10 @@
 ***********************************************/
 #include <cstdlib>
 #include <assert.h>
+#include <unistd.h>
 #include <map>
+#include <vector>
+#include <future>
 #include "log/log.h"
 #include "common/define.h"
 #include "common/utils.h"
@@ -63,7 +66,8 @@ StatusCode BackupMds::prepare_create(const std::string& bname,
     cur_backup_attr.backup_mode = bmode;
     cur_backup_attr.backup_name = bname;
     cur_backup_attr.backup_type = btype;
-    /*backup_id generated when backup is created*/
+    /*backup_id generated when backup task first run*/
+    cur_backup_attr.backup_id     = 0;
     cur_backup_attr.backup_status = BackupStatus::BACKUP_CREATING;
 
     /*in memroy update backup status*/
@@ -247,40 +251,73 @@ StatusCode BackupMds::restore_backup(const RestoreBackupInReq* req,
 
 StatusCode BackupMds::local_restore(const std::string& bname,
                         ServerWriter<RestoreBackupInAck>* writer) {
-    std::string backup_base = m_ctx->get_backup_base(bname);
-    std::string cur_backup  = backup_base;
     LOG_INFO << " local restore bname:" << bname << " begin";
-    while (!cur_backup.empty()) {
-        backupid_t cur_backup_id = m_ctx->get_backup_id(cur_backup);
-        auto cur_backup_block_map_it = m_ctx->cur_blocks_map().find(cur_backup_id);
-        assert(cur_backup_block_map_it != m_ctx->cur_blocks_map().end());
-        auto cur_backup_block_map = cur_backup_block_map_it->second;
-
-        for (auto cur_block : cur_backup_block_map) {
-            RestoreBackupInAck ack;
-            ack.set_blk_no(cur_block.first);
-            ack.set_blk_obj(cur_block.second);
-            writer->Write(ack);
-        }
-
-        if (cur_backup.compare(bname) == 0) {
-            /*arrive the end backup*/
-            break;
+    /*only latest version of each block sent, blocks overwritten by later
+     *backup in chain skipped, every block independent on client*/
+    BackupBlockMap blocks(m_ctx->vol_name());
+    m_ctx->flatten_backup_chain(bname, blocks);
+    StatusCode ret = StatusCode::sOk;
+    blocks.for_each([&](const block_t& blk, const backup_object_t& obj) {
+        RestoreBackupInAck ack;
+        ack.set_blk_no(blk);
+        ack.set_blk_obj(obj);
+        if (!writer->Write(ack)) {
+            LOG_ERROR << " local restore bname:" << bname << " write failed";
+            ret = StatusCode::sInternalError;
+            return false;
         }
-        cur_backup = m_ctx->get_next_backup(cur_backup);
+        return true;
+    });
+    if (ret != StatusCode::sOk) {
+        return ret;
     }
-    LOG_INFO << " local restore bname:" << bname << " end";
+    LOG_INFO << " local restore bname:" << bname << " blocks:" << blocks.size()
+             << " end";
     return StatusCode::sOk;
 }
 
 StatusCode BackupMds::remote_restore(const std::string& bname,
                  ServerWriter<RestoreBackupInAck>* writer) {
+    LOG_INFO << " remote restore bname:" << bname << " begin";
+    /*blocks come in ascending order, broken download resume after the last
+     *block received instead of from the beginning*/
+    block_t next_blk = 0;
+    bool link_broken = false;
+    StatusCode ret = StatusCode::sOk;
+    for (int retry = 0; retry <= BACKUP_REMOTE_RETRY; retry++) {
+        if (retry > 0) {
+            LOG_ERROR << " remote restore bname:" << bname << " retry:" << retry
+                      << " from blk:" << next_blk;
+            sleep(BACKUP_REMOTE_RETRY_WAIT);
+        }
+        ret = remote_restore_once(bname, next_blk, writer, link_broken);
+        if (ret == StatusCode::sOk || !link_broken) {
+            break;
+        }
+    }
+
+    RestoreBackupInAck over_ack;
+    over_ack.set_blk_over(true);
+    writer->Write(over_ack);
+    LOG_INFO << " remote restore bname:" << bname << " end ret:" << ret;
+    return ret;
+}
+
+StatusCode BackupMds::remote_restore_once(const std::string& bname,
+                 block_t& next_blk, ServerWriter<RestoreBackupInAck>* writer,
+                 bool& link_broken) {
+    link_broken = true;
     ClientContext rpc_ctx;
     grpc_stream_ptr remote_stream = NetSender::instance().create_stream(&rpc_ctx);
+    if (remote_stream == nullptr) {
+        LOG_ERROR << "create remote download stream failed";
+        return StatusCode::sInternalError;
+    }
 
     DownloadDataReq download_req;
     download_req.set_vol_name(m_ctx->vol_name());
     download_req.set_backup_name(bname);
+    download_req.set_start_blk(next_blk);
 
     std::string download_req_buf;
     download_req.SerializeToString(&download_req_buf);
@@ -288,7 +325,6 @@ StatusCode BackupMds::remote_restore(const std::string& bname,
     TransferRequest transfer_req;
     transfer_req.set_type(MessageType::REMOTE_BACKUP_DOWNLOAD_DATA);
     transfer_req.set_data(download_req_buf.c_str(), download_req_buf.length());
-    LOG_INFO << " remote restore bname:" << bname << " begin";
 
     if (!remote_stream->Write(transfer_req)) {
         LOG_ERROR << "send remote download req failed";
@@ -297,29 +333,48 @@ StatusCode BackupMds::remote_restore(const std::string& bname,
 
     TransferResponse transfer_res;
     while (remote_stream->Read(&transfer_res)) {
-        assert(transfer_res.type() == MessageType::REMOTE_BACKUP_DOWNLOAD_DATA);
-
+        if (transfer_res.type() != MessageType::REMOTE_BACKUP_DOWNLOAD_DATA) {
+            continue;
+        }
         DownloadDataAck download_ack;
         download_ack.ParseFromArray(transfer_res.data().c_str(), \
                                     transfer_res.data().length());
-
-        RestoreBackupInAck restore_ack;
         if (download_ack.blk_over()) {
-            restore_ack.set_blk_over(true);
-            bool bwrite = writer->Write(restore_ack);
-            assert(bwrite);
-            break;
+            if (download_ack.status() != StatusCode::sOk) {
+                LOG_ERROR << "remote download bname:" << bname
+                          << " failed:" << download_ack.status();
+                link_broken = (download_ack.status() != StatusCode::sBackupNotExist);
+            }
+            return download_ack.status();
         }
 
+        RestoreBackupInAck restore_ack;
         restore_ack.set_blk_no(download_ack.blk_no());
-        restore_ack.set_blk_data(download_ack.blk_data().c_str(), \
-                                 download_ack.blk_data().length());
-        bool bwrite = writer->Write(restore_ack);
-        assert(bwrite);
+        if (download_ack.blk_zero()) {
+            restore_ack.set_blk_obj(BACKUP_ZERO_OBJECT);
+        } else {
+            restore_ack.set_blk_data(download_ack.blk_data().c_str(), \
+                                     download_ack.blk_data().length());
+        }
+        if (!writer->Write(restore_ack)) {
+            LOG_ERROR << "remote restore bname:" << bname << " write failed";
+            link_broken = false;
+            return StatusCode::sInternalError;
+        }
+        next_blk = download_ack.blk_no() + 1;
     }
+    LOG_ERROR << "remote download bname:" << bname << " broken at blk:" << next_blk;
+    return StatusCode::sInternalError;
+}
 
-    LOG_INFO << " remote restore bname:" << bname << " end";
-    return StatusCode::sOk;
+shared_ptr<BackupMds::upload_state_t> BackupMds::get_upload(
+        const std::string& bname) {
+    std::lock_guard<std::mutex> scope_guard(m_upload_lock);
+    auto it = m_uploads.find(bname);
+    if (it == m_uploads.end()) {
+        return nullptr;
+    }
+    return it->second;
 }
 
 StatusCode BackupMds::do_remote_create_start(const RemoteBackupStartReq* req,
@@ -333,28 +388,65 @@ StatusCode BackupMds::do_remote_create_start(const RemoteBackupStartReq* req,
     LOG_INFO << " do remote create start vname:" << m_ctx->vol_name()
              << " bname:" << backup_name;
 
-    ret = prepare_create(backup_name, backup_mode, backup_type, true);
-    if (ret) {
-        ack->set_status(ret);
-        LOG_INFO << "do remote create start vname:" << m_ctx->vol_name()
-                 << " bname:" << backup_name <<" failed";
-        return ret;
-    }
+    backupid_t backup_id = 0;
+    off_t resume_pos = 0;
     auto it = m_ctx->cur_backups_map().find(backup_name);
-    if (it == m_ctx->cur_backups_map().end()) {
-        return StatusCode::sBackupNotExist;
+    if (it != m_ctx->cur_backups_map().end() &&
+        it->second.backup_status == BackupStatus::BACKUP_CREATING &&
+        it->second.backup_id != 0) {
+        /*interrupted upload, sender continue after durable blocks*/
+        backup_id = it->second.backup_id;
+        m_ctx->add_block_map(backup_id);
+        std::string progress = m_ctx->index_store()->db_get(
+                                    spawn_backup_progress_key(backup_id));
+        resume_pos = progress.empty() ? 0 : atoll(progress.c_str());
+    } else {
+        ret = prepare_create(backup_name, backup_mode, backup_type, true);
+        if (ret) {
+            ack->set_status(ret);
+            LOG_INFO << "do remote create start vname:" << m_ctx->vol_name()
+                     << " bname:" << backup_name <<" failed";
+            return ret;
+        }
+        it = m_ctx->cur_backups_map().find(backup_name);
+        if (it == m_ctx->cur_backups_map().end()) {
+            ack->set_status(StatusCode::sBackupNotExist);
+            return StatusCode::sBackupNotExist;
+        }
+        /*generate backup id*/
+        backup_id = m_ctx->spawn_backup_id();
+        /*update backup attr*/
+        it->second.backup_id = backup_id;
+
+        /*prepare backup block map*/
+        m_ctx->add_block_map(backup_id);
+
+        /*backup id persist before any block, upload resumable after restart*/
+        IndexStore::Transaction transaction =
+                                m_ctx->index_store()->fetch_transaction();
+        transaction->put(spawn_latest_backup_id_key(),
+                         std::to_string(m_ctx->latest_backup_id()));
+        transaction->put(spawn_backup_attr_map_key(backup_name),
+                         spawn_backup_attr_map_val(it->second));
+        if (m_ctx->index_store()->submit_transaction(transaction)) {
+            ack->set_status(StatusCode::sInternalError);
+            return StatusCode::sInternalError;
+        }
     }
-    /*generate backup id*/
-    backupid_t backup_id  = m_ctx->spawn_backup_id();
-    /*update backup attr*/
-    it->second.backup_id     = backup_id;
 
-    /*prepare backup block map*/
-    map<block_t, backup_object_t> block_map;
-    m_ctx->cur_blocks_map().insert({backup_id, block_map});
+    shared_ptr<upload_state_t> state(new upload_state_t);
+    state->backup_id = backup_id;
+    state->trans = m_ctx->index_store()->fetch_transaction();
+    state->status = StatusCode::sOk;
+    {
+        std::lock_guard<std::mutex> scope_guard(m_upload_lock);
+        m_uploads[backup_name] = state;
+    }
 
+    ack->set_status(StatusCode::sOk);
+    ack->set_resume_pos(resume_pos);
     LOG_INFO << " do remote create start vname:" << m_ctx->vol_name()
-             << " bname:" << backup_name << " ok";
+             << " bname:" << backup_name << " resume_pos:" << resume_pos << " ok";
     return StatusCode::sOk;
 }
 
@@ -366,34 +458,65 @@ StatusCode BackupMds::do_remote_create_upload(UploadDataReq* req,
     const char* blk_data = req->blk_data().c_str();
     size_t blk_len = req->blk_data().length();
 
-    LOG_INFO << " do remote upload vname:" << m_ctx->vol_name() << " bname:" << backup_name;
-    if (!m_ctx->is_backup_exist(backup_name)) {
+    shared_ptr<upload_state_t> state = get_upload(backup_name);
+    if (state == nullptr) {
         LOG_ERROR << " do remote upload vname:" << m_ctx->vol_name()
-                  << " bname:" << backup_name << " failed not exist";
+                  << " bname:" << backup_name << " failed not start";
+        ack->set_status(StatusCode::sBackupNotExist);
         return StatusCode::sBackupNotExist;
     }
-    backupid_t backup_id = m_ctx->get_backup_id(backup_name);
-    backup_object_t blk_obj = spawn_backup_object_name(m_ctx->vol_name(), backup_id, blk_no);
-
-    /*store backup data to block store in object*/
-    int write_ret = m_ctx->block_store()->write(blk_obj, const_cast<char*>(blk_data),
-                                                blk_len, blk_off);
-    if (write_ret != 0) {
-        LOG_ERROR << "do remote update wrie failed"; 
-        return StatusCode::sInternalError;
+    /*blocks after a failed one dropped, sender resume from ack_pos*/
+    if (state->status != StatusCode::sOk) {
+        ack->set_status(state->status);
+        return state->status;
+    }
+    backupid_t backup_id = state->backup_id;
+    backup_object_t blk_obj = BACKUP_ZERO_OBJECT;
+    if (!req->blk_zero()) {
+        blk_obj = spawn_backup_object_name(m_ctx->vol_name(), backup_id, blk_no);
+        /*store backup data to block store in object*/
+        int write_ret = 0;
+        if (m_ctx->dedup()->enabled() && blk_off == 0) {
+            write_ret = m_ctx->dedup()->store(blk_obj, const_cast<char*>(blk_data),
+                                              blk_len, blk_obj);
+        } else {
+            write_ret = m_ctx->block_store()->write(blk_obj, const_cast<char*>(blk_data),
+                                                    blk_len, blk_off);
+        }
+        if (write_ret != 0) {
+            LOG_ERROR << "do remote upload write blk:" << blk_no << " failed";
+            state->status = StatusCode::sInternalError;
+            ack->set_status(state->status);
+            return state->status;
+        }
     }
 
-    /*update backup block map*/
+    /*update backup block map, resent block overwrite*/
     auto backup_block_map_it = m_ctx->cur_blocks_map().find(backup_id);
     if (backup_block_map_it == m_ctx->cur_blocks_map().end()) {
-        LOG_ERROR << "do remote update find failed"; 
-        return StatusCode::sInternalError;
+        LOG_ERROR << "do remote upload find block map failed";
+        state->status = StatusCode::sInternalError;
+        ack->set_status(state->status);
+        return state->status;
+    }
+    backup_block_map_it->second.set(blk_no, blk_obj);
+    state->trans->put(spawn_backup_block_map_key(backup_id, blk_no), blk_obj);
+
+    if (req->sync()) {
+        /*block map and progress in one transaction, then ack*/
+        state->trans->put(spawn_backup_progress_key(backup_id),
+                          std::to_string(req->end_pos()));
+        if (m_ctx->index_store()->submit_transaction(state->trans)) {
+            LOG_ERROR << "do remote upload sync pos:" << req->end_pos()
+                      << " failed";
+            state->status = StatusCode::sInternalError;
+            ack->set_status(state->status);
+            return state->status;
+        }
+        state->trans = m_ctx->index_store()->fetch_transaction();
+        ack->set_ack_pos(req->end_pos());
     }
-    map<block_t, backup_object_t> &backup_block_map = backup_block_map_it->second;
-    backup_block_map.insert({blk_no, blk_obj});
-
-    LOG_INFO << " do remote upload vname:" << m_ctx->vol_name()
-             << " bname:" << backup_name << " ok";
+    ack->set_status(StatusCode::sOk);
     return StatusCode::sOk;
 }
 
@@ -403,35 +526,46 @@ StatusCode BackupMds::do_remote_create_end(const RemoteBackupEndReq* req,
 
     LOG_INFO << " do remote create end vname:" << m_ctx->vol_name()
              << " bname:" << backup_name;
-    if (!m_ctx->is_backup_exist(backup_name)) {
+    auto it = m_ctx->cur_backups_map().find(backup_name);
+    shared_ptr<upload_state_t> state = get_upload(backup_name);
+    if (it == m_ctx->cur_backups_map().end() || state == nullptr) {
         LOG_ERROR << " do remote create end vname:" << m_ctx->vol_name()
                   << " bname:" << backup_name << " failed not exist";
+        ack->set_status(StatusCode::sBackupNotExist);
         return StatusCode::sBackupNotExist;
     }
+    if (state->status != StatusCode::sOk) {
+        LOG_ERROR << " do remote create end vname:" << m_ctx->vol_name()
+                  << " bname:" << backup_name << " failed upload";
+        ack->set_status(state->status);
+        return state->status;
+    }
 
-    auto it = m_ctx->cur_backups_map().find(backup_name);
-    assert( it != m_ctx->cur_backups_map().end());
+    /*blocks after last sync committed along with backup attr, block map of
+     *previous sync already persisted*/
     it->second.backup_status = BackupStatus::BACKUP_AVAILABLE;
-
-    IndexStore::Transaction transaction = m_ctx->index_store()->fetch_transaction();
+    IndexStore::Transaction transaction = state->trans;
     std::string pkey = spawn_latest_backup_id_key();
     std::string pval = std::to_string(m_ctx->latest_backup_id());
     transaction->put(pkey, pval);
     pkey = spawn_backup_attr_map_key(backup_name);
     pval = spawn_backup_attr_map_val(it->second);
     transaction->put(pkey, pval);
-
-    backupid_t backup_id = m_ctx->get_backup_id(backup_name);
-    auto block_map_it = m_ctx->cur_blocks_map().find(backup_id);
-    auto& block_map = block_map_it->second;
-    for (auto block : block_map) {
-        pkey = spawn_backup_block_map_key(backup_id, block.first);
-        pval = block.second;
-        transaction->put(pkey, pval);
+    transaction->del(spawn_backup_progress_key(state->backup_id));
+    transaction->put(spawn_backup_compact_map_key(state->backup_id),
+                     m_ctx->cur_blocks_map().at(state->backup_id).encode());
+    if (m_ctx->index_store()->submit_transaction(transaction)) {
+        it->second.backup_status = BackupStatus::BACKUP_CREATING;
+        ack->set_status(StatusCode::sInternalError);
+        return StatusCode::sInternalError;
+    }
+    {
+        std::lock_guard<std::mutex> scope_guard(m_upload_lock);
+        m_uploads.erase(backup_name);
     }
-    m_ctx->index_store()->submit_transaction(transaction);
 
     m_ctx->trace();
+    ack->set_status(StatusCode::sOk);
     LOG_INFO << " do remote create end vname:" << m_ctx->vol_name()
              << " bname:" << backup_name << " ok";
     return StatusCode::sOk;
@@ -463,67 +597,116 @@ StatusCode BackupMds::do_remote_delete(const RemoteBackupDeleteReq* req,
     return StatusCode::sOk;
 }
 
+StatusCode BackupMds::send_download_over(const StatusCode status,
+        ServerReaderWriter<TransferResponse, TransferRequest>* stream) {
+    /*notify no any more data any more*/
+    DownloadDataAck end_ack;
+    end_ack.set_blk_over(true);
+    end_ack.set_status(status);
+    std::string end_ack_buf;
+    end_ack.SerializeToString(&end_ack_buf);
+    TransferResponse res;
+    res.set_type(MessageType::REMOTE_BACKUP_DOWNLOAD_DATA);
+    res.set_data(end_ack_buf.c_str(), end_ack_buf.length());
+    return stream->Write(res) ? StatusCode::sOk : StatusCode::sInternalError;
+}
+
 StatusCode BackupMds::do_remote_download(const DownloadDataReq* req,
         ServerReaderWriter<TransferResponse, TransferRequest>* stream) {
     StatusCode ret = StatusCode::sOk;
     std::string backup_name = req->backup_name();
 
     LOG_INFO << "do remote download vname:" << m_ctx->vol_name()
-             << " bname:" << backup_name;
+             << " bname:" << backup_name << " start_blk:" << req->start_blk();
     if (!m_ctx->is_backup_exist(backup_name)) {
         LOG_ERROR << " do remote download vname:" << m_ctx->vol_name()
                   << " bname:" << backup_name << " failed not exist";
-        /*notify no any more data any more*/
-        DownloadDataAck end_ack;
-        end_ack.set_blk_over(true);
-        std::string end_ack_buf;
-        end_ack.SerializeToString(&end_ack_buf);
-        TransferResponse res;
-        res.set_type(MessageType::REMOTE_BACKUP_DOWNLOAD_DATA);
-        res.set_data(end_ack_buf.c_str(), end_ack_buf.length());
-        bool bret = stream->Write(res);
-        assert(bret == true);
+        send_download_over(StatusCode::sBackupNotExist, stream);
         return StatusCode::sBackupNotExist;
     }
 
-    backupid_t backup_id = m_ctx->get_backup_id(backup_name);
-    auto block_map_it = m_ctx->cur_blocks_map().find(backup_id);
-    auto& block_map = block_map_it->second;
-    char* buf = new char[BACKUP_BLOCK_SIZE];
-    assert(buf != nullptr);
-    for (auto block : block_map) {
-        uint64_t blk_no = block.first;
-        std::string blk_obj = block.second;
-        LOG_INFO << "download data blk_no:" << blk_no << " blk_obj:" << blk_obj;
-        int read_ret = m_ctx->block_store()->read(blk_obj, buf, BACKUP_BLOCK_SIZE, 0);
-        assert(read_ret == BACKUP_BLOCK_SIZE);
-        DownloadDataAck ack;
-        ack.set_blk_no(blk_no);
-        ack.set_blk_data(buf, BACKUP_BLOCK_SIZE);
-        std::string ack_buf;
-        ack.SerializeToString(&ack_buf);
-        TransferResponse res;
-        res.set_type(MessageType::REMOTE_BACKUP_DOWNLOAD_DATA);
-        res.set_data(ack_buf.c_str(), ack_buf.length());
-        bool bret = stream->Write(res);
-        assert(bret == true);
-    }
-    if (buf) {
-        delete [] buf;
+    /*latest version of blocks in chain, incr backup restore whole volume,
+     *blocks sent before interruption skipped*/
+    BackupBlockMap block_map(m_ctx->vol_name());
+    m_ctx->flatten_backup_chain(backup_name, block_map);
+    vector<pair<block_t, backup_object_t>> blocks;
+    block_map.for_each([&blocks](const block_t& blk, const backup_object_t& obj) {
+        blocks.push_back({blk, obj});
+        return true;
+    }, req->start_blk());
+
+    /*objects of next window read ahead while current window sending*/
+    const size_t window = BACKUP_DOWNLOAD_PREFETCH;
+    vector<char> bufs[2] = {vector<char>(window * BACKUP_BLOCK_SIZE),
+                            vector<char>(window * BACKUP_BLOCK_SIZE)};
+    vector<block_read_t> reads[2];
+    auto prefetch = [&](const size_t start, const int idx) {
+        reads[idx].clear();
+        for (size_t i = start; i < blocks.size() && i < start + window; i++) {
+            if (blocks[i].second == BACKUP_ZERO_OBJECT) {
+                continue;
+            }
+            block_read_t read;
+            read.object = blocks[i].second;
+            read.buf = bufs[idx].data() + (i - start) * BACKUP_BLOCK_SIZE;
+            read.len = BACKUP_BLOCK_SIZE;
+            read.off = 0;
+            read.ret = 0;
+            reads[idx].push_back(read);
+        }
+        return std::async(std::launch::async, [this, &reads, idx, window]() {
+            m_ctx->block_store()->read_batch(reads[idx], window);
+        });
+    };
+
+    std::future<void> pending = prefetch(0, 0);
+    for (size_t start = 0, idx = 0; start < blocks.size();
+         start += window, idx ^= 1) {
+        pending.wait();
+        if (start + window < blocks.size()) {
+            pending = prefetch(start + window, idx ^ 1);
+        }
+        size_t r = 0;
+        for (size_t i = start; i < blocks.size() && i < start + window; i++) {
+            DownloadDataAck ack;
+            ack.set_blk_no(blocks[i].first);
+            if (blocks[i].second == BACKUP_ZERO_OBJECT) {
+                ack.set_blk_zero(true);
+            } else {
+                block_read_t& read = reads[idx][r++];
+                if (read.ret != (int)BACKUP_BLOCK_SIZE) {
+                    LOG_ERROR << "download read blk_no:" << blocks[i].first
+                              << " blk_obj:" << read.object
+                              << " ret:" << read.ret;
+                    ret = StatusCode::sInternalError;
+                    break;
+                }
+                ack.set_blk_data(read.buf, BACKUP_BLOCK_SIZE);
+            }
+            std::string ack_buf;
+            ack.SerializeToString(&ack_buf);
+            TransferResponse res;
+            res.set_type(MessageType::REMOTE_BACKUP_DOWNLOAD_DATA);
+            res.set_data(ack_buf.c_str(), ack_buf.length());
+            if (!stream->Write(res)) {
+                LOG_ERROR << "download send blk_no:" << blocks[i].first
+                          << " failed";
+                ret = StatusCode::sInternalError;
+                break;
+            }
+        }
+        if (ret != StatusCode::sOk) {
+            break;
+        }
     }
-    /*notify no any more data any more*/
-    DownloadDataAck end_ack;
-    end_ack.set_blk_over(true);
-    std::string end_ack_buf;
-    end_ack.SerializeToString(&end_ack_buf);
-    TransferResponse res;
-    res.set_type(MessageType::REMOTE_BACKUP_DOWNLOAD_DATA);
-    res.set_data(end_ack_buf.c_str(), end_ack_buf.length());
-    bool bret = stream->Write(res);
-    assert(bret == true);
+    /*prefetch buffers in use until read done*/
+    pending.wait();
+
+    send_download_over(ret, stream);
     LOG_INFO << "do remote download vname:" << m_ctx->vol_name()
-             << " bname:" << backup_name << " ok";
-    return StatusCode::sOk;
+             << " bname:" << backup_name << " blocks:" << blocks.size()
+             << " ret:" << ret;
+    return ret;
 }
 
 int BackupMds::recover() {
@@ -553,10 +736,18 @@ int BackupMds::recover() {
         m_ctx->cur_backups_map().insert({backup_name, backup_attr});
     }
 
-    /*recover backup block map*/
+    /*recover backup block map, finished backup from its compact map, the
+     *others or the ones without compact map from block keys*/
     for (auto backup : m_ctx->cur_backups_map()) {
         backupid_t backup_id = backup.second.backup_id;
-        map<block_t, backup_object_t> block_map;
+        BackupBlockMap& block_map = m_ctx->add_block_map(backup_id);
+        bool finished =
+            (backup.second.backup_status != BackupStatus::BACKUP_CREATING);
+        std::string compact_key = spawn_backup_compact_map_key(backup_id);
+        if (finished &&
+            block_map.decode(m_ctx->index_store()->db_get(compact_key))) {
+            continue;
+        }
 
         prefix = BACKUP_BLOCK_PREFIX;
         prefix.append(BACKUP_FS);
@@ -569,11 +760,17 @@ int BackupMds::recover() {
             backupid_t backup_id;
             block_t    blk_id;
             split_backup_block_map_key(it->key(), backup_id, blk_id);
-            block_map.insert({blk_id, it->value()});
+            block_map.set(blk_id, it->value());
         }
-
-        m_ctx->cur_blocks_map().insert({backup_id, block_map});
+        if (finished) {
+            /*next recover load it directly*/
+            m_ctx->index_store()->db_put(compact_key, block_map.encode());
+        }
+    }
+    if (m_ctx->dedup()->enabled()) {
+        m_ctx->dedup()->recover();
     }
+    m_ctx->reclaimer()->recover();
     /*todo: it seems only do on local site
      *1. only valid on local site recover
      *2. what to do on remote site recover
@@ -14,6 +14,7 @@
 #include <memory>
 #include <mutex>
 #include <list>
+#include <map>
 #include <atomic>
 #include <grpc++/grpc++.h>
 #include "rpc/common.pb.h"
@@ -101,6 +102,23 @@ class BackupMds {
                              ServerWriter<RestoreBackupInAck>* writer);
     StatusCode remote_restore(const std::string& bname,
                               ServerWriter<RestoreBackupInAck>* writer);
+    /*download from next_blk, advance it as blocks received; link_broken
+     *if worth retry*/
+    StatusCode remote_restore_once(const std::string& bname,
+                                   block_t& next_blk,
+                                   ServerWriter<RestoreBackupInAck>* writer,
+                                   bool& link_broken);
+    StatusCode send_download_over(const StatusCode status,
+            ServerReaderWriter<TransferResponse, TransferRequest>* stream);
+
+    /*remote backup being uploaded, blocks between two sync pending in
+     *transaction, persisted with progress when sender ask sync*/
+    struct upload_state_t {
+        backupid_t backup_id;
+        IndexStore::Transaction trans;
+        StatusCode status;
+    };
+    shared_ptr<upload_state_t> get_upload(const std::string& bname);
 
  private:
     shared_ptr<BackupCtx> m_ctx;
@@ -110,6 +128,9 @@ class BackupMds {
     atomic_bool m_task_schedule_run;
     /*all task will run in thread pool*/
     shared_ptr<ThreadPool> m_thread_pool;
+    /*remote backup uploading on this site*/
+    mutex m_upload_lock;
+    map<std::string, shared_ptr<upload_state_t>> m_uploads;
 };
 
 #endif  // SRC_SG_SERVER_BACKUP_BACKUP_MDS_H_
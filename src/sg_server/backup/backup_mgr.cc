@@ -11,7 +11,10 @@
 #include <stdio.h>
 #include <sys/types.h>
 #include <dirent.h>
+#include <algorithm>
+#include <condition_variable>
 #include "log/log.h"
+#include "common/thread_pool.h"
 #include "backup_mgr.h"
 
 using huawei::proto::StatusCode;
@@ -77,18 +80,49 @@ do {                                       \
 
 StatusCode BackupMgr::add_volume(const string& vol_name,
                                  const size_t& vol_size) {
-    std::lock_guard<std::mutex> lock(m_mutex);
-    auto it = m_all_backupmds.find(vol_name);
-    if (it != m_all_backupmds.end()) {
-        LOG_INFO << "add volume:" << vol_name << "failed, already exist";
-        return StatusCode::sVolumeAlreadyExist;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto it = m_all_backupmds.find(vol_name);
+        if (it != m_all_backupmds.end()) {
+            LOG_INFO << "add volume:" << vol_name << "failed, already exist";
+            return StatusCode::sVolumeAlreadyExist;
+        }
     }
 
+    /*recover out of lock, other volumes recover at the same time*/
     shared_ptr<BackupMds> backup_mds;
     backup_mds.reset(new BackupMds(vol_name, vol_size));
-    m_all_backupmds.insert({vol_name, backup_mds});
     backup_mds->recover();
 
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (!m_all_backupmds.insert({vol_name, backup_mds}).second) {
+        LOG_INFO << "add volume:" << vol_name << "failed, already exist";
+        return StatusCode::sVolumeAlreadyExist;
+    }
+    return StatusCode::sOk;
+}
+
+StatusCode BackupMgr::add_volumes(const map<string, size_t>& volumes) {
+    if (volumes.empty()) {
+        return StatusCode::sOk;
+    }
+    int thread_num = std::min<size_t>(META_RECOVER_THREADS, volumes.size());
+    sg_threads::ThreadPool pool(thread_num);
+    std::mutex done_mutex;
+    std::condition_variable done_cond;
+    size_t done = 0;
+    for (auto& vol : volumes) {
+        pool.submit([&, vol]() {
+            add_volume(vol.first, vol.second);
+            std::lock_guard<std::mutex> lock(done_mutex);
+            done++;
+            done_cond.notify_one();
+        });
+    }
+    std::unique_lock<std::mutex> lock(done_mutex);
+    done_cond.wait(lock, [&]{ return done == volumes.size(); });
+    LOG_INFO << "add volumes:" << volumes.size() << " threads:" << thread_num
+             << " ok";
     return StatusCode::sOk;
 }
 
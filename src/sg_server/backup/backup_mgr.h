@@ -65,6 +65,8 @@ class BackupMgr final: public BackupInnerControl::Service {
  public:
     /*call by sgserver when add and delete volume*/
     StatusCode add_volume(const std::string& vol_name, const size_t& vol_size);
+    /*add volumes and recover their meta concurrently*/
+    StatusCode add_volumes(const map<std::string, size_t>& volumes);
     StatusCode del_volume(const std::string& vol_name);
     /*rpc interface*/
     grpc::Status Create(ServerContext* context, const CreateBackupInReq* req,
@@ -90,6 +90,20 @@ StatusCode BackupMsgHandler::handle_remote_create_upload(TransferRequest* req,
 
     StatusCode ret = m_backup_mgr.handle_remote_create_upload(&upload_req,
                                                               &upload_ack);
+    /*cumulative ack only on sync or failure, sender keep streaming*/
+    if (!upload_req.sync() && ret == StatusCode::sOk) {
+        return ret;
+    }
+    if (ret != StatusCode::sOk) {
+        upload_ack.set_status(ret);
+    }
+    std::string ack_buf;
+    upload_ack.SerializeToString(&ack_buf);
+
+    TransferResponse res;
+    res.set_type(req->type());
+    res.set_data(ack_buf.c_str(), ack_buf.length());
+    stream->Write(res);
     return ret;
 }
 
@@ -0,0 +1,185 @@
+/**********************************************
+* Copyright (c) 2016 Huawei Technologies Co., Ltd. All rights reserved.
+* 
+* File name:    backup_pipeline.cc
+* Author: 
+* Date:         2017/07/05
+* Version:      1.0
+* Description:  staged backup data pipeline
+* 
+***********************************************/
+#include "log/log.h"
+#include "backup_pipeline.h"
+
+BackupPipeline::BackupPipeline(read_fn_t read_fn, stage_fn_t store_fn,
+                               stage_fn_t commit_fn, const int readers,
+                               const int writers, const int batch)
+    : m_read_que(BACKUP_PIPELINE_DEPTH),
+      m_write_que(batch > 1 && BACKUP_PIPELINE_DEPTH > batch ?
+                  BACKUP_PIPELINE_DEPTH / batch : BACKUP_PIPELINE_DEPTH) {
+    m_read_fn = read_fn;
+    m_store_fn = store_fn;
+    m_commit_fn = commit_fn;
+    m_readers = readers > 0 ? readers : 1;
+    m_writers = writers > 0 ? writers : 1;
+    m_batch = batch > 0 ? batch : 1;
+    m_ret = StatusCode::sOk;
+    m_finished = false;
+
+    for (int i = 0; i < m_readers; i++) {
+        m_reader_threads.push_back(std::thread(&BackupPipeline::reader_work, this));
+    }
+    for (int i = 0; i < m_writers; i++) {
+        m_writer_threads.push_back(std::thread(&BackupPipeline::writer_work, this));
+    }
+    m_committer_thread = std::thread(&BackupPipeline::committer_work, this);
+}
+
+BackupPipeline::~BackupPipeline() {
+    finish();
+}
+
+void BackupPipeline::set_error(const StatusCode ret) {
+    std::lock_guard<std::mutex> lock(m_ret_mutex);
+    if (m_ret == StatusCode::sOk) {
+        m_ret = ret;
+    }
+}
+
+bool BackupPipeline::failed() {
+    std::lock_guard<std::mutex> lock(m_ret_mutex);
+    return m_ret != StatusCode::sOk;
+}
+
+bool BackupPipeline::feed(const off_t off, const size_t len) {
+    if (failed()) {
+        return false;
+    }
+    if (m_feeding == nullptr) {
+        m_feeding.reset(new backup_batch_t);
+        m_feeding->chunks.reserve(m_batch);
+    }
+    backup_chunk_t chunk;
+    chunk.off = off;
+    chunk.len = len;
+    chunk.buf = nullptr;
+    chunk.zero = false;
+    chunk.ret = StatusCode::sOk;
+    m_feeding->chunks.push_back(chunk);
+    if ((int)m_feeding->chunks.size() < m_batch) {
+        return true;
+    }
+    return flush();
+}
+
+bool BackupPipeline::flush() {
+    if (m_feeding == nullptr) {
+        return true;
+    }
+    backup_batch_ptr batch = m_feeding;
+    m_feeding = nullptr;
+    return m_read_que.push(batch);
+}
+
+void BackupPipeline::reader_work() {
+    while (true) {
+        backup_batch_ptr batch;
+        backup_batch_queue_t::position pos;
+        {
+            std::lock_guard<std::mutex> lock(m_order_mutex);
+            if (!m_read_que.pop(batch, m_commit_que, pos)) {
+                return;
+            }
+        }
+        if (batch == nullptr) {
+            /*end of feed, tell committer one reader gone*/
+            m_commit_que.push(batch, pos);
+            return;
+        }
+        batch->commit_pos = pos;
+        StatusCode ret = StatusCode::sInternalError;
+        if (!failed()) {
+            for (auto& chunk : batch->chunks) {
+                chunk.buf = new char[chunk.len];
+            }
+            ret = m_read_fn(batch->chunks);
+        }
+        if (ret != StatusCode::sOk) {
+            for (auto& chunk : batch->chunks) {
+                chunk.ret = ret;
+            }
+            set_error(ret);
+        }
+        m_write_que.push(batch);
+    }
+}
+
+void BackupPipeline::writer_work() {
+    backup_batch_ptr batch;
+    while (m_write_que.pop(batch) && batch != nullptr) {
+        for (auto& chunk : batch->chunks) {
+            if (chunk.ret == StatusCode::sOk && !failed()) {
+                chunk.ret = m_store_fn(chunk);
+                if (chunk.ret != StatusCode::sOk) {
+                    set_error(chunk.ret);
+                }
+            } else if (chunk.ret == StatusCode::sOk) {
+                chunk.ret = StatusCode::sInternalError;
+            }
+            if (chunk.buf) {
+                delete [] chunk.buf;
+                chunk.buf = nullptr;
+            }
+        }
+        m_commit_que.push(batch, batch->commit_pos);
+    }
+}
+
+void BackupPipeline::committer_work() {
+    int readers_done = 0;
+    bool stopped = false;
+    backup_batch_ptr batch;
+    while (readers_done < m_readers && m_commit_que.pop(batch)) {
+        if (batch == nullptr) {
+            readers_done++;
+            continue;
+        }
+        for (auto& chunk : batch->chunks) {
+            /*stop at the first failed chunk, committed chunks stay contiguous*/
+            if (stopped || chunk.ret != StatusCode::sOk) {
+                stopped = true;
+                break;
+            }
+            StatusCode ret = m_commit_fn(chunk);
+            if (ret != StatusCode::sOk) {
+                set_error(ret);
+                stopped = true;
+                break;
+            }
+        }
+    }
+}
+
+StatusCode BackupPipeline::finish() {
+    if (m_finished) {
+        return m_ret;
+    }
+    m_finished = true;
+    if (!failed()) {
+        flush();
+    }
+    for (int i = 0; i < m_readers; i++) {
+        m_read_que.push(nullptr);
+    }
+    for (auto& t : m_reader_threads) {
+        t.join();
+    }
+    for (int i = 0; i < m_writers; i++) {
+        m_write_que.push(nullptr);
+    }
+    for (auto& t : m_writer_threads) {
+        t.join();
+    }
+    m_committer_thread.join();
+    return m_ret;
+}
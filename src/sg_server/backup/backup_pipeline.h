@@ -0,0 +1,105 @@
+/**********************************************
+* Copyright (c) 2016 Huawei Technologies Co., Ltd. All rights reserved.
+* 
+* File name:    backup_pipeline.h
+* Author: 
+* Date:         2017/07/05
+* Version:      1.0
+* Description:  staged backup data pipeline
+* 
+***********************************************/
+#ifndef SRC_SG_SERVER_BACKUP_BACKUP_PIPELINE_H_
+#define SRC_SG_SERVER_BACKUP_BACKUP_PIPELINE_H_
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <functional>
+#include "rpc/common.pb.h"
+#include "common/blocking_queue.h"
+#include "backup_def.h"
+
+using huawei::proto::StatusCode;
+
+/*one backup block flow through pipeline*/
+struct backup_chunk {
+    off_t  off;
+    size_t len;
+    /*hold data between read and store stage*/
+    char*  buf;
+    bool   zero;
+    backup_object_t obj;
+    StatusCode ret;
+};
+typedef struct backup_chunk backup_chunk_t;
+
+/*chunks read together, share one commit slot*/
+struct backup_batch;
+typedef std::shared_ptr<backup_batch> backup_batch_ptr;
+typedef BlockingQueue<backup_batch_ptr> backup_batch_queue_t;
+struct backup_batch {
+    std::vector<backup_chunk_t> chunks;
+    /*slot in commit queue, keep commit in feed order*/
+    backup_batch_queue_t::position commit_pos;
+};
+typedef struct backup_batch backup_batch_t;
+
+/*feed -> N readers -> M writers -> one committer
+ *fed chunks grouped into batch, reader read whole batch in one call so
+ *reader can fetch several blocks per round trip; commit slot reserved when
+ *reader take batch, chunks committed in feed order no matter which writer
+ *finish first; data buffer only live in read and store stage, memory
+ *bounded by (readers + writers + queue depth) batches*/
+class BackupPipeline {
+ public:
+    typedef std::function<StatusCode(std::vector<backup_chunk_t>&)> read_fn_t;
+    typedef std::function<StatusCode(backup_chunk_t&)> stage_fn_t;
+
+    BackupPipeline(read_fn_t read_fn, stage_fn_t store_fn,
+                   stage_fn_t commit_fn, const int readers,
+                   const int writers, const int batch = 1);
+    BackupPipeline(const BackupPipeline& other) = delete;
+    BackupPipeline& operator=(const BackupPipeline& other) = delete;
+    ~BackupPipeline();
+
+    /*feed chunk in order, block when pipeline full, false after failure*/
+    bool feed(const off_t off, const size_t len);
+    /*wait all fed chunks committed, return the first stage error*/
+    StatusCode finish();
+
+ private:
+    /*push batch under feeding to readers*/
+    bool flush();
+    void reader_work();
+    void writer_work();
+    void committer_work();
+    void set_error(const StatusCode ret);
+    bool failed();
+
+ private:
+    read_fn_t  m_read_fn;
+    stage_fn_t m_store_fn;
+    stage_fn_t m_commit_fn;
+    int m_readers;
+    int m_writers;
+    int m_batch;
+    backup_batch_ptr m_feeding;
+
+    backup_batch_queue_t m_read_que;
+    backup_batch_queue_t m_write_que;
+    /*not bounded, reserved slot must never wait for space*/
+    backup_batch_queue_t m_commit_que;
+    /*reader take batch and reserve commit slot atomically*/
+    std::mutex m_order_mutex;
+
+    std::mutex m_ret_mutex;
+    StatusCode m_ret;
+
+    std::vector<std::thread> m_reader_threads;
+    std::vector<std::thread> m_writer_threads;
+    std::thread m_committer_thread;
+    bool m_finished;
+};
+
+#endif  // SRC_SG_SERVER_BACKUP_BACKUP_PIPELINE_H_
@@ -0,0 +1,116 @@
+/**********************************************
+* Copyright (c) 2016 Huawei Technologies Co., Ltd. All rights reserved.
+* 
+* File name:    backup_reclaimer.cc
+* Author: 
+* Date:         2017/07/07
+* Version:      1.0
+* Description:  background removal of unreferenced backup objects
+* 
+***********************************************/
+#include "log/log.h"
+#include "backup_util.h"
+#include "backup_reclaimer.h"
+
+BackupReclaimer::BackupReclaimer(IndexStore* index_store,
+                                 BlockStore* block_store) {
+    m_index_store = index_store;
+    m_block_store = block_store;
+    m_inflight = 0;
+    m_running = true;
+    m_worker = std::thread(&BackupReclaimer::work, this);
+}
+
+BackupReclaimer::~BackupReclaimer() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_running = false;
+    }
+    m_cond.notify_all();
+    if (m_worker.joinable()) {
+        m_worker.join();
+    }
+}
+
+int BackupReclaimer::recover() {
+    std::vector<backup_object_t> objs;
+    IndexStore::SimpleIteratorPtr it = m_index_store->db_iterator();
+    std::string prefix = BACKUP_GC_PREFIX;
+    prefix.append(BACKUP_FS);
+    for (it->seek_to_first(prefix);
+         it->valid() && !it->key().compare(0, prefix.size(), prefix);
+         it->next()) {
+        backup_object_t obj;
+        split_backup_gc_key(it->key(), obj);
+        objs.push_back(obj);
+    }
+    LOG_INFO << "backup reclaimer recover objects:" << objs.size();
+    if (objs.empty()) {
+        return 0;
+    }
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_queue.insert(m_queue.end(), objs.begin(), objs.end());
+    m_cond.notify_one();
+    return 0;
+}
+
+int BackupReclaimer::reclaim(const std::vector<backup_object_t>& objs) {
+    if (objs.empty()) {
+        return 0;
+    }
+    IndexStore::Transaction transaction = m_index_store->fetch_transaction();
+    for (auto& obj : objs) {
+        transaction->put(spawn_backup_gc_key(obj), "");
+    }
+    if (m_index_store->submit_transaction(transaction)) {
+        LOG_ERROR << "backup reclaimer persist objects:" << objs.size()
+                  << " failed";
+        return -1;
+    }
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_queue.insert(m_queue.end(), objs.begin(), objs.end());
+    m_cond.notify_one();
+    return 0;
+}
+
+void BackupReclaimer::drain() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_idle_cond.wait(lock, [this]() {
+        return (m_queue.empty() && m_inflight == 0) || !m_running;
+    });
+}
+
+void BackupReclaimer::work() {
+    while (true) {
+        std::vector<backup_object_t> objs;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_cond.wait(lock, [this]() {
+                return !m_queue.empty() || !m_running;
+            });
+            if (!m_running) {
+                break;
+            }
+            while (!m_queue.empty() && objs.size() < BACKUP_RECLAIM_BATCH) {
+                objs.push_back(m_queue.front());
+                m_queue.pop_front();
+            }
+            m_inflight = objs.size();
+        }
+
+        IndexStore::Transaction transaction = m_index_store->fetch_transaction();
+        for (auto& obj : objs) {
+            /*object may already removed before crash, no matter*/
+            m_block_store->remove(obj);
+            transaction->del(spawn_backup_gc_key(obj));
+        }
+        m_index_store->submit_transaction(transaction);
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_inflight = 0;
+        if (m_queue.empty()) {
+            m_idle_cond.notify_all();
+        }
+    }
+    m_idle_cond.notify_all();
+}
@@ -0,0 +1,60 @@
+/**********************************************
+* Copyright (c) 2016 Huawei Technologies Co., Ltd. All rights reserved.
+* 
+* File name:    backup_reclaimer.h
+* Author: 
+* Date:         2017/07/07
+* Version:      1.0
+* Description:  background removal of unreferenced backup objects
+* 
+***********************************************/
+#ifndef SRC_SG_SERVER_BACKUP_BACKUP_RECLAIMER_H_
+#define SRC_SG_SERVER_BACKUP_BACKUP_RECLAIMER_H_
+#include <string>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include "common/block_store.h"
+#include "common/index_store.h"
+#include "backup_def.h"
+
+/*backup delete and merge only drop block map entries, objects lost last
+ *reference recorded as gc key and removed by worker batch by batch, gc key
+ *dropped after removal; gc keys left by crash queued again on recover*/
+class BackupReclaimer {
+ public:
+    BackupReclaimer(IndexStore* index_store, BlockStore* block_store);
+    BackupReclaimer(const BackupReclaimer& other) = delete;
+    BackupReclaimer& operator=(const BackupReclaimer& other) = delete;
+    /*stop worker, objects not removed yet stay in gc keys*/
+    ~BackupReclaimer();
+
+    /*queue objects of gc keys left by last run*/
+    int recover();
+
+    /*persist gc keys of objects and queue them*/
+    int reclaim(const std::vector<backup_object_t>& objs);
+
+    /*wait until queued objects all removed*/
+    void drain();
+
+ private:
+    void work();
+
+ private:
+    IndexStore* m_index_store;
+    BlockStore* m_block_store;
+
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+    std::condition_variable m_idle_cond;
+    std::deque<backup_object_t> m_queue;
+    /*objects taken by worker but not removed*/
+    size_t m_inflight;
+    bool m_running;
+    std::thread m_worker;
+};
+
+#endif  // SRC_SG_SERVER_BACKUP_BACKUP_RECLAIMER_H_
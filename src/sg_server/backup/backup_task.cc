@@ -8,9 +8,12 @@
 * Description:  general backup async task
 * 
 ***********************************************/
+#include <unistd.h>
 #include <vector>
 #include <map>
+#include <set>
 #include <functional>
+#include <algorithm>
 #include "log/log.h"
 #include "common/define.h"
 #include "common/utils.h"
@@ -34,7 +37,6 @@ using huawei::proto::transfer::UploadDataAck;
 using huawei::proto::transfer::DownloadDataReq;
 using huawei::proto::transfer::DownloadDataAck;
 
-
 AsyncTask::AsyncTask(const string& backup_name, shared_ptr<BackupCtx> ctx) {
     m_backup_name = backup_name;
     m_ctx = ctx;
@@ -49,54 +51,145 @@ LocalCreateTask::LocalCreateTask(const string& backup_name,
     m_task_name.append("_create_backup");
     m_task_type   = BACKUP_CREATE;
     m_task_status = TASK_CREATE;
+    m_backup_id   = 0;
+    m_resume_pos  = 0;
+    m_writers     = BACKUP_WRITE_THREADS;
+    m_commit_count = 0;
+    m_commit_pos  = 0;
 }
 
 LocalCreateTask::~LocalCreateTask() {
 }
 
-StatusCode LocalCreateTask::do_full_backup() {
-    StatusCode ret_code = StatusCode::sOk;
-    off_t  cur_pos = 0;
-    off_t  end_pos = m_ctx->vol_size();
-    size_t chunk_size = BACKUP_BLOCK_SIZE;
-    char* chunk_buf = new char[chunk_size];
-    assert(chunk_buf != nullptr);
-    string cur_backup = m_backup_name;
+StatusCode LocalCreateTask::read_chunks(const string& snap,
+                                        vector<backup_chunk_t>& chunks) {
+    /*whole backup blocks read in one batch, tail block of volume alone*/
+    vector<off_t> offs;
+    vector<char*> bufs;
+    vector<size_t> idxs;
+    for (size_t i = 0; i < chunks.size(); i++) {
+        if (chunks[i].len == BACKUP_BLOCK_SIZE && chunks.size() > 1) {
+            offs.push_back(chunks[i].off);
+            bufs.push_back(chunks[i].buf);
+            idxs.push_back(i);
+            continue;
+        }
+        /*zero chunk not transferred*/
+        StatusCode ret = m_ctx->snap_client()->ReadSnapshot(m_ctx->vol_name(),
+                            snap, chunks[i].buf, chunks[i].len, chunks[i].off,
+                            &chunks[i].zero);
+        if (ret != StatusCode::sOk) {
+            LOG_ERROR << "backup read snap:" << snap << " off:"
+                      << chunks[i].off << " failed:" << ret;
+            return ret;
+        }
+    }
+    if (offs.empty()) {
+        return StatusCode::sOk;
+    }
+    vector<bool> zeros;
+    StatusCode ret = m_ctx->snap_client()->ReadSnapshotBatch(m_ctx->vol_name(),
+                            snap, offs, BACKUP_BLOCK_SIZE, bufs, zeros);
+    if (ret != StatusCode::sOk) {
+        LOG_ERROR << "backup batch read snap:" << snap << " off:"
+                  << offs.front() << " count:" << offs.size()
+                  << " failed:" << ret;
+        return ret;
+    }
+    for (size_t i = 0; i < idxs.size(); i++) {
+        chunks[idxs[i]].zero = zeros[i];
+    }
+    return StatusCode::sOk;
+}
 
-    while (cur_pos < end_pos) {
-        chunk_size =((end_pos-cur_pos) > BACKUP_BLOCK_SIZE) ?  \
-                      BACKUP_BLOCK_SIZE : (end_pos-cur_pos);
-        /*read current snapshot*/
-        string cur_snap = backup_to_snap_name(cur_backup);
-        ret_code = m_ctx->snap_client()->ReadSnapshot(m_ctx->vol_name(),
-                                   cur_snap, chunk_buf, chunk_size, cur_pos);
-        assert(ret_code == StatusCode::sOk);
-        /*spawn block object*/
-        block_t cur_blk_no = (cur_pos / BACKUP_BLOCK_SIZE);
-        backupid_t cur_backup_id = m_ctx->get_backup_id(cur_backup);
-        backup_object_t cur_blk_obj = spawn_backup_object_name(
-                m_ctx->vol_name(), cur_backup_id, cur_blk_no);
-        /*store backup data to block store in object*/
-        int write_ret = m_ctx->block_store()->write(cur_blk_obj, chunk_buf,
-                                                    chunk_size, 0);
-        assert(write_ret == 0);
-
-        /*update backup block map*/
-        auto cur_backup_block_map_it = m_ctx->cur_blocks_map().find(cur_backup_id);
-        assert(cur_backup_block_map_it != m_ctx->cur_blocks_map().end());
-        map<block_t, backup_object_t> &cur_backup_block_map = cur_backup_block_map_it->second;
-        cur_backup_block_map.insert({cur_blk_no, cur_blk_obj});
-        cur_pos += chunk_size;
-    }
-
-    if (chunk_buf) {
-        delete [] chunk_buf;
-    }
-    return ret_code;
+StatusCode LocalCreateTask::store_chunk(backup_chunk_t& chunk) {
+    /*all zero block only mapped to BACKUP_ZERO_OBJECT*/
+    chunk.obj = BACKUP_ZERO_OBJECT;
+    if (chunk.zero || buf_is_zero(chunk.buf, chunk.len)) {
+        return StatusCode::sOk;
+    }
+    block_t blk_no = chunk.off / BACKUP_BLOCK_SIZE;
+    backup_object_t blk_obj = spawn_backup_object_name(m_ctx->vol_name(),
+                                                       m_backup_id, blk_no);
+    /*store backup data to block store in object*/
+    int write_ret = 0;
+    if (m_ctx->dedup()->enabled()) {
+        write_ret = m_ctx->dedup()->store(blk_obj, chunk.buf, chunk.len,
+                                          blk_obj);
+    } else {
+        write_ret = m_ctx->block_store()->write(blk_obj, chunk.buf,
+                                                chunk.len, 0);
+    }
+    if (write_ret != 0) {
+        LOG_ERROR << "store backup block:" << blk_no << " failed";
+        return StatusCode::sInternalError;
+    }
+    chunk.obj = blk_obj;
+    return StatusCode::sOk;
 }
 
-StatusCode LocalCreateTask::do_incr_backup() {
-    StatusCode ret_code = StatusCode::sOk;
+StatusCode LocalCreateTask::commit_chunk(backup_chunk_t& chunk) {
+    block_t blk_no = chunk.off / BACKUP_BLOCK_SIZE;
+    /*update backup block map*/
+    auto block_map_it = m_ctx->cur_blocks_map().find(m_backup_id);
+    if (block_map_it == m_ctx->cur_blocks_map().end()) {
+        return StatusCode::sInternalError;
+    }
+    block_map_it->second.set(blk_no, chunk.obj);
+    m_commit_trans->put(spawn_backup_block_map_key(m_backup_id, blk_no),
+                        chunk.obj);
+    m_commit_pos = chunk.off + chunk.len;
+    if (++m_commit_count >= BACKUP_COMMIT_BATCH) {
+        flush_commit();
+    }
+    return StatusCode::sOk;
+}
+
+void LocalCreateTask::flush_commit() {
+    if (m_commit_count == 0) {
+        return;
+    }
+    /*block map and progress in one transaction*/
+    m_commit_trans->put(spawn_backup_progress_key(m_backup_id),
+                        to_string(m_commit_pos));
+    m_ctx->index_store()->submit_transaction(m_commit_trans);
+    m_commit_trans = m_ctx->index_store()->fetch_transaction();
+    m_commit_count = 0;
+}
+
+StatusCode LocalCreateTask::run_pipeline(const string& snap,
+        const function<void(BackupPipeline&)>& feeder) {
+    m_commit_trans = m_ctx->index_store()->fetch_transaction();
+    m_commit_count = 0;
+    int batch = BACKUP_READ_BATCH_BYTES / BACKUP_BLOCK_SIZE;
+    BackupPipeline pipeline(
+        [this, &snap](vector<backup_chunk_t>& chunks) {
+            return read_chunks(snap, chunks);
+        },
+        [this](backup_chunk_t& chunk) { return store_chunk(chunk); },
+        [this](backup_chunk_t& chunk) { return commit_chunk(chunk); },
+        BACKUP_READ_THREADS, m_writers, batch);
+    feeder(pipeline);
+    StatusCode ret = pipeline.finish();
+    flush_commit();
+    return ret;
+}
+
+StatusCode LocalCreateTask::do_full_backup() {
+    off_t end_pos = m_ctx->vol_size();
+    string cur_snap = backup_to_snap_name(m_backup_name);
+    return run_pipeline(cur_snap, [this, end_pos](BackupPipeline& pipeline) {
+        for (off_t pos = m_resume_pos; pos < end_pos; pos += BACKUP_BLOCK_SIZE) {
+            size_t len = std::min((off_t)BACKUP_BLOCK_SIZE, end_pos - pos);
+            if (!pipeline.feed(pos, len)) {
+                break;
+            }
+        }
+    });
+}
+
+StatusCode LocalCreateTask::incr_backup_snaps(string& pre_snap,
+                                              string& cur_snap) {
     string cur_backup = m_backup_name;
     string prev_backup = m_ctx->get_prev_backup(cur_backup);
     if (prev_backup.empty()) {
@@ -104,61 +197,90 @@ StatusCode LocalCreateTask::do_incr_backup() {
         return StatusCode::sBackupNotExist;
     }
 
-    string pre_snap = backup_to_snap_name(prev_backup);
-    string cur_snap = backup_to_snap_name(cur_backup);
+    pre_snap = backup_to_snap_name(prev_backup);
+    cur_snap = backup_to_snap_name(cur_backup);
     if (!m_ctx->is_snapshot_valid(pre_snap) ||
         !m_ctx->is_snapshot_valid(cur_snap)) {
         LOG_ERROR << "incr backup:" << cur_backup<< "has no snapshot";
         return StatusCode::sBackupNotExist;
     }
+    return StatusCode::sOk;
+}
 
-    /*todo modify as stream interface*/
-    /*1. diff cur and prev snapshot*/
-    vector<DiffBlocks> diff_blocks;
-    ret_code = m_ctx->snap_client()->DiffSnapshot(m_ctx->vol_name(),
-                                            pre_snap, cur_snap, diff_blocks);
-    assert(ret_code == StatusCode::sOk);
-
-    /*2. read diff data(current snapshot and diff region)*/
-    char* buf = new char[COW_BLOCK_SIZE];
-    for (auto it : diff_blocks) {
-        uint64_t diff_block_no_size = it.diff_block_no_size();
-        for (int i = 0; i < diff_block_no_size; i++) {
-            uint64_t diff_block_no = it.diff_block_no(i);
-            off_t    diff_block_off = diff_block_no * COW_BLOCK_SIZE;
-            size_t   diff_block_size = COW_BLOCK_SIZE;
-
-            ret_code = m_ctx->snap_client()->ReadSnapshot(m_ctx->vol_name(),
-                            cur_snap, buf, diff_block_size, diff_block_off);
-            assert(ret_code == StatusCode::sOk);
-
-            /*3. append backup meta(block, object) and (object, backup_ref)*/
-            block_t cur_backup_blk_no = (diff_block_off / BACKUP_BLOCK_SIZE);
-            backupid_t cur_backup_id  = m_ctx->get_backup_id(cur_backup);
-            backup_object_t cur_backup_blk_obj = spawn_backup_object_name(
-                    m_ctx->vol_name(), cur_backup_id, cur_backup_blk_no);
-
-            /*store backup data to block store in object*/
-            size_t write_size = diff_block_size;
-            /*snapshot cow block  unit diff from backup block unit*/
-            off_t  write_off = (diff_block_off % BACKUP_BLOCK_SIZE);
-            int write_ret = m_ctx->block_store()->write(cur_backup_blk_obj,
-                                                 buf, write_size, write_off);
-            assert(write_ret == 0);
-
-            /*update backup block map*/
-            auto cur_backup_block_map_it = m_ctx->cur_blocks_map().find(cur_backup_id);
-            assert(cur_backup_block_map_it != m_ctx->cur_blocks_map().end());
-            map<block_t, backup_object_t> &cur_backup_block_map = cur_backup_block_map_it->second;
-            cur_backup_block_map.insert({cur_backup_blk_no, cur_backup_blk_obj});
+StatusCode LocalCreateTask::stream_incr_backup(const string& pre_snap,
+                                               const string& cur_snap) {
+    /*changed blocks pulled chunk by chunk in ascending order while earlier
+     *blocks being read and stored, diff never materialized*/
+    shared_ptr<DiffReader> reader = m_ctx->snap_client()->DiffSnapshotStream(
+                                    m_ctx->vol_name(), pre_snap, cur_snap, true);
+    off_t end_pos = m_ctx->vol_size();
+    StatusCode ret = run_pipeline(cur_snap, [&](BackupPipeline& pipeline) {
+        string   snap_name;
+        uint64_t blk_no;
+        off_t    next_pos = m_resume_pos;
+        while (reader->next(snap_name, blk_no)) {
+            /*cow block may be smaller or larger than backup block, backup
+             *object always hold whole backup block*/
+            off_t diff_start = blk_no * reader->blk_size();
+            off_t diff_end = std::min(end_pos,
+                                      (off_t)(diff_start + reader->blk_size()));
+            off_t pos = diff_start - (diff_start % BACKUP_BLOCK_SIZE);
+            for (pos = std::max(pos, next_pos); pos < diff_end;
+                 pos += BACKUP_BLOCK_SIZE) {
+                size_t len = std::min((off_t)BACKUP_BLOCK_SIZE, end_pos - pos);
+                if (!pipeline.feed(pos, len)) {
+                    return;
+                }
+                next_pos = pos + BACKUP_BLOCK_SIZE;
+            }
         }
+    });
+    if (ret == StatusCode::sOk && reader->status() != StatusCode::sOk) {
+        LOG_ERROR << "incr backup:" << m_backup_name << " diff failed";
+        ret = reader->status();
     }
+    return ret;
+}
 
-    if (buf) {
-        delete [] buf;
+StatusCode LocalCreateTask::do_incr_backup() {
+    string pre_snap;
+    string cur_snap;
+    StatusCode ret_code = incr_backup_snaps(pre_snap, cur_snap);
+    if (ret_code != StatusCode::sOk) {
+        return ret_code;
     }
+    return stream_incr_backup(pre_snap, cur_snap);
+}
+
+StatusCode LocalCreateTask::prepare_backup_id(backup_attr_t& attr) {
+    backupid_t backup_id = attr.backup_id;
+    if (backup_id != 0 &&
+        m_ctx->cur_blocks_map().find(backup_id) != m_ctx->cur_blocks_map().end()) {
+        /*interrupted create, continue after committed blocks*/
+        string progress = m_ctx->index_store()->db_get(
+                                spawn_backup_progress_key(backup_id));
+        m_resume_pos = progress.empty() ? 0 : atoll(progress.c_str());
+        m_backup_id = backup_id;
+        LOG_INFO << "backup:" << m_backup_name << " resume from:" << m_resume_pos;
+        return StatusCode::sOk;
+    }
+
+    /*generate backup id, persist before any block committed*/
+    backup_id = m_ctx->spawn_backup_id();
+    attr.backup_id = backup_id;
+    m_ctx->add_block_map(backup_id);
+    m_backup_id = backup_id;
+    m_resume_pos = 0;
 
-    return ret_code;
+    IndexStore::Transaction transaction = m_ctx->index_store()->fetch_transaction();
+    transaction->put(spawn_latest_backup_id_key(),
+                     to_string(m_ctx->latest_backup_id()));
+    transaction->put(spawn_backup_attr_map_key(m_backup_name),
+                     spawn_backup_attr_map_val(attr));
+    if (m_ctx->index_store()->submit_transaction(transaction)) {
+        return StatusCode::sInternalError;
+    }
+    return StatusCode::sOk;
 }
 
 bool LocalCreateTask::ready() {
@@ -190,25 +312,25 @@ void LocalCreateTask::work() {
 
     m_task_status = TASK_RUN;
 
-    /*generate backup id*/
-    backupid_t backup_id = m_ctx->spawn_backup_id();
-    /*update backup attr*/
-    it->second.backup_id = backup_id;
-    /*prepare backup block map*/
-    map<block_t, backup_object_t> block_map;
-    m_ctx->cur_blocks_map().insert({backup_id, block_map});
-
+    StatusCode ret = prepare_backup_id(it->second);
     /*do backup and update backup block map*/
-    if (it->second.backup_mode == BackupMode::BACKUP_FULL) {
-        do_full_backup();
-    } else if (it->second.backup_mode == BackupMode::BACKUP_INCR) {
-        do_incr_backup();
-    } else {
+    if (ret == StatusCode::sOk) {
+        if (it->second.backup_mode == BackupMode::BACKUP_FULL) {
+            ret = do_full_backup();
+        } else if (it->second.backup_mode == BackupMode::BACKUP_INCR) {
+            ret = do_incr_backup();
+        }
+    }
+    if (ret != StatusCode::sOk) {
+        /*backup stay creating, resumed by task created on recover*/
+        LOG_ERROR << "backup:" << cur_backup << " create failed:" << ret;
+        m_task_status = TASK_ERROR;
+        return;
     }
 
     it->second.backup_status = BackupStatus::BACKUP_AVAILABLE;
 
-    /*db persist*/
+    /*db persist, block map already committed by pipeline*/
     IndexStore::Transaction transaction = m_ctx->index_store()->fetch_transaction();
     string pkey = spawn_latest_backup_id_key();
     string pval = to_string(m_ctx->latest_backup_id());
@@ -216,11 +338,10 @@ void LocalCreateTask::work() {
     pkey = spawn_backup_attr_map_key(cur_backup);
     pval = spawn_backup_attr_map_val(it->second);
     transaction->put(pkey, pval);
-    for (auto block : block_map) {
-        pkey = spawn_backup_block_map_key(backup_id, block.first);
-        pval = block.second;
-        transaction->put(pkey, pval);
-    }
+    transaction->del(spawn_backup_progress_key(m_backup_id));
+    /*backup block map never change until merge, loaded on recover*/
+    transaction->put(spawn_backup_compact_map_key(m_backup_id),
+                     m_ctx->cur_blocks_map().at(m_backup_id).encode());
     m_ctx->index_store()->submit_transaction(transaction);
 
     /*delete snapshot of prev backup*/
@@ -240,120 +361,115 @@ void LocalCreateTask::work() {
 
 RemoteCreateTask::RemoteCreateTask(const string& backup_name,
         shared_ptr<BackupCtx> ctx) : LocalCreateTask(backup_name, ctx) {
-    ClientContext* rpc_ctx = new ClientContext;
-    m_remote_stream = NetSender::instance().create_stream(rpc_ctx);
-    if (m_remote_stream == nullptr) {
-        LOG_ERROR << "remote rpc stream failed";
-    }
+    /*one rpc stream, upload one by one*/
+    m_writers = 1;
+    m_resumable = false;
+    m_unsynced = 0;
+    m_sync_inflight = 0;
+    m_acked_pos = 0;
+    connect();
 }
 
 RemoteCreateTask::~RemoteCreateTask() {
-}
-
-StatusCode RemoteCreateTask::do_full_backup() {
-    StatusCode ret_code = StatusCode::sOk;
-    LOG_INFO << " remote create start";
-    /*notify start create backup meta on remote site*/
-    ret_code = remote_create_start();
-    if (ret_code) {
-        return ret_code;
+    if (m_rpc_ctx) {
+        m_rpc_ctx->TryCancel();
     }
-
-    LOG_INFO << " remote create upload";
-    off_t  cur_pos = 0;
-    off_t  end_pos = m_ctx->vol_size();
-    size_t chunk_size = BACKUP_BLOCK_SIZE;
-    char* chunk_buf = new char[chunk_size];
-    assert(chunk_buf != nullptr);
-    string cur_backup = m_backup_name;
-    while (cur_pos < end_pos) {
-        chunk_size =((end_pos-cur_pos) > BACKUP_BLOCK_SIZE) ?  \
-                    BACKUP_BLOCK_SIZE : (end_pos-cur_pos);
-        /*read current snapshot*/
-        string cur_snap = backup_to_snap_name(cur_backup);
-        ret_code = m_ctx->snap_client()->ReadSnapshot(m_ctx->vol_name(),
-                            cur_snap, chunk_buf, chunk_size, cur_pos);
-        assert(ret_code == StatusCode::sOk);
-        /*spawn block object*/
-        block_t cur_blk_no = (cur_pos / BACKUP_BLOCK_SIZE);
-        off_t   cur_blk_off =(cur_pos % BACKUP_BLOCK_SIZE);
-        /*upload backup data to remote site*/
-        ret_code = remote_create_upload(cur_blk_no, cur_blk_off,
-                                        chunk_buf, chunk_size);
-        assert(ret_code == StatusCode::sOk);
-        cur_pos += chunk_size;
-    }
-
-    if (chunk_buf) {
-        delete [] chunk_buf;
-    }
-
-    LOG_INFO << " remote create end";
-    /*notify stop create backup meta on remote site*/
-    ret_code = remote_create_end();
-    return ret_code;
+    m_remote_stream.reset();
 }
 
-StatusCode RemoteCreateTask::do_incr_backup() {
-    StatusCode ret_code = StatusCode::sOk;
-    string cur_backup = m_backup_name;
-    string prev_backup = m_ctx->get_prev_backup(cur_backup);
-    if (prev_backup.empty()) {
-        LOG_ERROR << "incr backup:" << cur_backup<< "has no previous backup";
-        return StatusCode::sBackupNotExist;
+void RemoteCreateTask::connect() {
+    /*broken stream abandoned, blocks not synced dropped by remote*/
+    if (m_rpc_ctx) {
+        m_rpc_ctx->TryCancel();
     }
-    string pre_snap = backup_to_snap_name(prev_backup);
-    string cur_snap = backup_to_snap_name(cur_backup);
-    if (!m_ctx->is_snapshot_valid(pre_snap) ||
-        !m_ctx->is_snapshot_valid(cur_snap)) {
-        LOG_ERROR << "incr backup:" << cur_backup<< "has no snapshot";
-        return StatusCode::sBackupNotExist;
+    m_remote_stream.reset();
+    m_rpc_ctx.reset(new ClientContext);
+    m_remote_stream = NetSender::instance().create_stream(m_rpc_ctx.get());
+    if (m_remote_stream == nullptr) {
+        LOG_ERROR << "remote rpc stream failed";
     }
+}
 
-    /*notify start create backup meta on remote site*/
-    ret_code = remote_create_start();
-    if (ret_code) {
-        return ret_code;
+StatusCode RemoteCreateTask::store_chunk(backup_chunk_t& chunk) {
+    /*upload backup data to remote site*/
+    block_t blk_no  = (chunk.off / BACKUP_BLOCK_SIZE);
+    off_t   blk_off = (chunk.off % BACKUP_BLOCK_SIZE);
+    bool zero = chunk.zero || buf_is_zero(chunk.buf, chunk.len);
+    /*single writer, chunks uploaded in offset order, so end of the chunk
+     *is the resume position once remote persisted it*/
+    bool sync = (++m_unsynced >= BACKUP_UPLOAD_SYNC_BLOCKS);
+    StatusCode ret = remote_create_upload(blk_no, blk_off, chunk.buf, chunk.len,
+                                          zero, chunk.off + chunk.len, sync);
+    if (ret != StatusCode::sOk) {
+        return ret;
+    }
+    if (sync) {
+        m_unsynced = 0;
+        m_sync_inflight++;
+    }
+    /*blocks not acked yet bounded by window*/
+    while (m_sync_inflight > 0 &&
+           m_sync_inflight * BACKUP_UPLOAD_SYNC_BLOCKS + m_unsynced >=
+           BACKUP_UPLOAD_WINDOW) {
+        ret = wait_upload_ack();
+        if (ret != StatusCode::sOk) {
+            return ret;
+        }
     }
+    return StatusCode::sOk;
+}
 
-    /*todo modify as stream interface diff cur and prev snapshot*/
-    vector<DiffBlocks> diff_blocks;
-    ret_code = m_ctx->snap_client()->DiffSnapshot(m_ctx->vol_name(),
-                                         pre_snap, cur_snap, diff_blocks);
-    assert(ret_code == StatusCode::sOk);
-
-    /*read diff data(current snapshot and diff region)*/
-    size_t chunk_size = COW_BLOCK_SIZE;
-    char* chunk_buf = new char[COW_BLOCK_SIZE];
-    for (auto it : diff_blocks) {
-        uint64_t diff_block_no_size = it.diff_block_no_size();
-        for (int i = 0; i < diff_block_no_size; i++) {
-            uint64_t diff_block_no = it.diff_block_no(i);
-            off_t    diff_block_off = diff_block_no * COW_BLOCK_SIZE;
-
-            ret_code = m_ctx->snap_client()->ReadSnapshot(m_ctx->vol_name(),
-                                                          cur_snap,
-                                                          chunk_buf,
-                                                          chunk_size,
-                                                          diff_block_off);
-            assert(ret_code == StatusCode::sOk);
-
-            /*3. append backup meta(block, object) and (object, backup_ref)*/
-            block_t cur_blk_no  = (diff_block_off / BACKUP_BLOCK_SIZE);
-            off_t   cur_blk_off = (diff_block_off % BACKUP_BLOCK_SIZE);
-            ret_code = remote_create_upload(cur_blk_no, cur_blk_off,
-                                            chunk_buf, chunk_size);
-            assert(ret_code == StatusCode::sOk);
+StatusCode RemoteCreateTask::commit_chunk(backup_chunk_t& chunk) {
+    /*block map maintained on remote site*/
+    return StatusCode::sOk;
+}
+
+StatusCode RemoteCreateTask::remote_transfer(
+        const function<StatusCode()>& upload) {
+    StatusCode ret = StatusCode::sOk;
+    for (int retry = 0; retry <= BACKUP_REMOTE_RETRY; retry++) {
+        if (retry > 0) {
+            LOG_ERROR << "remote backup:" << m_backup_name << " retry:" << retry
+                      << " acked pos:" << m_acked_pos;
+            sleep(BACKUP_REMOTE_RETRY_WAIT);
+            connect();
+        }
+        m_resumable = false;
+        /*notify start create backup meta on remote site*/
+        ret = remote_create_start();
+        if (ret == StatusCode::sOk) {
+            ret = upload();
+        }
+        /*notify stop create backup meta on remote site*/
+        if (ret == StatusCode::sOk) {
+            ret = remote_create_end();
+        }
+        if (ret == StatusCode::sOk || !m_resumable) {
+            break;
         }
     }
+    return ret;
+}
+
+StatusCode RemoteCreateTask::do_full_backup() {
+    LOG_INFO << " remote create full backup:" << m_backup_name;
+    return remote_transfer([this]() {
+        return LocalCreateTask::do_full_backup();
+    });
+}
 
-    if (chunk_buf) {
-        delete [] chunk_buf;
+StatusCode RemoteCreateTask::do_incr_backup() {
+    string pre_snap;
+    string cur_snap;
+    StatusCode ret_code = incr_backup_snaps(pre_snap, cur_snap);
+    if (ret_code) {
+        return ret_code;
     }
 
-    /*notify stop create backup meta on remote site*/
-    ret_code = remote_create_end();
-    return ret_code;
+    LOG_INFO << " remote create incr backup:" << m_backup_name;
+    return remote_transfer([&]() {
+        return stream_incr_backup(pre_snap, cur_snap);
+    });
 }
 
 bool RemoteCreateTask::ready() {
@@ -378,7 +494,13 @@ bool RemoteCreateTask::ready() {
 StatusCode RemoteCreateTask::remote_create_start() {
     RemoteBackupStartReq start_req;
 
-    LOG_INFO << "send remote create start req 1";
+    m_unsynced = 0;
+    m_sync_inflight = 0;
+    if (m_remote_stream == nullptr) {
+        m_resumable = true;
+        return StatusCode::sInternalError;
+    }
+
     start_req.set_vol_name(m_ctx->vol_name());
     start_req.set_vol_size(m_ctx->vol_size());
     start_req.set_backup_name(m_backup_name);
@@ -392,31 +514,47 @@ StatusCode RemoteCreateTask::remote_create_start() {
     transfer_req.set_type(MessageType::REMOTE_BACKUP_CREATE_START);
     transfer_req.set_data(start_req_buf.c_str(), start_req_buf.length());
 
-    LOG_INFO << "send remote create start req 2";
     if (!m_remote_stream->Write(transfer_req)) {
         LOG_ERROR << "send remote create start req failed";
+        m_resumable = true;
         return StatusCode::sInternalError;
     }
 
-    LOG_INFO << "send remote create start req 3";
     TransferResponse transfer_res;
     if (!m_remote_stream->Read(&transfer_res)) {
         LOG_ERROR << "recv remote create start res failed";
+        m_resumable = true;
         return StatusCode::sInternalError;
     }
+    RemoteBackupStartAck start_ack;
+    start_ack.ParseFromString(transfer_res.data());
+    if (start_ack.status() != StatusCode::sOk) {
+        LOG_ERROR << "remote create start failed:" << start_ack.status();
+        return start_ack.status();
+    }
 
-    LOG_INFO << "send remote create start req ok";
+    /*remote already has blocks of interrupted run*/
+    m_resume_pos = start_ack.resume_pos();
+    m_acked_pos = m_resume_pos;
+    LOG_INFO << "send remote create start req ok resume pos:" << m_resume_pos;
     return StatusCode::sOk;
 }
 
 StatusCode RemoteCreateTask::remote_create_upload(block_t blk_no, off_t blk_off,
-                                    char* blk_data, size_t blk_data_len) {
+                                    char* blk_data, size_t blk_data_len,
+                                    bool blk_zero, off_t end_pos, bool sync) {
     UploadDataReq upload_req;
     upload_req.set_vol_name(m_ctx->vol_name());
     upload_req.set_backup_name(m_backup_name);
     upload_req.set_blk_no(blk_no);
     upload_req.set_blk_off(blk_off);
-    upload_req.set_blk_data(blk_data, blk_data_len);
+    if (blk_zero) {
+        upload_req.set_blk_zero(true);
+    } else {
+        upload_req.set_blk_data(blk_data, blk_data_len);
+    }
+    upload_req.set_end_pos(end_pos);
+    upload_req.set_sync(sync);
 
     string upload_req_buf;
     upload_req.SerializeToString(&upload_req_buf);
@@ -427,8 +565,36 @@ StatusCode RemoteCreateTask::remote_create_upload(block_t blk_no, off_t blk_off,
 
     if (!m_remote_stream->Write(transfer_req)) {
         LOG_ERROR << "send upload data req failed";
+        m_resumable = true;
+        return StatusCode::sInternalError;
+    }
+    return StatusCode::sOk;
+}
+
+StatusCode RemoteCreateTask::wait_upload_ack() {
+    TransferResponse transfer_res;
+    if (!m_remote_stream->Read(&transfer_res)) {
+        LOG_ERROR << "recv upload data ack failed";
+        m_resumable = true;
         return StatusCode::sInternalError;
     }
+    return handle_upload_ack(transfer_res);
+}
+
+StatusCode RemoteCreateTask::handle_upload_ack(const TransferResponse& res) {
+    UploadDataAck upload_ack;
+    upload_ack.ParseFromString(res.data());
+    if (upload_ack.status() != StatusCode::sOk) {
+        /*remote store failure may be transient, resume from acked pos*/
+        LOG_ERROR << "remote upload failed:" << upload_ack.status()
+                  << " acked pos:" << m_acked_pos;
+        m_resumable = (upload_ack.status() == StatusCode::sInternalError);
+        return upload_ack.status();
+    }
+    if ((off_t)upload_ack.ack_pos() > m_acked_pos) {
+        m_acked_pos = upload_ack.ack_pos();
+    }
+    m_sync_inflight--;
     return StatusCode::sOk;
 }
 
@@ -446,15 +612,30 @@ StatusCode RemoteCreateTask::remote_create_end() {
 
     if (!m_remote_stream->Write(transfer_req)) {
         LOG_ERROR << "send remote create end req failed";
+        m_resumable = true;
         return StatusCode::sInternalError;
     }
 
+    /*acks of syncs in flight arrive before end ack*/
     TransferResponse transfer_res;
-    if (!m_remote_stream->Read(&transfer_res)) {
-        LOG_ERROR << "recv remote create end res failed";
-        return StatusCode::sInternalError;
+    while (m_remote_stream->Read(&transfer_res)) {
+        if (transfer_res.type() == MessageType::REMOTE_BACKUP_UPLOAD_DATA) {
+            StatusCode ret = handle_upload_ack(transfer_res);
+            if (ret != StatusCode::sOk) {
+                return ret;
+            }
+            continue;
+        }
+        RemoteBackupEndAck end_ack;
+        end_ack.ParseFromString(transfer_res.data());
+        if (end_ack.status() != StatusCode::sOk) {
+            LOG_ERROR << "remote create end failed:" << end_ack.status();
+        }
+        return end_ack.status();
     }
-    return StatusCode::sOk;
+    LOG_ERROR << "recv remote create end res failed";
+    m_resumable = true;
+    return StatusCode::sInternalError;
 }
 
 LocalDeleteTask::LocalDeleteTask(const string& backup_name,
@@ -475,27 +656,29 @@ StatusCode LocalDeleteTask::do_delete_backup(const string& cur_backup) {
 
     auto backup_it = m_ctx->cur_blocks_map().find(backup_id);
     assert(backup_it != m_ctx->cur_blocks_map().end());
+    auto& block_map = backup_it->second;
 
-    /*delete backup object*/
-    auto block_map = backup_it->second;
-    for (auto block_it : block_map) {
-        m_ctx->block_store()->remove(block_it.second);
-    }
-
-    /*db persist*/
+    /*db persist batch by batch, rerun after crash go on with blocks left,
+     *compact map dropped first so recover rebuild from blocks left*/
     IndexStore::Transaction transaction = m_ctx->index_store()->fetch_transaction();
-    string pkey;
-    for (auto block : block_map) {
-        pkey = spawn_backup_block_map_key(backup_id, block.first);
-        transaction->del(pkey);
-    }
-    pkey = spawn_backup_attr_map_key(cur_backup);
-    transaction->del(pkey);
+    transaction->del(spawn_backup_compact_map_key(backup_id));
+    vector<backup_object_t> objs;
+    block_map.for_each([&](const block_t& blk, const backup_object_t& obj) {
+        transaction->del(spawn_backup_block_map_key(backup_id, blk));
+        objs.push_back(obj);
+        if (objs.size() >= BACKUP_COMMIT_BATCH) {
+            m_ctx->index_store()->submit_transaction(transaction);
+            release_objects(objs);
+            transaction = m_ctx->index_store()->fetch_transaction();
+        }
+        return true;
+    });
+    transaction->del(spawn_backup_attr_map_key(cur_backup));
     m_ctx->index_store()->submit_transaction(transaction);
+    release_objects(objs);
 
     /*delete backup meta in memory*/
-    block_map.clear();
-    m_ctx->cur_blocks_map().erase(backup_id);
+    m_ctx->cur_blocks_map().erase(backup_it);
     m_ctx->cur_backups_map().erase(cur_backup);
     return StatusCode::sOk;
 }
@@ -510,41 +693,64 @@ StatusCode LocalDeleteTask::do_merge_backup(const string& cur_backup,
     auto next_backup_it = m_ctx->cur_blocks_map().find(next_backup_id);
     assert(cur_backup_it != m_ctx->cur_blocks_map().end());
     assert(next_backup_it != m_ctx->cur_blocks_map().end());
-    auto& cur_blocks_map  = cur_backup_it->second;
+    auto& cur_block_map  = cur_backup_it->second;
     auto& next_block_map = next_backup_it->second;
-    for (auto cur_block_it : cur_blocks_map) {
-        auto ret = next_block_map.insert({cur_block_it.first, cur_block_it.second});
-        if (!ret.second) {
-            /*backup block already in next bakcup, delete attached object*/
-            m_ctx->block_store()->remove(cur_block_it.second);
-        }
-    }
 
-     /*db persist*/
+    /*only keys of blocks the deleted backup own touched: block not in next
+     *backup move to it, block overwritten by next backup dropped with its
+     *object; db persist batch by batch, rerun after crash go on with blocks
+     *left, moved block already gone from current backup; compact maps
+     *dropped in first batch, rebuilt from block keys if crash midway*/
     IndexStore::Transaction transaction = m_ctx->index_store()->fetch_transaction();
-    string pkey;
-    string pval;
-    for (auto block : cur_blocks_map) {
-        pkey = spawn_backup_block_map_key(cur_backup_id, block.first);
-        transaction->del(pkey);
-    }
-    pkey = spawn_backup_attr_map_key(cur_backup);
-    transaction->del(pkey);
-    for (auto block : next_block_map) {
-       pkey = spawn_backup_block_map_key(next_backup_id, block.first);
-       pval = block.second;
-       transaction->put(pkey, pval);
-    }
+    transaction->del(spawn_backup_compact_map_key(cur_backup_id));
+    transaction->del(spawn_backup_compact_map_key(next_backup_id));
+    vector<backup_object_t> stale_objs;
+    int count = 0;
+    cur_block_map.for_each([&](const block_t& blk, const backup_object_t& obj) {
+        transaction->del(spawn_backup_block_map_key(cur_backup_id, blk));
+        if (next_block_map.insert(blk, obj)) {
+            transaction->put(spawn_backup_block_map_key(next_backup_id, blk),
+                             obj);
+        } else {
+            /*backup block already in next bakcup, delete attached object*/
+            stale_objs.push_back(obj);
+        }
+        if (++count >= BACKUP_COMMIT_BATCH) {
+            m_ctx->index_store()->submit_transaction(transaction);
+            release_objects(stale_objs);
+            transaction = m_ctx->index_store()->fetch_transaction();
+            count = 0;
+        }
+        return true;
+    });
+    transaction->del(spawn_backup_attr_map_key(cur_backup));
+    transaction->put(spawn_backup_compact_map_key(next_backup_id),
+                     next_block_map.encode());
     m_ctx->index_store()->submit_transaction(transaction);
+    release_objects(stale_objs);
 
     /*delete backup meta in memory*/
-    cur_blocks_map.clear();
-    m_ctx->cur_blocks_map().erase(cur_backup_id);
+    m_ctx->cur_blocks_map().erase(cur_backup_it);
     m_ctx->cur_backups_map().erase(cur_backup);
 
     return StatusCode::sOk;
 }
 
+void LocalDeleteTask::release_objects(vector<backup_object_t>& objs) {
+    vector<backup_object_t> removable;
+    for (auto& obj : objs) {
+        if (obj == BACKUP_ZERO_OBJECT) {
+            continue;
+        }
+        if (m_ctx->dedup()->unref(obj)) {
+            removable.push_back(obj);
+        }
+    }
+    /*removed by reclaimer in background, delete not wait object store*/
+    m_ctx->reclaimer()->reclaim(removable);
+    objs.clear();
+}
+
 bool LocalDeleteTask::ready() {
     m_task_status = TASK_READY;
     return true;
@@ -569,7 +775,7 @@ void LocalDeleteTask::work() {
         if (next_backup.empty()) {
             do_delete_backup(cur_backup);
         } else {
-            BackupMode next_backup_mode = m_ctx->get_backup_mode(cur_backup);
+            BackupMode next_backup_mode = m_ctx->get_backup_mode(next_backup);
             if (next_backup_mode == BackupMode::BACKUP_FULL) {
                 /*can directly delete*/
                 do_delete_backup(cur_backup);
@@ -12,9 +12,12 @@
 #define SRC_SG_SERVER_BACKUP_BACKUP_TASK_H_
 #include <string>
 #include <memory>
+#include <vector>
+#include <functional>
 #include "rpc/common.pb.h"
 #include "transfer/net_sender.h"
 #include "backup_ctx.h"
+#include "backup_pipeline.h"
 
 using huawei::proto::StatusCode;
 
@@ -45,8 +48,9 @@ class AsyncTask {
     virtual bool ready() = 0;
     virtual void work()  = 0;
 
+    /*failed task also finish, interrupted backup resumed on recover*/
     bool finish() const {
-        return m_task_status == TASK_DONE ? true : false;
+        return (m_task_status == TASK_DONE || m_task_status == TASK_ERROR);
     }
 
  protected:
@@ -79,6 +83,36 @@ class LocalCreateTask : public AsyncTask, public IBackupCreate {
  protected:
     StatusCode do_full_backup() override;
     StatusCode do_incr_backup() override;
+
+    /*backup id of first run, or resume position of interrupted run*/
+    StatusCode prepare_backup_id(backup_attr_t& attr);
+    /*snapshots of previous and current backup*/
+    StatusCode incr_backup_snaps(std::string& pre_snap, std::string& cur_snap);
+    /*feed blocks changed between snapshots from diff stream*/
+    StatusCode stream_incr_backup(const std::string& pre_snap,
+                                  const std::string& cur_snap);
+    /*feeder feed chunks in offset order*/
+    StatusCode run_pipeline(const std::string& snap,
+                const std::function<void(BackupPipeline&)>& feeder);
+
+    /*pipeline stages, concurrent except commit*/
+    /*several blocks per snapshot read*/
+    StatusCode read_chunks(const std::string& snap,
+                           std::vector<backup_chunk_t>& chunks);
+    /*all zero block only mapped to BACKUP_ZERO_OBJECT without object*/
+    virtual StatusCode store_chunk(backup_chunk_t& chunk);
+    /*update block map, persist with progress every BACKUP_COMMIT_BATCH*/
+    virtual StatusCode commit_chunk(backup_chunk_t& chunk);
+    void flush_commit();
+
+ protected:
+    backupid_t m_backup_id;
+    /*blocks before it committed by interrupted run*/
+    off_t m_resume_pos;
+    int   m_writers;
+    IndexStore::Transaction m_commit_trans;
+    int   m_commit_count;
+    off_t m_commit_pos;
 };
 
 class RemoteCreateTask : public LocalCreateTask {
@@ -92,13 +126,34 @@ class RemoteCreateTask : public LocalCreateTask {
  protected:
     StatusCode do_full_backup() override;
     StatusCode do_incr_backup() override;
+    StatusCode store_chunk(backup_chunk_t& chunk) override;
+    StatusCode commit_chunk(backup_chunk_t& chunk) override;
  private:
+    /*drop current stream and open a new one*/
+    void connect();
+    /*start, upload and end on the stream; when link broken or remote
+     *failed, reconnect and resume from the position remote persisted*/
+    StatusCode remote_transfer(const std::function<StatusCode()>& upload);
     StatusCode remote_create_start();
+    /*zero block only send flag, no data carried; sync ask remote persist
+     *blocks before end_pos and ack*/
     StatusCode remote_create_upload(block_t blk_no, off_t blk_off,
-                                    char* blk_data, size_t blk_data_len);
+                                    char* blk_data, size_t blk_data_len,
+                                    bool blk_zero, off_t end_pos, bool sync);
+    /*consume one cumulative ack*/
+    StatusCode wait_upload_ack();
+    StatusCode handle_upload_ack(const TransferResponse& res);
     StatusCode remote_create_end();
  private:
+    std::unique_ptr<ClientContext> m_rpc_ctx;
     grpc_stream_ptr m_remote_stream;
+    /*failure worth reconnect and resume*/
+    bool  m_resumable;
+    /*blocks sent after last sync, sync sent but not acked*/
+    int   m_unsynced;
+    int   m_sync_inflight;
+    /*blocks before it persisted on remote*/
+    off_t m_acked_pos;
 };
 
 class IBackupDelete {
@@ -124,6 +179,9 @@ class LocalDeleteTask : public AsyncTask, public IBackupDelete {
     /*backup has depended*/
     StatusCode do_merge_backup(const std::string& cur_backup,
                                const std::string& next_backup) override;
+    /*drop block map reference of objects, hand objects no one refer to
+     *reclaimer; called after block map persist, crash only leak object*/
+    void release_objects(std::vector<backup_object_t>& objs);
 };
 
 class RemoteDeleteTask : public LocalDeleteTask {
@@ -8,6 +8,7 @@
 * Description:  general backup utility
 * 
 ***********************************************/
+#include <cstdlib>
 #include "log/log.h"
 #include "backup_util.h"
 
@@ -112,6 +113,46 @@ void split_backup_block_map_key(const std::string& raw_key,
     block_id  = atol(block.c_str());
 }
 
+std::string spawn_backup_progress_key(const backupid_t& backup_id) {
+    return spawn_key(BACKUP_PROGRESS_PREFIX, std::to_string(backup_id));
+}
+
+std::string spawn_backup_compact_map_key(const backupid_t& backup_id) {
+    return spawn_key(BACKUP_COMPACT_PREFIX, std::to_string(backup_id));
+}
+
+std::string spawn_backup_fp_key(const uint64_t& xxh,
+                                const backup_object_t& obj) {
+    std::string key = std::to_string(xxh);
+    key.append(BACKUP_FS);
+    key += obj;
+    return spawn_key(BACKUP_FP_PREFIX, key);
+}
+
+void split_backup_fp_key(const std::string& raw_key, uint64_t& xxh,
+                         backup_object_t& obj) {
+    std::string prefix;
+    std::string key;
+    split_key(raw_key, prefix, key);
+
+    std::string hash;
+    split_key(key, hash, obj);
+    xxh = strtoull(hash.c_str(), nullptr, 10);
+}
+
+std::string spawn_backup_ref_key(const backup_object_t& obj) {
+    return spawn_key(BACKUP_REF_PREFIX, obj);
+}
+
+std::string spawn_backup_gc_key(const backup_object_t& obj) {
+    return spawn_key(BACKUP_GC_PREFIX, obj);
+}
+
+void split_backup_gc_key(const std::string& raw_key, backup_object_t& obj) {
+    std::string prefix = BACKUP_GC_PREFIX;
+    obj = raw_key.substr(prefix.size() + 1);
+}
+
 std::string spawn_backup_object_name(const std::string& vol_name,
                                      const backupid_t& backup_id,
                                      const block_t& blk_id) {
@@ -124,3 +165,34 @@ std::string spawn_backup_object_name(const std::string& vol_name,
     backup_object_name.append(BACKUP_OBJ_SUFFIX);
     return backup_object_name;
 }
+
+bool split_backup_object_name(const backup_object_t& obj,
+                              std::string& vol_name, backupid_t& backup_id,
+                              block_t& blk_id) {
+    /*volume name may contain separator, parse from tail*/
+    std::string suffix = BACKUP_OBJ_SUFFIX;
+    if (obj.size() <= suffix.size() ||
+        obj.compare(obj.size() - suffix.size(), suffix.size(), suffix)) {
+        return false;
+    }
+    size_t end = obj.size() - suffix.size();
+    size_t blk_pos = obj.rfind(BACKUP_FS, end - 1);
+    if (blk_pos == std::string::npos || blk_pos == 0) {
+        return false;
+    }
+    size_t id_pos = obj.rfind(BACKUP_FS, blk_pos - 1);
+    if (id_pos == std::string::npos) {
+        return false;
+    }
+    std::string id_str = obj.substr(id_pos + 1, blk_pos - id_pos - 1);
+    std::string blk_str = obj.substr(blk_pos + 1, end - blk_pos - 1);
+    if (id_str.empty() || blk_str.empty() ||
+        id_str.find_first_not_of("0123456789") != std::string::npos ||
+        blk_str.find_first_not_of("0123456789") != std::string::npos) {
+        return false;
+    }
+    vol_name = obj.substr(0, id_pos);
+    backup_id = strtoull(id_str.c_str(), nullptr, 10);
+    blk_id = strtoull(blk_str.c_str(), nullptr, 10);
+    return true;
+}
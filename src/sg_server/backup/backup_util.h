@@ -30,8 +30,29 @@ std::string spawn_backup_block_map_key(const backupid_t & backup_id,
 void split_backup_block_map_key(const std::string& raw_key,
                                 backupid_t& backup_id, block_t& block_id);
 
+std::string spawn_backup_progress_key(const backupid_t& backup_id);
+
+/*compact block map of backup: prefix#backup_id*/
+std::string spawn_backup_compact_map_key(const backupid_t& backup_id);
+
+/*dedup fingerprint key: prefix#xxh64#object*/
+std::string spawn_backup_fp_key(const uint64_t& xxh,
+                                const backup_object_t& obj);
+void split_backup_fp_key(const std::string& raw_key, uint64_t& xxh,
+                         backup_object_t& obj);
+/*dedup refcount key: prefix#object, value: refcount#xxh64*/
+std::string spawn_backup_ref_key(const backup_object_t& obj);
+
+/*garbage object key: prefix#object*/
+std::string spawn_backup_gc_key(const backup_object_t& obj);
+void split_backup_gc_key(const std::string& raw_key, backup_object_t& obj);
+
 std::string spawn_backup_object_name(const std::string& vol_name,
                                      const backupid_t& backup_id,
                                      const block_t& blk_id);
+/*false if object name not spawned by spawn_backup_object_name*/
+bool split_backup_object_name(const backup_object_t& obj,
+                              std::string& vol_name, backupid_t& backup_id,
+                              block_t& blk_id);
 
 #endif  // SRC_SG_SERVER_BACKUP_BACKUP_UTIL_H_
@@ -85,7 +85,8 @@ int main(int argc, char** argv) {
     RpcServer repServer(ip2,port2,grpc::InsecureServerCredentials());
 
     RepMsgHandlers rep_msg_handler(meta/*JournalMetaManager*/,
-                                   meta /*VolumeMetaManager*/,mount_path);
+                                   meta /*VolumeMetaManager*/,mount_path,
+                                   snapMgr);
     BackupMsgHandler backup_msg_handler(backupMgr);
     NetReceiver netReceiver(rep_msg_handler, backup_msg_handler);
     repServer.register_service(&netReceiver);
@@ -141,6 +142,7 @@ int main(int argc, char** argv) {
     std::list<VolumeMeta> list;
     RESULT res = meta->list_volume_meta(list);
     if(DRS_OK == res){
+        map<string, size_t> meta_volumes;
         for(VolumeMeta& vol_meta:list){
             auto& vol = vol_meta.info().vol_id();
             GCTask::instance().add_volume(vol);
@@ -150,11 +152,11 @@ int main(int argc, char** argv) {
                 && vol_meta.info().rep_enable()) // no matter what replication status is
                 rep_scheduler.add_volume(vol);
 
-            /*snapshot meta init*/
-            snapMgr.add_volume(vol_meta.info().vol_id(), vol_meta.info().size());
-            /*backup meata init*/
-            backupMgr.add_volume(vol_meta.info().vol_id(), vol_meta.info().size());
+            meta_volumes.insert({vol_meta.info().vol_id(), vol_meta.info().size()});
         }
+        /*snapshot and backup meta init, volumes recover concurrently*/
+        snapMgr.add_volumes(meta_volumes);
+        backupMgr.add_volumes(meta_volumes);
         GCTask::instance().set_volumes_initialized(true);
     }
     else{
@@ -0,0 +1,123 @@
+/**********************************************
+* Copyright (c) 2016 Huawei Technologies Co., Ltd. All rights reserved.
+* 
+* File name:    block_hashes.cc
+* Author: 
+* Date:         2017/07/21
+* Version:      1.0
+* Description:  block hashes of peer volume for base sync
+* 
+************************************************/
+#include <chrono>
+#include <algorithm>
+#include <openssl/sha.h>
+#include "log/log.h"
+#include "common/utils.h"
+#include "block_hashes.h"
+
+std::string rep_block_hash(const char* buf,const size_t& len){
+    if(buf_is_zero(buf,len)){
+        return std::string();
+    }
+    unsigned char digest[SHA256_DIGEST_LENGTH];
+    SHA256((const unsigned char*)buf,len,digest);
+    return std::string((const char*)digest,SHA256_DIGEST_LENGTH);
+}
+
+PeerBlockHashes::PeerBlockHashes(const uint64_t& blk_size,
+        const uint64_t& vol_size):
+        blk_size_(blk_size),
+        blk_count_((vol_size + blk_size - 1) / blk_size),
+        requested_(0),
+        cursor_(0),
+        disabled_(false),
+        waited_(0),
+        late_(0){
+}
+
+bool PeerBlockHashes::next_request(uint64_t& start,uint64_t& count){
+    std::lock_guard<std::mutex> lck(mtx_);
+    if(disabled_ || requested_ >= blk_count_){
+        return false;
+    }
+    uint64_t ahead = REP_HASH_PREFETCH_WINDOWS * REP_HASH_WINDOW_BLOCKS;
+    if(requested_ > cursor_ && requested_ - cursor_ >= ahead){
+        return false;
+    }
+    start = requested_;
+    count = std::min((uint64_t)REP_HASH_WINDOW_BLOCKS,blk_count_ - start);
+    requested_ += count;
+    return true;
+}
+
+void PeerBlockHashes::on_ack(const ReplicateHashAck& ack){
+    std::lock_guard<std::mutex> lck(mtx_);
+    uint64_t start = ack.start_blk();
+    uint64_t expect = std::min((uint64_t)REP_HASH_WINDOW_BLOCKS,
+        blk_count_ > start ? blk_count_ - start : 0);
+    if(start % REP_HASH_WINDOW_BLOCKS != 0
+        || (uint64_t)ack.hash_size() != expect){
+        LOG_WARN << "unexpected block hashes from peer, start:" << start
+            << ",count:" << ack.hash_size();
+        return;
+    }
+    std::vector<std::string>& hashes = windows_[start];
+    hashes.assign(ack.hash().begin(),ack.hash().end());
+    late_ = 0;
+    cond_.notify_all();
+}
+
+void PeerBlockHashes::on_fail(){
+    std::lock_guard<std::mutex> lck(mtx_);
+    LOG_WARN << "peer failed to hash blocks, send blocks without compare";
+    disabled_ = true;
+    cond_.notify_all();
+}
+
+int PeerBlockHashes::match(const uint64_t& blk,const char* buf,
+        const size_t& len,const bool& zero){
+    uint64_t start = blk - blk % REP_HASH_WINDOW_BLOCKS;
+    std::unique_lock<std::mutex> lck(mtx_);
+    cursor_ = blk;
+    // windows behind cursor never used again
+    windows_.erase(windows_.begin(),windows_.lower_bound(start));
+    if(disabled_ || blk >= requested_){
+        return -1;
+    }
+    if(windows_.count(start) == 0){
+        // blocks of a late window go without compare, wait only once
+        if(waited_ == start + 1){
+            return -1;
+        }
+        waited_ = start + 1;
+        bool ready = cond_.wait_for(lck,
+            std::chrono::milliseconds(REP_HASH_WAIT_MS),[&]{
+                return disabled_ || windows_.count(start) > 0;});
+        if(!ready && ++late_ >= REP_HASH_MAX_LATE_WINDOWS){
+            LOG_WARN << "peer block hashes late, start:" << start
+                << ", send blocks without compare";
+            disabled_ = true;
+        }
+        if(!ready){
+            return -1;
+        }
+    }
+    if(disabled_){
+        return -1;
+    }
+    std::string peer = windows_[start][blk - start];
+    lck.unlock();
+    // hash is empty for zero block, no need to scan it
+    std::string local = zero ? std::string() : rep_block_hash(buf,len);
+    return local == peer ? 1 : 0;
+}
+
+void PeerBlockHashes::reset(){
+    std::lock_guard<std::mutex> lck(mtx_);
+    requested_ = 0;
+    cursor_ = 0;
+    disabled_ = false;
+    waited_ = 0;
+    late_ = 0;
+    windows_.clear();
+}
@@ -0,0 +1,64 @@
+/**********************************************
+* Copyright (c) 2016 Huawei Technologies Co., Ltd. All rights reserved.
+* 
+* File name:    block_hashes.h
+* Author: 
+* Date:         2017/07/21
+* Version:      1.0
+* Description:  block hashes of peer volume for base sync
+* 
+************************************************/
+#ifndef BLOCK_HASHES_H_
+#define BLOCK_HASHES_H_
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <condition_variable>
+#include "rpc/transfer.pb.h"
+using huawei::proto::transfer::ReplicateHashAck;
+
+// blocks of one hash request, 256MB of data in 8KB of hashes
+#define REP_HASH_WINDOW_BLOCKS (256)
+// windows asked ahead of the block being sent
+#define REP_HASH_PREFETCH_WINDOWS (2)
+// longest a block waits for its window of hashes, sent without compare
+// after it; sending never stalls on a slow peer
+#define REP_HASH_WAIT_MS (100)
+// windows late in a row, peer too slow or an old one, stop asking it
+#define REP_HASH_MAX_LATE_WINDOWS (4)
+
+// strong hash of block, empty if block all zero
+std::string rep_block_hash(const char* buf,const size_t& len);
+
+// hashes of blocks the peer volume already has, pulled window by window
+// ahead of base sync cursor; a block hashed same on both sides is not sent
+class PeerBlockHashes{
+    uint64_t blk_size_;
+    uint64_t blk_count_;
+    std::mutex mtx_;
+    std::condition_variable cond_;
+    uint64_t requested_; // blocks before it were asked
+    uint64_t cursor_; // block being compared
+    bool disabled_; // peer failed or never answered
+    uint64_t waited_; // start blk + 1 of window already waited for
+    int late_; // windows not answered in time since last answer
+    std::map<uint64_t,std::vector<std::string>> windows_; // start blk -> hashes
+public:
+    PeerBlockHashes(const uint64_t& blk_size,const uint64_t& vol_size);
+    ~PeerBlockHashes(){}
+
+    // next window to ask peer, false if enough windows asked ahead
+    bool next_request(uint64_t& start,uint64_t& count);
+    void on_ack(const ReplicateHashAck& ack);
+    void on_fail();
+    // 1 if peer has same block, 0 if differ, -1 if peer hash unknown;
+    // wait a short while once for the window of blk if it was asked
+    // but not answered
+    int match(const uint64_t& blk,const char* buf,const size_t& len,
+            const bool& zero);
+    // ask from first block again
+    void reset();
+};
+#endif
@@ -0,0 +1,87 @@
+/**********************************************
+* Copyright (c) 2016 Huawei Technologies Co., Ltd. All rights reserved.
+* 
+* File name:    chunk_sizer.cc
+* Author: 
+* Date:         2017/07/14
+* Version:      1.0
+* Description:  adapt journal chunk size to replication link
+* 
+************************************************/
+#include <algorithm>
+#include "log/log.h"
+#include "chunk_sizer.h"
+
+// weight of new sample in smoothed value
+#define CHUNK_SIZER_GAIN (0.125)
+
+ChunkSizer::ChunkSizer(const std::string& vol_name):
+        vol_(vol_name),
+        rtt_(0),
+        bw_(0),
+        inflight_(0),
+        acked_(0),
+        chunk_(REP_CHUNK_INIT){
+}
+
+size_t ChunkSizer::chunk_size()const{
+    return chunk_.load();
+}
+
+double ChunkSizer::bandwidth(){
+    std::lock_guard<std::mutex> lck(mtx_);
+    return bw_;
+}
+
+void ChunkSizer::on_reply(const double& rtt){
+    if(rtt <= 0)
+        return;
+    std::lock_guard<std::mutex> lck(mtx_);
+    rtt_ = rtt_ == 0 ? rtt : rtt_ + (rtt - rtt_) * CHUNK_SIZER_GAIN;
+    adjust();
+}
+
+void ChunkSizer::on_task_sent(const time_point& now){
+    std::lock_guard<std::mutex> lck(mtx_);
+    // link was idle, sample starts now
+    if(inflight_++ == 0){
+        acked_ = 0;
+        sample_start_ = now;
+    }
+}
+
+void ChunkSizer::on_task_done(const uint64_t& acked,const time_point& now){
+    std::lock_guard<std::mutex> lck(mtx_);
+    if(inflight_ > 0)
+        inflight_--;
+    acked_ += acked;
+    double seconds = std::chrono::duration<double>(now - sample_start_).count();
+    // sample once a period, or when no task left in flight
+    if(inflight_ > 0 && seconds < REP_CHUNK_SAMPLE_SECONDS)
+        return;
+    // few bytes are dominated by round trip, not a bandwidth sample
+    if(acked_ >= REP_CHUNK_MIN && seconds > 0){
+        double bw = acked_ / seconds;
+        bw_ = bw_ == 0 ? bw : bw_ + (bw - bw_) * CHUNK_SIZER_GAIN;
+        adjust();
+    }
+    acked_ = 0;
+    sample_start_ = now;
+}
+
+void ChunkSizer::adjust(){
+    if(rtt_ == 0 || bw_ == 0)
+        return;
+    size_t cur = chunk_.load();
+    size_t target = (size_t)(bw_ * rtt_ / REP_CHUNK_PER_RTT);
+    // at most double or halve each time, avoid oscillation
+    target = std::min(target, cur * 2);
+    target = std::max(target, cur / 2);
+    target = std::min(std::max(target, (size_t)REP_CHUNK_MIN),
+                      (size_t)REP_CHUNK_MAX);
+    if(target != cur){
+        chunk_.store(target);
+        LOG_DEBUG << vol_ << " replicate chunk size:" << target
+            << ",rtt:" << rtt_ << ",bw:" << bw_;
+    }
+}
@@ -0,0 +1,58 @@
+/**********************************************
+* Copyright (c) 2016 Huawei Technologies Co., Ltd. All rights reserved.
+* 
+* File name:    chunk_sizer.h
+* Author: 
+* Date:         2017/07/14
+* Version:      1.0
+* Description:  adapt journal chunk size to replication link
+* 
+************************************************/
+#ifndef CHUNK_SIZER_H_
+#define CHUNK_SIZER_H_
+#include <cstdint>
+#include <string>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+
+#define REP_CHUNK_MIN (64*1024UL)
+// keep data request well below grpc default 4MB message limit
+#define REP_CHUNK_MAX (2*1024*1024UL)
+#define REP_CHUNK_INIT (512*1024UL)
+// chunks in flight per round trip
+#define REP_CHUNK_PER_RTT (4)
+// period of one bandwidth sample while tasks in flight, in seconds
+#define REP_CHUNK_SAMPLE_SECONDS (0.5)
+
+// chunk size of journal data request of one replication pair: a part of
+// measured bandwidth-delay product, so long fat links keep several chunks
+// in flight per round trip while short links use small chunks; bandwidth
+// is bytes acknowledged per second while any task of the pair is in
+// flight, so tasks queued behind each other do not count the wait
+class ChunkSizer{
+    typedef std::chrono::steady_clock::time_point time_point;
+    std::string vol_;
+    std::mutex mtx_;
+    double rtt_; // smoothed round trip of replicate command, in seconds
+    double bw_; // smoothed bytes per second acknowledged
+    int inflight_; // tasks sent and not completed
+    uint64_t acked_; // bytes acknowledged since sample start
+    time_point sample_start_;
+    std::atomic<size_t> chunk_;
+    void adjust();
+public:
+    explicit ChunkSizer(const std::string& vol_name);
+    ~ChunkSizer(){}
+
+    size_t chunk_size()const;
+    double bandwidth();
+    // reply of replicate command arrived after rtt seconds
+    void on_reply(const double& rtt);
+    // task starts sending
+    void on_task_sent(const time_point& now);
+    // task completed, acked is its data bytes if succeeded, else 0
+    void on_task_done(const uint64_t& acked,const time_point& now);
+};
+
+#endif
@@ -0,0 +1,293 @@
+/**********************************************
+* Copyright (c) 2016 Huawei Technologies Co., Ltd. All rights reserved.
+* 
+* File name:    journal_collapse.cc
+* Author: 
+* Date:         2017/07/17
+* Version:      1.0
+* Description:  collapse overwritten journal entries of replication window
+* 
+************************************************/
+#include <unistd.h>
+#include <errno.h>
+#include <map>
+#include <sstream>
+#include <algorithm>
+#include <google/protobuf/io/coded_stream.h>
+#include <google/protobuf/wire_format_lite.h>
+#include "log/log.h"
+#include "common/define.h"
+#include "common/crc32.h"
+#include "common/config_option.h"
+#include "rpc/message.pb.h"
+#include "journal_collapse.h"
+using google::protobuf::io::CodedInputStream;
+using google::protobuf::io::CodedOutputStream;
+using google::protobuf::internal::WireFormatLite;
+using huawei::proto::DiskPos;
+
+// entry layout: type(4) + length(4) + message + crc(4)
+#define ENTRY_HEAD_LEN (8)
+#define ENTRY_EXTRA_LEN (12)
+// pos fields are ahead of data in write message, read this much first
+#define POS_PREFIX_LEN (4096)
+
+typedef struct extent_t{
+    uint64_t off;
+    uint64_t len;
+}extent_t;
+
+typedef struct entry_t{
+    uint64_t off; // in journal file
+    uint64_t size; // persist size
+    bool barrier; // not io, never superseded and stop collapsing
+    std::vector<extent_t> extents;
+}entry_t;
+
+// disk ranges written later in window, merged, start -> end
+class CoverSet{
+    std::map<uint64_t,uint64_t> ranges_;
+public:
+    bool covers(const uint64_t& off,const uint64_t& len)const{
+        auto it = ranges_.upper_bound(off);
+        if(it == ranges_.begin())
+            return false;
+        --it;
+        return it->second >= off + len;
+    }
+    void add(uint64_t off,uint64_t len){
+        uint64_t end = off + len;
+        auto it = ranges_.upper_bound(off);
+        if(it != ranges_.begin()){
+            auto prev = std::prev(it);
+            if(prev->second >= off){
+                off = prev->first;
+                end = std::max(end,prev->second);
+                it = ranges_.erase(prev);
+            }
+        }
+        while(it != ranges_.end() && it->first <= end){
+            end = std::max(end,it->second);
+            it = ranges_.erase(it);
+        }
+        ranges_[off] = end;
+    }
+    void clear(){
+        ranges_.clear();
+    }
+};
+
+bool journal_collapse_enabled(const std::string& vol_name){
+    if(g_option.replicate_collapse)
+        return true;
+    std::stringstream volumes(g_option.replicate_collapse_volumes);
+    std::string vol;
+    while(getline(volumes,vol,',')){
+        if(vol == vol_name)
+            return true;
+    }
+    return false;
+}
+
+static bool read_full(const int fd,char* buf,const size_t& len,
+        const uint64_t& off){
+    size_t done = 0;
+    while(done < len){
+        ssize_t ret = ::pread(fd,buf + done,len - done,off + done);
+        if(ret < 0 && errno == EINTR)
+            continue;
+        if(ret <= 0)
+            return false;
+        done += ret;
+    }
+    return true;
+}
+
+// parse pos of write message, false if message incomplete, a truncated
+// prefix is only complete once data field is seen
+static bool parse_extents(const std::string& msg,const bool& truncated,
+        std::vector<extent_t>& extents){
+    extents.clear();
+    CodedInputStream in((const uint8_t*)msg.data(),msg.size());
+    uint32_t tag;
+    while((tag = in.ReadTag()) != 0){
+        int field = WireFormatLite::GetTagFieldNumber(tag);
+        if(field == 1){
+            std::string pos_buf;
+            uint32_t len;
+            DiskPos pos;
+            if(!in.ReadVarint32(&len) || !in.ReadString(&pos_buf,len)
+                || !pos.ParseFromString(pos_buf)){
+                return false;
+            }
+            if(pos.length() > 0){
+                extents.push_back({pos.offset(),pos.length()});
+            }
+        }
+        else if(field == 2){
+            return true; // data follows all pos
+        }
+        else if(!WireFormatLite::SkipField(&in,tag)){
+            return false;
+        }
+    }
+    return !truncated && in.ConsumedEntireMessage();
+}
+
+static bool scan_entries(const int fd,const uint64_t& start,
+        const uint64_t& end,std::vector<entry_t>& entries){
+    uint64_t off = start;
+    std::string msg;
+    while(off + ENTRY_EXTRA_LEN <= end){
+        uint32_t head[2];
+        if(!read_full(fd,(char*)head,ENTRY_HEAD_LEN,off))
+            return false;
+        uint32_t type = head[0];
+        uint64_t size = ENTRY_EXTRA_LEN + head[1];
+        if(off + size > end)
+            return false;
+        entry_t e;
+        e.off = off;
+        e.size = size;
+        e.barrier = (type != IO_WRITE);
+        if(type == IO_WRITE){
+            size_t len = std::min((size_t)head[1],(size_t)POS_PREFIX_LEN);
+            msg.resize(len);
+            if(len && !read_full(fd,&msg[0],len,off + ENTRY_HEAD_LEN))
+                return false;
+            if(!parse_extents(msg,len < head[1],e.extents)){
+                // merged io with many pos, read whole message
+                msg.resize(head[1]);
+                if(!read_full(fd,&msg[0],head[1],off + ENTRY_HEAD_LEN)
+                    || !parse_extents(msg,false,e.extents))
+                    return false;
+            }
+        }
+        else if(type != SNAPSHOT_CREATE && type != SNAPSHOT_DELETE
+                && type != SNAPSHOT_ROLLBACK){
+            return false;
+        }
+        entries.push_back(std::move(e));
+        off += size;
+    }
+    return true;
+}
+
+static void add_segment(std::vector<CollapseSegment>& segments,
+        const uint64_t& off,const uint64_t& len,const bool& fill){
+    if(len == 0)
+        return;
+    if(!segments.empty() && segments.back().fill == fill
+        && segments.back().off + segments.back().len == off){
+        segments.back().len += len;
+        return;
+    }
+    segments.push_back({off,len,fill});
+}
+
+uint64_t collapse_journal_window(const int fd,const uint64_t& start,
+        const uint64_t& end,std::vector<CollapseSegment>& segments){
+    segments.clear();
+    std::vector<entry_t> entries;
+    if(!scan_entries(fd,start,end,entries)){
+        LOG_WARN << "collapse scan stop at entry:" << entries.size()
+            << ", rest of window sent as data";
+    }
+
+    // walk back, entry superseded if later writes cover all its extents
+    std::vector<bool> superseded(entries.size(),false);
+    CoverSet covered;
+    for(size_t i = entries.size(); i > 0; i--){
+        entry_t& e = entries[i-1];
+        if(e.barrier){
+            covered.clear();
+            continue;
+        }
+        bool all = true;
+        for(auto& x:e.extents){
+            if(!covered.covers(x.off,x.len)){
+                all = false;
+                break;
+            }
+        }
+        superseded[i-1] = all; // no-op entry too
+        for(auto& x:e.extents){
+            covered.add(x.off,x.len);
+        }
+    }
+
+    std::vector<CollapseSegment> raw;
+    uint64_t off = start;
+    for(size_t i = 0; i < entries.size(); i++){
+        add_segment(raw,entries[i].off,entries[i].size,superseded[i]);
+        off = entries[i].off + entries[i].size;
+    }
+    add_segment(raw,off,end - off,false);
+
+    // short fills are not worth a request
+    uint64_t filled = 0;
+    for(auto& s:raw){
+        bool fill = s.fill && s.len >= FILL_ENTRY_MIN;
+        add_segment(segments,s.off,s.len,fill);
+        if(fill)
+            filled += s.len;
+    }
+    return filled;
+}
+
+// length of zero data making write message exactly msg_len, false if
+// no such length
+static bool fill_data_len(const uint64_t& msg_len,uint64_t& data_len){
+    if(msg_len == 0){
+        data_len = 0;
+        return true;
+    }
+    for(int v = 1; v <= 5; v++){
+        if(msg_len < (uint64_t)(1 + v))
+            break;
+        uint64_t n = msg_len - 1 - v;
+        if(CodedOutputStream::VarintSize64(n) == v){
+            data_len = n;
+            return true;
+        }
+    }
+    return false;
+}
+
+static void append_fill_entry(const uint64_t& size,std::string& out){
+    uint64_t data_len = 0;
+    uint32_t msg_len = size - ENTRY_EXTRA_LEN;
+    SG_ASSERT(fill_data_len(msg_len,data_len));
+    std::string msg;
+    if(msg_len){
+        const uint32_t tag = WireFormatLite::MakeTag(2,
+            WireFormatLite::WIRETYPE_LENGTH_DELIMITED);
+        msg.resize(msg_len,'\0');
+        uint8_t* p = (uint8_t*)&msg[0];
+        p = CodedOutputStream::WriteTagToArray(tag,p);
+        CodedOutputStream::WriteVarint64ToArray(data_len,p);
+    }
+    uint32_t type = IO_WRITE;
+    uint32_t crc = crc32c(msg.data(),msg.size(),0);
+    out.append((char*)&type,sizeof(type));
+    out.append((char*)&msg_len,sizeof(msg_len));
+    out.append(msg);
+    out.append((char*)&crc,sizeof(crc));
+}
+
+void build_fill_entries(const uint64_t& len,std::string& out){
+    uint64_t left = len;
+    while(left > 0){
+        uint64_t piece = std::min(left,(uint64_t)FILL_ENTRY_MAX);
+        if(left - piece > 0 && left - piece < FILL_ENTRY_MIN){
+            piece = left - FILL_ENTRY_MIN;
+        }
+        uint64_t data_len;
+        if(!fill_data_len(piece - ENTRY_EXTRA_LEN,data_len)){
+            // few lengths have no exact message, split off a small entry
+            piece = FILL_ENTRY_MIN;
+        }
+        append_fill_entry(piece,out);
+        left -= piece;
+    }
+}
@@ -0,0 +1,45 @@
+/**********************************************
+* Copyright (c) 2016 Huawei Technologies Co., Ltd. All rights reserved.
+* 
+* File name:    journal_collapse.h
+* Author: 
+* Date:         2017/07/17
+* Version:      1.0
+* Description:  collapse overwritten journal entries of replication window
+* 
+************************************************/
+#ifndef JOURNAL_COLLAPSE_H_
+#define JOURNAL_COLLAPSE_H_
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// fill shorter than this is sent as data
+#define FILL_ENTRY_MIN (64)
+// max length of one no-op entry built by receiver
+#define FILL_ENTRY_MAX (1024*1024UL)
+
+// range of journal window to send: journal data, or superseded entries
+// which receiver fills with no-op entries of the same length
+typedef struct CollapseSegment{
+    uint64_t off;
+    uint64_t len;
+    bool fill;
+}CollapseSegment;
+
+// whether collapse is configured for the volume: replicate.collapse or
+// listed in replicate.collapse_volumes
+bool journal_collapse_enabled(const std::string& vol_name);
+
+// plan journal range [start,end) of one replication window: an io entry
+// whose extents are all rewritten later in the window is superseded;
+// snapshot entries are barriers, writes before them are always sent.
+// window ends at a consumer marker, so the secondary replay is the same
+// as source there. unparsable tail is sent as data. return filled bytes
+uint64_t collapse_journal_window(const int fd,const uint64_t& start,
+        const uint64_t& end,std::vector<CollapseSegment>& segments);
+
+// append no-op io entries(no disk pos) exactly len bytes long to out
+void build_fill_entries(const uint64_t& len,std::string& out);
+
+#endif
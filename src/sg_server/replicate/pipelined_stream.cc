@@ -0,0 +1,212 @@
+/**********************************************
+* Copyright (c) 2016 Huawei Technologies Co., Ltd. All rights reserved.
+* 
+* File name:    pipelined_stream.cc
+* Author: 
+* Date:         2017/07/14
+* Version:      1.0
+* Description:  replicate stream shared by in-flight tasks
+* 
+************************************************/
+#include <vector>
+#include "log/log.h"
+#include "pipelined_stream.h"
+#include "rep_task.h"
+using grpc::Status;
+
+PipelinedStream::PipelinedStream(pipe_stream_ptr stream,int max_inflight,
+        sg_threads::ThreadPool& done_pool):
+        stream_(stream),
+        done_pool_(done_pool),
+        inflight_(0),
+        max_inflight_(max_inflight),
+        broken_(false){
+    reader_ = std::thread(&PipelinedStream::read_replies,this);
+}
+
+PipelinedStream::~PipelinedStream(){
+    if(reader_.joinable()){
+        reader_.join();
+    }
+}
+
+bool PipelinedStream::acquire(){
+    std::unique_lock<std::mutex> lck(mtx_);
+    cond_.wait(lck,[this]{return broken_ || inflight_ < max_inflight_;});
+    if(broken_)
+        return false;
+    inflight_++;
+    return true;
+}
+
+bool PipelinedStream::expect_reply(const uint64_t& id,
+        std::shared_ptr<InflightTask>& t,const bool& counted){
+    std::lock_guard<std::mutex> lck(mtx_);
+    if(broken_)
+        return false;
+    if(counted)
+        t->pending++;
+    PendingReply& r = replies_[id];
+    r.task = t;
+    r.sent = std::chrono::steady_clock::now();
+    r.counted = counted;
+    return true;
+}
+
+bool PipelinedStream::write(const TransferRequest& req){
+    if(stream_->Write(req))
+        return true;
+    LOG_ERROR << "replicate grpc write failed, id=" << req.id();
+    set_broken();
+    return false;
+}
+
+void PipelinedStream::finish_task(std::shared_ptr<InflightTask>& t,
+        bool failed){
+    bool done = false;
+    {
+        std::lock_guard<std::mutex> lck(mtx_);
+        t->all_sent = true;
+        t->failed = t->failed || failed;
+        done = (t->pending == 0);
+    }
+    if(done){
+        complete(t);
+    }
+}
+
+bool PipelinedStream::broken(){
+    std::lock_guard<std::mutex> lck(mtx_);
+    return broken_;
+}
+
+void PipelinedStream::drain(){
+    std::unique_lock<std::mutex> lck(mtx_);
+    cond_.wait(lck,[this]{return inflight_ == 0;});
+}
+
+void PipelinedStream::close(){
+    stream_->WritesDone();
+    if(reader_.joinable()){
+        reader_.join();
+    }
+    // callbacks in done pool still use this stream
+    drain();
+    Status status = stream_->Finish();
+    if (!status.ok()) {
+        LOG_ERROR << "replicate client close stream failed!";
+    }
+}
+
+void PipelinedStream::read_replies(){
+    TransferResponse res;
+    while(stream_->Read(&res)){ // blocked
+        std::shared_ptr<InflightTask> t;
+        double rtt = 0;
+        bool done = false;
+        bool counted = true;
+        {
+            std::lock_guard<std::mutex> lck(mtx_);
+            auto it = replies_.find(res.id());
+            if(it == replies_.end()){
+                LOG_WARN << "reply of unknown replicate cmd, id=" << res.id();
+                continue;
+            }
+            t = it->second.task;
+            rtt = std::chrono::duration<double>(
+                std::chrono::steady_clock::now() - it->second.sent).count();
+            counted = it->second.counted;
+            replies_.erase(it);
+        }
+        if(!counted){
+            // data for task, it handles failure itself
+            t->task->on_reply(res);
+            continue;
+        }
+        {
+            std::lock_guard<std::mutex> lck(mtx_);
+            if(res.status()){
+                LOG_ERROR << "destination handle replicate cmd failed!, task id:"
+                    << t->task->get_id();
+                t->failed = true;
+            }
+            t->pending--;
+            done = (t->pending == 0 && t->all_sent);
+        }
+        if(!res.status()){
+            std::shared_ptr<RepContext> rep_ctx =
+                std::dynamic_pointer_cast<RepContext>(t->task->get_context());
+            if(rep_ctx && rep_ctx->get_codec()){
+                rep_ctx->get_codec()->on_accept(res.accept_encode(),
+                    res.accept_fill());
+            }
+            if(rep_ctx && rep_ctx->get_sizer()){
+                rep_ctx->get_sizer()->on_reply(rtt);
+            }
+        }
+        if(done){
+            complete(t);
+        }
+    }
+    LOG_INFO << "replicate stream reader exit";
+    set_broken();
+}
+
+void PipelinedStream::set_broken(){
+    std::vector<std::shared_ptr<InflightTask>> done_tasks;
+    {
+        std::lock_guard<std::mutex> lck(mtx_);
+        broken_ = true;
+        // a task may wait for several replies, complete it only once
+        for(auto it=replies_.begin(); it!=replies_.end(); ++it){
+            std::shared_ptr<InflightTask>& t = it->second.task;
+            if(!it->second.counted)
+                continue;
+            t->failed = true;
+            if(t->pending > 0){
+                t->pending = 0;
+                if(t->all_sent)
+                    done_tasks.push_back(t);
+            }
+        }
+        replies_.clear();
+    }
+    cond_.notify_all();
+    for(auto& t:done_tasks){
+        complete(t);
+    }
+}
+
+void PipelinedStream::complete(std::shared_ptr<InflightTask> t){
+    // callback takes lock of replicator and may wait for marker queue
+    if(!done_pool_.submit([this,t](){run_complete(t);})){
+        run_complete(t);
+    }
+}
+
+void PipelinedStream::run_complete(std::shared_ptr<InflightTask> t){
+    std::shared_ptr<TransferTask>& task = t->task;
+    std::shared_ptr<RepContext> rep_ctx =
+        std::dynamic_pointer_cast<RepContext>(task->get_context());
+    if(rep_ctx && rep_ctx->get_sizer()){
+        rep_ctx->get_sizer()->on_task_done(t->failed ? 0 : t->bytes,
+            std::chrono::steady_clock::now());
+    }
+    if(t->failed){
+        // note: if failed, do not run callback function,
+        // or task window goes wrong
+        task->set_status(T_ERROR);
+    }
+    else{
+        task->set_status(T_DONE);
+        LOG_DEBUG << "task id:" << task->get_id()
+            << ",vol:" << rep_ctx->get_vol_id()
+            << ",journal:" << rep_ctx->get_j_counter();
+        rep_ctx->get_callback()(task);
+    }
+    {
+        std::lock_guard<std::mutex> lck(mtx_);
+        inflight_--;
+    }
+    cond_.notify_all();
+}
@@ -0,0 +1,91 @@
+/**********************************************
+* Copyright (c) 2016 Huawei Technologies Co., Ltd. All rights reserved.
+* 
+* File name:    pipelined_stream.h
+* Author: 
+* Date:         2017/07/14
+* Version:      1.0
+* Description:  replicate stream shared by in-flight tasks
+* 
+************************************************/
+#ifndef PIPELINED_STREAM_H_
+#define PIPELINED_STREAM_H_
+#include <map>
+#include <mutex>
+#include <thread>
+#include <chrono>
+#include <memory>
+#include <condition_variable>
+#include "rpc/transfer.grpc.pb.h"
+#include "common/thread_pool.h"
+#include "sg_server/transfer/transfer_task.h"
+
+typedef std::shared_ptr<grpc::ClientReaderWriterInterface<TransferRequest,
+        TransferResponse>> pipe_stream_ptr;
+
+// task whose commands are waiting for replies
+typedef struct InflightTask{
+    std::shared_ptr<TransferTask> task;
+    int pending; // commands not replied
+    bool all_sent; // all packages written to stream
+    bool failed;
+    uint64_t bytes; // bytes written, for link bandwidth
+    explicit InflightTask(std::shared_ptr<TransferTask> t):
+        task(t),pending(0),all_sent(false),failed(false),bytes(0){}
+}InflightTask;
+
+// command waiting for reply
+typedef struct PendingReply{
+    std::shared_ptr<InflightTask> task;
+    std::chrono::steady_clock::time_point sent;
+    bool counted; // task waits for it, else reply only carries data to task
+}PendingReply;
+
+// stream shared by many in-flight tasks: commands are written without
+// waiting for reply, a reader thread correlates replies with commands by
+// id and completes a task once all of its commands are replied; callbacks
+// of completed tasks run in the done pool of handler, so a slow callback
+// never holds up replies of other tasks
+class PipelinedStream{
+    pipe_stream_ptr stream_;
+    sg_threads::ThreadPool& done_pool_;
+    std::mutex mtx_;
+    std::condition_variable cond_;
+    // command id -> task waiting for its reply
+    std::map<uint64_t,PendingReply> replies_;
+    int inflight_; // tasks not completed
+    int max_inflight_;
+    bool broken_;
+    std::thread reader_;
+
+    void read_replies();
+    // mark stream broken and fail all tasks waiting for replies
+    void set_broken();
+    // hand task over to done pool
+    void complete(std::shared_ptr<InflightTask> t);
+    // set task done and run callback, or mark it failed to be redone
+    void run_complete(std::shared_ptr<InflightTask> t);
+public:
+    PipelinedStream(pipe_stream_ptr stream,int max_inflight,
+            sg_threads::ThreadPool& done_pool);
+    ~PipelinedStream();
+    PipelinedStream(PipelinedStream&) = delete;
+    PipelinedStream& operator=(PipelinedStream const&) = delete;
+
+    // block until a task slot is free; false if stream broken
+    bool acquire();
+    // register command before writing it, so its reply is never missed;
+    // task never waits for a not counted reply, it may never come
+    bool expect_reply(const uint64_t& id,std::shared_ptr<InflightTask>& t,
+            const bool& counted=true);
+    bool write(const TransferRequest& req);
+    // all packages of task were written or it failed; task completes
+    // here if no reply pending
+    void finish_task(std::shared_ptr<InflightTask>& t,bool failed);
+    bool broken();
+    // wait for all in-flight tasks completed
+    void drain();
+    // close write side, wait for reader exit and callbacks of tasks
+    void close();
+};
+#endif
@@ -0,0 +1,112 @@
+/**********************************************
+* Copyright (c) 2016 Huawei Technologies Co., Ltd. All rights reserved.
+* 
+* File name:    rep_journal_file.cc
+* Author: 
+* Date:         2017/07/19
+* Version:      1.0
+* Description:  journal file written by replication receiver
+* 
+************************************************/
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <memory>
+#include "log/log.h"
+#include "rep_journal_file.h"
+
+RepJournalFile::RepJournalFile(const std::string& path):
+        path_(path),fd_(-1),pending_(0),failed_(false){
+}
+
+RepJournalFile::~RepJournalFile(){
+    close();
+}
+
+bool RepJournalFile::open(const uint64_t& prealloc){
+    fd_ = ::open(path_.c_str(),O_WRONLY);
+    if(fd_ < 0){
+        LOG_ERROR << "open journal file failed:" << path_
+            << ",errno:" << errno;
+        return false;
+    }
+    // keep size, so replayer never read the reserved zeros as entries
+    if(prealloc > 0
+        && fallocate(fd_,FALLOC_FL_KEEP_SIZE,0,prealloc) != 0){
+        LOG_DEBUG << "preallocate journal file " << path_
+            << " failed:" << strerror(errno);
+    }
+    return true;
+}
+
+void RepJournalFile::write_done(bool ok){
+    std::lock_guard<std::mutex> lck(mtx_);
+    if(!ok){
+        failed_ = true;
+    }
+    if(--pending_ == 0){
+        cond_.notify_all();
+    }
+}
+
+bool RepJournalFile::write_async(sg_threads::ThreadPool& pool,
+        const uint64_t& offset,std::string&& data){
+    std::unique_lock<std::mutex> lck(mtx_);
+    ++pending_;
+    lck.unlock();
+    // pool copies the task, share the data instead of copying it
+    std::shared_ptr<std::string> buf(new std::string(std::move(data)));
+    bool ret = pool.submit([this,offset,buf](){
+        const char* p = buf->data();
+        size_t left = buf->size();
+        off_t off = offset;
+        while(left > 0){
+            ssize_t n = ::pwrite(fd_,p,left,off);
+            if(n < 0 && errno == EINTR){
+                continue;
+            }
+            if(n <= 0){
+                LOG_ERROR << "write journal file " << path_ << " failed, offset:"
+                    << off << ",errno:" << errno;
+                write_done(false);
+                return;
+            }
+            p += n;
+            left -= n;
+            off += n;
+        }
+        write_done(true);
+    });
+    if(!ret){
+        write_done(false);
+    }
+    return ret;
+}
+
+void RepJournalFile::fail(){
+    std::lock_guard<std::mutex> lck(mtx_);
+    failed_ = true;
+}
+
+bool RepJournalFile::sync(){
+    std::unique_lock<std::mutex> lck(mtx_);
+    cond_.wait(lck,[this]{return pending_ == 0;});
+    bool ok = !failed_;
+    failed_ = false;
+    lck.unlock();
+    if(fd_ >= 0 && ::fdatasync(fd_) != 0){
+        LOG_ERROR << "sync journal file " << path_ << " failed,errno:" << errno;
+        ok = false;
+    }
+    return ok;
+}
+
+void RepJournalFile::close(){
+    std::unique_lock<std::mutex> lck(mtx_);
+    cond_.wait(lck,[this]{return pending_ == 0;});
+    if(fd_ >= 0){
+        ::close(fd_);
+        fd_ = -1;
+    }
+}
@@ -0,0 +1,51 @@
+/**********************************************
+* Copyright (c) 2016 Huawei Technologies Co., Ltd. All rights reserved.
+* 
+* File name:    rep_journal_file.h
+* Author: 
+* Date:         2017/07/19
+* Version:      1.0
+* Description:  journal file written by replication receiver
+* 
+************************************************/
+#ifndef REP_JOURNAL_FILE_H_
+#define REP_JOURNAL_FILE_H_
+#include <cstdint>
+#include <string>
+#include <mutex>
+#include <condition_variable>
+#include "common/thread_pool.h"
+
+// threads and queued chunks of the writer shared by all receiving journals;
+// a full queue blocks the transfer stream, which throttles the sender
+#define REP_WRITER_THREADS (4)
+#define REP_WRITER_QUEUE (256)
+
+// receiving journal file: space is preallocated on open, chunks are written
+// by pwrite at their own offset in writer threads, so they may complete out
+// of order; data is only made durable by sync at the end of a task
+class RepJournalFile{
+    std::string path_;
+    int fd_;
+    std::mutex mtx_;
+    std::condition_variable cond_;
+    int pending_; // writes submitted but not finished
+    bool failed_; // any write or chunk failed since last sync
+    void write_done(bool ok);
+public:
+    explicit RepJournalFile(const std::string& path);
+    ~RepJournalFile();
+
+    // open existing journal file, reserve prealloc bytes without changing
+    // file size; preallocation is best effort
+    bool open(const uint64_t& prealloc);
+    // write data at offset in pool, data is owned by the write
+    bool write_async(sg_threads::ThreadPool& pool,const uint64_t& offset,
+            std::string&& data);
+    // chunk lost before it reached the file, fail next sync
+    void fail();
+    // wait pending writes and flush them to disk; false if any write failed
+    bool sync();
+    void close();
+};
+#endif
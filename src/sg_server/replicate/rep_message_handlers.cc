@@ -11,9 +11,13 @@
 #include <algorithm>
 #include "log/log.h"
 #include "sg_server/sg_util.h"
-#include "common/crc32.h"
 #include "rep_message_handlers.h"
 #include "common/config_parser.h"
+#include "sg_server/transfer/transfer_codec.h"
+#include "journal_collapse.h"
+#include "block_hashes.h"
+#include "../snap_client_wrapper.h"
+#include "../snapshot/snapshot_mgr.h"
 
 using huawei::proto::JournalMeta;
 using huawei::proto::transfer::MessageType;
@@ -22,6 +26,8 @@ using huawei::proto::transfer::ReplicateDataReq;
 using huawei::proto::transfer::ReplicateMarkerReq;
 using huawei::proto::transfer::ReplicateStartReq;
 using huawei::proto::transfer::ReplicateEndReq;
+using huawei::proto::transfer::ReplicateHashReq;
+using huawei::proto::transfer::ReplicateHashAck;
 using huawei::proto::REPLAYER;
 using huawei::proto::StatusCode;
 using huawei::proto::sOk;
@@ -31,13 +37,23 @@ using huawei::proto::VolumeInfo;
 using huawei::proto::REP_PRIMARY;
 using huawei::proto::REP_FAILED_OVER;
 
+// view of local volume hashed for peer base sync, one per volume
+#define REP_RESEED_SNAP "replicate_reseed"
+// replay held for reseed is released if peer stops asking for hashes
+#define REP_RESEED_PIN_SECONDS (600)
+// blocks read from snapshot in one batch when hashing
+#define REP_HASH_READ_BATCH (16)
+
 RepMsgHandlers::RepMsgHandlers(std::shared_ptr<JournalMetaManager> meta,
         std::shared_ptr<VolumeMetaManager> v_meta,
-        const string& path):
+        const string& path,
+        SnapshotMgr& snap_mgr):
         j_meta_(meta),
         vol_meta_(v_meta),
-        mount_path_(path){
-    
+        mount_path_(path),
+        snap_mgr_(snap_mgr){
+    writer_.reset(new sg_threads::ThreadPool(REP_WRITER_THREADS,
+        REP_WRITER_QUEUE));
 }
 
 RepMsgHandlers::~RepMsgHandlers(){
@@ -45,11 +61,14 @@ RepMsgHandlers::~RepMsgHandlers(){
 
 // TODO: reject sync io&marker if it's primary, or secondary with rep status  failedover rep status
 StatusCode RepMsgHandlers::rep_handle(const TransferRequest& req){
-
     switch(req.type()){
         case MessageType::REPLICATE_DATA:
-            hanlde_replicate_data_req(req);
-            break;
+            // no response for data, failure is kept on the journal and
+            // fails the end of task
+            if(hanlde_replicate_data_req(req))
+                return (sOk);
+            else
+                return (sInternalError);
 
         case MessageType::REPLICATE_MARKER:
             if(handle_replicate_marker_req(req))
@@ -64,7 +83,7 @@ StatusCode RepMsgHandlers::rep_handle(const TransferRequest& req){
                 return (sInternalError);
 
         case MessageType::REPLICATE_END:
-            // TODO: if some writes failed, set res=-1 to let client retry the task?
+            // failed writes of the task fail the end, client retry the task
             if(handle_replicate_end_req(req))
                 return (sOk);
             else
@@ -76,6 +95,92 @@ StatusCode RepMsgHandlers::rep_handle(const TransferRequest& req){
     return StatusCode::sInvalidOperation;
 }
 
+StatusCode RepMsgHandlers::rep_hash_handle(const TransferRequest& req,
+        std::string& ack_data){
+    ReplicateHashReq msg;
+    bool ret = msg.ParseFromString(req.data());
+    SG_ASSERT(ret == true);
+    if(!validate_replicate(msg.vol_id())){
+        LOG_ERROR << "the volume[" << msg.vol_id() << "] replicate was denied!";
+        return StatusCode::sReplicateDenied;
+    }
+    if(msg.blk_size() == 0 || msg.blk_size() > COW_BLOCK_SIZE
+        || msg.blk_count() > REP_HASH_WINDOW_BLOCKS){
+        LOG_ERROR << "invalid block hash request, block size:" << msg.blk_size()
+            << ",count:" << msg.blk_count();
+        return StatusCode::sInvalidOperation;
+    }
+
+    // replay held and a view read rather than the volume, blocks written
+    // by the sync itself never change answers of later windows
+    std::shared_ptr<SnapshotCtrlClient> client =
+        SnapClientWrapper::instance().get_client();
+    const string& vol = msg.vol_id();
+    if(msg.start_blk() == 0){
+        StatusCode status = pin_replay(vol);
+        if(status != StatusCode::sOk){
+            return status;
+        }
+    }
+    else if(!refresh_pin(vol)){
+        LOG_ERROR << "block hashes of " << vol << " from " << msg.start_blk()
+            << " asked without view";
+        return StatusCode::sInvalidOperation;
+    }
+
+    const uint64_t blk_size = msg.blk_size();
+    const uint64_t vol_blks = (msg.vol_size() + blk_size - 1) / blk_size;
+    const uint64_t end_blk = std::min(msg.start_blk() + msg.blk_count(),vol_blks);
+    ReplicateHashAck ack;
+    ack.set_start_blk(msg.start_blk());
+    std::vector<char> buf(REP_HASH_READ_BATCH * blk_size);
+    for(uint64_t blk = msg.start_blk(); blk < end_blk;){
+        // whole blocks read in batch, tail block of volume alone
+        std::vector<off_t> offs;
+        std::vector<char*> bufs;
+        while(blk < end_blk && offs.size() < REP_HASH_READ_BATCH
+            && (blk + 1) * blk_size <= msg.vol_size()){
+            bufs.push_back(&buf[offs.size() * blk_size]);
+            offs.push_back(blk * blk_size);
+            blk++;
+        }
+        StatusCode status = StatusCode::sOk;
+        std::vector<bool> zeros;
+        if(!offs.empty()){
+            status = client->ReadSnapshotBatch(vol,REP_RESEED_SNAP,offs,
+                blk_size,bufs,zeros);
+            for(size_t i = 0; status == StatusCode::sOk && i < offs.size(); i++){
+                ack.add_hash(zeros[i] ? std::string() :
+                    rep_block_hash(bufs[i],blk_size));
+            }
+        }
+        else{
+            size_t len = msg.vol_size() - blk * blk_size;
+            bool zero = false;
+            status = client->ReadSnapshot(vol,REP_RESEED_SNAP,&buf[0],len,
+                blk * blk_size,&zero);
+            if(status == StatusCode::sOk){
+                ack.add_hash(zero ? std::string() : rep_block_hash(&buf[0],len));
+            }
+            blk++;
+        }
+        if(status != StatusCode::sOk){
+            LOG_ERROR << "read snapshot for block hash of " << vol
+                << " failed:" << status;
+            unpin_replay(vol);
+            return status;
+        }
+    }
+    // hashes of last window sent, view no longer needed
+    if(end_blk >= vol_blks){
+        unpin_replay(vol);
+    }
+    LOG_DEBUG << "block hashes of " << vol << " from " << msg.start_blk()
+        << ",count:" << ack.hash_size();
+    SG_ASSERT(true == ack.SerializeToString(&ack_data));
+    return StatusCode::sOk;
+}
+
 bool RepMsgHandlers::handle_replicate_marker_req(const TransferRequest& req){
     // deserialize message from TransferRequest
     ReplicateMarkerReq msg;
@@ -85,28 +190,113 @@ bool RepMsgHandlers::handle_replicate_marker_req(const TransferRequest& req){
     LOG_DEBUG << "sync_marker, volume=" << msg.vol_id() << ",marker="
         << msg.marker().cur_journal() << ":" << msg.marker().pos();
 
+    // checked and updated under pin lock, reseed never pins a replay
+    // about to move on
+    std::lock_guard<std::mutex> lck(pin_mtx_);
+    auto it = pins_.find(msg.vol_id());
+    if(it != pins_.end()){
+        ReseedPin& pin = it->second;
+        if(std::chrono::steady_clock::now() - pin.active
+            <= std::chrono::seconds(REP_RESEED_PIN_SECONDS)){
+            // replay held while volume is hashed, marker applied after
+            if(!pin.held || j_meta_->compare_marker(msg.marker(),pin.marker) > 0){
+                pin.marker = msg.marker();
+                pin.held = true;
+            }
+            return true;
+        }
+        LOG_WARN << "reseed of " << msg.vol_id() << " idle, release replay";
+        release_pin(msg.vol_id(),pin);
+        pins_.erase(it);
+    }
+    return update_producer_marker(msg.vol_id(),msg.marker());
+}
+
+bool RepMsgHandlers::update_producer_marker(const string& vol,
+        const JournalMarker& new_marker){
     // get replayer producer marker, if failed, try to update it
     JournalMarker marker;
-    RESULT result = j_meta_->get_producer_marker(msg.vol_id(),REPLAYER,
-                marker);
+    RESULT result = j_meta_->get_producer_marker(vol,REPLAYER,marker);
     if(result == DRS_OK){
         // compare the markers, if the one sent is bigger, update it
-        int cmp = j_meta_->compare_marker(msg.marker(),marker);
+        int cmp = j_meta_->compare_marker(new_marker,marker);
         if(cmp <= 0){
             LOG_WARN << "the new producer marker "
-                << msg.marker().cur_journal() << ":" << msg.marker().pos()
+                << new_marker.cur_journal() << ":" << new_marker.pos()
                 << " is less than the last " 
                 << marker.cur_journal() << ":" << marker.pos();
             return true;
         }
     }
-    result = j_meta_->set_producer_marker(msg.vol_id(),msg.marker());
+    result = j_meta_->set_producer_marker(vol,new_marker);
     SG_ASSERT(result == DRS_OK);
     LOG_INFO << "update replayer producer marker to: "
-        << msg.marker().cur_journal() << ":" << msg.marker().pos();
+        << new_marker.cur_journal() << ":" << new_marker.pos();
     return true;
 }
 
+StatusCode RepMsgHandlers::pin_replay(const string& vol){
+    std::lock_guard<std::mutex> lck(pin_mtx_);
+    // volume must hold all journals received, or replay overwrites blocks
+    // peer already matched against the view
+    JournalMarker producer;
+    JournalMarker consumer;
+    if(j_meta_->get_producer_marker(vol,REPLAYER,producer) == DRS_OK){
+        if(j_meta_->get_consumer_marker(vol,REPLAYER,consumer) != DRS_OK
+            || j_meta_->compare_marker(consumer,producer) < 0){
+            LOG_WARN << "replay of " << vol << " not caught up, no block hashes";
+            return StatusCode::sInvalidOperation;
+        }
+    }
+    // pin of an interrupted sync kept with its marker held back
+    ReseedPin& pin = pins_[vol];
+    pin.active = std::chrono::steady_clock::now();
+    snap_mgr_.delete_view(vol,REP_RESEED_SNAP);
+    StatusCode status = snap_mgr_.create_view(vol,REP_RESEED_SNAP);
+    if(status != StatusCode::sOk){
+        LOG_ERROR << "create view for block hash of " << vol
+            << " failed:" << status;
+        release_pin(vol,pin);
+        pins_.erase(vol);
+        return status;
+    }
+    LOG_INFO << "replay of " << vol << " held for block hashes";
+    return StatusCode::sOk;
+}
+
+bool RepMsgHandlers::refresh_pin(const string& vol){
+    std::lock_guard<std::mutex> lck(pin_mtx_);
+    auto it = pins_.find(vol);
+    if(it == pins_.end()){
+        return false;
+    }
+    auto now = std::chrono::steady_clock::now();
+    if(now - it->second.active > std::chrono::seconds(REP_RESEED_PIN_SECONDS)){
+        release_pin(vol,it->second);
+        pins_.erase(it);
+        return false;
+    }
+    it->second.active = now;
+    return true;
+}
+
+void RepMsgHandlers::unpin_replay(const string& vol){
+    std::lock_guard<std::mutex> lck(pin_mtx_);
+    auto it = pins_.find(vol);
+    if(it != pins_.end()){
+        release_pin(vol,it->second);
+        pins_.erase(it);
+    }
+}
+
+void RepMsgHandlers::release_pin(const string& vol,ReseedPin& pin){
+    snap_mgr_.delete_view(vol,REP_RESEED_SNAP);
+    if(pin.held){
+        update_producer_marker(vol,pin.marker);
+    }
+    LOG_INFO << "replay of " << vol << " released";
+}
+
 bool RepMsgHandlers::hanlde_replicate_data_req(const TransferRequest& req){
     // deserialize message from TransferRequest
     ReplicateDataReq data_msg;
@@ -119,7 +309,7 @@ bool RepMsgHandlers::hanlde_replicate_data_req(const TransferRequest& req){
     }
 
     // get journal file fd && write data
-    std::shared_ptr<std::ofstream> of = get_fstream(data_msg.vol_id(),
+    std::shared_ptr<RepJournalFile> of = get_journal_file(data_msg.vol_id(),
         data_msg.journal_counter(),data_msg.sub_counter());
     if(of == nullptr){
         LOG_INFO << "journal file not found, create it:"
@@ -136,22 +326,68 @@ bool RepMsgHandlers::hanlde_replicate_data_req(const TransferRequest& req){
         const Jkey jkey(data_msg.vol_id(), data_msg.journal_counter(),
             data_msg.sub_counter());
         std::unique_lock<std::mutex> lock(mutex_);
-        js_map_.insert(std::pair<const Jkey,std::shared_ptr<std::ofstream>>(jkey,of));
+        js_map_.insert(std::pair<const Jkey,std::shared_ptr<RepJournalFile>>(jkey,of));
         lock.unlock();
     }
 
-    if(data_msg.data().length() > 0){
+    if(data_msg.fill_len() > 0){
+        if(!fill_journal(of,data_msg.offset(),data_msg.fill_len())){
+            of->fail();
+            return false;
+        }
+        return true;
+    }
 
-        uint32_t crc = crc32c(data_msg.data().c_str(),data_msg.data().length(),0);
+    // only journal data of chunk is encoded
+    if(req.encode() != EncodeType::NONE_EN
+        && req.encode() != EncodeType::UNKNOWN_EN){
+        std::string plain;
+        if(!transfer_decode(req.encode(),data_msg.data(),plain)){
+            LOG_ERROR << "decode data of journal " << data_msg.vol_id()
+                << std::hex << ":" << data_msg.journal_counter()
+                << ":" << data_msg.sub_counter() << std::dec
+                << " failed, offset:" << data_msg.offset()
+                << ",encode:" << req.encode();
+            of->fail();
+            return false;
+        }
+        data_msg.mutable_data()->swap(plain);
+    }
+
+    if(data_msg.data().length() > 0){
         LOG_DEBUG << "j_counter[" << std::hex << data_msg.journal_counter()
             << ":" << data_msg.sub_counter() << std::dec
             << "] receive data, len:" << data_msg.data().length()
-            << ",offset:" << data_msg.offset() << ",crc:"
-            << crc;
-        // TODO:replace with async io if has io bottleneck
-        of->seekp(data_msg.offset());
-        of->write(data_msg.data().c_str(),data_msg.data().length());
-        SG_ASSERT(of->fail()==0 && of->bad()==0);
+            << ",offset:" << data_msg.offset();
+        // chunk buffer handed over to writer, synced at the end of task
+        return of->write_async(*writer_,data_msg.offset(),
+            std::move(*data_msg.mutable_data()));
+    }
+    return true;
+}
+
+bool RepMsgHandlers::fill_journal(std::shared_ptr<RepJournalFile>& of,
+        const uint64_t& offset,const uint64_t& len){
+    if(len < FILL_ENTRY_MIN){
+        LOG_ERROR << "fill length " << len << " too short, offset:" << offset;
+        return false;
+    }
+    LOG_DEBUG << "fill superseded entries, offset:" << offset << ",len:" << len;
+    // build no-op entries piece by piece, bound memory
+    const uint64_t step = 4 * FILL_ENTRY_MAX;
+    uint64_t done = 0;
+    while(done < len){
+        uint64_t piece = std::min(len - done,step);
+        if(len - done - piece > 0 && len - done - piece < FILL_ENTRY_MIN){
+            piece = len - done - FILL_ENTRY_MIN;
+        }
+        std::string buf;
+        build_fill_entries(piece,buf);
+        SG_ASSERT(buf.size() == piece);
+        if(!of->write_async(*writer_,offset + done,std::move(buf))){
+            return false;
+        }
+        done += piece;
     }
     return true;
 }
@@ -167,7 +403,7 @@ bool RepMsgHandlers::handle_replicate_start_req(const TransferRequest& req){
         return false;
     }
     // create journal
-    std::shared_ptr<std::ofstream> of_p =
+    std::shared_ptr<RepJournalFile> of_p =
             create_journal(msg.vol_id(),msg.journal_counter(),msg.sub_counter());
     if(of_p == nullptr){
         LOG_ERROR << "create journal " << msg.vol_id() << ":"
@@ -178,12 +414,12 @@ bool RepMsgHandlers::handle_replicate_start_req(const TransferRequest& req){
     // inset journal file to map
     const Jkey jkey(msg.vol_id(),msg.journal_counter(),msg.sub_counter());
     std::lock_guard<std::mutex> lock(mutex_);
-    js_map_.insert(std::pair<const Jkey,std::shared_ptr<std::ofstream>>(jkey,of_p));
+    js_map_.insert(std::pair<const Jkey,std::shared_ptr<RepJournalFile>>(jkey,of_p));
 
     return true;
 }
 
-std::shared_ptr<std::ofstream> RepMsgHandlers::create_journal(
+std::shared_ptr<RepJournalFile> RepMsgHandlers::create_journal(
             const string& vol_id,const uint64_t& counter, const uint64_t& sub){
     // create journal key&file 
     string key = sg_util::construct_journal_key(vol_id,counter,sub);
@@ -204,10 +440,10 @@ std::shared_ptr<std::ofstream> RepMsgHandlers::create_journal(
         return nullptr;
     }
     string path = mount_path_ + meta.path();
-    // open journal file
-    std::shared_ptr<std::ofstream> of_p(// if "in" open mode is not set, the file will be trancated?
-        new std::ofstream(path.c_str(),std::ofstream::binary|std::ofstream::in));
-    if(!of_p->is_open()){
+    // open journal file, reserve whole journal so chunks written out of
+    // order do not fragment it
+    std::shared_ptr<RepJournalFile> of_p(new RepJournalFile(path));
+    if(!of_p->open(g_option.journal_max_size)){
         LOG_ERROR << "open journal file filed:" << path << ",key:" << keys.front();
         return nullptr;
     }
@@ -225,8 +461,8 @@ bool RepMsgHandlers::handle_replicate_end_req(const TransferRequest& req){
     LOG_DEBUG << "get end req:"  << msg.vol_id() << ":"
             << std::hex << msg.journal_counter()
             << ":" << msg.sub_counter();
-    // close & fflush journal files and seal the journal
-    std::shared_ptr<std::ofstream> of = get_fstream(msg.vol_id(),
+    // flush journal file and seal the journal
+    std::shared_ptr<RepJournalFile> of = get_journal_file(msg.vol_id(),
         msg.journal_counter(),msg.sub_counter());
     if(of == nullptr){
         LOG_ERROR << "file[" << msg.vol_id() << ":"
@@ -236,14 +472,20 @@ bool RepMsgHandlers::handle_replicate_end_req(const TransferRequest& req){
         return false;
     }
 
-    if(of->is_open()){
-        of->close();
-    }
-    // remove journal ofstream
+    // all chunks of the task were received before end, wait them on disk
+    bool synced = of->sync();
+    of->close();
+    // remove journal file
     const Jkey jkey(msg.vol_id(),msg.journal_counter(),msg.sub_counter());
     std::unique_lock<std::mutex> lock(mutex_);
     js_map_.erase(jkey);
     lock.unlock();
+    if(!synced){
+        LOG_ERROR << "write journal " << msg.vol_id() << ":"
+            << std::hex << msg.journal_counter()
+            << ":" << msg.sub_counter() << std::dec << " failed!";
+        return false;
+    }
 
     // source journal is opened, do not seal
     if(msg.is_open()){
@@ -261,7 +503,7 @@ bool RepMsgHandlers::handle_replicate_end_req(const TransferRequest& req){
     return true;
 }
 
-std::shared_ptr<std::ofstream> RepMsgHandlers::get_fstream(const string& vol,
+std::shared_ptr<RepJournalFile> RepMsgHandlers::get_journal_file(const string& vol,
         const uint64_t& counter,const uint64_t& sub){
     const Jkey key(vol,counter,sub);
     std::lock_guard<std::mutex> lock(mutex_);
@@ -10,15 +10,17 @@
 ************************************************/
 #ifndef REP_MESSAGE_HANDLERS_H_
 #define REP_MESSAGE_HANDLERS_H_
-#include <fstream>
 #include <string>
 #include <memory>
 #include <map>
 #include <mutex>
+#include <chrono>
 #include <cstdint>
 #include "sg_server/journal_meta_manager.h"
 #include "sg_server/volume_meta_manager.h"
 #include "rpc/transfer.grpc.pb.h"
+#include "common/thread_pool.h"
+#include "rep_journal_file.h"
 using std::string;
 using huawei::proto::transfer::TransferRequest;
 using huawei::proto::transfer::TransferResponse;
@@ -35,31 +37,62 @@ typedef struct Jkey{
             return c_ < j2.c_;
         if(sub_ != j2.sub_)
             return sub_ < j2.sub_;
-        return vol_.compare(j2.vol_);
+        return vol_ < j2.vol_;
     }
 }Jkey;
 
+class SnapshotMgr;
+
+// replay of a volume held while its blocks are hashed for base sync of
+// peer, so the view hashed never changes under the sync
+typedef struct ReseedPin{
+    std::chrono::steady_clock::time_point active; // last hash request
+    bool held; // a producer marker was held back
+    JournalMarker marker; // applied when pin released
+    ReseedPin():held(false){}
+}ReseedPin;
+
 class RepMsgHandlers{
 private:
     std::string mount_path_;
     std::shared_ptr<JournalMetaManager> j_meta_;
     std::shared_ptr<VolumeMetaManager> vol_meta_;
     std::mutex mutex_;
-    std::map<const Jkey,std::shared_ptr<std::ofstream>> js_map_;
+    // writes chunks of all receiving journals, outlive the files
+    std::unique_ptr<sg_threads::ThreadPool> writer_;
+    std::map<const Jkey,std::shared_ptr<RepJournalFile>> js_map_;
+    SnapshotMgr& snap_mgr_;
+    std::mutex pin_mtx_;
+    std::map<string,ReseedPin> pins_; // volume -> pin of reseed
 public:
     RepMsgHandlers(std::shared_ptr<JournalMetaManager> j_meta,
-                std::shared_ptr<VolumeMetaManager> v_meta, const std::string& path);
+                std::shared_ptr<VolumeMetaManager> v_meta, const std::string& path,
+                SnapshotMgr& snap_mgr);
     ~RepMsgHandlers();
     StatusCode rep_handle(const TransferRequest& req);
+    // hash blocks of local volume asked by base sync of peer
+    StatusCode rep_hash_handle(const TransferRequest& req,std::string& ack_data);
 private:
     // replicate related handle methods
     bool hanlde_replicate_data_req(const TransferRequest& req);
     bool handle_replicate_start_req(const TransferRequest& req);
     bool handle_replicate_end_req(const TransferRequest& req);
     bool handle_replicate_marker_req(const TransferRequest& req);
-    std::shared_ptr<std::ofstream>  create_journal(
+    // move replayer producer marker forward, never backward
+    bool update_producer_marker(const string& vol,const JournalMarker& marker);
+    // hold replay and take view of volume, replay must have caught up
+    StatusCode pin_replay(const string& vol);
+    // false if volume not pinned or pin expired
+    bool refresh_pin(const string& vol);
+    // drop view and apply producer marker held back
+    void unpin_replay(const string& vol);
+    void release_pin(const string& vol,ReseedPin& pin);
+    // write no-op entries over superseded range of collapsed window
+    bool fill_journal(std::shared_ptr<RepJournalFile>& of,
+            const uint64_t& offset,const uint64_t& len);
+    std::shared_ptr<RepJournalFile> create_journal(
             const string& vol_id,const uint64_t& counter,const uint64_t& sub);
-    std::shared_ptr<std::ofstream> get_fstream(const string& vol,
+    std::shared_ptr<RepJournalFile> get_journal_file(const string& vol,
             const uint64_t& counter,const uint64_t& sub);
     // check whether the replicate direction is valid or not
     bool validate_replicate(const string& vol_id);
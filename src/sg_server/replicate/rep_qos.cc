@@ -0,0 +1,138 @@
+/**********************************************
+* Copyright (c) 2016 Huawei Technologies Co., Ltd. All rights reserved.
+* 
+* File name:    rep_qos.cc
+* Author: 
+* Date:         2017/07/24
+* Version:      1.0
+* Description:  replication bandwidth limit and fair share of volumes
+* 
+************************************************/
+#include <cstdlib>
+#include <sstream>
+#include <algorithm>
+#include <thread>
+#include "log/log.h"
+#include "common/config_option.h"
+#include "rep_qos.h"
+using std::chrono::steady_clock;
+
+#define MB (1024.0 * 1024.0)
+
+TokenBucket::TokenBucket(const double& rate):
+        rate_(rate),
+        tokens_(rate * REP_QOS_BURST_SECONDS),
+        last_(steady_clock::now()){
+}
+
+void TokenBucket::set_rate(const double& rate){
+    rate_ = rate;
+    tokens_ = std::min(tokens_,rate_ * REP_QOS_BURST_SECONDS);
+}
+
+double TokenBucket::wait_time(const steady_clock::time_point& now){
+    if(!limited()){
+        return 0;
+    }
+    double elapsed = std::chrono::duration<double>(now - last_).count();
+    if(elapsed > 0){
+        tokens_ = std::min(tokens_ + elapsed * rate_,
+            rate_ * REP_QOS_BURST_SECONDS);
+        last_ = now;
+    }
+    return tokens_ >= 0 ? 0 : -tokens_ / rate_;
+}
+
+void TokenBucket::take(const size_t& bytes){
+    if(limited()){
+        tokens_ -= bytes;
+    }
+}
+
+RepQos::RepQos(const double& global_rate):
+        global_(global_rate),
+        vtime_(0),
+        seq_(0){
+}
+
+RepQos& RepQos::instance(){
+    static RepQos qos(g_option.replicate_bandwidth * MB);
+    return qos;
+}
+
+RepQos::VolQos& RepQos::vol_qos(const std::string& vol){
+    auto it = vols_.find(vol);
+    if(it != vols_.end()){
+        return it->second;
+    }
+    double rate = g_option.replicate_volume_bandwidth * MB;
+    double weight = 1;
+    // format: vol1:mb:weight,vol2:mb:weight
+    std::stringstream volumes(g_option.replicate_qos_volumes);
+    std::string entry;
+    while(getline(volumes,entry,',')){
+        std::stringstream fields(entry);
+        std::string name,mb,w;
+        getline(fields,name,':');
+        if(name != vol){
+            continue;
+        }
+        if(getline(fields,mb,':') && !mb.empty()){
+            rate = atof(mb.c_str()) * MB;
+        }
+        if(getline(fields,w,':') && atof(w.c_str()) > 0){
+            weight = atof(w.c_str());
+        }
+        break;
+    }
+    LOG_INFO << "replicate qos of volume " << vol << ", bandwidth:"
+        << rate / MB << "MB/s,weight:" << weight;
+    return vols_.insert(std::make_pair(vol,VolQos(rate,weight))).first->second;
+}
+
+void RepQos::set_volume(const std::string& vol,const double& rate,
+        const double& weight){
+    std::lock_guard<std::mutex> lck(mtx_);
+    VolQos& q = vol_qos(vol);
+    q.bucket.set_rate(rate);
+    q.weight = weight > 0 ? weight : 1;
+}
+
+void RepQos::acquire(const std::string& vol,const size_t& bytes){
+    std::unique_lock<std::mutex> lck(mtx_);
+    VolQos& q = vol_qos(vol);
+    // own limit first, a throttled volume never holds up the link
+    double wait = 0;
+    while((wait = q.bucket.wait_time(steady_clock::now())) > 0){
+        lck.unlock();
+        std::this_thread::sleep_for(std::chrono::duration<double>(wait));
+        lck.lock();
+    }
+    q.bucket.take(bytes);
+    if(!global_.limited()){
+        return;
+    }
+
+    // volume back from idle starts from now, never from its old credit
+    double start = std::max(vtime_,q.finish);
+    q.finish = start + bytes / q.weight;
+    const std::pair<double,uint64_t> tag(q.finish,++seq_);
+    waiting_.insert(tag);
+    cond_.notify_all();
+    while(true){
+        if(*waiting_.begin() != tag){
+            cond_.wait(lck);
+            continue;
+        }
+        wait = global_.wait_time(steady_clock::now());
+        if(wait <= 0){
+            break;
+        }
+        // a chunk with smaller tag may arrive while waiting
+        cond_.wait_for(lck,std::chrono::duration<double>(wait));
+    }
+    waiting_.erase(waiting_.begin());
+    vtime_ = tag.first;
+    global_.take(bytes);
+    cond_.notify_all();
+}
@@ -0,0 +1,79 @@
+/**********************************************
+* Copyright (c) 2016 Huawei Technologies Co., Ltd. All rights reserved.
+* 
+* File name:    rep_qos.h
+* Author: 
+* Date:         2017/07/24
+* Version:      1.0
+* Description:  replication bandwidth limit and fair share of volumes
+* 
+************************************************/
+#ifndef REP_QOS_H_
+#define REP_QOS_H_
+#include <cstdint>
+#include <string>
+#include <map>
+#include <set>
+#include <mutex>
+#include <chrono>
+#include <condition_variable>
+
+// tokens a bucket holds at most, in seconds of its rate
+#define REP_QOS_BURST_SECONDS (0.2)
+
+// token bucket in bytes; a sender waits until tokens are not negative,
+// then takes a whole chunk even if it borrows from the future
+class TokenBucket{
+    double rate_; // bytes per second, 0 means no limit
+    double tokens_;
+    std::chrono::steady_clock::time_point last_;
+public:
+    explicit TokenBucket(const double& rate);
+    ~TokenBucket(){}
+
+    void set_rate(const double& rate);
+    bool limited()const{
+        return rate_ > 0;
+    }
+    // seconds to wait before sending at now
+    double wait_time(const std::chrono::steady_clock::time_point& now);
+    void take(const size_t& bytes);
+};
+
+// bandwidth of volumes on the replication link: each volume is limited by
+// its own bucket, and volumes contend for the global bucket in weighted
+// fair order by self-clocked finish tags, so chunks of a volume with a
+// write burst queue behind those of quieter volumes
+class RepQos{
+    typedef struct VolQos{
+        TokenBucket bucket;
+        double weight;
+        double finish; // finish tag of last queued chunk
+        VolQos(const double& rate,const double& w):
+            bucket(rate),weight(w),finish(0){}
+    }VolQos;
+    std::mutex mtx_;
+    std::condition_variable cond_;
+    TokenBucket global_;
+    double vtime_; // finish tag of last granted chunk
+    uint64_t seq_;
+    std::set<std::pair<double,uint64_t>> waiting_; // finish tag, seq
+    std::map<std::string,VolQos> vols_;
+
+    VolQos& vol_qos(const std::string& vol);
+public:
+    // rate in bytes per second, 0 means no limit
+    explicit RepQos(const double& global_rate);
+    ~RepQos(){}
+    RepQos(RepQos&) = delete;
+    RepQos& operator=(RepQos const&) = delete;
+
+    // limits of replicate.bandwidth, volume_bandwidth and qos_volumes
+    static RepQos& instance();
+
+    void set_volume(const std::string& vol,const double& rate,
+            const double& weight);
+    // block until bytes of volume may be sent
+    void acquire(const std::string& vol,const size_t& bytes);
+};
+#endif
@@ -8,6 +8,11 @@
 * Description:
 * 
 ************************************************/
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#include <google/protobuf/io/coded_stream.h>
+#include <google/protobuf/wire_format_lite.h>
 #include "rep_task.h"
 #include "log/log.h"
 #include "../sg_util.h"
@@ -16,16 +21,19 @@
 #include "common/journal_entry.h"
 #include "common/define.h"
 #include "common/crc32.h"
+#include "common/config_option.h"
 using huawei::proto::StatusCode;
 using huawei::proto::transfer::MessageType;
 using huawei::proto::transfer::EncodeType;
 using huawei::proto::transfer::ReplicateStartReq;
 using huawei::proto::transfer::ReplicateEndReq;
 using huawei::proto::transfer::ReplicateDataReq;
+using huawei::proto::transfer::ReplicateHashReq;
 using google::protobuf::Message;
+using google::protobuf::io::CodedOutputStream;
+using google::protobuf::internal::WireFormatLite;
 using huawei::proto::WriteMessage;
 using huawei::proto::DiskPos;
-#define JOURNAL_BLOCK_SIZE (512*1024L)
 // suppose that the serialized entry length was never longer than MAX_JOURNAL_ENTRY_LEN
 #define PREFIX_DATA_LEN 128
 #define MAX_JOURNAL_ENTRY_LEN (PREFIX_DATA_LEN + COW_BLOCK_SIZE)
@@ -48,20 +56,21 @@ int construct_transfer_data_request(TransferRequest* req,
         const string& vol_id,const int64_t& j_counter,
         const int64_t& sub_counter,
         const char* buffer, const uint64_t& offset,
-        const size_t& size,const uint64_t& id){
+        const size_t& size,const uint64_t& id,
+        const EncodeType& encode){
     ReplicateDataReq data_msg;
     data_msg.set_vol_id(vol_id);
     data_msg.set_journal_counter(j_counter);
     data_msg.set_sub_counter(sub_counter);
     data_msg.set_offset(offset);
-    data_msg.set_data(buffer,size);
+    // compress journal data of each chunk only when it pays off, the header
+    // stays plain so receiver knows the journal even if decoding fails
+    string plain(buffer,size);
+    req->set_encode(transfer_encode(encode,plain,*data_msg.mutable_data()));
 
     req->set_id(id);
-    req->set_encode(EncodeType::NONE_EN);
     req->set_type(MessageType::REPLICATE_DATA);
-    string temp;
-    SG_ASSERT(true == data_msg.SerializeToString(&temp));
-    req->set_data(temp.c_str(),temp.length());
+    SG_ASSERT(true == data_msg.SerializeToString(req->mutable_data()));
     return 0;
 }
 
@@ -69,9 +78,13 @@ int construct_transfer_start_request(TransferRequest* req,
                                 const string& vol_id,
                                 const int64_t& j_counter,
                                 const int64_t& sub_counter,
-                                const uint64_t& id){
+                                const uint64_t& id,
+                                const EncodeType& propose,
+                                const bool& propose_fill){
     req->set_id(id);
     req->set_encode(EncodeType::NONE_EN);
+    req->set_propose_encode(propose);
+    req->set_propose_fill(propose_fill);
     req->set_type(MessageType::REPLICATE_START);
     ReplicateStartReq start_msg;
     start_msg.set_vol_id(vol_id);
@@ -86,9 +99,12 @@ int construct_transfer_start_request(TransferRequest* req,
 int construct_transfer_end_request(TransferRequest* req,
             const string& vol_id,const int64_t& j_counter,
             const int64_t& sub_counter,
-            const uint64_t& id, const bool& is_open){
+            const uint64_t& id, const bool& is_open,
+            const EncodeType& propose,const bool& propose_fill){
     req->set_id(id);
     req->set_encode(EncodeType::NONE_EN);
+    req->set_propose_encode(propose);
+    req->set_propose_fill(propose_fill);
     req->set_type(MessageType::REPLICATE_END);
     ReplicateEndReq end_msg;
     end_msg.set_vol_id(vol_id);
@@ -101,32 +117,143 @@ int construct_transfer_end_request(TransferRequest* req,
     return 0;
 }
 
+// pread until size or end of file, return bytes read
+static ssize_t read_file_data(const int fd,char* buf,const uint64_t& offset,
+        const size_t& size){
+    size_t done = 0;
+    while(done < size){
+        ssize_t ret = ::pread(fd,buf + done,size - done,offset + done);
+        if(ret < 0 && errno == EINTR)
+            continue;
+        if(ret < 0)
+            return -1;
+        if(ret == 0)
+            break; // end of file
+        done += ret;
+    }
+    return done;
+}
+
+// append data field header and pread file data right behind it
+static ssize_t append_file_data(string& wire,const int fd,
+        const uint64_t& offset,const size_t& size){
+    const uint32_t tag = WireFormatLite::MakeTag(
+        ReplicateDataReq::kDataFieldNumber,
+        WireFormatLite::WIRETYPE_LENGTH_DELIMITED);
+    size_t head = wire.size();
+    size_t hdr_len = CodedOutputStream::VarintSize32(tag)
+        + CodedOutputStream::VarintSize32(size);
+    wire.resize(head + hdr_len + size);
+    uint8_t* p = (uint8_t*)&wire[head];
+    p = CodedOutputStream::WriteTagToArray(tag,p);
+    p = CodedOutputStream::WriteVarint32ToArray(size,p);
+
+    ssize_t ret = read_file_data(fd,(char*)p,offset,size);
+    if(ret < 0)
+        return ret;
+    size_t done = ret;
+    if(done < size){
+        // rewrite header with real length, rare so move data
+        wire.resize(head);
+        string data((char*)p,done);
+        hdr_len = CodedOutputStream::VarintSize32(tag)
+            + CodedOutputStream::VarintSize32(done);
+        wire.resize(head + hdr_len);
+        p = (uint8_t*)&wire[head];
+        p = CodedOutputStream::WriteTagToArray(tag,p);
+        CodedOutputStream::WriteVarint32ToArray(done,p);
+        wire.append(data);
+    }
+    return done;
+}
+
+ssize_t construct_transfer_data_request(TransferRequest* req,
+        const string& vol_id,const int64_t& j_counter,
+        const int64_t& sub_counter,
+        const int fd, const uint64_t& offset,
+        const size_t& size,const uint64_t& id,
+        const EncodeType& encode){
+    // data field goes last, parser accepts fields in any order
+    ReplicateDataReq data_msg;
+    data_msg.set_vol_id(vol_id);
+    data_msg.set_journal_counter(j_counter);
+    data_msg.set_sub_counter(sub_counter);
+    data_msg.set_offset(offset);
+
+    req->set_id(id);
+    req->set_type(MessageType::REPLICATE_DATA);
+    if(encode == EncodeType::NONE_EN){
+        req->set_encode(EncodeType::NONE_EN);
+        SG_ASSERT(true == data_msg.SerializeToString(req->mutable_data()));
+        return append_file_data(*req->mutable_data(),fd,offset,size);
+    }
+    // only journal data is encoded, header stays plain
+    string plain(size,0);
+    ssize_t ret = read_file_data(fd,&plain[0],offset,size);
+    if(ret < 0)
+        return ret;
+    plain.resize(ret);
+    req->set_encode(transfer_encode(encode,plain,*data_msg.mutable_data()));
+    SG_ASSERT(true == data_msg.SerializeToString(req->mutable_data()));
+    return ret;
+}
+
+// superseded entries in [offset, offset+len), receiver fills them
+int construct_transfer_fill_request(TransferRequest* req,
+        const string& vol_id,const int64_t& j_counter,
+        const int64_t& sub_counter,const uint64_t& offset,
+        const uint64_t& len,const uint64_t& id){
+    ReplicateDataReq data_msg;
+    data_msg.set_vol_id(vol_id);
+    data_msg.set_journal_counter(j_counter);
+    data_msg.set_sub_counter(sub_counter);
+    data_msg.set_offset(offset);
+    data_msg.set_fill_len(len);
+
+    req->set_id(id);
+    req->set_encode(EncodeType::NONE_EN);
+    req->set_type(MessageType::REPLICATE_DATA);
+    SG_ASSERT(true == data_msg.SerializeToString(req->mutable_data()));
+    return 0;
+}
+
+int construct_transfer_hash_request(TransferRequest* req,
+        const string& vol_id,const uint64_t& start_blk,
+        const uint64_t& blk_count,const uint64_t& blk_size,
+        const uint64_t& vol_size,const uint64_t& id){
+    ReplicateHashReq hash_msg;
+    hash_msg.set_vol_id(vol_id);
+    hash_msg.set_start_blk(start_blk);
+    hash_msg.set_blk_count(blk_count);
+    hash_msg.set_blk_size(blk_size);
+    hash_msg.set_vol_size(vol_size);
+
+    req->set_id(id);
+    req->set_encode(EncodeType::NONE_EN);
+    req->set_type(MessageType::REPLICATE_HASH);
+    SG_ASSERT(true == hash_msg.SerializeToString(req->mutable_data()));
+    return 0;
+}
+
 int JournalTask::init(){
     package_id = 0;
     SG_ASSERT(ctx != nullptr);
-    is.open(path,std::fstream::in|std::ifstream::binary);
-    if(!is.is_open()){
+    fd = ::open(path.c_str(),O_RDONLY);
+    if(fd < 0){
         LOG_ERROR << "open file:" << path << " of "
-            << ctx->get_j_counter() << " error.";
+            << ctx->get_j_counter() << " error:" << errno;
         return -1;
     }
+    ::posix_fadvise(fd,0,0,POSIX_FADV_SEQUENTIAL);
     cur_off = start_off;
-    is.seekg(cur_off);
-    SG_ASSERT(is.fail()==0 && is.bad()==0);
 
     LOG_DEBUG << "transfering journal " << std::hex
         << ctx->get_j_counter() << std::dec << " from "
         << start_off << " to " << ctx->get_end_off();
-
-    buffer = (char*)malloc(JOURNAL_BLOCK_SIZE);
-    if(buffer == nullptr){
-        LOG_ERROR << "alloc buffer for journal task failed!";
-        return -1;
-    }
     return 0;
 }
 
-bool JournalTask::has_next_package(){
+bool JournalTask::has_next_package(){
     if(get_status() == T_CANCELED || get_status() == T_ERROR)
         return false;
     return (!end);
@@ -137,37 +264,72 @@ TransferRequest* JournalTask::get_next_package(){
     if(cur_off >= ctx->get_end_off()){
         TransferRequest* req = new TransferRequest;
         construct_transfer_end_request(req,ctx->get_peer_vol(),
-                ctx->get_j_counter(),0,++package_id,ctx->get_is_open());
+                ctx->get_j_counter(),0,++package_id,ctx->get_is_open(),
+                ctx->get_propose_encode(),
+                ctx->get_propose_fill());
         end = true;
         LOG_DEBUG << "construct end req, " << ctx->get_peer_vol()
             << ":" << ctx->get_j_counter();
         return req;
     }
 
-    size_t size = (ctx->get_end_off()-cur_off) > JOURNAL_BLOCK_SIZE ?
-        JOURNAL_BLOCK_SIZE:(ctx->get_end_off() - cur_off);
-    if(is.read(buffer,size)){
+    if(fd < 0){
+        LOG_ERROR << "journal file[" << path << "] not opened";
+        return nullptr;
+    }
+    if(!planned){
+        planned = true;
+        // plan once the peer accepted fill ranges, window is fixed by now
+        if(ctx->get_fill()){
+            uint64_t filled = collapse_journal_window(fd,start_off,
+                ctx->get_end_off(),segments);
+            LOG_DEBUG << "collapse journal " << std::hex << ctx->get_j_counter()
+                << std::dec << " from " << start_off << " to "
+                << ctx->get_end_off() << ",filled:" << filled;
+            if(filled == 0)
+                segments.clear();
+        }
+    }
+    uint64_t limit = ctx->get_end_off();
+    while(seg_idx < segments.size()
+        && segments[seg_idx].off + segments[seg_idx].len <= cur_off){
+        seg_idx++;
+    }
+    if(seg_idx < segments.size()){
+        CollapseSegment& seg = segments[seg_idx];
+        if(seg.fill){
+            TransferRequest* req = new TransferRequest;
+            construct_transfer_fill_request(req,ctx->get_peer_vol(),
+                ctx->get_j_counter(),0,cur_off,seg.off + seg.len - cur_off,
+                ++package_id);
+            cur_off = seg.off + seg.len;
+            return req;
+        }
+        limit = std::min(limit,seg.off + seg.len);
+    }
+
+    size_t chunk = ctx->get_chunk_size();
+    size_t size = (limit-cur_off) > chunk ? chunk:(limit - cur_off);
 
+    TransferRequest* req = new TransferRequest;
+    ssize_t ret = construct_transfer_data_request(req,ctx->get_peer_vol(),
+            ctx->get_j_counter(),0,fd,cur_off,size,++package_id,
+            ctx->get_encode());
+    if(ret < 0){
+        LOG_ERROR << "read file[" << path << "] failed,required length["
+            << size << "],offset[" << cur_off << "],errno:" << errno;
+        delete req;
+        return nullptr;
     }
-    else if(is.eof()){
-        size = is.gcount();
+    if((size_t)ret < size){
+        size = ret;
         // TODO: remove this line if file created with padding filled
         ctx->set_end_off(cur_off + size);
         LOG_WARN << "journal file[" << path << "] end at:" << cur_off + size;
     }
-    else{
-        LOG_ERROR << "read file[" << path << "] failed,required length["
-            << size << "],offset[" << cur_off << "].";
-        return nullptr;
-    }
 
-    TransferRequest* req = new TransferRequest;
-    construct_transfer_data_request(req,ctx->get_peer_vol(),ctx->get_j_counter(),
-            0,buffer,cur_off,size,++package_id);
-
-    uint32_t crc = crc32c(buffer,size,0);
-    LOG_DEBUG << "transfer file[" << path << "] from "<< cur_off 
-        << ",len [" << size << "],crc[" << crc << "].";
+    LOG_DEBUG << "transfer file[" << path << "] from "<< cur_off
+        << ",len [" << size << "].";
     cur_off += size; // update offset
     return req;
 }
@@ -175,15 +337,15 @@ TransferRequest* JournalTask::get_next_package(){
 int JournalTask::reset(){
     end = false;
     cur_off = start_off;
-    is.seekg(cur_off);
+    // peer may not accept fill any more, plan again
+    segments.clear();
+    seg_idx = 0;
+    planned = false;
     return 0;
 }
 
 
 int DiffSnapTask::init(){
-    diff_blocks.clear();
-    vector_cursor = 0;
-    array_cursor = 0;
     all_data_sent = false;
     cur_off = 0;
     // sub counter should start at 1, or it will overlat the former journal
@@ -192,26 +354,36 @@ int DiffSnapTask::init(){
     // set journal max size
     max_journal_size = ctx->get_end_off();
 
-    // init diff_blocks
-    StatusCode ret = SnapClientWrapper::instance().get_client()->DiffSnapshot(
-            ctx->get_vol_id(),pre_snap,cur_snap,diff_blocks);
-    SG_ASSERT(ret == StatusCode::sOk);
-    if(SnapClientWrapper::instance().diff_snapshot_is_empty(ctx->get_vol_id(),
-        cur_snap,pre_snap)){
-        LOG_INFO << "no data sync for diff snapshot,pre:" << cur_snap
-            << ",pre:" << pre_snap;
-        end = true;
-    }
-
     buffer = (char*)malloc(COW_BLOCK_SIZE);
     if(buffer == nullptr){
         LOG_ERROR << "alloc buffer for diff block failed!";
         return -1;
     }
+    return open_diff_reader();
+}
+
+int DiffSnapTask::open_diff_reader(){
+    // diff blocks were pulled chunk by chunk, not the whole diff in memory
+    diff_reader = SnapClientWrapper::instance().get_client()->DiffSnapshotStream(
+            ctx->get_vol_id(),pre_snap,cur_snap);
+    if(!peek_diff_block()){
+        LOG_INFO << "no data sync for diff snapshot,cur:" << cur_snap
+            << ",pre:" << pre_snap;
+        end = true;
+    }
     return 0;
 }
 
-bool DiffSnapTask::has_next_package(){
+bool DiffSnapTask::peek_diff_block(){
+    std::string snap_name;
+    if(diff_reader->next(snap_name,pending_blk)){
+        return true;
+    }
+    SG_ASSERT(diff_reader->status() == StatusCode::sOk);
+    return false;
+}
+
+bool DiffSnapTask::has_next_package(){
     if(get_status() == T_CANCELED || get_status() == T_ERROR)
         return false;
     return (!end);
@@ -224,7 +396,9 @@ TransferRequest* DiffSnapTask::get_next_package(){
     if(all_data_sent){ // all data sent
         TransferRequest* req = new TransferRequest;
         construct_transfer_end_request(req,ctx->get_peer_vol(),
-                ctx->get_j_counter(),sub_counter,++package_id,ctx->get_is_open());
+                ctx->get_j_counter(),sub_counter,++package_id,ctx->get_is_open(),
+                ctx->get_propose_encode(),
+                ctx->get_propose_fill());
         end = true;
         LOG_DEBUG << "construct end req,peer volume: " << ctx->get_peer_vol()
             << ", cur_snap" << cur_snap;
@@ -241,77 +415,62 @@ TransferRequest* DiffSnapTask::get_next_package(){
         size_t size = sizeof(journal_file_header_t);
         construct_transfer_data_request(req,ctx->get_peer_vol(),
             ctx->get_j_counter(),sub_counter,
-            (char*)(&header),cur_off,size,++package_id);
+            (char*)(&header),cur_off,size,++package_id,
+            ctx->get_encode());
         cur_off += size;
         return req;
     }
 
-    DiffBlocks& diff_block = diff_blocks[vector_cursor];
     // construct transfer request
     TransferRequest* req = new TransferRequest;
-    if(diff_block.diff_block_no_size() > 0){// first diff_blocks may be empty
-        // if no enough space in cur journal file, seal it
-        if(cur_off + MAX_JOURNAL_ENTRY_LEN > max_journal_size){
-            construct_transfer_end_request(req,ctx->get_peer_vol(),
-                ctx->get_j_counter(),sub_counter,++package_id,ctx->get_is_open());
-            LOG_DEBUG << "journal[" << sub_counter << "] is full"
-                << ", cur_snap" << cur_snap;
-            // next journal
-            sub_counter++;
-            SG_ASSERT(sub_counter < 0xffff);
-            cur_off = 0;
-            return req;
-        }
-        //read diff block data from snapshot
-        uint64_t diff_block_no = diff_block.diff_block_no(array_cursor);
-        off_t    diff_block_off = diff_block_no * COW_BLOCK_SIZE;
-        size_t   diff_block_size = COW_BLOCK_SIZE;
-        StatusCode ret = SnapClientWrapper::instance().get_client()->ReadSnapshot(
-            ctx->get_vol_id(),cur_snap,buffer,diff_block_size,diff_block_off);
-        SG_ASSERT(ret == StatusCode::sOk);
+    // if no enough space in cur journal file, seal it
+    if(cur_off + MAX_JOURNAL_ENTRY_LEN > max_journal_size){
+        construct_transfer_end_request(req,ctx->get_peer_vol(),
+            ctx->get_j_counter(),sub_counter,++package_id,ctx->get_is_open(),
+                ctx->get_propose_encode(),
+                ctx->get_propose_fill());
+        LOG_DEBUG << "journal[" << sub_counter << "] is full"
+            << ", cur_snap" << cur_snap;
+        // next journal
+        sub_counter++;
+        SG_ASSERT(sub_counter < 0xffff);
+        cur_off = 0;
+        return req;
+    }
+    //read diff block data from snapshot
+    // volume may cow in smaller granularity than COW_BLOCK_SIZE
+    size_t   diff_block_size = diff_reader->blk_size();
+    off_t    diff_block_off = pending_blk * diff_block_size;
+    StatusCode ret = SnapClientWrapper::instance().get_client()->ReadSnapshot(
+        ctx->get_vol_id(),cur_snap,buffer,diff_block_size,diff_block_off);
+    SG_ASSERT(ret == StatusCode::sOk);
 
-        //construct JournalEntry
-        JournalEntry entry;
-        construct_journal_entry(entry,buffer,diff_block_off,diff_block_size);
-        string entry_string;
-        size_t size = entry.copy_entry(entry_string);
-        LOG_DEBUG << "get snap diff block no:" << diff_block_off
-            << " ,vector cursor:" << vector_cursor
-            << " ,array cursor:" << array_cursor
-            << " ,entry len:" << entry.get_length()
-            << " ,entry crc:" << entry.get_crc()
-            << " ,entry_string len:" << entry_string.length();
+    //construct JournalEntry
+    JournalEntry entry;
+    construct_journal_entry(entry,buffer,diff_block_off,diff_block_size);
+    string entry_string;
+    size_t size = entry.copy_entry(entry_string);
+    LOG_DEBUG << "get snap diff block no:" << pending_blk
+        << " ,entry len:" << entry.get_length()
+        << " ,entry crc:" << entry.get_crc()
+        << " ,entry_string len:" << entry_string.length();
 
-        construct_transfer_data_request(req,ctx->get_peer_vol(),
-            ctx->get_j_counter(),sub_counter,
-            entry_string.c_str(),cur_off,size,++package_id);
-        // debug
-        uint32_t crc = crc32c(entry_string.c_str(),size,0);
-        LOG_DEBUG << "transfer journal sub[" << sub_counter << "] from "<< cur_off 
-            << ",len [" << size << "],crc[" << crc << "].";
+    construct_transfer_data_request(req,ctx->get_peer_vol(),
+        ctx->get_j_counter(),sub_counter,
+        entry_string.c_str(),cur_off,size,++package_id,
+            ctx->get_encode());
+    // debug
+    uint32_t crc = crc32c(entry_string.c_str(),size,0);
+    LOG_DEBUG << "transfer journal sub[" << sub_counter << "] from "<< cur_off 
+        << ",len [" << size << "],crc[" << crc << "].";
 
-        cur_off += size;
-    }
-    //move cursors
-    if(array_cursor + 1 >= diff_block.diff_block_no_size()){
-        // check next diffblock
-        vector_cursor++;
-        array_cursor = 0;
-        if(vector_cursor >= diff_blocks.size()){
-            LOG_INFO << "all diff blocks were traversed in task["
-                << this->get_id() << "]";
-            all_data_sent = true;
-        }
-        else{
-            if(diff_blocks[vector_cursor].diff_block_no_size()<=0){
-                LOG_WARN << "no diff block was found in task["
-                    << this->get_id() << "], cursor:" << vector_cursor;
-                all_data_sent = true;
-            }
-        }
-    }
-    else{
-        array_cursor++;
+    cur_off += size;
+
+    // move to next diff block
+    if(!peek_diff_block()){
+        LOG_INFO << "all diff blocks were traversed in task["
+            << this->get_id() << "]";
+        all_data_sent = true;
     }
     return req;
 }
@@ -333,12 +492,10 @@ void DiffSnapTask::set_cur_snap(const std::string& _snap){
 int DiffSnapTask::reset(){
     // TODO: resume at breakpoint
     end = false;
-    vector_cursor = 0;
-    array_cursor = 0;
     all_data_sent = false;
     cur_off = 0;
     sub_counter = 1;
-    return 0;
+    return open_diff_reader();
 }
 
 
@@ -360,7 +517,12 @@ int BaseSnapTask::init(){
     cur_off = 0;
     sub_counter = 1;
     read_off = 0;
+    skipped = 0;
     end = false;
+    // peer volume may hold most of the blocks, e.g. after failover
+    if(g_option.replicate_reseed){
+        peer_hashes.reset(new PeerBlockHashes(COW_BLOCK_SIZE,vol_size));
+    }
     buffer = (char*)malloc(COW_BLOCK_SIZE);
     if(buffer == nullptr){
         LOG_ERROR << "alloc buffer for diff block failed!";
@@ -370,7 +532,7 @@ int BaseSnapTask::init(){
     return 0;
 }
 
-bool BaseSnapTask::has_next_package(){
+bool BaseSnapTask::has_next_package(){
     if(get_status() == T_CANCELED || get_status() == T_ERROR)
         return false;
     return (!end);
@@ -381,13 +543,7 @@ TransferRequest* BaseSnapTask::get_next_package(){
         return nullptr;
 
     if(read_off >= vol_size){
-        // construct end cmd
-        TransferRequest* req = new TransferRequest;
-        construct_transfer_end_request(req,ctx->get_peer_vol(),
-                ctx->get_j_counter(),sub_counter,++package_id,ctx->get_is_open());
-        end = true;
-        LOG_INFO << "transfer base snap end:" << base_snap;
-        return req;
+        return construct_end();
     }
 
     if(cur_off == 0){
@@ -400,7 +556,8 @@ TransferRequest* BaseSnapTask::get_next_package(){
         size_t size = sizeof(journal_file_header_t);
         construct_transfer_data_request(req,ctx->get_peer_vol(),
             ctx->get_j_counter(),sub_counter,
-            (char*)(&header),cur_off,size,++package_id);
+            (char*)(&header),cur_off,size,++package_id,
+            ctx->get_encode());
         cur_off += size;
         return req;
     }
@@ -408,7 +565,9 @@ TransferRequest* BaseSnapTask::get_next_package(){
     if(cur_off + MAX_JOURNAL_ENTRY_LEN > max_journal_size){
         TransferRequest* req = new TransferRequest;
         construct_transfer_end_request(req,ctx->get_peer_vol(),
-            ctx->get_j_counter(),sub_counter,++package_id,ctx->get_is_open());
+            ctx->get_j_counter(),sub_counter,++package_id,ctx->get_is_open(),
+                ctx->get_propose_encode(),
+                ctx->get_propose_fill());
         LOG_DEBUG << "journal[" << sub_counter << "] is full"
             << ", base_snap" << base_snap;
         // next journal
@@ -417,12 +576,34 @@ TransferRequest* BaseSnapTask::get_next_package(){
         cur_off = 0;
         return req;
     }
-    // read snapshot
-    uint64_t len = vol_size - read_off > COW_BLOCK_SIZE ?
-        COW_BLOCK_SIZE:(vol_size - read_off);
-    StatusCode ret = SnapClientWrapper::instance().get_client()->ReadSnapshot(
-        ctx->get_vol_id(),base_snap,buffer,len,read_off);
-    SG_ASSERT(ret == StatusCode::sOk);
+    // read snapshot, skip blocks peer already has
+    uint64_t len = 0;
+    while(true){
+        if(read_off >= vol_size){
+            return construct_end();
+        }
+        // ask hashes of blocks ahead, peer answers while blocks are sent
+        uint64_t start_blk = 0;
+        uint64_t blk_count = 0;
+        if(peer_hashes && peer_hashes->next_request(start_blk,blk_count)){
+            TransferRequest* req = new TransferRequest;
+            construct_transfer_hash_request(req,ctx->get_peer_vol(),
+                start_blk,blk_count,COW_BLOCK_SIZE,vol_size,++package_id);
+            return req;
+        }
+        len = vol_size - read_off > COW_BLOCK_SIZE ?
+            COW_BLOCK_SIZE:(vol_size - read_off);
+        bool zero = false;
+        StatusCode ret = SnapClientWrapper::instance().get_client()->ReadSnapshot(
+            ctx->get_vol_id(),base_snap,buffer,len,read_off,&zero);
+        SG_ASSERT(ret == StatusCode::sOk);
+        if(peer_hashes == nullptr || peer_hashes->match(
+                read_off / COW_BLOCK_SIZE,buffer,len,zero) != 1){
+            break;
+        }
+        read_off += len;
+        skipped++;
+    }
 
     //construct JournalEntry
     JournalEntry entry;
@@ -438,7 +619,8 @@ TransferRequest* BaseSnapTask::get_next_package(){
     TransferRequest* req = new TransferRequest;
     construct_transfer_data_request(req,ctx->get_peer_vol(),
         ctx->get_j_counter(),sub_counter,
-        entry_string.c_str(),cur_off,size,++package_id);
+        entry_string.c_str(),cur_off,size,++package_id,
+            ctx->get_encode());
 
     uint32_t crc = crc32c(entry_string.c_str(),size,0);
     LOG_DEBUG << "transfer journal sub[" << sub_counter << "] from "<< cur_off 
@@ -446,16 +628,43 @@ TransferRequest* BaseSnapTask::get_next_package(){
 
     cur_off += size;
 
-    // update read offset
-    read_off += size;
+    // update read offset, by block length rather than entry length
+    read_off += len;
     return req;
 }
 
+TransferRequest* BaseSnapTask::construct_end(){
+    TransferRequest* req = new TransferRequest;
+    construct_transfer_end_request(req,ctx->get_peer_vol(),
+            ctx->get_j_counter(),sub_counter,++package_id,ctx->get_is_open(),
+            ctx->get_propose_encode(),
+            ctx->get_propose_fill());
+    end = true;
+    LOG_INFO << "transfer base snap end:" << base_snap
+        << ",blocks peer already has:" << skipped;
+    return req;
+}
+
+void BaseSnapTask::on_reply(const TransferResponse& res){
+    if(peer_hashes == nullptr || res.type() != MessageType::REPLICATE_HASH)
+        return;
+    ReplicateHashAck ack;
+    if(res.status() != StatusCode::sOk || !ack.ParseFromString(res.data())){
+        peer_hashes->on_fail();
+        return;
+    }
+    peer_hashes->on_ack(ack);
+}
+
 int BaseSnapTask::reset(){
     cur_off = 0;
     sub_counter = 1;
     read_off = 0;
+    skipped = 0;
     end = false;
+    if(peer_hashes){
+        peer_hashes->reset();
+    }
     return 0;
 }
 
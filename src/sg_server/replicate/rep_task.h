@@ -10,11 +10,16 @@
 ************************************************/
 #ifndef REP_TASK_H_
 #define REP_TASK_H_
+#include <unistd.h>
 #include <fstream>
 #include <string>
 #include <vector>
 #include "rep_type.h"
 #include "sg_server/transfer/transfer_task.h"
+#include "sg_server/transfer/transfer_codec.h"
+#include "chunk_sizer.h"
+#include "journal_collapse.h"
+#include "block_hashes.h"
 #include "../snap_client_wrapper.h"
 class RepContext:public TaskContext{
 protected:
@@ -24,6 +29,8 @@ protected:
     uint64_t end_off; // end offset of journal file
     bool is_open; // journal file is opened?
     std::function<void(std::shared_ptr<TransferTask>&)> callback;
+    std::shared_ptr<PairCodec> codec; // codec negotiated with peer
+    std::shared_ptr<ChunkSizer> sizer; // journal chunk size of the link
 public:
     RepContext(
             const std::string& _vol_id,
@@ -83,6 +90,38 @@ public:
     void set_callback(std::function<void(std::shared_ptr<TransferTask>&)> _callback){
         callback = _callback;
     }
+
+    std::shared_ptr<PairCodec>& get_codec(){
+        return codec;
+    }
+    void set_codec(std::shared_ptr<PairCodec> _codec){
+        codec = _codec;
+    }
+    // codec for data chunks, raw until peer accepted one
+    EncodeType get_encode(){
+        return codec ? codec->accepted() : EncodeType::NONE_EN;
+    }
+    // codec proposed to peer in replicate commands
+    EncodeType get_propose_encode(){
+        return codec ? codec->proposed() : EncodeType::NONE_EN;
+    }
+    bool get_propose_fill(){
+        return codec ? codec->fill_proposed() : false;
+    }
+    // superseded journal entries may be sent as fill ranges
+    bool get_fill(){
+        return codec ? codec->fill_accepted() : false;
+    }
+
+    std::shared_ptr<ChunkSizer>& get_sizer(){
+        return sizer;
+    }
+    void set_sizer(std::shared_ptr<ChunkSizer> _sizer){
+        sizer = _sizer;
+    }
+    size_t get_chunk_size(){
+        return sizer ? sizer->chunk_size() : REP_CHUNK_INIT;
+    }
 };
 
 class JournalTask:public TransferTask {
@@ -94,9 +133,12 @@ private:
     // internal params
     bool end; // task done, ReplicateEndReq was sent
     uint64_t cur_off;
-    std::ifstream is;
-    char* buffer;
+    int fd; // journal data read straight into request, no buffer
     uint64_t package_id;
+    // collapsed plan of the window, empty if not collapsing
+    std::vector<CollapseSegment> segments;
+    size_t seg_idx;
+    bool planned;
 public:
     JournalTask(const uint64_t& _start,
             const std::string& _path,
@@ -104,19 +146,19 @@ public:
             start_off(_start),
             cur_off(_start),
             end(false),
-            buffer(nullptr),
+            fd(-1),
             path(_path),
             ctx(_context),
             package_id(0),
+            seg_idx(0),
+            planned(false),
             TransferTask(_context){
         init();
     }
 
     ~JournalTask(){
-        if(is.is_open())
-            is.close();
-        if(buffer)
-            free(buffer);
+        if(fd >= 0)
+            ::close(fd);
     }
 
     void set_path(const string& _path);
@@ -144,9 +186,8 @@ private:
     // internal params
     bool end; // ReplicateEndReq was constructed, sending
     bool all_data_sent; // all data was sent
-    std::vector<DiffBlocks> diff_blocks;
-    int vector_cursor; // cursor of DiffBlocks vector
-    int array_cursor; // cursor of array in DiffBlock
+    std::shared_ptr<DiffReader> diff_reader; // pull diff blocks by stream
+    uint64_t pending_blk; // diff block peeked from reader, not sent yet
     uint64_t cur_off; // pair with j_counter, indicate whether there was space in journal
     int64_t sub_counter; // sub journal counter, start from 1
     uint64_t max_journal_size;
@@ -184,6 +225,11 @@ public:
     int reset() override;
 
     int init();
+private:
+    // open diff stream and peek the first diff block
+    int open_diff_reader();
+    // peek next diff block into pending_blk, false if no more
+    bool peek_diff_block();
 };
 
 class BaseSnapTask:public TransferTask {
@@ -200,6 +246,8 @@ private:
     uint64_t cur_off; // pair with j_counter, indicate whether there was space in journal
     int64_t sub_counter; // sub journal counter, start from 1
     uint64_t max_journal_size;
+    std::shared_ptr<PeerBlockHashes> peer_hashes; // null if not reseed
+    uint64_t skipped; // blocks peer already has
 
 public:
     BaseSnapTask(const std::string& _base,
@@ -231,8 +279,12 @@ public:
 
     TransferRequest* get_next_package() override;
 
+    void on_reply(const TransferResponse& res) override;
+
     int reset() override;
 
     int init();
+private:
+    TransferRequest* construct_end();
 };
 #endif
\ No newline at end of file
@@ -28,7 +28,9 @@ RepVolume::RepVolume(const string& vol_id,
         journal_mgr_(j_mgr),
         task_generating_flag_(false),
         transient_state(false),
-        base_sync_state_(NO_SYNC){
+        base_sync_state_(NO_SYNC),
+        codec_(new PairCodec(vol_id)),
+        sizer_(new ChunkSizer(vol_id)){
     load_volume_meta();
 }
 RepVolume::~RepVolume(){
@@ -140,6 +142,8 @@ void RepVolume::register_replicator(
         GCTask::instance().register_consumer(vol_id_,reptr.get());
     }
     replicator_->set_peer_volume(get_peer_volume());
+    replicator_->set_codec(codec_);
+    replicator_->set_sizer(sizer_);
 }
 
 bool RepVolume::need_replicate(){
@@ -255,6 +259,8 @@ std::shared_ptr<TransferTask> RepVolume::generate_base_sync_task(
     // NOTE: use peer volume id
     std::shared_ptr<RepContext> ctx(new RepContext(vol_id_,get_peer_volume(), counter,
                             g_option.journal_max_size,false,std::ref(f)));
+    ctx->set_codec(codec_);
+    ctx->set_sizer(sizer_);
     std::shared_ptr<TransferTask> task;
     if(has_pre_snap){
         task.reset(new DiffSnapTask(pre_snap,cur_snap,ctx));
@@ -39,6 +39,10 @@ class RepVolume{
     std::atomic<bool> task_generating_flag_;
     std::shared_ptr<VolumeMetaManager> vol_mgr_;
     std::shared_ptr<JournalMetaManager> journal_mgr_;
+    // transfer codec shared by journal and base sync tasks of this pair
+    std::shared_ptr<PairCodec> codec_;
+    // journal chunk size adapted to the link of this pair
+    std::shared_ptr<ChunkSizer> sizer_;
 public:
     RepVolume(const string& vol_id,
             std::shared_ptr<VolumeMetaManager> vol_mgr,
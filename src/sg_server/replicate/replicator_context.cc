@@ -201,6 +201,8 @@ std::shared_ptr<TransferTask> ReplicatorContext::construct_task(
     auto f = std::bind(&ReplicatorContext::recycle_task,this,std::placeholders::_1);
     bool is_open = meta.status() == OPENED ? true:false;
     std::shared_ptr<RepContext> ctx(new RepContext(vol_,peer_volume_,c,e.end_offset(),is_open,f));
+    ctx->set_codec(codec_);
+    ctx->set_sizer(sizer_);
     std::shared_ptr<TransferTask> task(
         new JournalTask(e.start_offset(),g_option.journal_mount_point + meta.path(), ctx));
     task->set_status(T_WAITING);
@@ -250,3 +252,11 @@ void ReplicatorContext::set_peer_volume(const string& peer_vol){
     peer_volume_ = peer_vol;
 }
 
+void ReplicatorContext::set_codec(std::shared_ptr<PairCodec> codec){
+    codec_ = codec;
+}
+
+void ReplicatorContext::set_sizer(std::shared_ptr<ChunkSizer> sizer){
+    sizer_ = sizer;
+}
+
@@ -137,6 +137,8 @@ public:
 
     const string& get_peer_volume();
     void set_peer_volume(const string& peer_vol);
+    void set_codec(std::shared_ptr<PairCodec> codec);
+    void set_sizer(std::shared_ptr<ChunkSizer> sizer);
 
     // get producer marker,replicator should not tranfer journals more than this marker
     int get_producer_marker(JournalMarker& marker);
@@ -164,6 +166,10 @@ private:
     std::list<JournalElement> pending_journals_;
     // peer volume
     string peer_volume_;
+    // transfer codec negotiated with peer
+    std::shared_ptr<PairCodec> codec_;
+    // journal chunk size adapted to the link
+    std::shared_ptr<ChunkSizer> sizer_;
 };
 
 typedef struct MarkerContext{
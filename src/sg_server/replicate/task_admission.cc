@@ -0,0 +1,76 @@
+/**********************************************
+* Copyright (c) 2016 Huawei Technologies Co., Ltd. All rights reserved.
+* 
+* File name:    task_admission.cc
+* Author: 
+* Date:         2017/07/26
+* Version:      1.0
+* Description:  per volume admission of tasks to handler threads
+* 
+************************************************/
+#include "log/log.h"
+#include "task_admission.h"
+#include "rep_task.h"
+
+TaskAdmission::TaskAdmission(
+        std::shared_ptr<BlockingQueue<std::shared_ptr<TransferTask>>> in,
+        const int& per_volume):
+        in_(in),
+        per_volume_(per_volume){
+}
+
+std::string TaskAdmission::volume_of(
+        const std::shared_ptr<TransferTask>& task){
+    std::shared_ptr<RepContext> rep_ctx =
+        std::dynamic_pointer_cast<RepContext>(task->get_context());
+    return rep_ctx ? rep_ctx->get_vol_id() : std::string();
+}
+
+std::shared_ptr<TransferTask> TaskAdmission::unpark(){
+    for(auto it=parked_.begin(); it!=parked_.end(); ++it){
+        if(writing_[it->first] >= per_volume_)
+            continue;
+        std::shared_ptr<TransferTask> task = it->second.front();
+        writing_[it->first]++;
+        it->second.pop_front();
+        if(it->second.empty())
+            parked_.erase(it);
+        return task;
+    }
+    return nullptr;
+}
+
+std::shared_ptr<TransferTask> TaskAdmission::admit(){
+    {
+        // parked tasks waited longer than any in queue
+        std::lock_guard<std::mutex> lck(mtx_);
+        std::shared_ptr<TransferTask> task = unpark();
+        if(task != nullptr)
+            return task;
+    }
+    while(true){
+        std::shared_ptr<TransferTask> task = in_->pop(); // blocked
+        if(task == nullptr)
+            return nullptr;
+        std::string vol = volume_of(task);
+        if(vol.empty())
+            return task;
+        std::lock_guard<std::mutex> lck(mtx_);
+        if(parked_.count(vol) == 0 && writing_[vol] < per_volume_){
+            writing_[vol]++;
+            return task;
+        }
+        LOG_DEBUG << "park task " << task->get_id() << " of volume " << vol;
+        parked_[vol].push_back(task);
+    }
+}
+
+void TaskAdmission::done(const std::shared_ptr<TransferTask>& task){
+    std::string vol = volume_of(task);
+    if(vol.empty())
+        return;
+    std::lock_guard<std::mutex> lck(mtx_);
+    auto it = writing_.find(vol);
+    if(it != writing_.end() && --it->second <= 0)
+        writing_.erase(it);
+}
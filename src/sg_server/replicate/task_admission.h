@@ -0,0 +1,53 @@
+/**********************************************
+* Copyright (c) 2016 Huawei Technologies Co., Ltd. All rights reserved.
+* 
+* File name:    task_admission.h
+* Author: 
+* Date:         2017/07/26
+* Version:      1.0
+* Description:  per volume admission of tasks to handler threads
+* 
+************************************************/
+#ifndef TASK_ADMISSION_H_
+#define TASK_ADMISSION_H_
+#include <string>
+#include <map>
+#include <deque>
+#include <mutex>
+#include <memory>
+#include "common/blocking_queue.h"
+#include "sg_server/transfer/transfer_task.h"
+
+// tasks of one volume written by handler threads at once, below thread
+// count, so a volume held by its bandwidth limit never takes all threads
+#define TASK_ADMIT_PER_VOLUME (2)
+
+// takes tasks from queue shared by all volumes for handler threads; a task
+// whose volume already has enough tasks being written is parked, and
+// admitted before new tasks once one of them ends; tasks of a volume keep
+// their order
+class TaskAdmission{
+    std::shared_ptr<BlockingQueue<std::shared_ptr<TransferTask>>> in_;
+    int per_volume_;
+    std::mutex mtx_;
+    std::map<std::string,int> writing_; // volume -> tasks being written
+    std::map<std::string,std::deque<std::shared_ptr<TransferTask>>> parked_;
+
+    // empty if task is not of a volume, never capped
+    static std::string volume_of(const std::shared_ptr<TransferTask>& task);
+    // take parked task of a volume under cap
+    std::shared_ptr<TransferTask> unpark();
+public:
+    TaskAdmission(
+        std::shared_ptr<BlockingQueue<std::shared_ptr<TransferTask>>> in,
+        const int& per_volume);
+    ~TaskAdmission(){}
+    TaskAdmission(TaskAdmission&) = delete;
+    TaskAdmission& operator=(TaskAdmission const&) = delete;
+
+    // block until a task may be written
+    std::shared_ptr<TransferTask> admit();
+    // writing of an admitted task ends
+    void done(const std::shared_ptr<TransferTask>& task);
+};
+#endif
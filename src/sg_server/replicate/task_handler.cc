@@ -10,6 +10,7 @@
 ************************************************/
 #include<fstream>
 #include "task_handler.h"
+#include "rep_qos.h"
 #include "log/log.h"
 #include "../sg_util.h"
 #include <stdlib.h>// posix_memalign
@@ -20,14 +21,20 @@ using google::protobuf::int32;
 using huawei::proto::transfer::MessageType;
 
 #define TASK_HANDLER_THREAD_COUNT (8)
+// max tasks waiting for replies on one stream
+#define TASK_HANDLER_INFLIGHT_TASKS (8)
+// threads run callbacks of completed tasks
+#define TASK_HANDLER_DONE_THREADS (2)
 
 void TaskHandler::init(
         std::shared_ptr<BlockingQueue<std::shared_ptr<TransferTask>>> in,
         std::shared_ptr<BlockingQueue<std::shared_ptr<MarkerContext>>> out){
     tp_.reset(new sg_threads::ThreadPool(TASK_HANDLER_THREAD_COUNT,TASK_HANDLER_THREAD_COUNT));
+    done_tp_.reset(new sg_threads::ThreadPool(TASK_HANDLER_DONE_THREADS));
     running_ = true;
     seq_id_ = 0L;
     in_task_que_ = in;
+    admission_.reset(new TaskAdmission(in,TASK_ADMIT_PER_VOLUME));
     out_que_ = out;
     for(int i=0; i<TASK_HANDLER_THREAD_COUNT; i++){
         tp_->submit(std::bind(&TaskHandler::work,this));
@@ -61,84 +68,69 @@ void TaskHandler::wait_for_grpc_stream_ready(ClientContext* rpc_ctx,
     }
 }
 
+void TaskHandler::reset_stream(ClientContext*& rpc_ctx,
+        std::unique_ptr<PipelinedStream>& pipe){
+    ClientState s = NetSender::instance().get_state(false);
+    LOG_INFO << "rpc channel state:"
+        << NetSender::instance().get_printful_state(s);
+    // replies of in-flight tasks never come, cancel the call
+    rpc_ctx->TryCancel();
+    pipe->close();
+    pipe.reset();
+    delete rpc_ctx;
+
+    LOG_WARN << " re-create rpc stream...";
+    rpc_ctx = new ClientContext;
+    grpc_stream_ptr stream;
+    wait_for_grpc_stream_ready(rpc_ctx,stream);
+    pipe.reset(new PipelinedStream(stream,TASK_HANDLER_INFLIGHT_TASKS,
+        *done_tp_));
+}
+
 void TaskHandler::work(){
     // init stream
     ClientContext* rpc_ctx = new ClientContext;
     grpc_stream_ptr stream;
     wait_for_grpc_stream_ready(rpc_ctx,stream);
+    std::unique_ptr<PipelinedStream> pipe(
+        new PipelinedStream(stream,TASK_HANDLER_INFLIGHT_TASKS,*done_tp_));
 
-    // do TransferTask
+    // do TransferTask, not wait for replies of previous tasks
     while(running_){
-        std::shared_ptr<TransferTask> task = in_task_que_->pop();
+        // a volume never holds all threads, others keep their share
+        std::shared_ptr<TransferTask> task = admission_->admit();
         SG_ASSERT(task != nullptr);
-        if(0 == do_transfer(task,stream)){
-            task->set_status(T_DONE);
-            // note: if failed, do not run callback function, 
-            // or task window goes wrong
-            std::shared_ptr<RepContext> rep_ctx =
-                std::dynamic_pointer_cast<RepContext>(task->get_context());
-            LOG_DEBUG << "task id:" << task->get_id()
-                << ",vol:" << rep_ctx->get_vol_id()
-                << ",journal:" << rep_ctx->get_j_counter();
-            rep_ctx->get_callback()(task);
+        if(pipe->broken()){
+            reset_stream(rpc_ctx,pipe);
         }
-        else{
-            ClientState s = NetSender::instance().get_state(false);
-            LOG_INFO << "rpc channel state:"
-                << NetSender::instance().get_printful_state(s);
-            if(CLIENT_READY != s){
-                stream->WritesDone();
-                stream->Finish();
-                if(rpc_ctx){
-                    delete rpc_ctx;
-                    rpc_ctx = nullptr;
-                }
-                LOG_WARN << " re-create rpc stream...";
-                rpc_ctx = new ClientContext;
-                wait_for_grpc_stream_ready(rpc_ctx,stream);
-            }
+        if(!pipe->acquire()){
+            task->set_status(T_ERROR);
+            admission_->done(task);
+            continue;
         }
+        do_transfer(task,*pipe);
+        admission_->done(task);
     }
 
     // recycel rpc resource
-    stream->WritesDone();
-    Status status = stream->Finish();// may block if not all data in the stream were read
-    if (!status.ok()) {
-        LOG_ERROR << "replicate client close stream failed!";
-    }
+    pipe->drain();
+    pipe->close();
     if(rpc_ctx){
         delete rpc_ctx;
         rpc_ctx = nullptr;
     }
 }
 
-int send_replicate_cmd(TransferRequest* req,
-        grpc_stream_ptr& stream){
-    if(stream->Write(*req)){
-        TransferResponse res;
-        if(stream->Read(&res)){ // blocked
-            SG_ASSERT(res.id() == req->id());
-            if(!res.status()){
-                return 0;
-            }
-            LOG_ERROR << "destination handle replicate cmd failed!";
-        }
-        else{
-            LOG_ERROR << "replicate grpc read failed!";
-        }
-    }
-    else{
-        LOG_ERROR << "replicate grpc write failed!";
-        return -1;
-    }
-    return -1;
-}
-
-
 int TaskHandler::do_transfer(std::shared_ptr<TransferTask> task,
-                grpc_stream_ptr& stream){
+                PipelinedStream& pipe){
     LOG_DEBUG << "start transfer task, id=" << task->get_id();
 
+    std::shared_ptr<InflightTask> inflight(new InflightTask(task));
+    std::shared_ptr<RepContext> rep_ctx =
+        std::dynamic_pointer_cast<RepContext>(task->get_context());
+    if(rep_ctx && rep_ctx->get_sizer()){
+        rep_ctx->get_sizer()->on_task_sent(std::chrono::steady_clock::now());
+    }
     bool error_flag = false;
     while(task->has_next_package()){
         TransferRequest* req = task->get_next_package();
@@ -149,28 +141,33 @@ int TaskHandler::do_transfer(std::shared_ptr<TransferTask> task,
         }
         switch(req->type()){
             case MessageType::REPLICATE_DATA:
-                if(!stream->Write(*req)){
+                // bandwidth limits and fair share with other volumes
+                if(rep_ctx){
+                    RepQos::instance().acquire(rep_ctx->get_vol_id(),
+                        req->data().size());
+                }
+                inflight->bytes += req->data().size();
+                if(!pipe.write(*req)){
                     LOG_ERROR << "send replicate data failed!, task id:"
                         << task->get_id();
                     error_flag = true;
                 }
                 break;
             case MessageType::REPLICATE_START:
-                if(send_replicate_cmd(req,stream) != 0){
-                    LOG_ERROR << "handle replicate start req failed!, task id:"
-                        << task->get_id();
-                    task->set_status(T_ERROR);
-                }
-                break;
             case MessageType::REPLICATE_END:
-                if(send_replicate_cmd(req,stream) != 0){
-                    LOG_ERROR << "handle replicate end req failed!, task id:"
-                        << task->get_id();
+            case MessageType::REPLICATE_HASH:
+                // ids of tasks overlap, replies are correlated by stream
+                // wide id
+                req->set_id(++seq_id_);
+                if(!pipe.expect_reply(req->id(),inflight,
+                        req->type() != MessageType::REPLICATE_HASH)
+                    || !pipe.write(*req)){
+                    LOG_ERROR << "send replicate cmd failed!, task id:"
+                        << task->get_id() << ",type:" << req->type();
                     error_flag = true;
                 }
                 break;
 
-
             default:
                 LOG_WARN << "unknown transfer message, type=" << req->type()
                     << ", id=" << req->id();
@@ -180,10 +177,9 @@ int TaskHandler::do_transfer(std::shared_ptr<TransferTask> task,
         delete req;
         req = nullptr;
         if(error_flag){
-            task->set_status(T_ERROR);
             break;
         }
     }
+    pipe.finish_task(inflight,error_flag);
     return error_flag? -1:0;
 }
-
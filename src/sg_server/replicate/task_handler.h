@@ -12,13 +12,18 @@
 #define TASK_HANDLER_H_
 #include <list>
 #include <vector>
+#include <map>
 #include <mutex>
 #include <thread>
+#include <chrono>
 #include <functional>
+#include <condition_variable>
 #include "rep_type.h"
 #include "common/thread_pool.h"
 #include "replicator_context.h"
 #include "rep_task.h"
+#include "pipelined_stream.h"
+#include "task_admission.h"
 #include "sg_server/transfer/net_sender.h"
 using huawei::proto::JournalMarker;
 
@@ -29,9 +34,13 @@ private:
     std::mutex mtx_;
     //input, queue of task which need to be excuted
     std::shared_ptr<BlockingQueue<std::shared_ptr<TransferTask>>> in_task_que_;
+    // tasks of input queue admitted per volume
+    std::unique_ptr<TaskAdmission> admission_;
     //output, queue of markerContext which need be synced
     std::shared_ptr<BlockingQueue<std::shared_ptr<MarkerContext>>> out_que_;
     std::unique_ptr<sg_threads::ThreadPool> tp_;
+    // runs callbacks of tasks completed by streams
+    std::unique_ptr<sg_threads::ThreadPool> done_tp_;
 public:
     static TaskHandler& instance(){
         static TaskHandler t;
@@ -50,14 +59,18 @@ private:
     TaskHandler();
     ~TaskHandler();
 
+    // write packages of task, completion is reported by the stream
     int do_transfer(std::shared_ptr<TransferTask> task,
-            grpc_stream_ptr& stream);
+            PipelinedStream& pipe);
 
     // thread main loop method
     void work();
 
     void wait_for_grpc_stream_ready(ClientContext* rpc_ctx,
         grpc_stream_ptr& stream);
+    // drop broken stream and its rpc context, then create new ones
+    void reset_stream(ClientContext*& rpc_ctx,
+        std::unique_ptr<PipelinedStream>& pipe);
 };
 
 #endif
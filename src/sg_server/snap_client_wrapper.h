@@ -31,26 +31,17 @@ public:
 
     bool diff_snapshot_is_empty(const string& vol,const string& cur_snap,
         const string& pre_snap){
-        std::vector<DiffBlocks> diff_blocks;
-        StatusCode ret = snap_ctrl_client->DiffSnapshot(
-                vol,pre_snap,cur_snap,diff_blocks);
-        SG_ASSERT(ret == StatusCode::sOk);
-        LOG_DEBUG << diff_blocks.size() << " blocks in diffSnapTask.";
-        if(diff_blocks.empty()){
-            LOG_INFO << "there was no diff blocks in task[" << cur_snap << "]";
-            return true;
+        // only the first diff block needed, no need to pull the whole diff
+        std::shared_ptr<DiffReader> reader = snap_ctrl_client->DiffSnapshotStream(
+                vol,pre_snap,cur_snap);
+        string snap_name;
+        uint64_t blk_no;
+        if(reader->next(snap_name,blk_no)){
+            return false;
         }
-        else{
-            for(int i=0; i<diff_blocks.size(); i++){
-                if(diff_blocks[i].diff_block_no_size() > 0){
-                    return false;
-                }
-            }
-            LOG_INFO << "there was no diff block in snap[" << cur_snap
-                    << "]";
-            return true;
-        }
-        return false;
+        SG_ASSERT(reader->status() == StatusCode::sOk);
+        LOG_INFO << "there was no diff block in snap[" << cur_snap << "]";
+        return true;
     }
 
     bool snapshot_is_empty(const string& vol,const string& snap){
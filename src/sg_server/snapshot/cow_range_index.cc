@@ -0,0 +1,170 @@
+/**********************************************
+*  Copyright (c) 2016 Huawei Technologies Co., Ltd. All rights reserved.
+* 
+*  File name:    cow_range_index.cc
+*  Author:
+*  Date:         2017/06/12
+*  Version:      1.0
+*  Description:  compact in memory index of block cow ranges
+* 
+*************************************************/
+#include <algorithm>
+#include "cow_range_index.h"
+
+CowRangeIndex::CowRangeIndex() {
+    m_count = 0;
+}
+
+CowRangeIndex::~CowRangeIndex() {
+    m_segments.clear();
+}
+
+bool CowRangeIndex::entry_less(const cow_entry& entry, const cow_entry& key) {
+    if (entry.blk_off != key.blk_off) {
+        return entry.blk_off < key.blk_off;
+    }
+    return entry.end < key.end;
+}
+
+void CowRangeIndex::insert(const block_t blk_id, const cow_range_t& range) {
+    cow_entry entry;
+    entry.start = range.start;
+    entry.end = range.end;
+    entry.blk_off = blk_id % COW_SEGMENT_BLOCKS;
+    segment_t& segment = m_segments[blk_id / COW_SEGMENT_BLOCKS];
+    /*recover and cow update mostly append*/
+    auto it = segment.end();
+    if (!segment.empty() && !entry_less(segment.back(), entry)) {
+        it = std::lower_bound(segment.begin(), segment.end(), entry,
+                              entry_less);
+    }
+    segment.insert(it, entry);
+    m_count++;
+}
+
+bool CowRangeIndex::erase(const block_t blk_id, const snapid_t end) {
+    auto seg_it = m_segments.find(blk_id / COW_SEGMENT_BLOCKS);
+    if (seg_it == m_segments.end()) {
+        return false;
+    }
+    segment_t& segment = seg_it->second;
+    cow_entry key = {0, end, (uint32_t)(blk_id % COW_SEGMENT_BLOCKS)};
+    auto it = std::lower_bound(segment.begin(), segment.end(), key, entry_less);
+    if (it == segment.end() || it->blk_off != key.blk_off || it->end != end) {
+        return false;
+    }
+    segment.erase(it);
+    if (segment.empty()) {
+        m_segments.erase(seg_it);
+    }
+    m_count--;
+    return true;
+}
+
+bool CowRangeIndex::find(const block_t blk_id, const snapid_t snap_id,
+                         cow_range_t& range) const {
+    auto seg_it = m_segments.find(blk_id / COW_SEGMENT_BLOCKS);
+    if (seg_it == m_segments.end()) {
+        return false;
+    }
+    const segment_t& segment = seg_it->second;
+    /*the first range end not less than snap_id is the only candidate*/
+    cow_entry key = {0, snap_id, (uint32_t)(blk_id % COW_SEGMENT_BLOCKS)};
+    auto it = std::lower_bound(segment.begin(), segment.end(), key, entry_less);
+    if (it == segment.end() || it->blk_off != key.blk_off ||
+        it->start > snap_id) {
+        return false;
+    }
+    range.start = it->start;
+    range.end = it->end;
+    return true;
+}
+
+bool CowRangeIndex::last(const block_t blk_id, cow_range_t& range) const {
+    auto seg_it = m_segments.find(blk_id / COW_SEGMENT_BLOCKS);
+    if (seg_it == m_segments.end()) {
+        return false;
+    }
+    const segment_t& segment = seg_it->second;
+    /*the entry before the first one of next block*/
+    cow_entry key = {0, 0, (uint32_t)(blk_id % COW_SEGMENT_BLOCKS) + 1};
+    auto it = std::lower_bound(segment.begin(), segment.end(), key, entry_less);
+    if (it == segment.begin()) {
+        return false;
+    }
+    it--;
+    if (it->blk_off != key.blk_off - 1) {
+        return false;
+    }
+    range.start = it->start;
+    range.end = it->end;
+    return true;
+}
+
+void CowRangeIndex::visit(const block_t first_blk, const block_t last_blk,
+                          const snapid_t snap_id,
+                          const visitor_t& visitor) const {
+    if (first_blk > last_blk) {
+        return;
+    }
+    auto seg_it = m_segments.lower_bound(first_blk / COW_SEGMENT_BLOCKS);
+    for (; seg_it != m_segments.end(); seg_it++) {
+        block_t seg_base = seg_it->first * COW_SEGMENT_BLOCKS;
+        if (seg_base > last_blk) {
+            return;
+        }
+        for (auto& entry : seg_it->second) {
+            block_t blk_id = seg_base + entry.blk_off;
+            if (blk_id < first_blk) {
+                continue;
+            }
+            if (blk_id > last_blk) {
+                return;
+            }
+            if (entry.start > snap_id || entry.end < snap_id) {
+                continue;
+            }
+            cow_range_t range = {entry.start, entry.end};
+            if (!visitor(blk_id, range)) {
+                return;
+            }
+        }
+    }
+}
+
+void CowRangeIndex::visit_all(const visitor_t& visitor) const {
+    for (auto& seg_it : m_segments) {
+        block_t seg_base = seg_it.first * COW_SEGMENT_BLOCKS;
+        for (auto& entry : seg_it.second) {
+            cow_range_t range = {entry.start, entry.end};
+            if (!visitor(seg_base + entry.blk_off, range)) {
+                return;
+            }
+        }
+    }
+}
+
+void CowRangeIndex::compact() {
+    for (auto& seg_it : m_segments) {
+        seg_it.second.shrink_to_fit();
+    }
+}
+
+void CowRangeIndex::clear() {
+    m_segments.clear();
+    m_count = 0;
+}
+
+size_t CowRangeIndex::size() const {
+    return m_count;
+}
+
+size_t CowRangeIndex::memory_usage() const {
+    /*red black tree node hold key, vector and about 4 pointers*/
+    size_t node_size = sizeof(uint64_t) + sizeof(segment_t) + 4 * sizeof(void*);
+    size_t usage = m_segments.size() * node_size;
+    for (auto& seg_it : m_segments) {
+        usage += seg_it.second.capacity() * sizeof(cow_entry);
+    }
+    return usage;
+}
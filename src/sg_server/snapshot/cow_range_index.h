@@ -0,0 +1,76 @@
+/**********************************************
+*  Copyright (c) 2016 Huawei Technologies Co., Ltd. All rights reserved.
+* 
+*  File name:    cow_range_index.h
+*  Author:
+*  Date:         2017/06/12
+*  Version:      1.0
+*  Description:  compact in memory index of block cow ranges
+* 
+*************************************************/
+#ifndef SRC_SG_SERVER_SNAPSHOT_COW_RANGE_INDEX_H_
+#define SRC_SG_SERVER_SNAPSHOT_COW_RANGE_INDEX_H_
+#include <map>
+#include <vector>
+#include <functional>
+#include "common/define.h"
+#include "snapshot_def.h"
+
+/*block count one index segment cover*/
+#define COW_SEGMENT_BLOCKS (4096UL)
+
+/*blocks grouped into fixed size segments, each segment keep a sorted array
+ *of cow ranges, no per block tree node and no cow object name string, cow
+ *object name spawn on demand from block and range end*/
+class CowRangeIndex {
+ public:
+    typedef std::function<bool(const block_t, const cow_range_t&)> visitor_t;
+
+    CowRangeIndex();
+    CowRangeIndex(const CowRangeIndex& other) = delete;
+    CowRangeIndex& operator=(const CowRangeIndex& other) = delete;
+    ~CowRangeIndex();
+
+    /*add cow range of block, ranges of one block never overlap*/
+    void insert(const block_t blk_id, const cow_range_t& range);
+    /*remove cow range of block end at the snapshot*/
+    bool erase(const block_t blk_id, const snapid_t end);
+    /*cow range which serve the snapshot, false if block not cow*/
+    bool find(const block_t blk_id, const snapid_t snap_id,
+              cow_range_t& range) const;
+    /*the latest cow range of block*/
+    bool last(const block_t blk_id, cow_range_t& range) const;
+
+    /*visit blocks in [first_blk, last_blk] in block order with the range
+     *serve the snapshot, visitor return false to stop*/
+    void visit(const block_t first_blk, const block_t last_blk,
+               const snapid_t snap_id, const visitor_t& visitor) const;
+    /*visit all cow ranges in block and range order*/
+    void visit_all(const visitor_t& visitor) const;
+
+    /*release spare capacity after bulk load*/
+    void compact();
+    void clear();
+    /*cow range count*/
+    size_t size() const;
+    /*approximate heap bytes used by the index*/
+    size_t memory_usage() const;
+
+ private:
+    /*block offset in segment first, then range end*/
+    struct cow_entry {
+        snapid_t start;
+        snapid_t end;
+        uint32_t blk_off;
+    };
+    typedef std::vector<cow_entry> segment_t;
+
+    static bool entry_less(const cow_entry& entry, const cow_entry& key);
+
+ private:
+    /*segment no and sorted cow entry of the segment*/
+    std::map<uint64_t, segment_t> m_segments;
+    size_t m_count;
+};
+
+#endif  // SRC_SG_SERVER_SNAPSHOT_COW_RANGE_INDEX_H_
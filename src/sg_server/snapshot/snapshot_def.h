@@ -12,7 +12,9 @@
 #define SRC_SG_SERVER_SNAPSHOT_SNAPSHOT_DEF_H_
 #include <string>
 #include <set>
+#include <map>
 #include "rpc/snapshot.pb.h"
+#include "common/define.h"
 using huawei::proto::SnapStatus;
 using huawei::proto::SnapType;
 using namespace std;
@@ -22,9 +24,18 @@ typedef uint64_t snapid_t;
 
 /*cow data object name*/
 typedef string cow_object_t;
-/*cow data object snapshot reference list*/
+/*cow data object snapshot reference list(legacy layout)*/
 typedef set<snapid_t> cow_object_ref_t;
 
+/*cow data object serve snapshot id range [start, end], end is the snapshot
+ *in which cow happened, start is the end of previous range plus one, the
+ *cow object name derive from volume, end and block*/
+struct cow_range {
+    snapid_t     start;
+    snapid_t     end;
+};
+typedef struct cow_range cow_range_t;
+
 /*snapshot attribution*/
 struct snap_attr {
     string replication_uuid;
@@ -38,8 +49,26 @@ struct snap_attr {
 };
 typedef struct snap_attr snap_attr_t;
 
+/*incremental diff progress, resume from it to compute next diff chunk*/
+struct diff_cursor {
+    snapid_t cur_snapid;
+    snapid_t last_snapid;
+    block_t  next_blk;
+    bool     pair_emitted;
+    /*diff first and last snapshot directly instead of pair by pair*/
+    bool     merged;
+};
+typedef struct diff_cursor diff_cursor_t;
+
+/*block count one diff chunk cover, align to hbitmap serialize granularity*/
+#define DIFF_CHUNK_BLOCKS (64*1024UL)
+
 /*snapshot meta store path*/
 #define SNAPSHOT_META  "/snapshot"
+/*snapshot meta checkpoint image beside meta store path*/
+#define SNAPSHOT_CKPT_FILE ".ckpt"
+/*seconds between two meta checkpoint*/
+#define SNAPSHOT_CKPT_INTERVAL (600)
 
 /*use spawn cow object name*/
 #define FS  "@"
@@ -50,6 +79,9 @@ typedef struct snap_attr snap_attr_t;
 #define SNAPSHOT_NAME_PREFIX         "snapshot_latestname"
 #define SNAPSHOT_MAP_PREFIX           "snapshot_table_prefix"
 #define SNAPSHOT_STATUS_PREFIX        "snapshot_status_prefix"
+#define SNAPSHOT_COWRANGE_PREFIX      "snapshot_cowrange_prefix"
+#define SNAPSHOT_COWSIZE_PREFIX       "snapshot_cowsize"
+/*legacy cow key layout, migrate to cow range when recover*/
 #define SNAPSHOT_COWBLOCK_PREFIX      "snapshot_cowblock_prefix"
 #define SNAPSHOT_COWOBJECT_PREFIX     "snapshot_cowobject_prefix"
 
@@ -9,12 +9,16 @@
 * 
 *************************************************/
 #include <cstdlib>
+#include <cstdio>
+#include <cstring>
 #include <unistd.h>
 #include <fcntl.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <assert.h>
+#include <vector>
 #include "common/config_option.h"
+#include "common/hbitmap.h"
 #include "snapshot_util.h"
 #include "snapshot_mds.h"
 
@@ -27,13 +31,12 @@ SnapshotMds::SnapshotMds(const string& vol_name, const size_t& vol_size) {
     m_volume_name = vol_name;
     m_volume_size = vol_size;
     m_latest_snapid = 0;
+    m_cow_block_size = COW_BLOCK_SIZE;
     m_snapshots.clear();
-    m_cow_block_map.clear();
-    m_cow_object_map.clear();
+    m_snap_ids.clear();
+    m_cow_index.clear();
 
-    m_block_store = new CephBlockStore(g_option.ceph_cluster_name,
-                                       g_option.ceph_user_name,
-                                       g_option.ceph_pool_name);
+    m_block_store = create_block_store(vol_name);
 
     /*todo: read from configure file*/
     string db_path = DB_DIR + vol_name + "/snapshot";
@@ -43,8 +46,13 @@ SnapshotMds::SnapshotMds(const string& vol_name, const size_t& vol_size) {
         int ret = system(cmd);
         assert(ret != -1);
     }
-    m_index_store = IndexStore::create("rocksdb", db_path);
+    /*attr and cow range each in own column family*/
+    m_index_store = IndexStore::create(g_option.index_store_type, db_path,
+                                       {SNAPSHOT_MAP_PREFIX,
+                                        SNAPSHOT_COWRANGE_PREFIX}, FS[0]);
     m_index_store->db_open();
+    m_ckpt_file = db_path + SNAPSHOT_CKPT_FILE;
+    m_ckpt_seq = 0;
 }
 
 SnapshotMds::~SnapshotMds() {
@@ -54,13 +62,13 @@ SnapshotMds::~SnapshotMds() {
     if (m_block_store) {
         delete m_block_store;
     }
-    m_cow_object_map.clear();
-    m_cow_block_map.clear();
+    m_cow_index.clear();
+    m_snap_ids.clear();
     m_snapshots.clear();
 }
 
 snapid_t SnapshotMds::spawn_snapshot_id() {
-    lock_guard<std::mutex> lock(m_mutex);
+    /*caller hold m_mutex*/
     /*todo: how to maintain and recycle snapshot id*/
     snapid_t snap_id = m_latest_snapid;
     m_latest_snapid++;
@@ -76,25 +84,54 @@ snapid_t SnapshotMds::get_snapshot_id(string snap_name) {
 }
 
 string SnapshotMds::get_snapshot_name(snapid_t snap_id) {
-    for (auto it : m_snapshots) {
-        if (it.second.snap_id == snap_id) {
-            return it.first;
-        }
+    auto it = m_snap_ids.find(snap_id);
+    if (it != m_snap_ids.end()) {
+        return it->second;
     }
     return "";
 }
 
+StatusCode SnapshotMds::set_cow_block_size(const size_t cow_block_size) {
+    if (cow_block_size == 0 || cow_block_size == m_cow_block_size) {
+        return StatusCode::sOk;
+    }
+    if (cow_block_size < COW_BLOCK_SIZE_MIN ||
+        cow_block_size > COW_BLOCK_SIZE ||
+        (cow_block_size & (cow_block_size - 1))) {
+        return StatusCode::sInvalidOperation;
+    }
+    if (!m_snapshots.empty() || m_cow_index.size() != 0) {
+        /*block number of exist cow data depend on old granularity*/
+        LOG_WARN << "cow block size keep:" << m_cow_block_size
+                 << " volume already has snapshot";
+        return StatusCode::sOk;
+    }
+    int ret = m_index_store->db_put(DbUtil::spawn_cow_size_key(),
+                                    to_string(cow_block_size));
+    if (ret) {
+        return StatusCode::sSnapMetaPersistError;
+    }
+    LOG_INFO << "cow block size change from:" << m_cow_block_size
+             << " to:" << cow_block_size;
+    m_cow_block_size = cow_block_size;
+    return StatusCode::sOk;
+}
+
 string SnapshotMds::get_latest_snap_name() {
-    auto rit = m_cow_block_map.rbegin();
-    if (rit == m_cow_block_map.rend()) {
+    auto rit = m_snap_ids.rbegin();
+    if (rit == m_snap_ids.rend()) {
         return "";
     }
-    snapid_t snap_id = rit->first;
-    if (snap_id == -1) {
-        return "";
+    return rit->second;
+}
+
+bool SnapshotMds::cow_range_referenced(const cow_range_t& range,
+                                       const snapid_t exclude) {
+    auto it = m_snap_ids.lower_bound(range.start);
+    if (it != m_snap_ids.end() && it->first == exclude) {
+        it++;
     }
-    string snap_name = get_snapshot_name(snap_id);
-    return snap_name;
+    return it != m_snap_ids.end() && it->first <= range.end;
 }
 
 StatusCode SnapshotMds::sync(const SyncReq* req, SyncAck* ack) {
@@ -103,6 +140,7 @@ StatusCode SnapshotMds::sync(const SyncReq* req, SyncAck* ack) {
     lock_guard<std::mutex> lock(m_mutex);
     string latest_snap_name = get_latest_snap_name();
     ack->set_latest_snap_name(latest_snap_name);
+    ack->set_cow_block_size(m_cow_block_size);
     ack->mutable_header()->set_status(StatusCode::sOk);
     LOG_INFO << "sync" << " vname:" << vol_name << " ok";
     return StatusCode::sOk;
@@ -122,12 +160,23 @@ StatusCode SnapshotMds::create_snapshot(const CreateReq* req, CreateAck* ack) {
         return StatusCode::sOk;
     }
 
+    StatusCode ret = set_cow_block_size(req->cow_block_size());
+    ack->set_cow_block_size(m_cow_block_size);
+    if (ret != StatusCode::sOk) {
+        ack->mutable_header()->set_status(ret);
+        LOG_ERROR << "create snapshot vname:" << vol_name << " sname:"
+                  << snap_name << " invalid cow block size:"
+                  << req->cow_block_size();
+        return ret;
+    }
+
     snap_attr_t cur_snap_attr;
     cur_snap_attr.replication_uuid = req->header().replication_uuid();
     cur_snap_attr.checkpoint_uuid  = req->header().checkpoint_uuid();
     cur_snap_attr.volume_uuid = vol_name;
     cur_snap_attr.snap_type = (SnapType)req->header().snap_type();
     cur_snap_attr.snap_name = snap_name;
+    cur_snap_attr.snap_id = -1;
     cur_snap_attr.snap_status = SnapStatus::SNAP_CREATING;
 
     /*in db update snapshot status*/
@@ -231,20 +280,20 @@ StatusCode SnapshotMds::rollback_snapshot(const RollbackReq* req,
     }
 
     snapid_t snap_id = it->second.snap_id;
-    auto snap_it = m_cow_block_map.find(snap_id);
-    if (snap_it == m_cow_block_map.end()) {
+    if (m_snap_ids.find(snap_id) == m_snap_ids.end()) {
         ack->mutable_header()->set_status(StatusCode::sSnapNotExist);
         LOG_INFO << "rollback snapshot vname:" << vol_name
                  << " snap_id:" << snap_id << " not exist";
         return StatusCode::sOk;
     }
 
-    map<block_t, cow_object_t>& block_map = snap_it->second;
-    for (auto blk_it : block_map) {
-        RollBlock* roll_blk = ack->add_roll_blocks();
-        roll_blk->set_blk_no(blk_it.first);
-        roll_blk->set_blk_object(blk_it.second);
-    }
+    m_cow_index.visit(0, UINT64_MAX, snap_id,
+        [&](const block_t blk_id, const cow_range_t& range) -> bool {
+            RollBlock* roll_blk = ack->add_roll_blocks();
+            roll_blk->set_blk_no(blk_id);
+            roll_blk->set_blk_object(spawn_cow_object_name(range.end, blk_id));
+            return true;
+        });
 
     ack->mutable_header()->set_status(StatusCode::sOk);
     LOG_INFO << "rollback snapshot vname:" << vol_name
@@ -253,6 +302,7 @@ StatusCode SnapshotMds::rollback_snapshot(const RollbackReq* req,
 }
 
 StatusCode SnapshotMds::create_event_update_status(string snap_name) {
+    lock_guard<std::mutex> lock(m_mutex);
     auto it = m_snapshots.find(snap_name);
     if (it == m_snapshots.end()) {
         return StatusCode::sSnapNotExist;
@@ -286,9 +336,7 @@ StatusCode SnapshotMds::create_event_update_status(string snap_name) {
     it->second.snap_id = snap_id;
     it->second.snap_status = SnapStatus::SNAP_CREATED;
 
-    /*prepare cow block map*/
-    map<block_t, cow_object_t> block_map;
-    m_cow_block_map.insert({snap_id, block_map});
+    m_snap_ids.insert({snap_id, snap_name});
     LOG_INFO << "update sname:" << snap_name << " create event ok";
     return StatusCode::sOk;
 }
@@ -313,36 +361,24 @@ StatusCode SnapshotMds::delete_event_update_status(string snap_name) {
     }
 
     snapid_t snap_id = it->second.snap_id;
-    auto snap_it = m_cow_block_map.find(snap_id);
-    if (snap_it == m_cow_block_map.end()) {
+    if (m_snap_ids.find(snap_id) == m_snap_ids.end()) {
         return StatusCode::sSnapNotExist;
     }
 
-    map<block_t, cow_object_t>& block_map = snap_it->second;
+    /*cow range only reclaim when no other snapshot fall in it*/
+    vector<pair<block_t, snapid_t>> reclaim_ranges;
     /*-----transction begin-----*/
     IndexStore::Transaction transaction = m_index_store->fetch_transaction();
     string pkey;
-    string pval;
-    /*delete cow block in the snapshot*/
-    for (auto blk_it : block_map) {
-        /*in db delete cow block key*/
-        pkey = DbUtil::spawn_cow_block_map_key(snap_id, blk_it.first);
-        transaction->del(pkey);
-
-        cow_object_t cow_obj = blk_it.second;
-
-        /*in db read modify write cow object reference*/
-        pkey = DbUtil::spawn_cow_object_map_key(cow_obj);
-        pval = m_index_store->db_get(pkey);
-        cow_object_ref_t obj_ref;
-        DbUtil::split_cow_object_map_val(pval, obj_ref);
-        obj_ref.erase(snap_id);
-        pval = DbUtil::spawn_cow_object_map_val(obj_ref);
-        transaction->put(pkey, pval);
-        if (obj_ref.empty()) {
-            transaction->del(pkey);
-        }
-    }
+    m_cow_index.visit(0, UINT64_MAX, snap_id,
+        [&](const block_t blk_id, const cow_range_t& range) -> bool {
+            if (!cow_range_referenced(range, snap_id)) {
+                string key = DbUtil::spawn_cow_range_key(blk_id, range.end);
+                transaction->del(key);
+                reclaim_ranges.push_back({blk_id, range.end});
+            }
+            return true;
+        });
     pkey = DbUtil::spawn_attr_map_key(snap_name);
     transaction->del(pkey);
     int ret = m_index_store->submit_transaction(transaction);
@@ -351,24 +387,14 @@ StatusCode SnapshotMds::delete_event_update_status(string snap_name) {
     }
     /*-----transction end-----*/
 
-    for (auto blk_it : block_map) {
-        cow_object_t cow_obj = blk_it.second;
-
-        /*in memory update cow object reference*/
-        cow_object_ref_t& cow_obj_ref = m_cow_object_map[cow_obj];
-        cow_obj_ref.erase(snap_id);
-
-        if (cow_obj_ref.empty()) {
-            /*in mem delete cow object key*/
-            m_cow_object_map.erase(cow_obj);
-            /*block store reclaim the cow object*/
-            m_block_store->remove(cow_obj);
-        }
+    for (auto reclaim : reclaim_ranges) {
+        /*block store reclaim the cow object*/
+        m_block_store->remove(spawn_cow_object_name(reclaim.second,
+                                                    reclaim.first));
+        m_cow_index.erase(reclaim.first, reclaim.second);
     }
-    block_map.clear();
-
-    m_cow_block_map.erase(snap_id);
 
+    m_snap_ids.erase(snap_id);
     m_snapshots.erase(snap_name);
     pkey = DbUtil::spawn_attr_map_key(snap_name);
     m_index_store->db_del(pkey);
@@ -380,6 +406,7 @@ StatusCode SnapshotMds::delete_event_update_status(string snap_name) {
 }
 
 StatusCode SnapshotMds::rollbacking_event_update_status(string snap_name) {
+    lock_guard<std::mutex> lock(m_mutex);
     auto it = m_snapshots.find(snap_name);
     if (it == m_snapshots.end()) {
         LOG_ERROR << "snap:" << snap_name << " not found";
@@ -453,6 +480,7 @@ StatusCode SnapshotMds::update(const UpdateReq* req, UpdateAck* ack) {
     /*get the latest snapshot in system*/
     string latest_snap_name = get_latest_snap_name();
     ack->set_latest_snap_name(latest_snap_name);
+    ack->set_cow_block_size(m_cow_block_size);
     LOG_INFO << "update vname:" << vol_name << " sname:" << snap_name
              << " event:" << snap_event << " ok";
     return StatusCode::sOk;
@@ -469,10 +497,8 @@ StatusCode SnapshotMds::cow_op(const CowReq* req, CowAck* ack) {
     LOG_INFO << "cow_op vname:" << vname << " snap_name:" << snap_name
              << " snap_id:" << snap_id << " blk_id:"  << blk_id;
 
-    auto snap_it = m_cow_block_map.find(snap_id);
-    map<block_t, cow_object_t>& block_map = snap_it->second;
-    auto blk_it = block_map.find(blk_id);
-    if (blk_it != block_map.end()) {
+    cow_range_t range;
+    if (m_cow_index.find(blk_id, snap_id, range)) {
         /*block already cow*/
         LOG_INFO << "cow_op COW_NO";
         ack->mutable_header()->set_status(StatusCode::sOk);
@@ -504,74 +530,32 @@ StatusCode SnapshotMds::cow_update(const CowUpdateReq* req, CowUpdateAck* ack) {
              << " snap_id:" << snap_id << " blk_id:"  << blk_no
              << " cow_obj:" << cow_obj;
 
-    /*----transaction begin-------*/
-    IndexStore::Transaction transaction = m_index_store->fetch_transaction();
-    /*in db update cow block*/
-    string pkey = DbUtil::spawn_cow_block_map_key(snap_id, blk_no);
-    transaction->put(pkey, cow_obj);
-    /*in db update cow object */
-    pkey = DbUtil::spawn_cow_object_map_key(cow_obj);
-    cow_object_ref_t cow_obj_ref;
-    cow_obj_ref.insert(snap_id);
-    string pval = DbUtil::spawn_cow_object_map_val(cow_obj_ref);
-    transaction->put(pkey, pval);
-    int ret = m_index_store->submit_transaction(transaction);
+    /*cow object serve all snapshots since the previous cow of the block*/
+    cow_range_t range;
+    cow_range_t last_range;
+    range.start = 0;
+    range.end = snap_id;
+    if (m_cow_index.last(blk_no, last_range)) {
+        if (last_range.end == snap_id) {
+            LOG_INFO << "cow_update snap_id:" << snap_id << " blk_id:" << blk_no
+                     << " already cow";
+            ack->mutable_header()->set_status(StatusCode::sOk);
+            return StatusCode::sOk;
+        }
+        assert(last_range.end < snap_id);
+        range.start = last_range.end + 1;
+    }
+
+    /*in db update cow range, one put whatever snapshot count*/
+    string pkey = DbUtil::spawn_cow_range_key(blk_no, snap_id);
+    string pval = DbUtil::spawn_cow_range_val(range);
+    int ret = m_index_store->db_put(pkey, pval);
     if (ret) {
         return StatusCode::sSnapMetaPersistError;
     }
 
-    /*in mem update cow_block_map*/
-    auto snap_it = m_cow_block_map.find(snap_id);
-    assert(snap_it != m_cow_block_map.end());
-    map<block_t, cow_object_t>& block_map = snap_it->second;
-    block_map.insert({blk_no, cow_obj});
-
-    /*in mem update cow object*/
-    auto obj_it = m_cow_object_map.find(cow_obj);
-    assert(obj_it == m_cow_object_map.end());
-    m_cow_object_map.insert({cow_obj, cow_obj_ref});
-
-    /*todo :travel forward to update other snapshot in cow_block_map
-     * should optimize by backward*/
-    auto travel_it = m_cow_block_map.begin();
-    for (; travel_it != m_cow_block_map.end() && travel_it->first < snap_id;
-          travel_it++) {
-        map<block_t, cow_object_t>& block_map = travel_it->second;
-        auto blk_it = block_map.find(blk_no);
-        if (blk_it != block_map.end()) {
-            LOG_INFO << "cow_update snapshot: " << travel_it->first
-                     << " has block:" << blk_no << " break";
-            continue;
-        }
-
-        LOG_INFO << "cow_update snapshot: " << travel_it->first
-                 << " has no block:" << blk_no;
-        IndexStore::Transaction transaction = m_index_store->fetch_transaction();
-        /*in db update cow block*/
-        string pkey = DbUtil::spawn_cow_block_map_key(travel_it->first, blk_no);
-        transaction->put(pkey, cow_obj);
-        /*in db update cow object(move up)*/
-        pkey = DbUtil::spawn_cow_object_map_key(cow_obj);
-        string pval = m_index_store->db_get(pkey);
-        cow_object_ref_t obj_ref;
-        DbUtil::split_cow_object_map_val(pval, obj_ref);
-        obj_ref.insert(travel_it->first);
-        pval = DbUtil::spawn_cow_object_map_val(obj_ref);
-        transaction->put(pkey, pval);
-        ret = m_index_store->submit_transaction(transaction);
-        if (ret) {
-            LOG_ERROR << "cow_update persist meta failed";
-            return StatusCode::sSnapMetaPersistError;
-        }
-
-        /*in mem update cow block*/
-        block_map.insert({blk_no, cow_obj});
-        /*in mem update cow object*/
-        auto obj_it = m_cow_object_map.find(cow_obj);
-        assert(obj_it != m_cow_object_map.end());
-        cow_object_ref_t& cow_obj_ref = obj_it->second;
-        cow_obj_ref.insert(travel_it->first);
-    }
+    /*in mem update cow range*/
+    m_cow_index.insert(blk_no, range);
 
     trace();
     ack->mutable_header()->set_status(StatusCode::sOk);
@@ -593,6 +577,109 @@ string SnapshotMds::spawn_cow_object_name(const snapid_t snap_id,
     return cow_object_name;
 }
 
+int SnapshotMds::split_cow_object_name(const string& raw, string& vol_name,
+                                       snapid_t& snap_id, block_t&  blk_id) {
+    /*volume name may contain FS, so parse from tail*/
+    string suffix = OBJ_SUFFIX;
+    if (raw.size() <= suffix.size() ||
+        raw.compare(raw.size() - suffix.size(), suffix.size(), suffix)) {
+        return -1;
+    }
+    string name = raw.substr(0, raw.size() - suffix.size());
+    size_t blk_pos = name.rfind(FS);
+    if (blk_pos == string::npos || blk_pos == 0) {
+        return -1;
+    }
+    size_t snap_pos = name.rfind(FS, blk_pos - 1);
+    if (snap_pos == string::npos) {
+        return -1;
+    }
+    vol_name = name.substr(0, snap_pos);
+    snap_id = strtoull(name.substr(snap_pos + 1, blk_pos - snap_pos - 1).c_str(),
+                       nullptr, 10);
+    blk_id = strtoull(name.substr(blk_pos + 1).c_str(), nullptr, 10);
+    return 0;
+}
+
+StatusCode SnapshotMds::next_diff_chunk(diff_cursor_t& cursor,
+                                        DiffBitmap* chunk, bool& finished) {
+    finished = false;
+    while (cursor.cur_snapid < cursor.last_snapid) {
+        auto cur_snap_it = m_snap_ids.find(cursor.cur_snapid);
+        if (cur_snap_it == m_snap_ids.end() ||
+            m_snap_ids.find(cursor.last_snapid) == m_snap_ids.end()) {
+            /*snapshot deleted during diff*/
+            return StatusCode::sSnapNotExist;
+        }
+        snapid_t cur_snapid  = cursor.cur_snapid;
+        /*range serve first snapshot end before last one, block changed in
+         *some pair between them, so merged diff is one pass in block order*/
+        snapid_t next_snapid = cursor.merged ? cursor.last_snapid :
+                               std::next(cur_snap_it, 1)->first;
+        const string& chunk_snap = cursor.merged ?
+                       m_snap_ids[cursor.last_snapid] : cur_snap_it->second;
+        /*block changed if the range serve current snapshot end before next
+         *snapshot, collect changed blocks in the chunk window of the first
+         *changed block from cursor*/
+        bool found = false;
+        block_t start_blk = 0;
+        block_t end_blk = 0;
+        HBitmap* bitmap = nullptr;
+        m_cow_index.visit(cursor.next_blk, UINT64_MAX, cur_snapid,
+            [&](const block_t blk_id, const cow_range_t& range) -> bool {
+                if (range.end >= next_snapid) {
+                    return true;
+                }
+                if (!found) {
+                    found = true;
+                    start_blk = blk_id - blk_id % DIFF_CHUNK_BLOCKS;
+                    end_blk = start_blk + DIFF_CHUNK_BLOCKS;
+                    bitmap = hbitmap_alloc(DIFF_CHUNK_BLOCKS, 0);
+                }
+                if (blk_id >= end_blk) {
+                    return false;
+                }
+                hbitmap_set(bitmap, blk_id - start_blk, 1);
+                return true;
+            });
+
+        if (!found) {
+            /*empty chunk let reader know the snapshot pair without diff*/
+            bool emit_empty = !cursor.pair_emitted;
+            if (emit_empty) {
+                chunk->set_snap_name(chunk_snap);
+                chunk->set_start_blk(0);
+                chunk->set_blk_count(0);
+                chunk->set_blk_size(m_cow_block_size);
+            }
+            cursor.cur_snapid = next_snapid;
+            cursor.next_blk = 0;
+            cursor.pair_emitted = false;
+            if (emit_empty) {
+                return StatusCode::sOk;
+            }
+            continue;
+        }
+
+        uint64_t size = hbitmap_serialization_size(bitmap, 0,
+                                                   DIFF_CHUNK_BLOCKS);
+        string buf(size, '\0');
+        hbitmap_serialize_part(bitmap, (uint8_t*)&buf[0], 0, DIFF_CHUNK_BLOCKS);
+        hbitmap_free(bitmap);
+
+        chunk->set_snap_name(chunk_snap);
+        chunk->set_start_blk(start_blk);
+        chunk->set_blk_count(DIFF_CHUNK_BLOCKS);
+        chunk->set_bitmap(buf);
+        chunk->set_blk_size(m_cow_block_size);
+        cursor.next_blk = end_blk;
+        cursor.pair_emitted = true;
+        return StatusCode::sOk;
+    }
+    finished = true;
+    return StatusCode::sOk;
+}
+
 StatusCode SnapshotMds::diff_snapshot(const DiffReq* req, DiffAck* ack) {
     string vname = req->vol_name();
     string first_snap = req->first_snap_name();
@@ -604,33 +691,42 @@ StatusCode SnapshotMds::diff_snapshot(const DiffReq* req, DiffAck* ack) {
     lock_guard<std::mutex> lock(m_mutex);
     snapid_t first_snapid = get_snapshot_id(first_snap);
     snapid_t last_snapid  = get_snapshot_id(last_snap);
-    assert(first_snapid != -1 && m_latest_snapid != -1);
-
-    auto first_snap_it = m_cow_block_map.find(first_snapid);
-    auto last_snap_it  = m_cow_block_map.find(last_snapid);
-    assert(first_snap_it != m_cow_block_map.end() &&
-           last_snap_it  != m_cow_block_map.end());
-    for (auto cur_snap_it = first_snap_it ; cur_snap_it != last_snap_it;
-         cur_snap_it++) {
-        auto next_snap_it = std::next(cur_snap_it, 1);
-        map<block_t, cow_object_t>& cur_block_map  = cur_snap_it->second;
-        map<block_t, cow_object_t>& next_block_map = next_snap_it->second;
-
-        DiffBlocks* diffblocks = ack->add_diff_blocks();
-        diffblocks->set_vol_name(vname);
-        diffblocks->set_snap_name(get_snapshot_name(cur_snap_it->first));
-        for (auto cur_blk_it : cur_block_map) {
-            auto next_blk_it = next_block_map.find(cur_blk_it.first);
-            if (next_blk_it == next_block_map.end()) {
-                /*block not apear in next snapshot*/
-                diffblocks->add_diff_block_no(cur_blk_it.first);
-            } else {
-                /*block in next snapshot, but cow after next snapshot*/
-                if (cur_blk_it.second.compare(next_blk_it->second) != 0) {
-                    diffblocks->add_diff_block_no(cur_blk_it.first);
-                }
-            }
+    assert(first_snapid != -1 && last_snapid != -1);
+
+    /*unary diff kept for compatibility, expand diff chunks to block no*/
+    diff_cursor_t cursor = {first_snapid, last_snapid, 0, false, false};
+    DiffBlocks* diffblocks = nullptr;
+    while (true) {
+        DiffBitmap chunk;
+        bool finished = false;
+        StatusCode ret = next_diff_chunk(cursor, &chunk, finished);
+        if (ret != StatusCode::sOk) {
+            ack->mutable_header()->set_status(ret);
+            return ret;
         }
+        if (finished) {
+            break;
+        }
+        if (diffblocks == nullptr ||
+            diffblocks->snap_name().compare(chunk.snap_name())) {
+            diffblocks = ack->add_diff_blocks();
+            diffblocks->set_vol_name(vname);
+            diffblocks->set_snap_name(chunk.snap_name());
+            diffblocks->set_blk_size(chunk.blk_size());
+        }
+        if (chunk.blk_count() == 0) {
+            continue;
+        }
+        HBitmap* bitmap = hbitmap_alloc(chunk.blk_count(), 0);
+        hbitmap_deserialize_part(bitmap, (uint8_t*)chunk.bitmap().data(), 0,
+                                 chunk.blk_count(), true);
+        HBitmapIter iter;
+        hbitmap_iter_init(&iter, bitmap, 0);
+        int64_t bit;
+        while ((bit = hbitmap_iter_next(&iter)) >= 0) {
+            diffblocks->add_diff_block_no(chunk.start_blk() + bit);
+        }
+        hbitmap_free(bitmap);
     }
     ack->mutable_header()->set_status(StatusCode::sOk);
     LOG_INFO << "diff snapshot" << " vname:" << vname
@@ -639,6 +735,58 @@ StatusCode SnapshotMds::diff_snapshot(const DiffReq* req, DiffAck* ack) {
     return StatusCode::sOk;
 }
 
+StatusCode SnapshotMds::diff_snapshot_stream(const DiffReq* req,
+        ServerWriter<DiffStreamAck>* writer) {
+    string vname = req->vol_name();
+    string first_snap = req->first_snap_name();
+    string last_snap  = req->last_snap_name();
+
+    LOG_INFO << "diff snapshot stream vname:" << vname
+             << " first_snap:" << first_snap << " last_snap:"  << last_snap;
+
+    unique_lock<std::mutex> lock(m_mutex);
+    snapid_t first_snapid = get_snapshot_id(first_snap);
+    snapid_t last_snapid  = get_snapshot_id(last_snap);
+    lock.unlock();
+    if (first_snapid == -1 || last_snapid == -1) {
+        LOG_ERROR << "diff snapshot stream vname:" << vname << " no snapshot";
+        return StatusCode::sSnapNotExist;
+    }
+
+    /*lock only held while one chunk computing, cow go on between chunks*/
+    diff_cursor_t cursor = {first_snapid, last_snapid, 0, false,
+                            req->merged()};
+    uint64_t chunk_num = 0;
+    while (true) {
+        DiffStreamAck ack;
+        bool finished = false;
+        lock.lock();
+        StatusCode ret = next_diff_chunk(cursor, ack.mutable_diff_bitmap(),
+                                         finished);
+        lock.unlock();
+        if (ret != StatusCode::sOk) {
+            LOG_ERROR << "diff snapshot stream vname:" << vname
+                      << " failed:" << ret;
+            return ret;
+        }
+        if (finished) {
+            break;
+        }
+        ack.mutable_header()->set_status(StatusCode::sOk);
+        ack.mutable_diff_bitmap()->set_vol_name(vname);
+        if (!writer->Write(ack)) {
+            LOG_ERROR << "diff snapshot stream vname:" << vname
+                      << " write chunk failed";
+            return StatusCode::sInternalError;
+        }
+        chunk_num++;
+    }
+    LOG_INFO << "diff snapshot stream vname:" << vname
+             << " first_snap:" << first_snap << " last_snap:"  << last_snap
+             << " chunks:" << chunk_num << " ok";
+    return StatusCode::sOk;
+}
+
 StatusCode SnapshotMds::read_snapshot(const ReadReq* req, ReadAck* ack) {
     string vol_name = req->vol_name();
     string snap_name = req->snap_name();
@@ -651,19 +799,19 @@ StatusCode SnapshotMds::read_snapshot(const ReadReq* req, ReadAck* ack) {
     lock_guard<std::mutex> lock(m_mutex);
     snapid_t snap_id = get_snapshot_id(snap_name);
     assert(snap_id != -1);
-    auto snap_it = m_cow_block_map.find(snap_id);
-    map<block_t, cow_object_t>& block_map = snap_it->second;
-
-    for (auto blk_it : block_map) {
-        block_t blk_no = blk_it.first;
-        off_t blk_start = blk_no * COW_BLOCK_SIZE;
-        off_t blk_end = (blk_no+1) * COW_BLOCK_SIZE;
-        if (blk_start >= off + len || blk_end <= off) {
-            continue;
-        }
-        ReadBlock* rblock = ack->add_read_blocks();
-        rblock->set_blk_no(blk_no);
-        rblock->set_blk_object(blk_it.second);
+
+    /*only visit cow blocks overlap with [off, off+len)*/
+    block_t first_blk = off / m_cow_block_size;
+    block_t last_blk  = (off + len - 1) / m_cow_block_size;
+    if (len > 0) {
+        m_cow_index.visit(first_blk, last_blk, snap_id,
+            [&](const block_t blk_id, const cow_range_t& range) -> bool {
+                ReadBlock* rblock = ack->add_read_blocks();
+                rblock->set_blk_no(blk_id);
+                rblock->set_blk_object(spawn_cow_object_name(range.end,
+                                                             blk_id));
+                return true;
+            });
     }
 
     ack->mutable_header()->set_status(StatusCode::sOk);
@@ -674,6 +822,20 @@ StatusCode SnapshotMds::read_snapshot(const ReadReq* req, ReadAck* ack) {
 }
 
 int SnapshotMds::recover() {
+    /*checkpoint image plus newer keys is much faster than full scan*/
+    if (load_checkpoint() == 0) {
+        rebuild_snap_ids();
+        m_cow_index.compact();
+        trace();
+        LOG_INFO << "drserver recover snapshot meta data from checkpoint ok";
+        return 0;
+    }
+    m_latest_snapid = 0;
+    m_cow_block_size = COW_BLOCK_SIZE;
+    m_snapshots.clear();
+    m_snap_ids.clear();
+    m_cow_index.clear();
+
     IndexStore::SimpleIteratorPtr it = m_index_store->db_iterator();
 
     /*recover latest snapshot id*/
@@ -685,6 +847,12 @@ int SnapshotMds::recover() {
         m_latest_snapid = atol(value.c_str());
     }
 
+    /*recover cow block size, volume before it use default*/
+    string cow_size = m_index_store->db_get(DbUtil::spawn_cow_size_key());
+    if (!cow_size.empty()) {
+        m_cow_block_size = strtoull(cow_size.c_str(), nullptr, 10);
+    }
+
     /*recover snapshot attr map*/
     prefix = SNAPSHOT_MAP_PREFIX;
     it->seek_to_first(prefix);
@@ -698,42 +866,286 @@ int SnapshotMds::recover() {
         DbUtil::split_attr_map_val(value, snap_attr);
         m_snapshots.insert({snap_name, snap_attr});
     }
+    rebuild_snap_ids();
 
-    /*recover snapshot cow block map*/
+    /*old version persist cow block and cow object, convert them first*/
+    if (migrate_legacy_cow_meta()) {
+        LOG_ERROR << "drserver migrate legacy cow meta failed";
+        return -1;
+    }
+
+    /*recover cow range*/
+    prefix = SNAPSHOT_COWRANGE_PREFIX;
+    it->seek_to_first(prefix);
+    for (; it->valid()&& !it->key().compare(0, prefix.size(), prefix.c_str());
+            it->next()) {
+        block_t  blk_id;
+        cow_range_t range;
+        DbUtil::split_cow_range_key(it->key(), blk_id, range.end);
+        DbUtil::split_cow_range_val(it->value(), range);
+        m_cow_index.insert(blk_id, range);
+    }
+    m_cow_index.compact();
+    trace();
+    checkpoint();
+    LOG_INFO << "drserver recover snapshot meta data ok";
+    return 0;
+}
+
+void SnapshotMds::rebuild_snap_ids() {
+    m_snap_ids.clear();
     for (auto snap : m_snapshots) {
-        snapid_t snap_id = snap.second.snap_id;
-        map<block_t, cow_object_t> cow_block_map;
-        prefix = SNAPSHOT_COWBLOCK_PREFIX;
-        prefix.append(FS);
-        prefix.append(to_string(snap_id));
-        prefix.append(FS);
-        it->seek_to_first(prefix);
-        for (; it->valid()&& !it->key().compare(0, prefix.size(), prefix.c_str());
-                it->next()) {
-            snapid_t snap_id;
-            block_t  blk_id;
-            DbUtil::split_cow_block_map_key(it->key(), snap_id, blk_id);
-            cow_block_map.insert({blk_id, it->value()});
+        if (snap.second.snap_status == SnapStatus::SNAP_CREATING) {
+            continue;
         }
+        m_snap_ids.insert({snap.second.snap_id, snap.first});
+    }
+}
 
-        m_cow_block_map.insert(pair<snapid_t, map<block_t, cow_object_t>> \
-                               (snap_id, cow_block_map));
+void SnapshotMds::apply_meta_key(const bool del, const string& key,
+                                 const string& val) {
+    auto has_prefix = [&key](const string& prefix) -> bool {
+        string p = DbUtil::spawn_key(prefix, "");
+        return !key.compare(0, p.size(), p);
+    };
+    if (has_prefix(SNAPSHOT_COWRANGE_PREFIX)) {
+        block_t blk_id;
+        cow_range_t range;
+        DbUtil::split_cow_range_key(key, blk_id, range.end);
+        /*put may shrink an existed range, replace it*/
+        m_cow_index.erase(blk_id, range.end);
+        if (!del) {
+            DbUtil::split_cow_range_val(val, range);
+            m_cow_index.insert(blk_id, range);
+        }
+    } else if (has_prefix(SNAPSHOT_MAP_PREFIX)) {
+        string snap_name;
+        DbUtil::split_attr_map_key(key, snap_name);
+        m_snapshots.erase(snap_name);
+        if (!del) {
+            snap_attr_t snap_attr;
+            DbUtil::split_attr_map_val(val, snap_attr);
+            m_snapshots.insert({snap_name, snap_attr});
+        }
+    } else if (has_prefix(SNAPSHOT_ID_PREFIX) && !del) {
+        m_latest_snapid = atol(val.c_str());
+    } else if (has_prefix(SNAPSHOT_COWSIZE_PREFIX) && !del) {
+        m_cow_block_size = strtoull(val.c_str(), nullptr, 10);
     }
+}
+
+/*checkpoint image layout, all integer in host byte order:
+ *magic|version|db seq|latest snapid|cow block size|
+ *snapshot count|{name len|name|attr len|attr}...|
+ *cow range count|{blk|start|end}...*/
+#define CKPT_MAGIC   (0x53474350UL)
+#define CKPT_VERSION (1)
+
+int SnapshotMds::checkpoint() {
+    lock_guard<std::mutex> ckpt_lock(m_ckpt_mutex);
+    /*copy meta and its db sequence under lock, write image out of lock so
+     *snapshot and cow requests not wait for disk*/
+    unique_lock<std::mutex> lock(m_mutex);
+    uint64_t seq = m_index_store->db_sequence();
+    if (seq == 0 || seq == m_ckpt_seq) {
+        return 0;
+    }
+
+    string image;
+    auto put_u64 = [&image](const uint64_t v) {
+        image.append(reinterpret_cast<const char*>(&v), sizeof(v));
+    };
+    auto put_str = [&](const string& v) {
+        put_u64(v.size());
+        image.append(v);
+    };
+    put_u64(CKPT_MAGIC);
+    put_u64(CKPT_VERSION);
+    put_u64(seq);
+    put_u64(m_latest_snapid);
+    put_u64(m_cow_block_size);
+    put_u64(m_snapshots.size());
+    for (auto& snap : m_snapshots) {
+        put_str(snap.first);
+        put_str(DbUtil::spawn_attr_map_val(snap.second));
+    }
+    put_u64(m_cow_index.size());
+    m_cow_index.visit_all(
+        [&](const block_t blk_id, const cow_range_t& range) -> bool {
+            put_u64(blk_id);
+            put_u64(range.start);
+            put_u64(range.end);
+            return true;
+        });
+    lock.unlock();
+
+    /*write temp then rename, checkpoint never torn*/
+    string tmp = m_ckpt_file + ".tmp";
+    FILE* fp = fopen(tmp.c_str(), "wb");
+    if (fp == nullptr) {
+        LOG_ERROR << "checkpoint vname:" << m_volume_name << " open failed";
+        return -1;
+    }
+    size_t ret = fwrite(image.data(), 1, image.size(), fp);
+    fflush(fp);
+    fsync(fileno(fp));
+    fclose(fp);
+    if (ret != image.size() || rename(tmp.c_str(), m_ckpt_file.c_str())) {
+        LOG_ERROR << "checkpoint vname:" << m_volume_name << " write failed";
+        return -1;
+    }
+    m_ckpt_seq = seq;
+    LOG_INFO << "checkpoint vname:" << m_volume_name << " seq:" << seq
+             << " size:" << image.size() << " ok";
+    return 0;
+}
 
-    /*recove cow object reference*/
-    prefix = SNAPSHOT_COWOBJECT_PREFIX;
+int SnapshotMds::load_checkpoint() {
+    FILE* fp = fopen(m_ckpt_file.c_str(), "rb");
+    if (fp == nullptr) {
+        return -1;
+    }
+    string image;
+    char buf[64 * 1024];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), fp)) > 0) {
+        image.append(buf, n);
+    }
+    fclose(fp);
+
+    size_t pos = 0;
+    bool bad = false;
+    auto get_u64 = [&]() -> uint64_t {
+        uint64_t v = 0;
+        if (pos + sizeof(v) > image.size()) {
+            bad = true;
+            return 0;
+        }
+        memcpy(&v, image.data() + pos, sizeof(v));
+        pos += sizeof(v);
+        return v;
+    };
+    auto get_str = [&]() -> string {
+        uint64_t len = get_u64();
+        if (bad || pos + len > image.size()) {
+            bad = true;
+            return "";
+        }
+        string v = image.substr(pos, len);
+        pos += len;
+        return v;
+    };
+
+    if (get_u64() != CKPT_MAGIC || get_u64() != CKPT_VERSION) {
+        LOG_WARN << "checkpoint vname:" << m_volume_name << " invalid";
+        return -1;
+    }
+    uint64_t seq = get_u64();
+    if (seq > m_index_store->db_sequence()) {
+        /*db lost writes the image covers, image not match db*/
+        LOG_WARN << "checkpoint vname:" << m_volume_name << " seq:" << seq
+                 << " newer than db:" << m_index_store->db_sequence();
+        return -1;
+    }
+    m_latest_snapid = get_u64();
+    m_cow_block_size = get_u64();
+    uint64_t snap_count = get_u64();
+    for (uint64_t i = 0; i < snap_count && !bad; i++) {
+        string snap_name = get_str();
+        snap_attr_t snap_attr;
+        DbUtil::split_attr_map_val(get_str(), snap_attr);
+        m_snapshots.insert({snap_name, snap_attr});
+    }
+    uint64_t cow_count = get_u64();
+    for (uint64_t i = 0; i < cow_count && !bad; i++) {
+        block_t blk_id = get_u64();
+        cow_range_t range;
+        range.start = get_u64();
+        range.end = get_u64();
+        m_cow_index.insert(blk_id, range);
+    }
+    if (bad || pos != image.size()) {
+        LOG_WARN << "checkpoint vname:" << m_volume_name << " truncated";
+        return -1;
+    }
+
+    /*keys written after checkpoint*/
+    int ret = m_index_store->db_replay(seq,
+        [this](bool del, const string& key, const string& val) {
+            apply_meta_key(del, key, val);
+        });
+    if (ret) {
+        LOG_WARN << "checkpoint vname:" << m_volume_name << " seq:" << seq
+                 << " replay failed";
+        return -1;
+    }
+    m_ckpt_seq = seq;
+    LOG_INFO << "checkpoint vname:" << m_volume_name << " seq:" << seq
+             << " snapshots:" << snap_count << " cow ranges:" << cow_count
+             << " loaded";
+    return 0;
+}
+
+int SnapshotMds::migrate_legacy_cow_meta() {
+    IndexStore::SimpleIteratorPtr it = m_index_store->db_iterator();
+    string prefix = SNAPSHOT_COWOBJECT_PREFIX;
     it->seek_to_first(prefix);
+    if (!it->valid() || it->key().compare(0, prefix.size(), prefix.c_str())) {
+        return 0;
+    }
+
+    IndexStore::Transaction transaction = m_index_store->fetch_transaction();
+    int count = 0;
+    /*cow object named by the snapshot cow happened in, reference snapshots
+     *are those before it without their own cow of the block*/
     for (; it->valid()&& !it->key().compare(0, prefix.size(), prefix.c_str());
             it->next()) {
         cow_object_t cow_object;
         DbUtil::split_cow_object_map_key(it->key(), cow_object);
         cow_object_ref_t cow_object_ref;
         DbUtil::split_cow_object_map_val(it->value(), cow_object_ref);
-        m_cow_object_map.insert(pair<cow_object_t, cow_object_ref_t> \
-                                (cow_object, cow_object_ref));
+        transaction->del(it->key());
+        if (cow_object_ref.empty()) {
+            continue;
+        }
+
+        string   vol_name;
+        snapid_t owner_id;
+        block_t  blk_id;
+        cow_range_t range;
+        range.start = *(cow_object_ref.begin());
+        range.end = *(cow_object_ref.rbegin());
+        if (split_cow_object_name(cow_object, vol_name, owner_id, blk_id)) {
+            LOG_ERROR << "migrate cow object:" << cow_object << " invalid name";
+            return -1;
+        }
+        /*cow object name derive from range end, which is the owner*/
+        if (owner_id < range.end) {
+            LOG_WARN << "migrate cow object:" << cow_object
+                     << " referenced after owner, clamp to owner";
+        }
+        range.end = owner_id;
+        if (range.start > range.end) {
+            range.start = range.end;
+        }
+        string pkey = DbUtil::spawn_cow_range_key(blk_id, range.end);
+        string pval = DbUtil::spawn_cow_range_val(range);
+        transaction->put(pkey, pval);
+        count++;
     }
-    trace();
-    LOG_INFO << "drserver recover snapshot meta data ok";
+
+    prefix = SNAPSHOT_COWBLOCK_PREFIX;
+    it->seek_to_first(prefix);
+    for (; it->valid()&& !it->key().compare(0, prefix.size(), prefix.c_str());
+            it->next()) {
+        transaction->del(it->key());
+    }
+
+    int ret = m_index_store->submit_transaction(transaction);
+    if (ret) {
+        return -1;
+    }
+    LOG_INFO << "migrate legacy cow meta ok, cow range:" << count;
     return 0;
 }
 
@@ -746,21 +1158,7 @@ void SnapshotMds::trace() {
                  << " snap_status:" << it.second.snap_status;
     }
 
-    LOG_INFO << "\t cow block map";
-    for (auto it : m_cow_block_map) {
-        LOG_INFO << "\t\t snap_id:" << it.first;
-        map<block_t, cow_object_t>& blk_map = it.second;
-        for (auto blk_it : blk_map) {
-            LOG_INFO << "\t\t\t blk_no:" << blk_it.first
-                     << " cow_obj:" << blk_it.second;
-        }
-    }
-    LOG_INFO << "\t cow object map";
-    for (auto it : m_cow_object_map) {
-        LOG_INFO << "\t\t cow_obj:" << it.first;
-        cow_object_ref_t& cow_obj_ref = it.second;
-        for (auto ref_it : cow_obj_ref) {
-            LOG_INFO << "\t\t\t\t snapid:" << ref_it;
-        }
-    }
+    LOG_INFO << "\t cow range map";
+    LOG_INFO << "\t\t range count:" << m_cow_index.size()
+             << " memory:" << m_cow_index.memory_usage();
 }
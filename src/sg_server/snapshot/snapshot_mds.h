@@ -23,10 +23,13 @@
 #include "common/index_store.h"
 #include "common/define.h"
 #include "snapshot_def.h"
+#include "cow_range_index.h"
 
 using huawei::proto::StatusCode;
 using huawei::proto::SnapStatus;
 using huawei::proto::SnapReqHead;
+using huawei::proto::DiffBitmap;
+using grpc::ServerWriter;
 
 using huawei::proto::inner::CreateReq;
 using huawei::proto::inner::CreateAck;
@@ -46,6 +49,7 @@ using huawei::proto::inner::CowUpdateReq;
 using huawei::proto::inner::CowUpdateAck;
 using huawei::proto::inner::DiffReq;
 using huawei::proto::inner::DiffAck;
+using huawei::proto::inner::DiffStreamAck;
 using huawei::proto::inner::ReadReq;
 using huawei::proto::inner::ReadAck;
 using huawei::proto::inner::SyncReq;
@@ -68,6 +72,8 @@ class SnapshotMds {
     StatusCode list_snapshot(const ListReq* req, ListAck* ack);
     StatusCode query_snapshot(const QueryReq* req, QueryAck* ack);
     StatusCode diff_snapshot(const DiffReq* req, DiffAck* ack);
+    StatusCode diff_snapshot_stream(const DiffReq* req,
+                                    ServerWriter<DiffStreamAck>* writer);
     StatusCode read_snapshot(const ReadReq* req, ReadAck* ack);
     /*snapshot status*/
     StatusCode update(const UpdateReq* req, UpdateAck* ack);
@@ -76,6 +82,8 @@ class SnapshotMds {
     StatusCode cow_update(const CowUpdateReq* req, CowUpdateAck* ack);
     /*crash recover*/
     int recover();
+    /*persist in-memory meta image with db sequence, skip if no change*/
+    int checkpoint();
 
  private:
     /*common helper*/
@@ -84,6 +92,9 @@ class SnapshotMds {
     string   get_snapshot_name(snapid_t snap_id);
     string   get_latest_snap_name();
 
+    /*cow block size can only change when no snapshot and cow data*/
+    StatusCode set_cow_block_size(const size_t cow_block_size);
+
     /*accord local and remote to mapping snapshot pair*/
     string mapping_snap_name(const SnapReqHead& shead, const string& sname);
     /*maintain snapshot status*/
@@ -93,8 +104,23 @@ class SnapshotMds {
 
     /*helper to generate cow object name*/
     string spawn_cow_object_name(const snapid_t snap_id, const block_t blk_id);
-    void split_cow_object_name(const string& raw, string& vol_name,
-                               snapid_t& snap_id, block_t&  blk_id);
+    int split_cow_object_name(const string& raw, string& vol_name,
+                              snapid_t& snap_id, block_t&  blk_id);
+
+    /*whether any snapshot other than exclude still in the range*/
+    bool cow_range_referenced(const cow_range_t& range,
+                              const snapid_t exclude);
+    /*compute diff chunk at cursor and move cursor forward*/
+    StatusCode next_diff_chunk(diff_cursor_t& cursor, DiffBitmap* chunk,
+                               bool& finished);
+
+    /*convert legacy cow block and cow object key to cow range*/
+    int migrate_legacy_cow_meta();
+    /*load checkpoint image and replay keys newer than it*/
+    int load_checkpoint();
+    /*apply one persisted key change to in-memory meta*/
+    void apply_meta_key(const bool del, const string& key, const string& val);
+    void rebuild_snap_ids();
     /*debug*/
     void trace();
 
@@ -106,16 +132,23 @@ class SnapshotMds {
     mutex m_mutex;
     /*the latest snapshot id*/
     snapid_t m_latest_snapid;
+    /*cow granularity, fixed since the first snapshot of volume*/
+    size_t m_cow_block_size;
     /*snapshot and attr map*/
     map<string, snap_attr_t> m_snapshots;
-    /*snapshot id and snapshot cow block map*/
-    map<snapid_t, map<block_t, cow_object_t>> m_cow_block_map;
-    /*cow object and snapshot referece map*/
-    map<cow_object_t, cow_object_ref_t> m_cow_object_map;
+    /*created snapshot id and name*/
+    map<snapid_t, string> m_snap_ids;
+    /*block and the cow ranges of the block*/
+    CowRangeIndex m_cow_index;
     /*index store for snapshot meta persist*/
     IndexStore* m_index_store;
     /*block store for cow object*/
     BlockStore* m_block_store;
+    /*meta checkpoint image file and db sequence it covers*/
+    string   m_ckpt_file;
+    uint64_t m_ckpt_seq;
+    /*one checkpoint writer at a time, older image never replace newer one*/
+    mutex    m_ckpt_mutex;
 };
 
 #endif  // SRC_SG_SERVER_SNAPSHOT_SNAPSHOT_MDS_H_
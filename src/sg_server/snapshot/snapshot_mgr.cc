@@ -11,7 +11,10 @@
 #include <stdio.h>
 #include <sys/types.h>
 #include <dirent.h>
+#include <algorithm>
+#include <chrono>
 #include "log/log.h"
+#include "common/thread_pool.h"
 #include "snapshot_mgr.h"
 
 using huawei::proto::StatusCode;
@@ -48,45 +51,176 @@ do {                                 \
 
 #define CMD_DO(vname, op, req, ack)    \
 do {                                   \
-    auto it = m_all_snapmds.find(vname);   \
-    if (it == m_all_snapmds.end()) {       \
+    shared_ptr<SnapshotMds> mds = find_mds(vname); \
+    if (mds == nullptr) {                  \
         ret = StatusCode::sVolumeNotExist; \
         break;                         \
     }                                  \
-    ret = it->second->op(req, ack);    \
+    ret = mds->op(req, ack);           \
 }while(0);
 
 SnapshotMgr::SnapshotMgr() {
     m_all_snapmds.clear();
+    m_ckpt_run = true;
+    m_ckpt_thread = std::thread(&SnapshotMgr::checkpoint_work, this);
 }
 
 SnapshotMgr::~SnapshotMgr() {
+    {
+        std::lock_guard<std::mutex> lock(m_ckpt_mutex);
+        m_ckpt_run = false;
+    }
+    m_ckpt_cond.notify_all();
+    if (m_ckpt_thread.joinable()) {
+        m_ckpt_thread.join();
+    }
     m_all_snapmds.clear();
 }
 
 StatusCode SnapshotMgr::add_volume(const string& vol_name,
                                    const size_t& vol_size) {
-    std::lock_guard<std::mutex> lock(m_mutex);
-    auto it = m_all_snapmds.find(vol_name);
-    if (it != m_all_snapmds.end()) {
-        LOG_INFO << "add volume:" << vol_name << "failed, already exist";
-        return StatusCode::sVolumeAlreadyExist;
+    {
+        /*reserve name, no one else open the same db while recovering*/
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_all_snapmds.count(vol_name) ||
+            !m_adding_vols.insert(vol_name).second) {
+            LOG_INFO << "add volume:" << vol_name << "failed, already exist";
+            return StatusCode::sVolumeAlreadyExist;
+        }
     }
 
+    /*recover out of lock, other volumes recover at the same time*/
     shared_ptr<SnapshotMds> snap_mds;
     snap_mds.reset(new SnapshotMds(vol_name, vol_size));
-    m_all_snapmds.insert({vol_name, snap_mds});
     snap_mds->recover();
 
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_adding_vols.erase(vol_name);
+    m_all_snapmds.insert({vol_name, snap_mds});
     return StatusCode::sOk;
 }
 
+StatusCode SnapshotMgr::add_volumes(const map<string, size_t>& volumes) {
+    if (volumes.empty()) {
+        return StatusCode::sOk;
+    }
+    int thread_num = std::min<size_t>(META_RECOVER_THREADS, volumes.size());
+    sg_threads::ThreadPool pool(thread_num);
+    std::mutex done_mutex;
+    std::condition_variable done_cond;
+    size_t done = 0;
+    for (auto& vol : volumes) {
+        pool.submit([&, vol]() {
+            add_volume(vol.first, vol.second);
+            std::lock_guard<std::mutex> lock(done_mutex);
+            done++;
+            done_cond.notify_one();
+        });
+    }
+    std::unique_lock<std::mutex> lock(done_mutex);
+    done_cond.wait(lock, [&]{ return done == volumes.size(); });
+    LOG_INFO << "add volumes:" << volumes.size() << " threads:" << thread_num
+             << " ok";
+    return StatusCode::sOk;
+}
+
+void SnapshotMgr::checkpoint_work() {
+    while (m_ckpt_run) {
+        {
+            std::unique_lock<std::mutex> lock(m_ckpt_mutex);
+            m_ckpt_cond.wait_for(lock, std::chrono::seconds(SNAPSHOT_CKPT_INTERVAL),
+                                 [this]{ return !m_ckpt_run; });
+        }
+        if (!m_ckpt_run) {
+            break;
+        }
+        vector<shared_ptr<SnapshotMds>> all_mds;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            for (auto& it : m_all_snapmds) {
+                all_mds.push_back(it.second);
+            }
+        }
+        for (auto& mds : all_mds) {
+            mds->checkpoint();
+        }
+    }
+}
+
 StatusCode SnapshotMgr::del_volume(const string& vol_name) {
     std::lock_guard<std::mutex> lock(m_mutex);
     m_all_snapmds.erase(vol_name);
     return StatusCode::sOk;
 }
 
+shared_ptr<SnapshotMds> SnapshotMgr::find_mds(const string& vol_name) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_all_snapmds.find(vol_name);
+    if (it == m_all_snapmds.end()) {
+        return nullptr;
+    }
+    return it->second;
+}
+
+StatusCode SnapshotMgr::create_view(const string& vol_name,
+                                    const string& snap_name) {
+    shared_ptr<SnapshotMds> snap_mds = find_mds(vol_name);
+    if (snap_mds == nullptr) {
+        return StatusCode::sVolumeNotExist;
+    }
+    CreateReq creq;
+    CreateAck cack;
+    creq.mutable_header()->set_snap_type(SnapType::SNAP_LOCAL);
+    creq.set_vol_name(vol_name);
+    creq.set_snap_name(snap_name);
+    StatusCode ret = snap_mds->create_snapshot(&creq, &cack);
+    if (ret == StatusCode::sOk) {
+        ret = cack.header().status();
+    }
+    if (ret != StatusCode::sOk) {
+        LOG_ERROR << "create view vname:" << vol_name << " sname:"
+                  << snap_name << " failed:" << ret;
+        return ret;
+    }
+    UpdateReq ureq;
+    UpdateAck uack;
+    ureq.mutable_header()->set_snap_type(SnapType::SNAP_LOCAL);
+    ureq.set_vol_name(vol_name);
+    ureq.set_snap_name(snap_name);
+    ureq.set_snap_event(UpdateEvent::CREATE_EVENT);
+    snap_mds->update(&ureq, &uack);
+    LOG_INFO << "create view vname:" << vol_name << " sname:" << snap_name
+             << " status:" << uack.header().status();
+    return uack.header().status();
+}
+
+StatusCode SnapshotMgr::delete_view(const string& vol_name,
+                                    const string& snap_name) {
+    shared_ptr<SnapshotMds> snap_mds = find_mds(vol_name);
+    if (snap_mds == nullptr) {
+        return StatusCode::sVolumeNotExist;
+    }
+    DeleteReq dreq;
+    DeleteAck dack;
+    dreq.mutable_header()->set_snap_type(SnapType::SNAP_LOCAL);
+    dreq.set_vol_name(vol_name);
+    dreq.set_snap_name(snap_name);
+    snap_mds->delete_snapshot(&dreq, &dack);
+    if (dack.header().status() != StatusCode::sOk) {
+        return dack.header().status();
+    }
+    UpdateReq ureq;
+    UpdateAck uack;
+    ureq.mutable_header()->set_snap_type(SnapType::SNAP_LOCAL);
+    ureq.set_vol_name(vol_name);
+    ureq.set_snap_name(snap_name);
+    ureq.set_snap_event(UpdateEvent::DELETE_EVENT);
+    snap_mds->update(&ureq, &uack);
+    LOG_INFO << "delete view vname:" << vol_name << " sname:" << snap_name
+             << " status:" << uack.header().status();
+    return uack.header().status();
+}
+
 grpc::Status SnapshotMgr::Sync(ServerContext* context, const SyncReq* req,
                                SyncAck* ack) {
     StatusCode ret;
@@ -102,17 +236,23 @@ grpc::Status SnapshotMgr::Create(ServerContext* context, const CreateReq* req,
     StatusCode ret;
     string vname = req->vol_name();
     size_t vsize = req->vol_size();
-    auto it = m_all_snapmds.find(vname);
     shared_ptr<SnapshotMds> snap_mds;
-    if (it != m_all_snapmds.end()) {
-        snap_mds = it->second;
-        goto create;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto it = m_all_snapmds.find(vname);
+        if (it != m_all_snapmds.end()) {
+            snap_mds = it->second;
+        } else if (m_adding_vols.count(vname)) {
+            /*volume still recovering*/
+            ret = StatusCode::sVolumeNotExist;
+            CMD_POST(vname, "create", ret);
+        } else {
+            /*(todo debug only)create snapshotmds for each volume*/
+            snap_mds.reset(new SnapshotMds(vname, vsize));
+            m_all_snapmds.insert({vname, snap_mds});
+        }
     }
-    /*(todo debug only)create snapshotmds for each volume*/
-    snap_mds.reset(new SnapshotMds(vname, vsize));
-    m_all_snapmds.insert({vname, snap_mds});
 
-create:
     CMD_PREV(vname, "create");
     ret = snap_mds->create_snapshot(req, ack);
     CMD_POST(vname, "create", ret);
@@ -199,6 +339,17 @@ grpc::Status SnapshotMgr::Diff(ServerContext* context, const DiffReq* req,
     CMD_POST(vname, "Diff", ret);
 }
 
+grpc::Status SnapshotMgr::DiffStream(ServerContext* context,
+                                     const DiffReq* req,
+                                     ServerWriter<DiffStreamAck>* writer) {
+    StatusCode ret;
+    string vname = req->vol_name();
+
+    CMD_PREV(vname, "DiffStream");
+    CMD_DO(vname, diff_snapshot_stream, req, writer);
+    CMD_POST(vname, "DiffStream", ret);
+}
+
 grpc::Status SnapshotMgr::Read(ServerContext* context, const ReadReq* req,
                                ReadAck* ack) {
     StatusCode ret;
@@ -12,8 +12,12 @@
 #define SRC_SG_SERVER_SNAPSHOT_SNAPSHOT_MGR_H_
 #include <string>
 #include <map>
+#include <set>
 #include <memory>
 #include <mutex>
+#include <thread>
+#include <atomic>
+#include <condition_variable>
 #include <grpc++/grpc++.h>
 #include "rpc/common.pb.h"
 #include "rpc/snapshot_inner_control.grpc.pb.h"
@@ -22,6 +26,7 @@
 using grpc::Server;
 using grpc::ServerBuilder;
 using grpc::ServerContext;
+using grpc::ServerWriter;
 using grpc::Status;
 using huawei::proto::StatusCode;
 using huawei::proto::inner::SnapshotInnerControl;
@@ -43,10 +48,12 @@ using huawei::proto::inner::CowUpdateReq;
 using huawei::proto::inner::CowUpdateAck;
 using huawei::proto::inner::DiffReq;
 using huawei::proto::inner::DiffAck;
+using huawei::proto::inner::DiffStreamAck;
 using huawei::proto::inner::ReadReq;
 using huawei::proto::inner::ReadAck;
 using huawei::proto::inner::SyncReq;
 using huawei::proto::inner::SyncAck;
+using huawei::proto::inner::UpdateEvent;
 
 /*work on storage gateway server, all snapshot api gateway */
 class SnapshotMgr final: public SnapshotInnerControl::Service {
@@ -57,7 +64,16 @@ class SnapshotMgr final: public SnapshotInnerControl::Service {
  public:
     /*call by sgserver when add and delete volume*/
     StatusCode add_volume(const std::string& vol_name, const size_t& vol_size);
+    /*add volumes and recover their meta concurrently*/
+    StatusCode add_volumes(const map<std::string, size_t>& volumes);
     StatusCode del_volume(const std::string& vol_name);
+    /*snapshot taken and dropped in meta only, no journal entry, used by
+     *replicate receiver as a read view; no cow is done for it, so only
+     *valid while replay of volume is held*/
+    StatusCode create_view(const std::string& vol_name,
+                           const std::string& snap_name);
+    StatusCode delete_view(const std::string& vol_name,
+                           const std::string& snap_name);
 
     /*rpc interface*/
     grpc::Status Sync(ServerContext* context, const SyncReq* req,
@@ -80,13 +96,27 @@ class SnapshotMgr final: public SnapshotInnerControl::Service {
                            CowUpdateAck* ack) override;
     grpc::Status Diff(ServerContext* context, const DiffReq* req,
                       DiffAck* ack) override;
+    grpc::Status DiffStream(ServerContext* context, const DiffReq* req,
+                            ServerWriter<DiffStreamAck>* writer) override;
     grpc::Status Read(ServerContext* context, const ReadReq* req,
                       ReadAck* ack) override;
 
+ private:
+    /*periodic checkpoint snapshot meta of all volumes*/
+    void checkpoint_work();
+    shared_ptr<SnapshotMds> find_mds(const std::string& vol_name);
+
  private:
     /*each volume has a snapshot mds*/
     mutex m_mutex;
     map<std::string, shared_ptr<SnapshotMds>> m_all_snapmds;
+    /*volumes recovering, not in m_all_snapmds yet*/
+    std::set<std::string> m_adding_vols;
+    /*checkpoint thread*/
+    atomic_bool m_ckpt_run{false};
+    mutex m_ckpt_mutex;
+    condition_variable m_ckpt_cond;
+    std::thread m_ckpt_thread;
 };
 
 #endif  // SRC_SG_SERVER_SNAPSHOT_SNAPSHOT_MGR_H_
@@ -8,9 +8,16 @@
 *  Description:  snapshot utility
 * 
 *************************************************/
+#include <cinttypes>
 #include "log/log.h"
 #include "snapshot_util.h"
 
+static string spawn_fixed_width_id(const uint64_t& id) {
+    char buf[32] = "";
+    snprintf(buf, sizeof(buf), "%020" PRIu64, id);
+    return string(buf);
+}
+
 string DbUtil::spawn_key(const string& prefix, const string& value) {
     string key = prefix;
     key.append(FS);
@@ -32,6 +39,10 @@ string DbUtil::spawn_latest_name_key() {
     return spawn_key(SNAPSHOT_NAME_PREFIX, "");
 }
 
+string DbUtil::spawn_cow_size_key() {
+    return spawn_key(SNAPSHOT_COWSIZE_PREFIX, "");
+}
+
 string DbUtil::spawn_attr_map_key(const string& snap_name) {
     return spawn_key(SNAPSHOT_MAP_PREFIX, snap_name);
 }
@@ -151,3 +162,39 @@ void DbUtil::split_cow_object_map_val(const string& raw_val,
         pos = raw.find(FS);
     }
 }
+
+string DbUtil::spawn_cow_range_key(const block_t& block_id,
+                                   const snapid_t& end) {
+    string key = spawn_fixed_width_id(block_id);
+    key.append(FS);
+    key += spawn_fixed_width_id(end);
+    return spawn_key(SNAPSHOT_COWRANGE_PREFIX, key);
+}
+
+void DbUtil::split_cow_range_key(const string& raw_key, block_t& block_id,
+                                 snapid_t& end) {
+    string prefix;
+    string key;
+    split_key(raw_key, prefix, key);
+
+    string block;
+    string snap;
+    split_key(key, block, snap);
+
+    block_id = strtoull(block.c_str(), nullptr, 10);
+    end = strtoull(snap.c_str(), nullptr, 10);
+}
+
+string DbUtil::spawn_cow_range_val(const cow_range_t& range) {
+    return to_string(range.start);
+}
+
+void DbUtil::split_cow_range_val(const string& raw_val, cow_range_t& range) {
+    /*early value carry cow object name after start, ignore it*/
+    string start = raw_val;
+    size_t pos = raw_val.find(FS);
+    if (pos != string::npos) {
+        start = raw_val.substr(0, pos);
+    }
+    range.start = strtoull(start.c_str(), nullptr, 10);
+}
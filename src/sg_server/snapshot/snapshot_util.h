@@ -24,6 +24,7 @@ class DbUtil {
                             std::string& key);
     static std::string spawn_latest_id_key();
     static std::string spawn_latest_name_key();
+    static std::string spawn_cow_size_key();
     static std::string spawn_attr_map_key(const std::string& snap_name);
     static void split_attr_map_key(const std::string& raw_key,
                                    std::string& snap_name);
@@ -41,6 +42,14 @@ class DbUtil {
     static std::string spawn_cow_object_map_val(const cow_object_ref_t& obj_ref);
     static void split_cow_object_map_val(const std::string& raw_val,
                                          cow_object_ref_t& obj_ref);
+    /*fixed width id keep cow range key sorted by block and snapshot*/
+    static std::string spawn_cow_range_key(const block_t& block_id,
+                                           const snapid_t& end);
+    static void split_cow_range_key(const std::string& raw_key,
+                                    block_t& block_id, snapid_t& end);
+    static std::string spawn_cow_range_val(const cow_range_t& range);
+    static void split_cow_range_val(const std::string& raw_val,
+                                    cow_range_t& range);
 };
 
 #endif  // SRC_SG_SERVER_SNAPSHOT_SNAPSHOT_UTIL_H_
@@ -10,6 +10,7 @@
 ************************************************/
 #include "net_receiver.h"
 #include "log/log.h"
+#include "transfer_codec.h"
 using grpc::Server;
 using grpc::ServerBuilder;
 using grpc::Status;
@@ -52,6 +53,11 @@ grpc::Status NetReceiver::transfer(ServerContext* context,
             {
                 StatusCode ret_code = rep_handlers_.rep_handle(req);
                 res.set_status(ret_code);
+                // accept proposed encoding of following data if can decode it
+                res.set_accept_encode(
+                    transfer_codec_supported(req.propose_encode()) ?
+                    req.propose_encode() : EncodeType::NONE_EN);
+                res.set_accept_fill(req.propose_fill());
                 if(!stream->Write(res)){
                     LOG_ERROR << "response of ending task failed:"
                         << req.id();
@@ -60,6 +66,20 @@ grpc::Status NetReceiver::transfer(ServerContext* context,
                 }
                 break;
             }
+            case MessageType::REPLICATE_HASH:
+            {
+                StatusCode ret_code = rep_handlers_.rep_hash_handle(req,
+                    *res.mutable_data());
+                res.set_status(ret_code);
+                bool ok = stream->Write(res);
+                res.clear_data();
+                if(!ok){
+                    LOG_ERROR << "response of block hash failed:" << req.id();
+                    grpc::Status status(grpc::INTERNAL,"write response of Rep request failed!");
+                    return status;
+                }
+                break;
+            }
             case MessageType::REMOTE_BACKUP_CREATE_START:
             case MessageType::REMOTE_BACKUP_UPLOAD_DATA:
             case MessageType::REMOTE_BACKUP_CREATE_END:
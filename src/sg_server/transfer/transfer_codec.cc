@@ -0,0 +1,148 @@
+/**********************************************
+* Copyright (c) 2016 Huawei Technologies Co., Ltd. All rights reserved.
+* 
+* File name:    transfer_codec.cc
+* Author: 
+* Date:         2017/07/12
+* Version:      1.0
+* Description:  compress transfer data on wire
+* 
+************************************************/
+#include <string.h>
+#include <sstream>
+#include <snappy.h>
+#include <zlib.h>
+#include "log/log.h"
+#include "common/config_option.h"
+#include "transfer_codec.h"
+#include "sg_server/replicate/journal_collapse.h"
+
+// max raw length of one transfer chunk
+#define TRANSFER_CODEC_MAX_LEN (64*1024*1024U)
+
+static EncodeType transfer_codec_from_name(const std::string& name){
+    if(name == "snappy")
+        return EncodeType::SNAPPY_EN;
+    if(name == "zlib")
+        return EncodeType::ZLIB_EN;
+    if(!name.empty() && name != "none"){
+        LOG_WARN << "transfer codec:" << name << " unknown, use none";
+    }
+    return EncodeType::NONE_EN;
+}
+
+EncodeType transfer_codec_of(const std::string& vol_name){
+    // format: vol1:codec1,vol2:codec2
+    std::stringstream volumes(g_option.replicate_compress_volumes);
+    std::string entry;
+    while(getline(volumes,entry,',')){
+        size_t pos = entry.find(':');
+        if(pos != std::string::npos && entry.substr(0,pos) == vol_name){
+            return transfer_codec_from_name(entry.substr(pos+1));
+        }
+    }
+    return transfer_codec_from_name(g_option.replicate_compress);
+}
+
+bool transfer_codec_supported(const EncodeType& encode){
+    return encode == EncodeType::NONE_EN
+        || encode == EncodeType::SNAPPY_EN
+        || encode == EncodeType::ZLIB_EN;
+}
+
+EncodeType transfer_encode(const EncodeType& codec, const std::string& in,
+                           std::string& out){
+    size_t len = in.size();
+    size_t data_len = 0;
+    if(codec == EncodeType::SNAPPY_EN){
+        out.resize(snappy::MaxCompressedLength(len));
+        snappy::RawCompress(in.data(),len,&out[0],&data_len);
+    }
+    else if(codec == EncodeType::ZLIB_EN){
+        uint32_t raw_len = len;
+        uLongf dest_len = compressBound(len);
+        out.resize(sizeof(raw_len) + dest_len);
+        memcpy(&out[0],&raw_len,sizeof(raw_len));
+        if(compress2((Bytef*)&out[sizeof(raw_len)],&dest_len,
+                     (const Bytef*)in.data(),len,Z_DEFAULT_COMPRESSION) == Z_OK){
+            data_len = sizeof(raw_len) + dest_len;
+        }
+    }
+    // save less than 1/8, not worth decode on receiver
+    if(data_len == 0 || data_len >= len - len/8){
+        out = in;
+        return EncodeType::NONE_EN;
+    }
+    out.resize(data_len);
+    return codec;
+}
+
+bool transfer_decode(const EncodeType& encode, const std::string& in,
+                     std::string& out){
+    if(encode == EncodeType::NONE_EN || encode == EncodeType::UNKNOWN_EN){
+        out = in;
+        return true;
+    }
+    if(encode == EncodeType::SNAPPY_EN){
+        size_t raw_len = 0;
+        if(!snappy::GetUncompressedLength(in.data(),in.size(),&raw_len)
+            || raw_len > TRANSFER_CODEC_MAX_LEN){
+            return false;
+        }
+        out.resize(raw_len);
+        return snappy::RawUncompress(in.data(),in.size(),&out[0]);
+    }
+    if(encode == EncodeType::ZLIB_EN){
+        uint32_t raw_len = 0;
+        if(in.size() < sizeof(raw_len))
+            return false;
+        memcpy(&raw_len,in.data(),sizeof(raw_len));
+        if(raw_len > TRANSFER_CODEC_MAX_LEN)
+            return false;
+        out.resize(raw_len);
+        uLongf dest_len = raw_len;
+        return uncompress((Bytef*)&out[0],&dest_len,
+                    (const Bytef*)in.data() + sizeof(raw_len),
+                    in.size() - sizeof(raw_len)) == Z_OK
+            && dest_len == raw_len;
+    }
+    LOG_ERROR << "transfer encode:" << encode << " unknown";
+    return false;
+}
+
+PairCodec::PairCodec(const std::string& vol_name):
+        proposed_(transfer_codec_of(vol_name)),
+        accepted_(EncodeType::NONE_EN),
+        fill_proposed_(journal_collapse_enabled(vol_name)),
+        fill_accepted_(false){
+}
+
+EncodeType PairCodec::proposed()const{
+    return proposed_;
+}
+
+EncodeType PairCodec::accepted()const{
+    return (EncodeType)accepted_.load();
+}
+
+bool PairCodec::fill_proposed()const{
+    return fill_proposed_;
+}
+
+bool PairCodec::fill_accepted()const{
+    return fill_accepted_.load();
+}
+
+void PairCodec::on_accept(const EncodeType& accept,const bool& fill){
+    // old peer leave it unknown
+    EncodeType e = transfer_codec_supported(accept) ? accept:EncodeType::NONE_EN;
+    if(accepted_.exchange(e) != e){
+        LOG_INFO << "replicate encode proposed:" << proposed_
+            << " peer accepted:" << e;
+    }
+    bool f = fill_proposed_ && fill;
+    if(fill_accepted_.exchange(f) != f){
+        LOG_INFO << "replicate collapse proposed:" << fill_proposed_
+            << " peer accepted:" << f;
+    }
+}
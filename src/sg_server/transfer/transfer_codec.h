@@ -0,0 +1,53 @@
+/**********************************************
+* Copyright (c) 2016 Huawei Technologies Co., Ltd. All rights reserved.
+* 
+* File name:    transfer_codec.h
+* Author: 
+* Date:         2017/07/12
+* Version:      1.0
+* Description:  compress transfer data on wire
+* 
+************************************************/
+#ifndef TRANSFER_CODEC_H_
+#define TRANSFER_CODEC_H_
+#include <string>
+#include <atomic>
+#include "rpc/transfer.pb.h"
+using huawei::proto::transfer::EncodeType;
+
+// encoding configured for volume: replicate.compress_volumes entry,
+// else replicate.compress; none, snappy or zlib
+EncodeType transfer_codec_of(const std::string& vol_name);
+// whether this side can decode the encoding
+bool transfer_codec_supported(const EncodeType& encode);
+
+// encode data with codec, decided per chunk: if not save 1/8 the data is
+// kept raw; return encoding of out
+EncodeType transfer_encode(const EncodeType& codec, const std::string& in,
+                           std::string& out);
+// false if encoding unknown or data corrupt
+bool transfer_decode(const EncodeType& encode, const std::string& in,
+                     std::string& out);
+
+// encoding of one replication pair: data sent raw until the peer accept
+// the encoding proposed on a command; peers not know the proposal never
+// answer it, so stay raw. same for fill ranges of collapsed journal
+class PairCodec{
+    EncodeType proposed_;
+    std::atomic<int> accepted_;
+    bool fill_proposed_;
+    std::atomic<bool> fill_accepted_;
+public:
+    explicit PairCodec(const std::string& vol_name);
+    ~PairCodec(){}
+
+    EncodeType proposed()const;
+    EncodeType accepted()const;
+    bool fill_proposed()const;
+    // superseded journal entries may be sent as fill ranges
+    bool fill_accepted()const;
+    // answer of peer in command response
+    void on_accept(const EncodeType& accept,const bool& fill);
+};
+
+#endif
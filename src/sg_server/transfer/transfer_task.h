@@ -15,6 +15,7 @@
 #include <memory>
 #include "rpc/transfer.pb.h"
 using huawei::proto::transfer::TransferRequest;
+using huawei::proto::transfer::TransferResponse;
 
 typedef enum TaskStatus{
     T_UNKNOWN,
@@ -52,6 +53,9 @@ public:
 
     virtual TransferRequest* get_next_package() = 0;
 
+    // reply with data to a command of the task, called in reader thread
+    virtual void on_reply(const TransferResponse& res){}
+
     // if failed & can not resume from breakpoint, reset the task and redo it
     virtual int reset() = 0;
 
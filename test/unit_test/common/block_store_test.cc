@@ -0,0 +1,210 @@
+/**********************************************
+* Copyright (c) 2016 Huawei Technologies Co., Ltd. All rights reserved.
+*
+* File name:    block_store_test.cc
+* Author:
+* Date:         2017/07/27
+* Version:      1.0
+* Description:  compress block store round trip test
+*
+************************************************/
+#include <errno.h>
+#include <string.h>
+#include <map>
+#include <string>
+#include "gtest/gtest.h"
+#include "common/block_store.h"
+
+namespace {
+/*objects in memory, read of missing object fail with -ENOENT*/
+class MemBlockStore : public BlockStore {
+ public:
+    MemBlockStore() : read_err(0) {}
+
+    int create(const std::string& object) {
+        objects[object];
+        return 0;
+    }
+    int remove(const std::string& object) {
+        objects.erase(object);
+        return 0;
+    }
+    int write(const std::string& object, char* buf, size_t len, off_t off) {
+        std::string& obj = objects[object];
+        if (obj.size() < off + len) {
+            obj.resize(off + len);
+        }
+        obj.replace(off, len, buf, len);
+        return 0;
+    }
+    int read(const std::string& object, char* buf, size_t len, off_t off) {
+        if (read_err) {
+            return read_err;
+        }
+        auto it = objects.find(object);
+        if (it == objects.end()) {
+            return -ENOENT;
+        }
+        if ((size_t)off >= it->second.size()) {
+            return 0;
+        }
+        size_t n = std::min(len, it->second.size() - off);
+        memcpy(buf, it->second.data() + off, n);
+        return n;
+    }
+
+    std::map<std::string, std::string> objects;
+    int read_err; // fail every read if set
+};
+}  // namespace
+
+class CompressBlockStoreTest : public testing::TestWithParam<block_codec_t> {
+ protected:
+    CompressBlockStoreTest()
+        : base(new MemBlockStore), store(base, GetParam()) {}
+
+    /*compressible but not constant*/
+    std::string data(const size_t len, const char seed) {
+        std::string d(len, '\0');
+        for (size_t i = 0; i < len; i++) {
+            d[i] = seed + (i / 64) % 8;
+        }
+        return d;
+    }
+
+    std::string read_all(const std::string& object, const size_t len) {
+        std::string buf(len, '\0');
+        int ret = store.read(object, &buf[0], len, 0);
+        EXPECT_EQ((int)len, ret);
+        return buf;
+    }
+
+    MemBlockStore* base;
+    CompressBlockStore store;
+};
+
+TEST_P(CompressBlockStoreTest, RoundTrip) {
+    std::string d = data(64 * 1024, 'a');
+    ASSERT_EQ(0, store.write("obj", &d[0], d.size(), 0));
+    if (GetParam() != BLOCK_CODEC_NONE) {
+        EXPECT_LT(base->objects["obj"].size(), d.size());
+    }
+    EXPECT_EQ(d, read_all("obj", d.size()));
+
+    /*read at offset and past end*/
+    std::string part(100, '\0');
+    EXPECT_EQ(100, store.read("obj", &part[0], 100, 4000));
+    EXPECT_EQ(d.substr(4000, 100), part);
+    EXPECT_EQ(0, store.read("obj", &part[0], 100, d.size()));
+
+    /*data looks like header still round trip*/
+    uint32_t magic = BLOCK_HDR_MAGIC;
+    memcpy(&d[0], &magic, sizeof(magic));
+    ASSERT_EQ(0, store.write("obj", &d[0], d.size(), 0));
+    EXPECT_EQ(d, read_all("obj", d.size()));
+}
+
+TEST_P(CompressBlockStoreTest, PartialOverwrite) {
+    std::string d = data(16 * 1024, 'a');
+    ASSERT_EQ(0, store.write("obj", &d[0], d.size(), 0));
+    std::string p = data(1000, 'x');
+    ASSERT_EQ(0, store.write("obj", &p[0], p.size(), 5000));
+    d.replace(5000, p.size(), p);
+    EXPECT_EQ(d, read_all("obj", d.size()));
+
+    /*extend beyond end*/
+    ASSERT_EQ(0, store.write("obj", &p[0], p.size(), d.size() + 24));
+    d.resize(d.size() + 24);
+    d.append(p);
+    EXPECT_EQ(d, read_all("obj", d.size()));
+
+    /*missing object is empty, hole filled by zero*/
+    ASSERT_EQ(0, store.write("new", &p[0], p.size(), 512));
+    EXPECT_EQ(std::string(512, '\0') + p, read_all("new", 512 + p.size()));
+}
+
+TEST_P(CompressBlockStoreTest, ReadErrorNotEmpty) {
+    std::string d = data(8 * 1024, 'a');
+    ASSERT_EQ(0, store.write("obj", &d[0], d.size(), 0));
+    std::string before = base->objects["obj"];
+
+    /*object can not be read, partial write must not replace it*/
+    base->read_err = -EIO;
+    std::string p = data(100, 'x');
+    EXPECT_EQ(-EIO, store.write("obj", &p[0], p.size(), 100));
+    EXPECT_EQ(before, base->objects["obj"]);
+}
+
+TEST_P(CompressBlockStoreTest, CorruptHeader) {
+    std::string d = data(8 * 1024, 'a');
+    ASSERT_EQ(0, store.write("obj", &d[0], d.size(), 0));
+
+    /*data length beyond object*/
+    std::string& raw = base->objects["obj"];
+    block_hdr_t hdr;
+    hdr.magic = BLOCK_HDR_MAGIC;
+    hdr.codec = GetParam();
+    hdr.orig_len = d.size();
+    hdr.data_len = raw.size();
+    memcpy(&raw[0], &hdr, sizeof(hdr));
+    std::string before = raw;
+    std::string buf(d.size(), '\0');
+    EXPECT_EQ(-1, store.read("obj", &buf[0], buf.size(), 0));
+    EXPECT_EQ(-1, store.write("obj", &d[0], 100, 100));
+    EXPECT_EQ(before, base->objects["obj"]);
+
+    /*unknown codec*/
+    hdr.codec = 9;
+    hdr.data_len = 16;
+    raw = std::string(sizeof(hdr) + 16, 'z');
+    memcpy(&raw[0], &hdr, sizeof(hdr));
+    EXPECT_EQ(-1, store.read("obj", &buf[0], buf.size(), 0));
+
+    /*compressed payload damaged*/
+    if (GetParam() != BLOCK_CODEC_NONE) {
+        ASSERT_EQ(0, store.write("obj", &d[0], d.size(), 0));
+        std::string& zraw = base->objects["obj"];
+        for (size_t i = sizeof(hdr); i < zraw.size(); i++) {
+            zraw[i] = ~zraw[i];
+        }
+        EXPECT_EQ(-1, store.read("obj", &buf[0], buf.size(), 0));
+    }
+}
+
+INSTANTIATE_TEST_CASE_P(Codecs, CompressBlockStoreTest,
+                        testing::Values(BLOCK_CODEC_NONE, BLOCK_CODEC_SNAPPY,
+                                        BLOCK_CODEC_ZLIB));
+
+TEST(CompressBlockStoreCodecTest, ChangeCodec) {
+    MemBlockStore* base = new MemBlockStore;
+    CompressBlockStore none_store(base, BLOCK_CODEC_NONE);
+    std::string d(8 * 1024, 'a');
+
+    /*object compressed before volume back to codec none*/
+    std::string raw;
+    {
+        MemBlockStore* zbase = new MemBlockStore;
+        CompressBlockStore z(zbase, BLOCK_CODEC_ZLIB);
+        ASSERT_EQ(0, z.write("obj", &d[0], d.size(), 0));
+        raw = zbase->objects["obj"];
+    }
+    ASSERT_LT(raw.size(), d.size());
+    base->objects["obj"] = raw;
+    std::string buf(d.size(), '\0');
+    EXPECT_EQ((int)d.size(), none_store.read("obj", &buf[0], buf.size(), 0));
+    EXPECT_EQ(d, buf);
+
+    /*partial write keep it readable*/
+    std::string p(100, 'x');
+    ASSERT_EQ(0, none_store.write("obj", &p[0], p.size(), 200));
+    d.replace(200, p.size(), p);
+    EXPECT_EQ((int)d.size(), none_store.read("obj", &buf[0], buf.size(), 0));
+    EXPECT_EQ(d, buf);
+
+    /*raw object patched in place, no header added*/
+    std::string r(4096, 'r');
+    ASSERT_EQ(0, none_store.write("raw", &r[0], r.size(), 0));
+    ASSERT_EQ(0, none_store.write("raw", &p[0], p.size(), 1000));
+    r.replace(1000, p.size(), p);
+    EXPECT_EQ(r, base->objects["raw"]);
+}
@@ -0,0 +1,91 @@
+/**********************************************
+* Copyright (c) 2016 Huawei Technologies Co., Ltd. All rights reserved.
+*
+* File name:    index_store_test.cc
+* Author:
+* Date:         2017/06/30
+* Version:      1.0
+* Description:  memory index store function test
+*
+************************************************/
+#include <string>
+#include <memory>
+#include "gtest/gtest.h"
+#include "common/index_store.h"
+
+TEST(MemIndexStoreTest,PutGetDel){
+    unique_ptr<IndexStore> store(IndexStore::create("memory", ""));
+    ASSERT_TRUE(store != nullptr);
+    EXPECT_EQ(0, store->db_open());
+    store->db_put("snapshot_table_prefix@s1", "1");
+    EXPECT_EQ("1", store->db_get("snapshot_table_prefix@s1"));
+    EXPECT_EQ("", store->db_get("snapshot_table_prefix@s2"));
+    store->db_del("snapshot_table_prefix@s1");
+    EXPECT_EQ("", store->db_get("snapshot_table_prefix@s1"));
+}
+
+TEST(MemIndexStoreTest,PrefixIterate){
+    unique_ptr<IndexStore> store(IndexStore::create("memory", ""));
+    store->db_put("backup_block_prefix@1@2", "b");
+    store->db_put("backup_block_prefix@1@1", "a");
+    store->db_put("backup_block_prefix@2@1", "c");
+    store->db_put("backup_map_prefix@bk", "m");
+
+    string prefix = "backup_block_prefix@1@";
+    IndexStore::SimpleIteratorPtr it = store->db_iterator();
+    string values;
+    for (it->seek_to_first(prefix);
+         it->valid() && !it->key().compare(0, prefix.size(), prefix);
+         it->next()) {
+        values += it->value();
+        /*deleting current key not break the iteration*/
+        store->db_del(it->key());
+    }
+    EXPECT_EQ("ab", values);
+    EXPECT_EQ("", store->db_get("backup_block_prefix@1@1"));
+    EXPECT_EQ("c", store->db_get("backup_block_prefix@2@1"));
+}
+
+TEST(MemIndexStoreTest,Transaction){
+    unique_ptr<IndexStore> store(IndexStore::create("memory", ""));
+    store->db_put("k1", "v1");
+    IndexStore::Transaction t = store->fetch_transaction();
+    t->put("k2", "v2");
+    t->del("k1");
+    t->put("k1", "v3");
+    EXPECT_EQ("v1", store->db_get("k1"));
+    EXPECT_EQ(0, store->submit_transaction(t));
+    EXPECT_EQ("v3", store->db_get("k1"));
+    EXPECT_EQ("v2", store->db_get("k2"));
+}
+
+TEST(MemIndexStoreTest,SeekToLastPrefix){
+    unique_ptr<IndexStore> store(IndexStore::create("memory", "", {}, '#'));
+    store->db_put("backup_block_prefix#1#1", "a");
+    store->db_put("backup_block_prefix#1#2", "b");
+    store->db_put("backup_block_prefix#2#1", "c");
+    store->db_put("backup_map_prefix#bk", "m");
+
+    IndexStore::SimpleIteratorPtr it = store->db_iterator();
+    EXPECT_EQ(0, it->seek_to_last("backup_block_prefix#1#"));
+    ASSERT_TRUE(it->valid());
+    EXPECT_EQ("b", it->value());
+    it->seek_to_last("backup_block_prefix#2#");
+    ASSERT_TRUE(it->valid());
+    EXPECT_EQ("c", it->value());
+    it->seek_to_last("backup_map_prefix#");
+    ASSERT_TRUE(it->valid());
+    EXPECT_EQ("m", it->value());
+    /*no key of prefix, neither before nor after it*/
+    it->seek_to_last("backup_block_prefix#3#");
+    EXPECT_FALSE(it->valid());
+    it->seek_to_last("a");
+    EXPECT_FALSE(it->valid());
+    it->seek_to_last("z");
+    EXPECT_FALSE(it->valid());
+    /*prefix without successor*/
+    store->db_put("\xff\xff" "1", "f");
+    it->seek_to_last("\xff\xff");
+    ASSERT_TRUE(it->valid());
+    EXPECT_EQ("f", it->value());
+}
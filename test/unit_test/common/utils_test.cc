@@ -0,0 +1,30 @@
+/**********************************************
+* Copyright (c) 2016 Huawei Technologies Co., Ltd. All rights reserved.
+*
+* File name:    utils_test.cc
+* Author:
+* Date:         2017/07/03
+* Version:      1.0
+* Description:  common utility function test
+*
+************************************************/
+#include <string.h>
+#include <vector>
+#include "gtest/gtest.h"
+#include "common/utils.h"
+
+TEST(UtilsTest,BufIsZero){
+    std::vector<char> buf(4096 + 7, 0);
+    EXPECT_TRUE(buf_is_zero(buf.data(), buf.size()));
+    EXPECT_TRUE(buf_is_zero(buf.data(), 0));
+    /*non zero byte in sse body, word tail and byte tail*/
+    size_t offs[] = {0, 63, 64, 2048, 4095, 4096, 4102};
+    for (size_t off : offs) {
+        buf[off] = 1;
+        EXPECT_FALSE(buf_is_zero(buf.data(), buf.size())) << off;
+        buf[off] = 0;
+    }
+    /*unaligned start*/
+    buf[0] = 1;
+    EXPECT_TRUE(buf_is_zero(buf.data() + 1, buf.size() - 1));
+}
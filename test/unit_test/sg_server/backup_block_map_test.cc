@@ -0,0 +1,110 @@
+/**********************************************
+* Copyright (c) 2016 Huawei Technologies Co., Ltd. All rights reserved.
+* 
+* File name:    backup_block_map_test.cc
+* Author: 
+* Date:         2017/07/10
+* Version:      1.0
+* Description:  compact backup block map test
+* 
+************************************************/
+#include <map>
+#include <string>
+#include "gtest/gtest.h"
+#include "common/define.h"
+#include "sg_server/backup/backup_util.h"
+#include "sg_server/backup/backup_block_map.h"
+
+static std::map<block_t, backup_object_t> dump(const BackupBlockMap& blocks,
+                                               const block_t start = 0) {
+    std::map<block_t, backup_object_t> out;
+    blocks.for_each([&out](const block_t& blk, const backup_object_t& obj) {
+        out[blk] = obj;
+        return true;
+    }, start);
+    return out;
+}
+
+TEST(BackupBlockMapTest,ObjectNameSplit){
+    std::string vol;
+    backupid_t id;
+    block_t blk;
+    EXPECT_TRUE(split_backup_object_name(
+                spawn_backup_object_name("vol#1", 2223, 17), vol, id, blk));
+    EXPECT_EQ("vol#1", vol);
+    EXPECT_EQ(2223U, id);
+    EXPECT_EQ(17U, blk);
+    EXPECT_FALSE(split_backup_object_name(BACKUP_ZERO_OBJECT, vol, id, blk));
+    EXPECT_FALSE(split_backup_object_name("vol#x#1.backupobj", vol, id, blk));
+}
+
+TEST(BackupBlockMapTest,RunsCoalesce){
+    BackupBlockMap blocks("vol");
+    std::map<block_t, backup_object_t> expect;
+    for (block_t blk = 0; blk < 1000; blk++) {
+        backup_object_t obj = (blk % 100 == 0) ? BACKUP_ZERO_OBJECT :
+                              spawn_backup_object_name("vol", 2222, blk);
+        blocks.set(blk, obj);
+        expect[blk] = obj;
+    }
+    EXPECT_EQ(1000U, blocks.size());
+    EXPECT_EQ(20U, blocks.extents());
+    EXPECT_EQ(expect, dump(blocks));
+
+    /*filling the gaps join runs*/
+    for (block_t blk = 0; blk < 1000; blk += 100) {
+        blocks.set(blk, spawn_backup_object_name("vol", 2222, blk));
+    }
+    EXPECT_EQ(1000U, blocks.size());
+    EXPECT_EQ(1U, blocks.extents());
+}
+
+TEST(BackupBlockMapTest,OverwriteSplitAndNamed){
+    BackupBlockMap blocks("vol");
+    std::map<block_t, backup_object_t> expect;
+    for (block_t blk = 10; blk < 20; blk++) {
+        expect[blk] = spawn_backup_object_name("vol", 2222, blk);
+        blocks.set(blk, expect[blk]);
+    }
+    /*block of merged backup, dedup object of other block, other volume*/
+    expect[15] = spawn_backup_object_name("vol", 2230, 15);
+    expect[12] = spawn_backup_object_name("vol", 2222, 3);
+    expect[30] = spawn_backup_object_name("other", 2222, 30);
+    blocks.set(15, expect[15]);
+    blocks.set(12, expect[12]);
+    blocks.set(30, expect[30]);
+    EXPECT_FALSE(blocks.insert(15, BACKUP_ZERO_OBJECT));
+    EXPECT_TRUE(blocks.insert(5, BACKUP_ZERO_OBJECT));
+    expect[5] = BACKUP_ZERO_OBJECT;
+
+    EXPECT_EQ(expect.size(), blocks.size());
+    EXPECT_EQ(expect, dump(blocks));
+    backup_object_t obj;
+    EXPECT_TRUE(blocks.get(12, obj));
+    EXPECT_EQ(expect[12], obj);
+    EXPECT_FALSE(blocks.get(20, obj));
+
+    std::map<block_t, backup_object_t> tail(expect.lower_bound(13),
+                                            expect.end());
+    EXPECT_EQ(tail, dump(blocks, 13));
+}
+
+TEST(BackupBlockMapTest,EncodeDecode){
+    BackupBlockMap blocks("vol");
+    for (block_t blk = 0; blk < 64; blk++) {
+        blocks.set(blk * 3, spawn_backup_object_name("vol", 2222 + blk % 2,
+                                                     blk * 3));
+    }
+    blocks.set(1, "shared_object");
+    blocks.set(2, BACKUP_ZERO_OBJECT);
+
+    BackupBlockMap loaded("vol");
+    EXPECT_TRUE(loaded.decode(blocks.encode()));
+    EXPECT_EQ(blocks.size(), loaded.size());
+    EXPECT_EQ(dump(blocks), dump(loaded));
+
+    std::string buf = blocks.encode();
+    EXPECT_FALSE(loaded.decode(buf.substr(0, buf.size() - 1)));
+    /*failed decode keep old content*/
+    EXPECT_EQ(dump(blocks), dump(loaded));
+}
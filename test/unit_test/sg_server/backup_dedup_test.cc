@@ -0,0 +1,127 @@
+/**********************************************
+* Copyright (c) 2016 Huawei Technologies Co., Ltd. All rights reserved.
+* 
+* File name:    backup_dedup_test.cc
+* Author: 
+* Date:         2017/07/04
+* Version:      1.0
+* Description:  backup object dedup and refcount test
+* 
+************************************************/
+#include <string.h>
+#include <map>
+#include <memory>
+#include <string>
+#include "gtest/gtest.h"
+#include "sg_server/backup/backup_dedup.h"
+
+namespace {
+/*object store in memory*/
+class MemBlockStore : public BlockStore {
+ public:
+    int create(const std::string& object) override {
+        m_objs[object];
+        return 0;
+    }
+    int remove(const std::string& object) override {
+        m_objs.erase(object);
+        return 0;
+    }
+    int write(const std::string& object, char* buf, size_t len, off_t off) override {
+        std::string& data = m_objs[object];
+        if (data.size() < off + len) {
+            data.resize(off + len);
+        }
+        data.replace(off, len, buf, len);
+        return 0;
+    }
+    int read(const std::string& object, char* buf, size_t len, off_t off) override {
+        auto it = m_objs.find(object);
+        if (it == m_objs.end()) {
+            return -1;
+        }
+        size_t n = it->second.copy(buf, len, off);
+        return n;
+    }
+    std::map<std::string, std::string> m_objs;
+};
+}  // namespace
+
+TEST(BackupDedupTest,ReuseAndRelease){
+    unique_ptr<IndexStore> index(IndexStore::create("memory", ""));
+    MemBlockStore blocks;
+    BackupDedup dedup(index.get(), &blocks);
+    EXPECT_EQ(0, dedup.recover());
+
+    char a[4096];
+    char b[4096];
+    memset(a, 'a', sizeof(a));
+    memset(b, 'b', sizeof(b));
+    backup_object_t obj;
+    EXPECT_EQ(0, dedup.store("o1", a, sizeof(a), obj));
+    EXPECT_EQ("o1", obj);
+    EXPECT_EQ(0, dedup.store("o2", a, sizeof(a), obj));
+    EXPECT_EQ("o1", obj);
+    /*same prefix, different length not deduped*/
+    EXPECT_EQ(0, dedup.store("o3", a, 1024, obj));
+    EXPECT_EQ("o3", obj);
+    EXPECT_EQ(0, dedup.store("o4", b, sizeof(b), obj));
+    EXPECT_EQ("o4", obj);
+    EXPECT_EQ(3U, blocks.m_objs.size());
+
+    EXPECT_FALSE(dedup.unref("o1"));
+    EXPECT_TRUE(dedup.unref("o1"));
+    /*released data stored again as new object*/
+    EXPECT_EQ(0, dedup.store("o5", a, sizeof(a), obj));
+    EXPECT_EQ("o5", obj);
+    /*object not in dedup store always removable*/
+    EXPECT_TRUE(dedup.unref("legacy"));
+}
+
+TEST(BackupDedupTest,RecoverFilter){
+    unique_ptr<IndexStore> index(IndexStore::create("memory", ""));
+    MemBlockStore blocks;
+    char a[4096];
+    memset(a, 'a', sizeof(a));
+    backup_object_t obj;
+    {
+        BackupDedup dedup(index.get(), &blocks);
+        EXPECT_EQ(0, dedup.store("o1", a, sizeof(a), obj));
+    }
+    BackupDedup dedup(index.get(), &blocks);
+    EXPECT_EQ(0, dedup.recover());
+    EXPECT_EQ(0, dedup.store("o2", a, sizeof(a), obj));
+    EXPECT_EQ("o1", obj);
+}
+
+TEST(BackupDedupTest,RestoreSameObjectNoRef){
+    unique_ptr<IndexStore> index(IndexStore::create("memory", ""));
+    MemBlockStore blocks;
+    BackupDedup dedup(index.get(), &blocks);
+    char a[4096];
+    memset(a, 'a', sizeof(a));
+    backup_object_t obj;
+    EXPECT_EQ(0, dedup.store("o1", a, sizeof(a), obj));
+    /*resumed create or resent block store it again*/
+    EXPECT_EQ(0, dedup.store("o1", a, sizeof(a), obj));
+    EXPECT_EQ("o1", obj);
+    EXPECT_TRUE(dedup.unref("o1"));
+}
+
+TEST(BackupDedupTest,DisabledKeepRefs){
+    unique_ptr<IndexStore> index(IndexStore::create("memory", ""));
+    MemBlockStore blocks;
+    char a[4096];
+    memset(a, 'a', sizeof(a));
+    backup_object_t obj;
+    {
+        BackupDedup dedup(index.get(), &blocks);
+        EXPECT_EQ(0, dedup.store("o1", a, sizeof(a), obj));
+        EXPECT_EQ(0, dedup.store("o2", a, sizeof(a), obj));
+    }
+    /*dedup turned off, shared object still removed only on last ref*/
+    BackupDedup dedup(index.get(), &blocks, false);
+    EXPECT_FALSE(dedup.enabled());
+    EXPECT_FALSE(dedup.unref("o1"));
+    EXPECT_TRUE(dedup.unref("o1"));
+}
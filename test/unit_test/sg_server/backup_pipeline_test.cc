@@ -0,0 +1,76 @@
+/**********************************************
+* Copyright (c) 2016 Huawei Technologies Co., Ltd. All rights reserved.
+* 
+* File name:    backup_pipeline_test.cc
+* Author: 
+* Date:         2017/07/05
+* Version:      1.0
+* Description:  backup pipeline order and failure test
+* 
+************************************************/
+#include <unistd.h>
+#include <string.h>
+#include <atomic>
+#include <vector>
+#include "gtest/gtest.h"
+#include "sg_server/backup/backup_pipeline.h"
+
+#define TEST_CHUNK_LEN (4096)
+
+TEST(BackupPipelineTest, CommitInFeedOrder) {
+    std::vector<off_t> committed;
+    BackupPipeline pipeline(
+        [](std::vector<backup_chunk_t>& chunks) {
+            /*several chunks read in one call*/
+            EXPECT_LE(chunks.size(), 3U);
+            for (auto& chunk : chunks) {
+                memset(chunk.buf, (int)(chunk.off / TEST_CHUNK_LEN), chunk.len);
+            }
+            return StatusCode::sOk;
+        },
+        [](backup_chunk_t& chunk) {
+            /*later chunk finish store earlier*/
+            usleep((16 - (chunk.off / TEST_CHUNK_LEN) % 16) * 100);
+            chunk.obj = std::to_string((int)chunk.buf[0]);
+            return StatusCode::sOk;
+        },
+        [&committed](backup_chunk_t& chunk) {
+            EXPECT_EQ(std::to_string((int)(chunk.off / TEST_CHUNK_LEN)), chunk.obj);
+            committed.push_back(chunk.off);
+            return StatusCode::sOk;
+        }, 4, 4, 3);
+    for (int i = 0; i < 100; i++) {
+        EXPECT_TRUE(pipeline.feed(i * TEST_CHUNK_LEN, TEST_CHUNK_LEN));
+    }
+    EXPECT_EQ(StatusCode::sOk, pipeline.finish());
+    ASSERT_EQ(100U, committed.size());
+    for (int i = 0; i < 100; i++) {
+        EXPECT_EQ(i * TEST_CHUNK_LEN, committed[i]);
+    }
+}
+
+TEST(BackupPipelineTest, StopAtFirstFailure) {
+    std::vector<off_t> committed;
+    const off_t bad_off = 30 * TEST_CHUNK_LEN;
+    BackupPipeline pipeline(
+        [](std::vector<backup_chunk_t>& chunks) { return StatusCode::sOk; },
+        [bad_off](backup_chunk_t& chunk) {
+            return chunk.off == bad_off ? StatusCode::sInternalError
+                                        : StatusCode::sOk;
+        },
+        [&committed](backup_chunk_t& chunk) {
+            committed.push_back(chunk.off);
+            return StatusCode::sOk;
+        }, 4, 4);
+    for (int i = 0; i < 100; i++) {
+        if (!pipeline.feed(i * TEST_CHUNK_LEN, TEST_CHUNK_LEN)) {
+            break;
+        }
+    }
+    EXPECT_EQ(StatusCode::sInternalError, pipeline.finish());
+    /*committed chunks contiguous, none after failed one*/
+    ASSERT_LE(committed.size(), 30U);
+    for (size_t i = 0; i < committed.size(); i++) {
+        EXPECT_EQ((off_t)(i * TEST_CHUNK_LEN), committed[i]);
+    }
+}
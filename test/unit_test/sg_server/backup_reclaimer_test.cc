@@ -0,0 +1,83 @@
+/**********************************************
+* Copyright (c) 2016 Huawei Technologies Co., Ltd. All rights reserved.
+* 
+* File name:    backup_reclaimer_test.cc
+* Author: 
+* Date:         2017/07/07
+* Version:      1.0
+* Description:  background backup object removal test
+* 
+************************************************/
+#include <set>
+#include <mutex>
+#include <memory>
+#include <string>
+#include <vector>
+#include "gtest/gtest.h"
+#include "sg_server/backup/backup_util.h"
+#include "sg_server/backup/backup_reclaimer.h"
+
+namespace {
+/*only track which objects exist*/
+class ObjectSetStore : public BlockStore {
+ public:
+    int create(const std::string& object) override {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_objs.insert(object);
+        return 0;
+    }
+    int remove(const std::string& object) override {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_objs.erase(object);
+        return 0;
+    }
+    int write(const std::string& object, char* buf, size_t len, off_t off) override {
+        return create(object);
+    }
+    int read(const std::string& object, char* buf, size_t len, off_t off) override {
+        return -1;
+    }
+    size_t size() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_objs.size();
+    }
+    std::mutex m_mutex;
+    std::set<std::string> m_objs;
+};
+}  // namespace
+
+TEST(BackupReclaimerTest,RemoveInBackground){
+    unique_ptr<IndexStore> index(IndexStore::create("memory", ""));
+    ObjectSetStore objs;
+    std::vector<backup_object_t> garbage;
+    for (int i = 0; i < 3 * BACKUP_RECLAIM_BATCH + 1; i++) {
+        std::string obj = "obj" + std::to_string(i);
+        objs.create(obj);
+        garbage.push_back(obj);
+    }
+    objs.create("live");
+
+    BackupReclaimer reclaimer(index.get(), &objs);
+    EXPECT_EQ(0, reclaimer.reclaim(garbage));
+    reclaimer.drain();
+    EXPECT_EQ(1U, objs.size());
+    EXPECT_EQ(1U, objs.m_objs.count("live"));
+    /*gc keys dropped after removal*/
+    EXPECT_EQ("", index->db_get(spawn_backup_gc_key("obj0")));
+}
+
+TEST(BackupReclaimerTest,RecoverPendingObjects){
+    unique_ptr<IndexStore> index(IndexStore::create("memory", ""));
+    ObjectSetStore objs;
+    objs.create("o1");
+    objs.create("o2");
+    /*gc keys left by crash before removal*/
+    index->db_put(spawn_backup_gc_key("o1"), "");
+    index->db_put(spawn_backup_gc_key("o2"), "");
+
+    BackupReclaimer reclaimer(index.get(), &objs);
+    EXPECT_EQ(0, reclaimer.recover());
+    reclaimer.drain();
+    EXPECT_EQ(0U, objs.size());
+    EXPECT_EQ("", index->db_get(spawn_backup_gc_key("o1")));
+}
@@ -0,0 +1,116 @@
+/**********************************************
+* Copyright (c) 2016 Huawei Technologies Co., Ltd. All rights reserved.
+*
+* File name:    block_hashes_test.cc
+* Author:
+* Date:         2017/07/21
+* Version:      1.0
+* Description:  peer block hashes of base sync test
+*
+************************************************/
+#include <string>
+#include <chrono>
+#include "gtest/gtest.h"
+#include "sg_server/replicate/block_hashes.h"
+
+static const uint64_t blk_size = 4096;
+
+TEST(PeerBlockHashesTest,PrefetchWindows){
+    uint64_t blks = 3 * REP_HASH_WINDOW_BLOCKS + 1;
+    PeerBlockHashes hashes(blk_size, blks * blk_size - 100);
+    uint64_t start = 0;
+    uint64_t count = 0;
+    EXPECT_TRUE(hashes.next_request(start, count));
+    EXPECT_EQ(0U, start);
+    EXPECT_EQ((uint64_t)REP_HASH_WINDOW_BLOCKS, count);
+    EXPECT_TRUE(hashes.next_request(start, count));
+    EXPECT_EQ((uint64_t)REP_HASH_WINDOW_BLOCKS, start);
+    /*enough windows asked ahead of cursor*/
+    EXPECT_FALSE(hashes.next_request(start, count));
+
+    ReplicateHashAck ack;
+    ack.set_start_blk(0);
+    for (int i = 0; i < REP_HASH_WINDOW_BLOCKS; i++) {
+        ack.add_hash(std::string());
+    }
+    hashes.on_ack(ack);
+    std::string zero(blk_size, 0);
+    EXPECT_EQ(1, hashes.match(REP_HASH_WINDOW_BLOCKS - 1, zero.data(),
+                              blk_size, true));
+    EXPECT_TRUE(hashes.next_request(start, count));
+    EXPECT_EQ(2U * REP_HASH_WINDOW_BLOCKS, start);
+    /*cursor moved on, last short window asked*/
+    ack.set_start_blk(REP_HASH_WINDOW_BLOCKS);
+    hashes.on_ack(ack);
+    EXPECT_EQ(1, hashes.match(2 * REP_HASH_WINDOW_BLOCKS - 1, zero.data(),
+                              blk_size, false));
+    EXPECT_TRUE(hashes.next_request(start, count));
+    EXPECT_EQ(3U * REP_HASH_WINDOW_BLOCKS, start);
+    EXPECT_EQ(1U, count);
+    EXPECT_FALSE(hashes.next_request(start, count));
+}
+
+TEST(PeerBlockHashesTest,MatchHash){
+    PeerBlockHashes hashes(blk_size, REP_HASH_WINDOW_BLOCKS * blk_size);
+    uint64_t start = 0;
+    uint64_t count = 0;
+    ASSERT_TRUE(hashes.next_request(start, count));
+    std::string same(blk_size, 'a');
+    std::string differ(blk_size, 'b');
+    ReplicateHashAck ack;
+    ack.set_start_blk(0);
+    for (int i = 0; i < REP_HASH_WINDOW_BLOCKS; i++) {
+        ack.add_hash(rep_block_hash(same.data(), blk_size));
+    }
+    hashes.on_ack(ack);
+    EXPECT_EQ(1, hashes.match(0, same.data(), blk_size, false));
+    EXPECT_EQ(0, hashes.match(1, differ.data(), blk_size, false));
+    /*local zero block against peer data*/
+    std::string zero(blk_size, 0);
+    EXPECT_EQ(0, hashes.match(2, zero.data(), blk_size, true));
+}
+
+TEST(PeerBlockHashesTest,PeerFailed){
+    PeerBlockHashes hashes(blk_size, REP_HASH_WINDOW_BLOCKS * blk_size);
+    uint64_t start = 0;
+    uint64_t count = 0;
+    ASSERT_TRUE(hashes.next_request(start, count));
+    hashes.on_fail();
+    std::string data(blk_size, 'a');
+    EXPECT_EQ(-1, hashes.match(0, data.data(), blk_size, false));
+    EXPECT_FALSE(hashes.next_request(start, count));
+    /*ask again after task reset*/
+    hashes.reset();
+    EXPECT_TRUE(hashes.next_request(start, count));
+    EXPECT_EQ(0U, start);
+}
+
+TEST(PeerBlockHashesTest,LateWindowNotStall){
+    PeerBlockHashes hashes(blk_size, 8 * REP_HASH_WINDOW_BLOCKS * blk_size);
+    uint64_t start = 0;
+    uint64_t count = 0;
+    std::string data(blk_size, 'a');
+    ASSERT_TRUE(hashes.next_request(start, count));
+    /*window never answered, first block waits a short while, later
+     *blocks of same window not wait at all*/
+    auto begin = std::chrono::steady_clock::now();
+    EXPECT_EQ(-1, hashes.match(0, data.data(), blk_size, false));
+    EXPECT_EQ(-1, hashes.match(1, data.data(), blk_size, false));
+    EXPECT_LT(std::chrono::steady_clock::now() - begin,
+              std::chrono::milliseconds(3 * REP_HASH_WAIT_MS));
+    /*late window answered afterwards, peer is fine*/
+    ReplicateHashAck ack;
+    ack.set_start_blk(0);
+    for (int i = 0; i < REP_HASH_WINDOW_BLOCKS; i++) {
+        ack.add_hash(rep_block_hash(data.data(), blk_size));
+    }
+    hashes.on_ack(ack);
+    EXPECT_EQ(1, hashes.match(2, data.data(), blk_size, false));
+    /*windows late in a row, peer not asked any more*/
+    for (uint64_t w = 1; w <= REP_HASH_MAX_LATE_WINDOWS; w++) {
+        ASSERT_TRUE(hashes.next_request(start, count));
+        EXPECT_EQ(w * REP_HASH_WINDOW_BLOCKS, start);
+        EXPECT_EQ(-1, hashes.match(start, data.data(), blk_size, false));
+    }
+    EXPECT_FALSE(hashes.next_request(start, count));
+}
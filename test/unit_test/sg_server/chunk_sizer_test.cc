@@ -0,0 +1,83 @@
+/**********************************************
+* Copyright (c) 2016 Huawei Technologies Co., Ltd. All rights reserved.
+*
+* File name:    chunk_sizer_test.cc
+* Author:
+* Date:         2017/07/14
+* Version:      1.0
+* Description:  replicate chunk size adaption test
+*
+************************************************/
+#include "gtest/gtest.h"
+#include "sg_server/replicate/chunk_sizer.h"
+
+using std::chrono::steady_clock;
+using std::chrono::milliseconds;
+
+/*one task at a time, each takes ms to be acknowledged*/
+static void serial_tasks(ChunkSizer& sizer, steady_clock::time_point& now,
+                         const uint64_t bytes, const int ms, const double rtt,
+                         const int count) {
+    for (int i = 0; i < count; i++) {
+        sizer.on_task_sent(now);
+        now += milliseconds(ms);
+        sizer.on_reply(rtt);
+        sizer.on_task_done(bytes, now);
+    }
+}
+
+TEST(ChunkSizerTest,GrowOnLongFatLink){
+    ChunkSizer sizer("vol");
+    EXPECT_EQ(REP_CHUNK_INIT, sizer.chunk_size());
+    /*200MB/s with 50ms rtt, bdp 10MB*/
+    steady_clock::time_point now = steady_clock::now();
+    serial_tasks(sizer, now, 200 * 1024 * 1024, 1000, 0.05, 16);
+    EXPECT_EQ(REP_CHUNK_MAX, sizer.chunk_size());
+}
+
+TEST(ChunkSizerTest,ShrinkOnShortLink){
+    ChunkSizer sizer("vol");
+    steady_clock::time_point now = steady_clock::now();
+    /*tiny task is not a bandwidth sample*/
+    serial_tasks(sizer, now, 1024, 1, 0.0005, 1);
+    EXPECT_EQ(REP_CHUNK_INIT, sizer.chunk_size());
+    EXPECT_EQ(0, sizer.bandwidth());
+    serial_tasks(sizer, now, 10 * 1024 * 1024, 100, 0.0005, 16);
+    EXPECT_EQ(REP_CHUNK_MIN, sizer.chunk_size());
+}
+
+TEST(ChunkSizerTest,QueuedTasksNotUnderestimate){
+    ChunkSizer sizer("vol");
+    steady_clock::time_point now = steady_clock::now();
+    const uint64_t bytes = 8 * 1024 * 1024;
+    /*80MB/s link, 8 tasks sent together are acknowledged one by one every
+     *100ms; per task time would count the wait behind earlier ones*/
+    for (int round = 0; round < 32; round++) {
+        for (int i = 0; i < 8; i++) {
+            sizer.on_task_sent(now);
+        }
+        for (int i = 0; i < 8; i++) {
+            now += milliseconds(100);
+            sizer.on_task_done(bytes, now);
+        }
+        /*idle time between rounds is not counted*/
+        now += milliseconds(1000);
+    }
+    EXPECT_NEAR(80.0 * 1024 * 1024, sizer.bandwidth(), 1024 * 1024);
+}
+
+TEST(ChunkSizerTest,FailedTaskEndsSample){
+    ChunkSizer sizer("vol");
+    steady_clock::time_point now = steady_clock::now();
+    sizer.on_task_sent(now);
+    sizer.on_task_sent(now);
+    now += milliseconds(100);
+    sizer.on_task_done(4 * 1024 * 1024, now);
+    now += milliseconds(100);
+    /*nothing acknowledged by failed task, link idle after it*/
+    sizer.on_task_done(0, now);
+    EXPECT_NEAR(20.0 * 1024 * 1024, sizer.bandwidth(), 1024);
+    now += milliseconds(5000);
+    serial_tasks(sizer, now, 2 * 1024 * 1024, 100, 0.05, 1);
+    EXPECT_NEAR(20.0 * 1024 * 1024, sizer.bandwidth(), 1024);
+}
@@ -0,0 +1,168 @@
+/**********************************************
+* Copyright (c) 2016 Huawei Technologies Co., Ltd. All rights reserved.
+* 
+* File name:    cow_range_index_test.cc
+* Author: 
+* Date:         2017/06/12
+* Version:      1.0
+* Description:  cow range index function test and memory/lookup benchmark
+* 
+************************************************/
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <string>
+#include "gtest/gtest.h"
+#include "sg_server/snapshot/cow_range_index.h"
+
+TEST(CowRangeIndexTest,FindServeSnapshot){
+    CowRangeIndex index;
+    index.insert(5, {0, 2});
+    index.insert(5, {3, 6});
+    index.insert(COW_SEGMENT_BLOCKS + 1, {0, 4});
+    EXPECT_EQ(3U, index.size());
+
+    cow_range_t range;
+    EXPECT_TRUE(index.find(5, 1, range));
+    EXPECT_EQ(0U, range.start);
+    EXPECT_EQ(2U, range.end);
+    EXPECT_TRUE(index.find(5, 6, range));
+    EXPECT_EQ(3U, range.start);
+    EXPECT_FALSE(index.find(5, 7, range));
+    EXPECT_FALSE(index.find(4, 1, range));
+    EXPECT_TRUE(index.find(COW_SEGMENT_BLOCKS + 1, 4, range));
+
+    EXPECT_TRUE(index.last(5, range));
+    EXPECT_EQ(6U, range.end);
+    EXPECT_FALSE(index.last(6, range));
+}
+
+TEST(CowRangeIndexTest,VisitAndErase){
+    CowRangeIndex index;
+    for (block_t blk = 0; blk < 3 * COW_SEGMENT_BLOCKS; blk += 100) {
+        index.insert(blk, {0, 1});
+        index.insert(blk, {2, 3});
+    }
+    block_t last = 0;
+    size_t count = 0;
+    index.visit(150, 2 * COW_SEGMENT_BLOCKS, 2,
+        [&](const block_t blk, const cow_range_t& range) -> bool {
+            EXPECT_GT(blk, last);
+            EXPECT_EQ(3U, range.end);
+            last = blk;
+            count++;
+            return true;
+        });
+    EXPECT_EQ((2 * COW_SEGMENT_BLOCKS) / 100 - 1, count);
+
+    EXPECT_TRUE(index.erase(200, 1));
+    EXPECT_FALSE(index.erase(200, 1));
+    cow_range_t range;
+    EXPECT_FALSE(index.find(200, 0, range));
+    EXPECT_TRUE(index.find(200, 2, range));
+}
+
+/*cow object counted allocator, measure the legacy map layout heap usage*/
+static size_t g_legacy_bytes = 0;
+template <typename T>
+struct CountAllocator {
+    typedef T value_type;
+    CountAllocator() {}
+    template <typename U> CountAllocator(const CountAllocator<U>&) {}
+    T* allocate(size_t n) {
+        g_legacy_bytes += n * sizeof(T);
+        return static_cast<T*>(::operator new(n * sizeof(T)));
+    }
+    void deallocate(T* p, size_t n) {
+        g_legacy_bytes -= n * sizeof(T);
+        ::operator delete(p);
+    }
+};
+template <typename T, typename U>
+bool operator==(const CountAllocator<T>&, const CountAllocator<U>&) {
+    return true;
+}
+template <typename T, typename U>
+bool operator!=(const CountAllocator<T>&, const CountAllocator<U>&) {
+    return false;
+}
+
+typedef std::basic_string<char, std::char_traits<char>,
+                          CountAllocator<char>> legacy_object_t;
+struct legacy_range_t {
+    snapid_t start;
+    snapid_t end;
+    legacy_object_t object;
+};
+typedef std::map<snapid_t, legacy_range_t, std::less<snapid_t>,
+        CountAllocator<std::pair<const snapid_t, legacy_range_t>>> legacy_ranges_t;
+typedef std::map<block_t, legacy_ranges_t, std::less<block_t>,
+        CountAllocator<std::pair<const block_t, legacy_ranges_t>>> legacy_index_t;
+
+/*memory and lookup cost against the map layout, too heavy for the unit
+ *suite, run with --gtest_also_run_disabled_tests*/
+TEST(CowRangeIndexTest,DISABLED_BenchmarkAgainstMapLayout){
+    /*1M blocks, 3 snapshots, each snapshot cow half of blocks*/
+    const block_t  blocks = 1024 * 1024;
+    const snapid_t snaps = 3;
+    std::mt19937_64 rand(0);
+    const std::string vol = "volume-0c1e5cf0-84b2-4e11-97a4-3ec9a1a8d0e2";
+
+    CowRangeIndex index;
+    legacy_index_t legacy;
+    for (block_t blk = 0; blk < blocks; blk++) {
+        snapid_t start = 0;
+        for (snapid_t snap = 0; snap < snaps; snap++) {
+            if (rand() % 2) {
+                continue;
+            }
+            index.insert(blk, {start, snap});
+            std::string name = vol + "@" + std::to_string(snap) + "@" +
+                               std::to_string(blk) + ".obj";
+            legacy_range_t range = {start, snap,
+                                    legacy_object_t(name.c_str())};
+            legacy[blk].insert({snap, range});
+            start = snap + 1;
+        }
+    }
+    index.compact();
+    EXPECT_LT(index.memory_usage(), g_legacy_bytes);
+
+    std::vector<std::pair<block_t, snapid_t>> probes;
+    for (int i = 0; i < 1000000; i++) {
+        probes.push_back({rand() % blocks, rand() % snaps});
+    }
+
+    size_t index_hit = 0;
+    auto begin = std::chrono::steady_clock::now();
+    for (auto& probe : probes) {
+        cow_range_t range;
+        index_hit += index.find(probe.first, probe.second, range);
+    }
+    auto index_cost = std::chrono::steady_clock::now() - begin;
+
+    size_t legacy_hit = 0;
+    begin = std::chrono::steady_clock::now();
+    for (auto& probe : probes) {
+        auto blk_it = legacy.find(probe.first);
+        if (blk_it == legacy.end()) {
+            continue;
+        }
+        auto range_it = blk_it->second.lower_bound(probe.second);
+        legacy_hit += (range_it != blk_it->second.end() &&
+                       range_it->second.start <= probe.second);
+    }
+    auto legacy_cost = std::chrono::steady_clock::now() - begin;
+    EXPECT_EQ(legacy_hit, index_hit);
+
+    using std::chrono::duration_cast;
+    using std::chrono::nanoseconds;
+    std::cout << "cow ranges:" << index.size()
+              << " index bytes:" << index.memory_usage()
+              << " map layout bytes:" << g_legacy_bytes << std::endl;
+    std::cout << "lookup index ns:"
+              << duration_cast<nanoseconds>(index_cost).count() / probes.size()
+              << " map layout ns:"
+              << duration_cast<nanoseconds>(legacy_cost).count() / probes.size()
+              << std::endl;
+}
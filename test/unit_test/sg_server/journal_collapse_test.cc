@@ -0,0 +1,195 @@
+/**********************************************
+* Copyright (c) 2016 Huawei Technologies Co., Ltd. All rights reserved.
+*
+* File name:    journal_collapse_test.cc
+* Author:
+* Date:         2017/07/17
+* Version:      1.0
+* Description:  collapse overwritten journal entries test
+*
+************************************************/
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+#include "gtest/gtest.h"
+#include "common/define.h"
+#include "common/journal_entry.h"
+#include "rpc/message.pb.h"
+#include "sg_server/replicate/journal_collapse.h"
+using huawei::proto::WriteMessage;
+using huawei::proto::SnapshotMessage;
+using huawei::proto::DiskPos;
+
+static size_t append_write(std::string& journal, const off_t off,
+                           const size_t len, const char c) {
+    std::shared_ptr<WriteMessage> message(new WriteMessage);
+    DiskPos* pos = message->add_pos();
+    pos->set_offset(off);
+    pos->set_length(len);
+    message->set_data(std::string(len, c));
+    JournalEntry entry;
+    entry.set_type(IO_WRITE);
+    entry.set_message(message);
+    entry.serialize();
+    entry.calculate_crc();
+    return entry.copy_entry(journal);
+}
+
+static size_t append_snapshot(std::string& journal) {
+    std::shared_ptr<SnapshotMessage> message(new SnapshotMessage);
+    message->set_snap_name("snap");
+    JournalEntry entry;
+    entry.set_type(SNAPSHOT_CREATE);
+    entry.set_message(message);
+    entry.serialize();
+    entry.calculate_crc();
+    return entry.copy_entry(journal);
+}
+
+/*one merged write with pos from off, every pos len long*/
+static size_t append_merged_write(std::string& journal, const off_t off,
+                                  const size_t len, const int count) {
+    std::shared_ptr<WriteMessage> message(new WriteMessage);
+    for (int i = 0; i < count; i++) {
+        DiskPos* pos = message->add_pos();
+        pos->set_offset(off + i * len);
+        pos->set_length(len);
+    }
+    message->set_data(std::string(len * count, 'm'));
+    JournalEntry entry;
+    entry.set_type(IO_WRITE);
+    entry.set_message(message);
+    entry.serialize();
+    entry.calculate_crc();
+    return entry.copy_entry(journal);
+}
+
+/*parse entries one by one as replayer does, return io entries with pos*/
+static int replay_writes(const std::string& journal_file,
+                         const std::string& journal) {
+    int fd = ::open(journal_file.c_str(), O_CREAT | O_TRUNC | O_WRONLY, 0644);
+    EXPECT_EQ((ssize_t)journal.size(), ::write(fd, journal.data(), journal.size()));
+    ::close(fd);
+    unique_ptr<AccessFile> file;
+    Env::instance()->create_access_file(journal_file, false, &file);
+    int writes = 0;
+    off_t off = 0;
+    while (off < (off_t)journal.size()) {
+        JournalEntry entry;
+        off = entry.parse(&file, journal.size(), off);
+        EXPECT_GT(off, 0);
+        if (off <= 0) {
+            break;
+        }
+        if (entry.get_type() == IO_WRITE) {
+            auto write = std::dynamic_pointer_cast<WriteMessage>(entry.get_message());
+            writes += write->pos_size() > 0 ? 1 : 0;
+        }
+    }
+    return writes;
+}
+
+class JournalCollapseTest : public testing::Test{
+ protected:
+    void SetUp() override {
+        char dir[] = "/tmp/journal_collapse_test.XXXXXX";
+        ASSERT_TRUE(::mkdtemp(dir) != nullptr);
+        dir_ = dir;
+        journal_file = dir_ + "/journal";
+    }
+
+    void TearDown() override {
+        ::unlink(journal_file.c_str());
+        ::rmdir(dir_.c_str());
+    }
+
+    std::string dir_;
+    std::string journal_file;
+};
+
+TEST_F(JournalCollapseTest,FillEntryLength){
+    uint64_t lens[] = {FILL_ENTRY_MIN, 141, 142, 143, 16399, 4096,
+                       FILL_ENTRY_MAX + 100, 3 * FILL_ENTRY_MAX};
+    for (auto len : lens) {
+        std::string fill;
+        build_fill_entries(len, fill);
+        EXPECT_EQ(len, fill.size());
+        EXPECT_EQ(0, replay_writes(journal_file, fill));
+    }
+}
+
+TEST_F(JournalCollapseTest,SupersededBeforeBarrier){
+    std::string journal;
+    size_t e1 = append_write(journal, 0, 4096, 'a');
+    append_write(journal, 8192, 4096, 'b');
+    /*rewrite first one, partly rewrite second one*/
+    append_write(journal, 0, 8192, 'c');
+    append_write(journal, 8192, 512, 'd');
+    append_snapshot(journal);
+    /*snapshot must see write before it*/
+    append_write(journal, 8192, 4096, 'e');
+
+    int fd = ::open(journal_file.c_str(), O_CREAT | O_TRUNC | O_RDWR, 0644);
+    ASSERT_EQ((ssize_t)journal.size(), ::write(fd, journal.data(), journal.size()));
+    std::vector<CollapseSegment> segments;
+    uint64_t filled = collapse_journal_window(fd, 0, journal.size(), segments);
+    ::close(fd);
+    EXPECT_EQ(e1, filled);
+    ASSERT_EQ(2U, segments.size());
+    EXPECT_TRUE(segments[0].fill);
+    EXPECT_EQ(0U, segments[0].off);
+    EXPECT_EQ(e1, segments[0].len);
+    EXPECT_FALSE(segments[1].fill);
+    EXPECT_EQ(journal.size() - e1, segments[1].len);
+
+    /*receiver view: fill range replaced, every entry still parse*/
+    std::string fill;
+    build_fill_entries(segments[0].len, fill);
+    std::string received = fill + journal.substr(e1);
+    EXPECT_EQ(journal.size(), received.size());
+    EXPECT_EQ(4, replay_writes(journal_file, received));
+}
+
+TEST_F(JournalCollapseTest,TruncatedTailSentAsData){
+    std::string journal;
+    append_write(journal, 0, 4096, 'a');
+    append_write(journal, 0, 4096, 'b');
+    int fd = ::open(journal_file.c_str(), O_CREAT | O_TRUNC | O_RDWR, 0644);
+    ASSERT_EQ((ssize_t)journal.size(), ::write(fd, journal.data(), journal.size()));
+    std::vector<CollapseSegment> segments;
+    /*window end in the middle of second entry*/
+    uint64_t filled = collapse_journal_window(fd, 0, journal.size() - 10, segments);
+    ::close(fd);
+    EXPECT_EQ(0U, filled);
+    ASSERT_EQ(1U, segments.size());
+    EXPECT_FALSE(segments[0].fill);
+    EXPECT_EQ(journal.size() - 10, segments[0].len);
+}
+
+TEST_F(JournalCollapseTest,PosBeyondPrefixNotSuperseded){
+    /*pos below 2M encode in 9 bytes, others in 10 bytes, 4 short and 406
+     *long ones end exactly at the 4096 bytes read first, rest of pos and
+     *data follow*/
+    const off_t base = (1 << 21) - 4 * 512;
+    std::string journal;
+    size_t e1 = append_merged_write(journal, base, 512, 500);
+    /*rewrite only pos inside the prefix*/
+    size_t e2 = append_write(journal, base, 410 * 512, 'a');
+    int fd = ::open(journal_file.c_str(), O_CREAT | O_TRUNC | O_RDWR, 0644);
+    ASSERT_EQ((ssize_t)journal.size(), ::write(fd, journal.data(), journal.size()));
+    std::vector<CollapseSegment> segments;
+    uint64_t filled = collapse_journal_window(fd, 0, journal.size(), segments);
+    EXPECT_EQ(0U, filled);
+    ASSERT_EQ(1U, segments.size());
+    EXPECT_FALSE(segments[0].fill);
+
+    /*rewrite all pos, merged write can go*/
+    size_t e3 = append_write(journal, base, 500 * 512, 'b');
+    ASSERT_EQ((ssize_t)e3, ::pwrite(fd, journal.data() + journal.size() - e3,
+                                    e3, journal.size() - e3));
+    filled = collapse_journal_window(fd, 0, journal.size(), segments);
+    ::close(fd);
+    EXPECT_EQ(e1 + e2, filled);
+}
@@ -0,0 +1,234 @@
+/**********************************************
+* Copyright (c) 2016 Huawei Technologies Co., Ltd. All rights reserved.
+*
+* File name:    pipelined_stream_test.cc
+* Author:
+* Date:         2017/07/14
+* Version:      1.0
+* Description:  replicate stream shared by in-flight tasks test
+*
+************************************************/
+#include <deque>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include "gtest/gtest.h"
+#include "sg_server/replicate/pipelined_stream.h"
+#include "sg_server/replicate/rep_task.h"
+using huawei::proto::transfer::MessageType;
+
+/*replies are fed by test, writes always succeed*/
+class FakeStream : public grpc::ClientReaderWriterInterface<TransferRequest,
+                                                             TransferResponse> {
+ public:
+    FakeStream() : closed_(false) {}
+
+    void WaitForInitialMetadata() {}
+    bool WritesDone() {
+        shutdown();
+        return true;
+    }
+    grpc::Status Finish() { return grpc::Status::OK; }
+    bool NextMessageSize(uint32_t* sz) {
+        *sz = 0;
+        return true;
+    }
+    bool Read(TransferResponse* msg) {
+        std::unique_lock<std::mutex> lck(mtx_);
+        cond_.wait(lck, [this] { return closed_ || !replies_.empty(); });
+        if (replies_.empty()) {
+            return false;
+        }
+        *msg = replies_.front();
+        replies_.pop_front();
+        return true;
+    }
+    bool Write(const TransferRequest& msg, grpc::WriteOptions options) {
+        return true;
+    }
+
+    void reply(const uint64_t id, const int status) {
+        TransferResponse res;
+        res.set_id(id);
+        res.set_status((huawei::proto::StatusCode)status);
+        std::lock_guard<std::mutex> lck(mtx_);
+        replies_.push_back(res);
+        cond_.notify_all();
+    }
+    /*peer gone, reader exit*/
+    void shutdown() {
+        std::lock_guard<std::mutex> lck(mtx_);
+        closed_ = true;
+        cond_.notify_all();
+    }
+
+ private:
+    std::mutex mtx_;
+    std::condition_variable cond_;
+    std::deque<TransferResponse> replies_;
+    bool closed_;
+};
+
+class FakeTask : public TransferTask {
+ public:
+    explicit FakeTask(std::shared_ptr<TaskContext> ctx) : TransferTask(ctx) {}
+    bool has_next_package() { return false; }
+    TransferRequest* get_next_package() { return nullptr; }
+    int reset() { return 0; }
+};
+
+class PipelinedStreamTest : public testing::Test {
+ protected:
+    PipelinedStreamTest()
+        : done_pool(2), stream(new FakeStream), done(0), block_id(0),
+          blocked(true) {}
+
+    std::shared_ptr<TransferTask> new_task(const uint64_t id) {
+        auto f = [this](std::shared_ptr<TransferTask>& t) {
+            std::unique_lock<std::mutex> lck(mtx);
+            if (t->get_id() == block_id) {
+                cond.wait(lck, [this] { return !blocked; });
+            }
+            order.push_back(t->get_id());
+            done++;
+            cond.notify_all();
+        };
+        std::shared_ptr<TaskContext> ctx(
+            new RepContext("vol", "peer", 1, 0, false, f));
+        std::shared_ptr<TransferTask> task(new FakeTask(ctx));
+        task->set_id(id);
+        return task;
+    }
+
+    /*write commands of task as task handler does*/
+    std::shared_ptr<InflightTask> send(PipelinedStream& pipe,
+                                       std::shared_ptr<TransferTask> task,
+                                       const std::vector<uint64_t>& ids) {
+        EXPECT_TRUE(pipe.acquire());
+        std::shared_ptr<InflightTask> t(new InflightTask(task));
+        for (auto id : ids) {
+            TransferRequest req;
+            req.set_id(id);
+            req.set_type(MessageType::REPLICATE_END);
+            EXPECT_TRUE(pipe.expect_reply(id, t));
+            EXPECT_TRUE(pipe.write(req));
+        }
+        return t;
+    }
+
+    bool wait_done(const int n) {
+        std::unique_lock<std::mutex> lck(mtx);
+        return cond.wait_for(lck, std::chrono::seconds(5),
+                             [this, n] { return done >= n; });
+    }
+
+    void unblock() {
+        std::lock_guard<std::mutex> lck(mtx);
+        blocked = false;
+        cond.notify_all();
+    }
+
+    sg_threads::ThreadPool done_pool;
+    std::shared_ptr<FakeStream> stream;
+    std::mutex mtx;
+    std::condition_variable cond;
+    std::vector<uint64_t> order;
+    int done;
+    uint64_t block_id; // callback of this task waits for unblock
+    bool blocked;
+};
+
+TEST_F(PipelinedStreamTest, OutOfOrderReplies) {
+    PipelinedStream pipe(stream, 8, done_pool);
+    std::shared_ptr<TransferTask> a = new_task(1);
+    std::shared_ptr<TransferTask> b = new_task(2);
+    std::shared_ptr<InflightTask> ta = send(pipe, a, {11, 12});
+    pipe.finish_task(ta, false);
+    std::shared_ptr<InflightTask> tb = send(pipe, b, {13});
+    pipe.finish_task(tb, false);
+
+    /*b replied first, a waits for both of its commands*/
+    stream->reply(13, 0);
+    stream->reply(12, 0);
+    ASSERT_TRUE(wait_done(1));
+    EXPECT_EQ(T_DONE, b->get_status());
+    EXPECT_NE(T_DONE, a->get_status());
+    stream->reply(11, 0);
+    ASSERT_TRUE(wait_done(2));
+    EXPECT_EQ(T_DONE, a->get_status());
+    EXPECT_EQ((std::vector<uint64_t>{2, 1}), order);
+    pipe.close();
+}
+
+TEST_F(PipelinedStreamTest, SlowCallbackNotBlockReplies) {
+    PipelinedStream pipe(stream, 8, done_pool);
+    block_id = 1;
+    std::shared_ptr<TransferTask> a = new_task(1);
+    std::shared_ptr<TransferTask> b = new_task(2);
+    std::shared_ptr<InflightTask> ta = send(pipe, a, {11});
+    pipe.finish_task(ta, false);
+    std::shared_ptr<InflightTask> tb = send(pipe, b, {12});
+    pipe.finish_task(tb, false);
+
+    /*callback of a hangs, reply of b is still read and b completed*/
+    stream->reply(11, 0);
+    stream->reply(12, 0);
+    ASSERT_TRUE(wait_done(1));
+    EXPECT_EQ((std::vector<uint64_t>{2}), order);
+    unblock();
+    ASSERT_TRUE(wait_done(2));
+    pipe.close();
+}
+
+TEST_F(PipelinedStreamTest, BrokenFailsInflightTasks) {
+    PipelinedStream pipe(stream, 8, done_pool);
+    std::shared_ptr<TransferTask> a = new_task(1);
+    std::shared_ptr<TransferTask> b = new_task(2);
+    std::shared_ptr<TransferTask> c = new_task(3);
+    /*a all sent, b still sending, c already replied*/
+    std::shared_ptr<InflightTask> ta = send(pipe, a, {11, 12});
+    pipe.finish_task(ta, false);
+    std::shared_ptr<InflightTask> tb = send(pipe, b, {13});
+    std::shared_ptr<InflightTask> tc = send(pipe, c, {14});
+    pipe.finish_task(tc, false);
+    stream->reply(14, 0);
+    stream->reply(11, 0);
+    ASSERT_TRUE(wait_done(1));
+
+    stream->shutdown();
+    pipe.finish_task(tb, false);
+    pipe.drain();
+    EXPECT_TRUE(pipe.broken());
+    EXPECT_FALSE(pipe.acquire());
+    EXPECT_EQ(T_ERROR, a->get_status());
+    EXPECT_EQ(T_ERROR, b->get_status());
+    EXPECT_EQ(T_DONE, c->get_status());
+    /*failed task never call back, or task window goes wrong*/
+    EXPECT_EQ((std::vector<uint64_t>{3}), order);
+    pipe.close();
+}
+
+TEST_F(PipelinedStreamTest, DrainWaitsCallbacks) {
+    PipelinedStream pipe(stream, 2, done_pool);
+    block_id = 2;
+    std::shared_ptr<InflightTask> ta = send(pipe, new_task(1), {11});
+    pipe.finish_task(ta, false);
+    std::shared_ptr<InflightTask> tb = send(pipe, new_task(2), {12});
+    pipe.finish_task(tb, false);
+
+    std::atomic<bool> drained(false);
+    std::thread drainer([&] {
+        pipe.drain();
+        drained = true;
+    });
+    stream->reply(11, 0);
+    stream->reply(12, 0);
+    ASSERT_TRUE(wait_done(1));
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    /*reply of b came, its callback not finished*/
+    EXPECT_FALSE(drained);
+    unblock();
+    drainer.join();
+    EXPECT_EQ(2, done);
+    pipe.close();
+}
@@ -0,0 +1,92 @@
+/**********************************************
+* Copyright (c) 2016 Huawei Technologies Co., Ltd. All rights reserved.
+*
+* File name:    rep_journal_file_test.cc
+* Author:
+* Date:         2017/07/19
+* Version:      1.0
+* Description:  replication receiver journal file write test
+*
+************************************************/
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <string>
+#include "gtest/gtest.h"
+#include "sg_server/replicate/rep_journal_file.h"
+
+class RepJournalFileTest : public testing::Test{
+ protected:
+    void SetUp() override {
+        char dir[] = "/tmp/rep_journal_file_test.XXXXXX";
+        ASSERT_TRUE(::mkdtemp(dir) != nullptr);
+        dir_ = dir;
+        journal_file = dir_ + "/journal";
+    }
+
+    void TearDown() override {
+        ::unlink(journal_file.c_str());
+        ::rmdir(dir_.c_str());
+    }
+
+    std::string dir_;
+    std::string journal_file;
+};
+
+TEST_F(RepJournalFileTest,OutOfOrderWrite){
+    int fd = ::open(journal_file.c_str(), O_CREAT | O_TRUNC | O_WRONLY, 0644);
+    ASSERT_GE(fd, 0);
+    ::close(fd);
+
+    sg_threads::ThreadPool pool(4, 8);
+    RepJournalFile file(journal_file);
+    ASSERT_TRUE(file.open(1024 * 1024));
+    /*preallocation never change visible size*/
+    struct stat st;
+    ASSERT_EQ(0, ::stat(journal_file.c_str(), &st));
+    EXPECT_EQ(0, st.st_size);
+
+    const int chunks = 64;
+    const size_t len = 4096;
+    for (int i = chunks - 1; i >= 0; i--) {
+        EXPECT_TRUE(file.write_async(pool, i * len, std::string(len, 'a' + i % 26)));
+    }
+    EXPECT_TRUE(file.sync());
+    file.close();
+
+    std::string expect;
+    for (int i = 0; i < chunks; i++) {
+        expect.append(len, 'a' + i % 26);
+    }
+    std::string got(expect.size() + 1, 0);
+    fd = ::open(journal_file.c_str(), O_RDONLY);
+    EXPECT_EQ((ssize_t)expect.size(), ::read(fd, &got[0], got.size()));
+    ::close(fd);
+    got.resize(expect.size());
+    EXPECT_EQ(expect, got);
+}
+
+TEST_F(RepJournalFileTest,MissingFile){
+    /*receiver only opens journal created by its journal meta*/
+    RepJournalFile file(journal_file);
+    EXPECT_FALSE(file.open(0));
+}
+
+TEST_F(RepJournalFileTest,FailedChunkFailsSync){
+    int fd = ::open(journal_file.c_str(), O_CREAT | O_TRUNC | O_WRONLY, 0644);
+    ASSERT_GE(fd, 0);
+    ::close(fd);
+
+    sg_threads::ThreadPool pool(4, 8);
+    RepJournalFile file(journal_file);
+    ASSERT_TRUE(file.open(0));
+    EXPECT_TRUE(file.write_async(pool, 0, std::string(4096, 'a')));
+    /*chunk not decoded, end of task must fail and task resent*/
+    file.fail();
+    EXPECT_FALSE(file.sync());
+    /*resent task starts clean*/
+    EXPECT_TRUE(file.write_async(pool, 0, std::string(4096, 'a')));
+    EXPECT_TRUE(file.sync());
+    file.close();
+}
@@ -0,0 +1,87 @@
+/**********************************************
+* Copyright (c) 2016 Huawei Technologies Co., Ltd. All rights reserved.
+*
+* File name:    rep_qos_test.cc
+* Author:
+* Date:         2017/07/24
+* Version:      1.0
+* Description:  replication bandwidth limit and fair share test
+*
+************************************************/
+#include <atomic>
+#include <thread>
+#include <vector>
+#include "gtest/gtest.h"
+#include "sg_server/replicate/rep_qos.h"
+using std::chrono::steady_clock;
+
+TEST(TokenBucketTest,BorrowAndRefill){
+    TokenBucket bucket(1000);
+    steady_clock::time_point now = steady_clock::now();
+    EXPECT_EQ(0, bucket.wait_time(now));
+    /*whole chunk taken even beyond tokens*/
+    bucket.take(1200);
+    double wait = bucket.wait_time(now);
+    EXPECT_GT(wait, 0.9);
+    EXPECT_LT(wait, 1.1);
+    EXPECT_EQ(0, bucket.wait_time(now + std::chrono::milliseconds(1100)));
+    /*idle time never accumulate more than burst*/
+    now += std::chrono::seconds(100);
+    EXPECT_EQ(0, bucket.wait_time(now));
+    bucket.take(1000 * REP_QOS_BURST_SECONDS + 100);
+    EXPECT_GT(bucket.wait_time(now), 0.09);
+
+    TokenBucket unlimited(0);
+    unlimited.take(1 << 30);
+    EXPECT_EQ(0, unlimited.wait_time(now));
+}
+
+TEST(RepQosTest,FairShareUnderBurst){
+    const size_t chunk = 64 * 1024;
+    RepQos qos(40 * 1024 * 1024);
+    qos.set_volume("burst", 0, 1);
+    qos.set_volume("quiet", 0, 1);
+    std::atomic<bool> stop(false);
+    std::atomic<uint64_t> burst_bytes(0);
+    std::atomic<uint64_t> quiet_bytes(0);
+    std::vector<std::thread> threads;
+    /*burst volume send on many streams, quiet one on one stream*/
+    for (int i = 0; i < 6; i++) {
+        threads.push_back(std::thread([&]{
+            while (!stop) {
+                qos.acquire("burst", chunk);
+                burst_bytes += chunk;
+            }
+        }));
+    }
+    threads.push_back(std::thread([&]{
+        while (!stop) {
+            qos.acquire("quiet", chunk);
+            quiet_bytes += chunk;
+        }
+    }));
+    std::this_thread::sleep_for(std::chrono::milliseconds(1000));
+    stop = true;
+    for (auto& t : threads) {
+        t.join();
+    }
+    uint64_t total = burst_bytes + quiet_bytes;
+    EXPECT_LT(total, 50ULL * 1024 * 1024);
+    EXPECT_GT(quiet_bytes * 10, total * 4);
+    EXPECT_GT(burst_bytes * 10, total * 4);
+}
+
+TEST(RepQosTest,VolumeLimit){
+    const size_t chunk = 64 * 1024;
+    RepQos qos(0);
+    qos.set_volume("vol", 4 * 1024 * 1024, 1);
+    steady_clock::time_point start = steady_clock::now();
+    for (int i = 0; i < 32; i++) {
+        qos.acquire("vol", chunk);
+    }
+    double seconds = std::chrono::duration<double>(
+                     steady_clock::now() - start).count();
+    /*2MB at 4MB/s*/
+    EXPECT_GT(seconds, 0.3);
+    EXPECT_LT(seconds, 0.8);
+}
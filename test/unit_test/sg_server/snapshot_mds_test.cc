@@ -0,0 +1,121 @@
+/**********************************************
+* Copyright (c) 2016 Huawei Technologies Co., Ltd. All rights reserved.
+*
+* File name:    snapshot_mds_test.cc
+* Author:
+* Date:         2017/07/27
+* Version:      1.0
+* Description:  snapshot meta checkpoint and recover test
+*
+************************************************/
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <memory>
+#include "gtest/gtest.h"
+#include "common/config_option.h"
+#include "sg_server/snapshot/snapshot_mds.h"
+using huawei::proto::inner::UpdateEvent;
+
+class SnapshotMdsTest : public testing::Test {
+ protected:
+    SnapshotMdsTest()
+        : vol_name("snapshot_mds_test_" + std::to_string(getpid())),
+          db_path(std::string(DB_DIR) + vol_name) {}
+
+    void SetUp() {
+        g_option.index_store_type = "rocksdb";
+        remove_db();
+    }
+    void TearDown() { remove_db(); }
+
+    void remove_db() {
+        std::string cmd = "rm -rf " + db_path;
+        system(cmd.c_str());
+    }
+
+    std::unique_ptr<SnapshotMds> open_mds() {
+        std::unique_ptr<SnapshotMds> mds(new SnapshotMds(vol_name, 1 << 30));
+        mds->recover();
+        return mds;
+    }
+
+    void create(SnapshotMds* mds, const std::string& snap_name) {
+        CreateReq req;
+        CreateAck ack;
+        req.set_vol_name(vol_name);
+        req.set_snap_name(snap_name);
+        EXPECT_EQ(StatusCode::sOk, mds->create_snapshot(&req, &ack));
+    }
+
+    void created(SnapshotMds* mds, const std::string& snap_name) {
+        UpdateReq req;
+        UpdateAck ack;
+        req.set_vol_name(vol_name);
+        req.set_snap_name(snap_name);
+        req.set_snap_event(UpdateEvent::CREATE_EVENT);
+        EXPECT_EQ(StatusCode::sOk, mds->update(&req, &ack));
+    }
+
+    std::vector<std::string> list(SnapshotMds* mds) {
+        ListReq req;
+        ListAck ack;
+        req.set_vol_name(vol_name);
+        mds->list_snapshot(&req, &ack);
+        return std::vector<std::string>(ack.snap_name().begin(),
+                                        ack.snap_name().end());
+    }
+
+    SnapStatus status(SnapshotMds* mds, const std::string& snap_name) {
+        QueryReq req;
+        QueryAck ack;
+        req.set_vol_name(vol_name);
+        req.set_snap_name(snap_name);
+        mds->query_snapshot(&req, &ack);
+        return ack.snap_status();
+    }
+
+    std::string vol_name;
+    std::string db_path;
+};
+
+TEST_F(SnapshotMdsTest, ReloadCheckpointAndNewerKeys) {
+    std::unique_ptr<SnapshotMds> mds = open_mds();
+    create(mds.get(), "s1");
+    created(mds.get(), "s1");
+    create(mds.get(), "s2");
+    EXPECT_EQ(0, mds->checkpoint());
+
+    /*keys after checkpoint replayed on reload*/
+    created(mds.get(), "s2");
+    create(mds.get(), "s3");
+    mds.reset();
+
+    mds = open_mds();
+    EXPECT_EQ((std::vector<std::string>{"s1", "s2", "s3"}), list(mds.get()));
+    EXPECT_EQ(SnapStatus::SNAP_CREATED, status(mds.get(), "s1"));
+    EXPECT_EQ(SnapStatus::SNAP_CREATED, status(mds.get(), "s2"));
+    EXPECT_EQ(SnapStatus::SNAP_CREATING, status(mds.get(), "s3"));
+}
+
+TEST_F(SnapshotMdsTest, CheckpointNewerThanDbRejected) {
+    std::string ckpt = db_path + "/snapshot" + SNAPSHOT_CKPT_FILE;
+    std::string saved = std::string(DB_DIR) + vol_name + ".ckpt";
+    std::unique_ptr<SnapshotMds> mds = open_mds();
+    create(mds.get(), "s1");
+    created(mds.get(), "s1");
+    EXPECT_EQ(0, mds->checkpoint());
+    mds.reset();
+
+    /*db lost the writes image cover, image must not be trusted*/
+    ASSERT_EQ(0, rename(ckpt.c_str(), saved.c_str()));
+    remove_db();
+    mds = open_mds();
+    mds.reset();
+    ASSERT_EQ(0, rename(saved.c_str(), ckpt.c_str()));
+
+    mds = open_mds();
+    EXPECT_TRUE(list(mds.get()).empty());
+}
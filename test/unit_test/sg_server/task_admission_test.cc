@@ -0,0 +1,123 @@
+/**********************************************
+* Copyright (c) 2016 Huawei Technologies Co., Ltd. All rights reserved.
+*
+* File name:    task_admission_test.cc
+* Author:
+* Date:         2017/07/26
+* Version:      1.0
+* Description:  per volume admission of replicate tasks test
+*
+************************************************/
+#include <set>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <condition_variable>
+#include "gtest/gtest.h"
+#include "sg_server/replicate/task_admission.h"
+#include "sg_server/replicate/rep_task.h"
+
+class AdmitTask : public TransferTask {
+ public:
+    explicit AdmitTask(std::shared_ptr<TaskContext> ctx) : TransferTask(ctx) {}
+    bool has_next_package() { return false; }
+    TransferRequest* get_next_package() { return nullptr; }
+    int reset() { return 0; }
+};
+
+class TaskAdmissionTest : public testing::Test {
+ protected:
+    TaskAdmissionTest()
+        : queue(new BlockingQueue<std::shared_ptr<TransferTask>>()),
+          admission(queue, TASK_ADMIT_PER_VOLUME) {}
+
+    /*task of no volume if vol empty*/
+    void push(const std::string& vol, const uint64_t id) {
+        std::shared_ptr<TaskContext> ctx;
+        if (!vol.empty()) {
+            ctx.reset(new RepContext(vol, "peer", 1, 0, false, nullptr));
+        }
+        std::shared_ptr<TransferTask> task(new AdmitTask(ctx));
+        task->set_id(id);
+        queue->push(task);
+    }
+
+    std::shared_ptr<BlockingQueue<std::shared_ptr<TransferTask>>> queue;
+    TaskAdmission admission;
+};
+
+TEST_F(TaskAdmissionTest, BurstVolumeParked) {
+    for (uint64_t id = 1; id <= 6; id++) {
+        push("a", id);
+    }
+    push("b", 7);
+    std::shared_ptr<TransferTask> a1 = admission.admit();
+    std::shared_ptr<TransferTask> a2 = admission.admit();
+    EXPECT_EQ(1U, a1->get_id());
+    EXPECT_EQ(2U, a2->get_id());
+    /*rest of a parked, b not waiting behind them*/
+    std::shared_ptr<TransferTask> b = admission.admit();
+    EXPECT_EQ(7U, b->get_id());
+    admission.done(b);
+    /*parked task admitted before new ones, in order*/
+    push("b", 8);
+    admission.done(a1);
+    EXPECT_EQ(3U, admission.admit()->get_id());
+    EXPECT_EQ(8U, admission.admit()->get_id());
+}
+
+TEST_F(TaskAdmissionTest, BlockedVolumeNotTakeAllThreads) {
+    const int threads = 4;
+    std::mutex mtx;
+    std::condition_variable cond;
+    bool released = false;
+    int writing_a = 0;
+    int max_writing_a = 0;
+    std::set<uint64_t> done;
+    /*handler threads, tasks of a held as by its bandwidth limit*/
+    auto work = [&] {
+        while (true) {
+            std::shared_ptr<TransferTask> task = admission.admit();
+            std::shared_ptr<RepContext> ctx =
+                std::dynamic_pointer_cast<RepContext>(task->get_context());
+            if (ctx == nullptr) {
+                break;
+            }
+            std::unique_lock<std::mutex> lck(mtx);
+            if (ctx->get_vol_id() == "a") {
+                writing_a++;
+                max_writing_a = std::max(max_writing_a, writing_a);
+                cond.wait(lck, [&] { return released; });
+                writing_a--;
+            }
+            done.insert(task->get_id());
+            cond.notify_all();
+            lck.unlock();
+            admission.done(task);
+        }
+    };
+    std::vector<std::thread> workers;
+    for (int i = 0; i < threads; i++) {
+        workers.push_back(std::thread(work));
+    }
+    for (uint64_t id = 1; id <= 8; id++) {
+        push("a", id);
+    }
+    push("b", 9);
+    {
+        std::unique_lock<std::mutex> lck(mtx);
+        EXPECT_TRUE(cond.wait_for(lck, std::chrono::seconds(5),
+                                  [&] { return done.count(9) > 0; }));
+        released = true;
+        cond.notify_all();
+        EXPECT_TRUE(cond.wait_for(lck, std::chrono::seconds(5),
+                                  [&] { return done.size() == 9; }));
+    }
+    for (int i = 0; i < threads; i++) {
+        push("", 0);
+    }
+    for (auto& t : workers) {
+        t.join();
+    }
+    EXPECT_EQ(TASK_ADMIT_PER_VOLUME, max_writing_a);
+}
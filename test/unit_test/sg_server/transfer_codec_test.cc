@@ -0,0 +1,53 @@
+/**********************************************
+* Copyright (c) 2016 Huawei Technologies Co., Ltd. All rights reserved.
+*
+* File name:    transfer_codec_test.cc
+* Author:
+* Date:         2017/07/12
+* Version:      1.0
+* Description:  transfer codec encode decode test
+*
+************************************************/
+#include <string>
+#include "gtest/gtest.h"
+#include "sg_server/transfer/transfer_codec.h"
+
+TEST(TransferCodecTest,RoundTrip){
+    std::string in(256*1024, 'a');
+    in.replace(1000, 10, "0123456789");
+    EncodeType codecs[] = {EncodeType::SNAPPY_EN, EncodeType::ZLIB_EN};
+    for(auto codec : codecs){
+        std::string encoded;
+        EXPECT_EQ(codec, transfer_encode(codec, in, encoded));
+        EXPECT_LT(encoded.size(), in.size());
+        std::string out;
+        EXPECT_TRUE(transfer_decode(codec, encoded, out));
+        EXPECT_EQ(in, out);
+        /*corrupt data never decoded*/
+        encoded.resize(encoded.size() / 2);
+        EXPECT_FALSE(transfer_decode(codec, encoded, out));
+    }
+}
+
+TEST(TransferCodecTest,KeepRawIfNotSave){
+    std::string in;
+    unsigned int seed = 1;
+    for(int i = 0; i < 4096; i++){
+        seed = seed * 1103515245 + 12345;
+        in.push_back((char)(seed >> 16));
+    }
+    std::string encoded;
+    EXPECT_EQ(EncodeType::NONE_EN,
+              transfer_encode(EncodeType::ZLIB_EN, in, encoded));
+    EXPECT_EQ(in, encoded);
+}
+
+TEST(TransferCodecTest,PairNegotiate){
+    PairCodec codec("vol");
+    EXPECT_EQ(EncodeType::NONE_EN, codec.accepted());
+    codec.on_accept(EncodeType::SNAPPY_EN, true);
+    EXPECT_EQ(EncodeType::SNAPPY_EN, codec.accepted());
+    /*old peer never answer the proposal*/
+    codec.on_accept(EncodeType::UNKNOWN_EN, false);
+    EXPECT_EQ(EncodeType::NONE_EN, codec.accepted());
+}